@@ -24,7 +24,10 @@
 #include <network/GetAPIEnums.h>
 #include <rfb/PixelBuffer.h>
 #include <rfb/PixelFormat.h>
+#include <rfb/Region.h>
+#include <rfb/ScaleCache.h>
 #include <stdint.h>
+#include <list>
 #include <map>
 #include <string>
 #include <vector>
@@ -36,8 +39,8 @@ namespace network {
   public:
     GetAPIMessager(const char *passwdfile_);
 
-    // from main thread
-    void mainUpdateScreen(rfb::PixelBuffer *pb);
+    // from main thread, changed is the damage since the last call
+    void mainUpdateScreen(rfb::PixelBuffer *pb, const rfb::Region &changed);
     void mainUpdateBottleneckStats(const char userid[], const char stats[]);
     void mainClearBottleneckStats(const char userid[]);
     void mainUpdateServerFrameStats(uint8_t changedPerc, uint32_t all,
@@ -66,6 +69,7 @@ namespace network {
     void netGetUsers(const char **ptr);
 
     const std::string_view netGetSessions();
+    std::string netGetTrace();
     void netGetBottleneckStats(char *buf, uint32_t len);
     void netGetFrameStats(char *buf, uint32_t len);
     void netResetFrameStatsCall();
@@ -105,14 +109,36 @@ namespace network {
   private:
     const char *passwdfile;
 
+    // The main thread keeps screenPb up to date by copying the damage
+    // into it, and rehashes the 64x64 tiles that touches. Damage it
+    // couldn't copy because a screenshot held the lock waits in
+    // mainPending. screenDamage is what changed since the last snapshot.
     pthread_mutex_t screenMutex;
     rfb::ManagedPixelBuffer screenPb;
     uint16_t screenW, screenH;
     uint64_t screenHash;
-
-    std::vector<uint8_t> cachedJpeg;
-    uint16_t cachedW, cachedH;
-    uint8_t cachedQ;
+    std::vector<uint64_t> tileHashes;
+    rfb::Region screenDamage;
+    rfb::Region mainPending;
+
+    void hashTiles(const rfb::Region &changed);
+
+    // Screenshots are scaled and encoded from a snapshot, outside of
+    // screenMutex, one at a time. The snapshot and the scaled copies are
+    // brought up to date from screenDamage, and the last few results are
+    // kept per size and quality.
+    pthread_mutex_t shotMutex;
+    rfb::ManagedPixelBuffer shotPb;
+    uint64_t shotHash;
+    rfb::ScaleCache shotScaler;
+
+    struct cachedShot_t {
+      uint16_t w, h;
+      uint8_t q;
+      uint64_t hash;
+      std::vector<uint8_t> jpeg;
+    };
+    std::list<cachedShot_t> shotCache;
 
     std::map<std::string, std::string> bottleneckStats;
     pthread_mutex_t statMutex;
@@ -25,9 +25,12 @@
 #include <rfb/EncodeManager.h>
 #include <rfb/LogWriter.h>
 #include <rfb/JpegCompressor.h>
+#include <rfb/tilecmp.h>
+#include <rfb/Trace.h>
 #include <rfb/xxhash.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 #include <string>
 #include <utility>
 
@@ -36,6 +39,11 @@ using namespace rfb;
 
 static LogWriter vlog("GetAPIMessager");
 
+static const int SHOT_TILE = 64;
+
+// Results kept for different sizes and qualities
+static const size_t SHOT_CACHE_SIZE = 4;
+
 struct TightJPEGConfiguration {
     int quality;
     int subsampling;
@@ -56,11 +64,12 @@ static const struct TightJPEGConfiguration conf[10] = {
 
 GetAPIMessager::GetAPIMessager(const char *passwdfile_): passwdfile(passwdfile_),
 					screenW(0), screenH(0), screenHash(0),
-					cachedW(0), cachedH(0), cachedQ(0),
+					shotHash(0),
 					ownerConnected(0), activeUsers(0),
 					sessionsInfo( "{\"users\":[]}"){
 
 	pthread_mutex_init(&screenMutex, NULL);
+	pthread_mutex_init(&shotMutex, NULL);
 	pthread_mutex_init(&userMutex, NULL);
 	pthread_mutex_init(&statMutex, NULL);
 	pthread_mutex_init(&frameStatMutex, NULL);
@@ -70,38 +79,98 @@ GetAPIMessager::GetAPIMessager(const char *passwdfile_): passwdfile(passwdfile_)
 }
 
 // from main thread
-void GetAPIMessager::mainUpdateScreen(rfb::PixelBuffer *pb) {
+void GetAPIMessager::mainUpdateScreen(rfb::PixelBuffer *pb, const rfb::Region &changed) {
+	mainPending.assign_union(changed);
+
 	if (pthread_mutex_trylock(&screenMutex))
 		return;
 
-	int stride;
-	const rdr::U8 * const buf = pb->getBuffer(pb->getRect(), &stride);
-
-	if (pb->width() != screenW || pb->height() != screenH) {
-		screenHash = 0;
+	if (pb->width() != screenW || pb->height() != screenH ||
+	    !pb->getPF().equal(screenPb.getPF())) {
 		screenW = pb->width();
 		screenH = pb->height();
 		screenPb.setPF(pb->getPF());
 		screenPb.setSize(screenW, screenH);
 
-		cachedW = cachedH = cachedQ = 0;
-		cachedJpeg.clear();
+		tileHashes.assign(((screenW + SHOT_TILE - 1) / SHOT_TILE) *
+		                  ((screenH + SHOT_TILE - 1) / SHOT_TILE), 0);
+
+		mainPending = pb->getRect();
 	}
 
-	const uint64_t newHash = XXH64(buf, pb->area() * 4, 0);
-	if (newHash != screenHash) {
-		cachedW = cachedH = cachedQ = 0;
-		cachedJpeg.clear();
+	mainPending.assign_intersect(pb->getRect());
+
+	if (!mainPending.is_empty()) {
+		std::vector<Rect> rects;
+		std::vector<Rect>::const_iterator rect;
+
+		mainPending.get_rects(&rects);
+		for (rect = rects.begin(); rect != rects.end(); ++rect) {
+			int stride;
+			const rdr::U8 * const buf = pb->getBuffer(*rect, &stride);
+			screenPb.imageRect(*rect, buf, stride);
+		}
 
-		screenHash = newHash;
-		rdr::U8 *rw = screenPb.getBufferRW(screenPb.getRect(), &stride);
-		memcpy(rw, buf, screenW * screenH * 4);
-		screenPb.commitBufferRW(screenPb.getRect());
+		hashTiles(mainPending);
+
+		screenDamage.assign_union(mainPending);
+		mainPending.clear();
 	}
 
 	pthread_mutex_unlock(&screenMutex);
 }
 
+// Called with screenMutex held
+void GetAPIMessager::hashTiles(const rfb::Region &changed) {
+	const int tilesW = (screenW + SHOT_TILE - 1) / SHOT_TILE;
+	const int bpp = screenPb.getPF().bpp / 8;
+	std::vector<Rect> rects;
+	std::vector<Rect>::const_iterator rect;
+	std::vector<int> tiles;
+	std::vector<int>::const_iterator tile;
+	bool any = false;
+
+	changed.get_rects(&rects);
+	for (rect = rects.begin(); rect != rects.end(); ++rect) {
+		for (int ty = rect->tl.y / SHOT_TILE; ty * SHOT_TILE < rect->br.y; ty++) {
+			for (int tx = rect->tl.x / SHOT_TILE; tx * SHOT_TILE < rect->br.x; tx++)
+				tiles.push_back(ty * tilesW + tx);
+		}
+	}
+
+	std::sort(tiles.begin(), tiles.end());
+	tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+
+	for (tile = tiles.begin(); tile != tiles.end(); ++tile) {
+		const int tx = *tile % tilesW, ty = *tile / tilesW;
+		const Rect r = Rect(tx * SHOT_TILE, ty * SHOT_TILE,
+		                    (tx + 1) * SHOT_TILE, (ty + 1) * SHOT_TILE)
+		               .intersect(screenPb.getRect());
+
+		int stride;
+		const rdr::U8 *px = screenPb.getBuffer(r, &stride);
+		const unsigned len = r.width() * bpp;
+		uint64_t hash;
+
+		if (len % TILEHASH_CHUNK == 0) {
+			hash = tileHash(px, stride * bpp, len, r.height());
+		} else {
+			hash = 0;
+			for (int y = 0; y < r.height(); y++, px += stride * bpp)
+				hash = XXH64(px, len, hash);
+		}
+
+		if (tileHashes[*tile] != hash) {
+			tileHashes[*tile] = hash;
+			any = true;
+		}
+	}
+
+	// Damage that didn't change anything keeps the cached screenshots
+	if (any)
+		screenHash = XXH64(&tileHashes[0], tileHashes.size() * sizeof(uint64_t), 0);
+}
+
 void GetAPIMessager::mainUpdateBottleneckStats(const char userid[], const char stats[]) {
 	if (pthread_mutex_trylock(&statMutex))
 		return;
@@ -188,37 +257,85 @@ uint8_t *GetAPIMessager::netGetScreenshot(uint16_t w, uint16_t h,
 	const uint8_t q, const bool dedup,
 	uint32_t &len, uint8_t *staging) {
 
+	std::list<cachedShot_t>::iterator it;
 	uint8_t *ret = NULL;
 	len = 0;
 
-	if (w > screenW)
-		w = screenW;
-	if (h > screenH)
-		h = screenH;
+	if (q > 9 || !staging)
+		return NULL;
 
-	if (!screenW || !screenH)
-		vlog.error("Screenshot requested but no screenshot exists (screen hasn't been viewed)");
+	if (pthread_mutex_lock(&shotMutex))
+		return NULL;
 
-	if (!w || !h || q > 9 || !staging)
+	// Bring the snapshot up to date, only what changed is copied
+	if (pthread_mutex_lock(&screenMutex)) {
+		pthread_mutex_unlock(&shotMutex);
 		return NULL;
+	}
+
+	if (screenW != shotPb.width() || screenH != shotPb.height() ||
+	    !screenPb.getPF().equal(shotPb.getPF())) {
+		shotPb.setPF(screenPb.getPF());
+		shotPb.setSize(screenW, screenH);
+		shotScaler.clear();
+		shotCache.clear();
 
-	if (pthread_mutex_lock(&screenMutex))
+		screenDamage = screenPb.getRect();
+	}
+
+	if (!screenDamage.is_empty()) {
+		std::vector<Rect> rects;
+		std::vector<Rect>::const_iterator rect;
+
+		screenDamage.get_rects(&rects);
+		for (rect = rects.begin(); rect != rects.end(); ++rect) {
+			int stride;
+			const rdr::U8 * const buf = screenPb.getBuffer(*rect, &stride);
+			shotPb.imageRect(*rect, buf, stride);
+		}
+
+		shotScaler.add_changed(screenDamage);
+		screenDamage.clear();
+	}
+
+	shotHash = screenHash;
+
+	pthread_mutex_unlock(&screenMutex);
+
+	if (w > shotPb.width())
+		w = shotPb.width();
+	if (h > shotPb.height())
+		h = shotPb.height();
+
+	if (!shotPb.width() || !shotPb.height())
+		vlog.error("Screenshot requested but no screenshot exists (screen hasn't been viewed)");
+
+	if (!w || !h) {
+		pthread_mutex_unlock(&shotMutex);
 		return NULL;
+	}
 
-	if (w == cachedW && h == cachedH && q == cachedQ) {
+	for (it = shotCache.begin(); it != shotCache.end(); ++it) {
+		if (it->w == w && it->h == h && it->q == q)
+			break;
+	}
+
+	if (it != shotCache.end() && it->hash == shotHash) {
 		if (dedup) {
 			// Return the hash of the unchanged image
-			sprintf((char *) staging, "%" PRIx64, screenHash);
+			sprintf((char *) staging, "%016" PRIx64, shotHash);
 			ret = staging;
 			len = 16;
 		} else {
 			// Return the cached image
-			len = cachedJpeg.size();
+			len = it->jpeg.size();
 			ret = staging;
-			memcpy(ret, &cachedJpeg[0], len);
+			memcpy(ret, &it->jpeg[0], len);
 
 			vlog.info("Returning cached screenshot");
 		}
+
+		shotCache.splice(shotCache.begin(), shotCache, it);
 	} else {
 		// Encode the new JPEG, cache it
 		JpegCompressor jc;
@@ -227,51 +344,63 @@ uint8_t *GetAPIMessager::netGetScreenshot(uint16_t w, uint16_t h,
 		quality = conf[q].quality;
 		subsampling = conf[q].subsampling;
 
+		if (it == shotCache.end()) {
+			if (shotCache.size() >= SHOT_CACHE_SIZE)
+				shotCache.pop_back();
+
+			cachedShot_t entry = {};
+			entry.w = w;
+			entry.h = h;
+			entry.q = q;
+			shotCache.push_front(entry);
+		} else {
+			shotCache.splice(shotCache.begin(), shotCache, it);
+		}
+
+		it = shotCache.begin();
+		it->hash = shotHash;
+
 		jc.clear();
 		int stride;
 
-		if (w != screenW || h != screenH) {
-			float xdiff = w / (float) screenW;
-			float ydiff = h / (float) screenH;
+		if (w != shotPb.width() || h != shotPb.height()) {
+			float xdiff = w / (float) shotPb.width();
+			float ydiff = h / (float) shotPb.height();
 			const float diff = xdiff < ydiff ? xdiff : ydiff;
 
-			const uint16_t neww = screenW * diff;
-			const uint16_t newh = screenH * diff;
+			const uint16_t neww = shotPb.width() * diff;
+			const uint16_t newh = shotPb.height() * diff;
 
-			const PixelBuffer *scaled = progressiveBilinearScale(&screenPb, neww, newh, diff);
+			// Area average, sharpest for thumbnails, and only the
+			// changed parts get redone
+			const PixelBuffer *scaled = shotScaler.get(&shotPb, neww, newh, diff, 3);
+			// Nothing ages the screenshot copies per frame, keep only
+			// as many as there are cached JPEGs
+			shotScaler.trim(SHOT_CACHE_SIZE);
 			const rdr::U8 * const buf = scaled->getBuffer(scaled->getRect(), &stride);
 
 			jc.compress(buf, stride, scaled->getRect(),
 					scaled->getPF(), quality, subsampling);
 
-			cachedJpeg.resize(jc.length());
-			memcpy(&cachedJpeg[0], jc.data(), jc.length());
-
-			delete scaled;
-
 			vlog.info("Returning scaled screenshot");
 		} else {
-			const rdr::U8 * const buf = screenPb.getBuffer(screenPb.getRect(), &stride);
+			const rdr::U8 * const buf = shotPb.getBuffer(shotPb.getRect(), &stride);
 
-			jc.compress(buf, stride, screenPb.getRect(),
-					screenPb.getPF(), quality, subsampling);
-
-			cachedJpeg.resize(jc.length());
-			memcpy(&cachedJpeg[0], jc.data(), jc.length());
+			jc.compress(buf, stride, shotPb.getRect(),
+					shotPb.getPF(), quality, subsampling);
 
 			vlog.info("Returning normal screenshot");
 		}
 
-		cachedQ = q;
-		cachedW = w;
-		cachedH = h;
+		const rdr::U8 * const jpeg = (const rdr::U8 *) jc.data();
+		it->jpeg.assign(jpeg, jpeg + jc.length());
 
-		len = cachedJpeg.size();
+		len = it->jpeg.size();
 		ret = staging;
-		memcpy(ret, &cachedJpeg[0], len);
+		memcpy(ret, &it->jpeg[0], len);
 	}
 
-	pthread_mutex_unlock(&screenMutex);
+	pthread_mutex_unlock(&shotMutex);
 
 	return ret;
 }
@@ -532,6 +661,11 @@ const std::string_view GetAPIMessager::netGetSessions()
 	return sessionsInfo;
 }
 
+std::string GetAPIMessager::netGetTrace()
+{
+	return rfb::Trace::dumpJSON();
+}
+
 void GetAPIMessager::netGetBottleneckStats(char *buf, uint32_t len) {
 /*
 {
@@ -87,6 +87,8 @@ Socket::Socket()
 
 Socket::~Socket()
 {
+  if (outstream)
+    outstream->stopWriter();
   if (instream && outstream)
     closesocket(getFd());
   delete instream;
@@ -97,6 +99,8 @@ Socket::~Socket()
 void Socket::shutdown()
 {
   isShutdown_ = true;
+  // Give the writer thread a last chance, it can't write after this
+  outstream->stopWriter();
   ::shutdown(getFd(), SHUT_RDWR);
 }
 
@@ -117,14 +121,19 @@ bool Socket::requiresQuery() const
 }
 
 void Socket::setFd(int fd)
+{
+  setStreams(new rdr::FdInStream(fd), new rdr::FdOutStream(fd));
+}
+
+void Socket::setStreams(rdr::FdInStream* in, rdr::FdOutStream* out)
 {
 #ifndef WIN32
   // - By default, close the socket on exec()
-  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  fcntl(out->getFd(), F_SETFD, FD_CLOEXEC);
 #endif
 
-  instream = new rdr::FdInStream(fd);
-  outstream = new rdr::FdOutStream(fd);
+  instream = in;
+  outstream = out;
   isShutdown_ = false;
 }
 
@@ -165,7 +174,17 @@ Socket* SocketListener::accept() {
 
   // Create the socket object & check connection is allowed
   Socket* s = createSocket(new_sock);
-  if (filter && !filter->verifyConnection(s)) {
+  if (s && filter && !filter->verifyConnection(s)) {
+    delete s;
+    return NULL;
+  }
+
+  return s;
+}
+
+Socket* SocketListener::finishAccept(int fd) {
+  Socket* s = finishSocket(fd);
+  if (s && filter && !filter->verifyConnection(s)) {
     delete s;
     return NULL;
   }
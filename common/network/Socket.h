@@ -60,6 +60,7 @@ namespace network {
     Socket();
 
     void setFd(int fd);
+    void setStreams(rdr::FdInStream* in, rdr::FdOutStream* out);
 
   private:
     rdr::FdInStream* instream;
@@ -89,6 +90,15 @@ namespace network {
     // if one is installed.  Otherwise, returns 0.
     Socket* accept();
 
+    // Listeners that must hear from a new connection before they can make
+    // its Socket return 0 from accept() and keep its fd pending instead.
+    // Once a pending fd is readable, finishAccept() returns its Socket
+    // just like accept() would. expirePending() closes the connections
+    // that have been pending for too long and returns their fds.
+    virtual void getPendingFds(std::list<int>* /*fds*/) {}
+    Socket* finishAccept(int fd);
+    virtual void expirePending(std::list<int>* /*fds*/) {}
+
     virtual int getMyPort() = 0;
 
     // setFilter() applies the specified filter to all new connections
@@ -105,6 +115,8 @@ namespace network {
     // createSocket() should create a new socket of the correct class
     // for the given file descriptor
     virtual Socket* createSocket(int fd) = 0;
+    // finishSocket() does the same for a pending fd
+    virtual Socket* finishSocket(int /*fd*/) { return 0; }
 
   protected:
     int fd;
@@ -36,6 +36,7 @@
 #endif
 
 #include <sys/un.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -50,9 +51,11 @@
 #include <network/GetAPI.h>
 #include <network/TcpSocket.h>
 #include <network/Udp.h>
+#include <network/WebSocketStreams.h>
 #include <rfb/LogWriter.h>
 #include <rfb/Configuration.h>
 #include <rfb/ServerCore.h>
+#include <rfb/util.h>
 
 #ifdef WIN32
 #include <os/winerrno.h>
@@ -83,6 +86,9 @@ static rfb::LogWriter vlog("TcpSocket");
 static rfb::BoolParameter UseIPv4("UseIPv4", "Use IPv4 for incoming and outgoing connections.", true);
 static rfb::BoolParameter UseIPv6("UseIPv6", "Use IPv6 for incoming and outgoing connections.", true);
 
+// How long a direct connection may wait for its handoff token, in ms
+static const unsigned HandoffTimeout = 10000;
+
 rfb::StringParameter httpDir("httpd",
                              "Directory containing files to serve via HTTP",
                              WWWDIR);
@@ -126,11 +132,46 @@ int network::getSockPort(int sock)
   }
 }
 
-WebSocket::WebSocket(int sock) : Socket(sock)
+WebSocket::WebSocket(int sock) : Socket(sock), peerAddress(NULL)
+{
+}
+
+WebSocket::WebSocket(const char* peer, rdr::FdInStream* in,
+                     rdr::FdOutStream* out)
+  : peerAddress(rfb::strDup(peer))
+{
+  int one = 1;
+
+  setStreams(in, out);
+
+  if (setsockopt(getFd(), IPPROTO_TCP, TCP_NODELAY,
+                 (char *)&one, sizeof(one)) < 0)
+    vlog.error("unable to setsockopt TCP_NODELAY: %d", errorNumber);
+}
+
+WebSocket::~WebSocket()
 {
+  rfb::strFree(peerAddress);
+}
+
+bool WebSocket::cork(bool enable) {
+  // Only direct connections sit on a TCP socket, proxied ones are AF_UNIX
+  if (!peerAddress)
+    return true;
+#ifndef TCP_CORK
+  return false;
+#else
+  int one = enable ? 1 : 0;
+  if (setsockopt(getFd(), IPPROTO_TCP, TCP_CORK, (char *)&one, sizeof(one)) < 0)
+    return false;
+  return true;
+#endif
 }
 
 char* WebSocket::getPeerAddress() {
+  if (peerAddress)
+    return rfb::strDup(peerAddress);
+
   struct sockaddr_un addr;
   socklen_t len = sizeof(struct sockaddr_un);
   if (getpeername(getFd(), (struct sockaddr *) &addr, &len) != 0) {
@@ -563,6 +604,15 @@ static void getSessionsCb(void *messager,  char **ptr)
   *ptr = sessionInfo;
 }
 
+static void getTraceCb(void *messager, char **ptr)
+{
+  GetAPIMessager *msgr = (GetAPIMessager *) messager;
+  const std::string trace = msgr->netGetTrace();
+
+  // Freed by the caller, like the session list
+  *ptr = strdup(trace.c_str());
+}
+
 #if OPENSSL_VERSION_NUMBER < 0x1010000f
 
 static pthread_mutex_t *sslmutex;
@@ -687,6 +737,7 @@ WebsocketListener::WebsocketListener(const struct sockaddr *listenaddr,
   settings.httpdir = NULL;
   if (httpdir && httpdir[0])
     settings.httpdir = realpath(httpdir, NULL);
+  settings.direct = rfb::Server::websocketDirect;
 
   settings.listen_sock = sock;
 
@@ -713,6 +764,7 @@ WebsocketListener::WebsocketListener(const struct sockaddr *listenaddr,
 
   settings.clearClipboardCb = clearClipboardCb;
   settings.getSessionsCb = getSessionsCb;
+  settings.getTraceCb = getTraceCb;
 
   openssl_threads();
 
@@ -728,7 +780,87 @@ WebsocketListener::WebsocketListener(const struct sockaddr *listenaddr,
 }
 
 Socket* WebsocketListener::createSocket(int fd) {
-  return new WebSocket(fd);
+  if (!settings.direct)
+    return new WebSocket(fd);
+
+  // The handshake thread sends a handoff token as soon as it connects,
+  // zero if it keeps proxying this connection itself. Waiting for it
+  // here would stall the X server, the caller watches the fd instead.
+  PendingHandoff p;
+  p.fd = fd;
+  gettimeofday(&p.accepted, NULL);
+  pending.push_back(p);
+
+  return NULL;
+}
+
+void WebsocketListener::getPendingFds(std::list<int>* fds) {
+  std::list<PendingHandoff>::const_iterator i;
+
+  for (i = pending.begin(); i != pending.end(); ++i)
+    fds->push_back(i->fd);
+}
+
+void WebsocketListener::expirePending(std::list<int>* fds) {
+  std::list<PendingHandoff>::iterator i;
+
+  for (i = pending.begin(); i != pending.end(); ) {
+    if (rfb::msSince(&i->accepted) < HandoffTimeout) {
+      ++i;
+      continue;
+    }
+
+    vlog.error("No handoff token from websocket thread, dropping connection");
+    closesocket(i->fd);
+    fds->push_back(i->fd);
+    i = pending.erase(i);
+  }
+}
+
+Socket* WebsocketListener::finishSocket(int fd) {
+  std::list<PendingHandoff>::iterator i;
+
+  for (i = pending.begin(); i != pending.end(); ++i) {
+    if (i->fd == fd)
+      break;
+  }
+  if (i == pending.end())
+    return NULL;
+  pending.erase(i);
+
+  // Sent in one go over a local socket, so readable means all of it
+  uint64_t token;
+  if (recv(fd, &token, sizeof(token), MSG_DONTWAIT) != sizeof(token)) {
+    closesocket(fd);
+    throw SocketException("no handoff token from websocket thread", errorNumber);
+  }
+
+  if (!token)
+    return new WebSocket(fd);
+
+  ws_ctx_t *ctx = ws_claim_handoff(token);
+  if (!ctx) {
+    closesocket(fd);
+    throw Exception("unknown websocket handoff token");
+  }
+
+  rfb::CharArray peer;
+  struct sockaddr_un addr;
+  socklen_t len = sizeof(struct sockaddr_un);
+  if (getpeername(fd, (struct sockaddr *) &addr, &len) == 0)
+    peer.buf = rfb::strDup(addr.sun_path + 1);
+  else
+    peer.buf = rfb::strDup(ctx->ip);
+  closesocket(fd);
+
+  // Reads must not block the X server on a partial TLS record
+  int flags = fcntl(ctx->sockfd, F_GETFL);
+  fcntl(ctx->sockfd, F_SETFL, flags | O_NONBLOCK);
+
+  vlog.debug("Direct websocket connection from %s", peer.buf);
+
+  return new WebSocket(peer.buf, new WebSocketInStream(ctx->sockfd, ctx->ssl),
+                       new WebSocketOutStream(ctx));
 }
 
 void WebsocketListener::getMyAddresses(std::list<char*>* result) {
@@ -36,6 +36,7 @@
 #else
 #include <sys/socket.h> /* for socklen_t */
 #include <netinet/in.h> /* for struct sockaddr_in */
+#include <sys/time.h>
 #endif
 
 #include <list>
@@ -67,11 +68,17 @@ namespace network {
   class WebSocket : public Socket {
   public:
     WebSocket(int sock);
+    // Direct mode, the streams do the WebSocket framing themselves
+    WebSocket(const char* peer, rdr::FdInStream* in, rdr::FdOutStream* out);
+    virtual ~WebSocket();
 
     virtual char* getPeerAddress();
     virtual char* getPeerEndpoint();
 
-    virtual bool cork(bool enable) { return true; }
+    virtual bool cork(bool enable);
+
+  private:
+    char* peerAddress;
   };
 
   class TcpListener : public SocketListener {
@@ -102,10 +109,21 @@ namespace network {
 
     virtual GetAPIMessager *getMessager() { return messager; }
 
+    // Direct connections wait for their handoff token
+    virtual void getPendingFds(std::list<int>* fds);
+    virtual void expirePending(std::list<int>* fds);
+
   protected:
     virtual Socket* createSocket(int fd);
+    virtual Socket* finishSocket(int fd);
   private:
     GetAPIMessager *messager;
+
+    struct PendingHandoff {
+      int fd;
+      struct timeval accepted;
+    };
+    std::list<PendingHandoff> pending;
   };
 
   void createLocalTcpListeners(std::list<SocketListener*> *listeners,
@@ -24,13 +24,19 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include <time.h>
 
+#include <list>
+#include <vector>
+
 #include <network/GetAPI.h>
 #include <network/Udp.h>
 #include <network/webudp/WuHost.h>
 #include <network/webudp/Wu.h>
 #include <network/websocket.h>
+#include <os/Mutex.h>
+#include <os/Thread.h>
 #include <rfb/LogWriter.h>
 #include <rfb/ServerCore.h>
 #include <rfb/xxhash.h>
@@ -42,6 +48,35 @@ static WuHost *host = NULL;
 
 rfb::IntParameter udpSize("udpSize", "UDP packet data size", 1296, 500, 1400);
 
+// The longest the pacer sleeps at a time, so that a stop request or a
+// raised rate isn't left waiting
+static const unsigned PACER_MAX_SLEEP_US = 5000;
+
+// Queued data beyond this is dropped, oldest first. The client has no use
+// for stale updates, and waiting here would hold up every other client.
+static const size_t PACER_MAX_QUEUED = UDPSTREAM_BUFSIZE * 2;
+
+// How often a piece is resent at most, however often it is asked for
+static const unsigned MAX_RESENDS = 2;
+
+//
+// Every message is split into pieces, each with a header of five 32-bit
+// words: message id, piece number, number of pieces, hash and frame.
+//
+// Clients that announce pseudoEncodingKasmUdpRecovery also get parity
+// pieces. Their piece number is the number of pieces plus the parity
+// index g, and they carry the message length and the number of parity
+// pieces G before the parity itself. Parity g is the XOR of the data
+// pieces whose number modulo G is g, each zero padded to the full piece
+// size, so any one missing piece of such a group can be rebuilt, even
+// after a burst of G lost packets. The message length gives the size of
+// the last piece.
+//
+// Such clients may also send binary data channel messages listing pieces
+// they are missing, as pairs of 32-bit message id and piece number. Those
+// still in the resend buffer are sent again ahead of everything else.
+//
+
 extern settings_t settings;
 
 static void udperr(const char *msg, void *) {
@@ -52,6 +87,16 @@ static void udpdebug(const char *msg, void *) {
 	vlog.debug("%s", msg);
 }
 
+static void udpsack(const WuSack *sack, void *user) {
+	((UdpStream *) user)->getCongestion()->gotSack(sack->cumulativeTsnAck,
+	                                               sack->gapAckBlocks,
+	                                               sack->numGapAckBlocks);
+}
+
+static void udpnack(const uint8_t *data, int32_t length, void *user) {
+	((UdpStream *) user)->gotNack(data, length);
+}
+
 void *udpserver(void *nport) {
 
 	WuHost *myhost = NULL;
@@ -68,6 +113,8 @@ void *udpserver(void *nport) {
 
 	WuHostSetErrorCallback(host, udperr);
 	WuHostSetDebugCallback(host, udpdebug);
+	WuHostSetSackCallback(host, udpsack);
+	WuHostSetDataCallback(host, udpnack);
 
 	while (1) {
 		WuAddress addr;
@@ -94,61 +141,410 @@ void *udpserver(void *nport) {
 	return NULL;
 }
 
+//
+// PacerThread sends the queued packets for one client at the rate the
+// congestion control allows. A short burst is let through at once, the
+// rest is spread out, so that a frame leaves over the frame interval
+// instead of overflowing queues along the way. Unpaced, it just sends.
+//
+
+class UdpStream::PacerThread : public os::Thread {
+public:
+	PacerThread(WuClient *client, UdpCongestion *congestion, bool paced);
+	~PacerThread();
+
+	// queue() returns how many packets had to be dropped to make room.
+	// Resends go to the front.
+	unsigned queue(const uint8_t *data, size_t len, bool front = false);
+	size_t queued();
+
+	bool isFailed();
+	void clearFailed();
+
+	void stop();
+
+protected:
+	void worker();
+
+private:
+	void dropQueued();
+
+	WuClient *client;
+	UdpCongestion *congestion;
+	bool paced;
+
+	std::list<std::vector<uint8_t> *> packets;
+	std::list<std::vector<uint8_t> *> freePackets;
+	size_t queuedBytes;
+
+	bool stopRequested;
+	bool failed;
+
+	os::Mutex *mutex;
+	os::Condition *cond;
+};
+
+UdpStream::PacerThread::PacerThread(WuClient *client_, UdpCongestion *congestion_,
+                                    bool paced_):
+	client(client_), congestion(congestion_), paced(paced_), queuedBytes(0),
+	stopRequested(false), failed(false) {
+	mutex = new os::Mutex();
+	cond = new os::Condition(mutex);
+}
+
+UdpStream::PacerThread::~PacerThread() {
+	std::list<std::vector<uint8_t> *>::iterator iter;
+
+	for (iter = packets.begin(); iter != packets.end(); ++iter)
+		delete *iter;
+	for (iter = freePackets.begin(); iter != freePackets.end(); ++iter)
+		delete *iter;
+
+	delete cond;
+	delete mutex;
+}
+
+unsigned UdpStream::PacerThread::queue(const uint8_t *data, size_t len, bool front) {
+	std::vector<uint8_t> *packet;
+	unsigned dropped = 0;
+
+	os::AutoMutex a(mutex);
+
+	if (failed)
+		return 0;
+
+	while (!packets.empty() && queuedBytes + len > PACER_MAX_QUEUED) {
+		queuedBytes -= packets.front()->size();
+		freePackets.splice(freePackets.end(), packets, packets.begin());
+		dropped++;
+	}
+
+	if (freePackets.empty()) {
+		packet = new std::vector<uint8_t>;
+	} else {
+		packet = freePackets.front();
+		freePackets.pop_front();
+	}
+
+	packet->assign(data, data + len);
+	if (front)
+		packets.push_front(packet);
+	else
+		packets.push_back(packet);
+	queuedBytes += len;
+
+	cond->signal();
+
+	return dropped;
+}
+
+size_t UdpStream::PacerThread::queued() {
+	os::AutoMutex a(mutex);
+	return queuedBytes;
+}
+
+bool UdpStream::PacerThread::isFailed() {
+	os::AutoMutex a(mutex);
+	return failed;
+}
+
+void UdpStream::PacerThread::clearFailed() {
+	os::AutoMutex a(mutex);
+	failed = false;
+}
+
+void UdpStream::PacerThread::stop() {
+	mutex->lock();
+	stopRequested = true;
+	cond->signal();
+	mutex->unlock();
+
+	wait();
+}
+
+// Called with the mutex held
+void UdpStream::PacerThread::dropQueued() {
+	freePackets.splice(freePackets.end(), packets);
+	queuedBytes = 0;
+}
+
+void UdpStream::PacerThread::worker() {
+	struct timeval last, now;
+	double tokens = 0;
+
+	gettimeofday(&last, NULL);
+
+	mutex->lock();
+
+	while (true) {
+		std::vector<uint8_t> *packet;
+		size_t rate, burst;
+		uint32_t tsn;
+		int32_t ret;
+
+		if (stopRequested)
+			dropQueued();
+
+		if (packets.empty()) {
+			if (stopRequested)
+				break;
+			cond->wait();
+			continue;
+		}
+
+		packet = packets.front();
+
+		packets.pop_front();
+		queuedBytes -= packet->size();
+
+		mutex->unlock();
+
+		while (paced) {
+			// About 2ms worth may go out back to back
+			rate = congestion->getRate();
+			burst = rate / 500;
+			if (burst < (size_t) udpSize * 2)
+				burst = udpSize * 2;
+
+			gettimeofday(&now, NULL);
+			tokens += rate * ((now.tv_sec - last.tv_sec) +
+			                  (now.tv_usec - last.tv_usec) / 1000000.0);
+			if (tokens > burst)
+				tokens = burst;
+			last = now;
+
+			if (tokens >= packet->size()) {
+				tokens -= packet->size();
+				break;
+			}
+
+			double us = (packet->size() - tokens) * 1000000.0 / rate;
+			usleep(us < PACER_MAX_SLEEP_US ? (unsigned) us + 1 : PACER_MAX_SLEEP_US);
+		}
+
+		ret = WuHostSendBinary(host, client, packet->data(), packet->size(), &tsn);
+		if (ret >= 0)
+			congestion->sent(tsn, packet->size());
+
+		mutex->lock();
+
+		freePackets.push_back(packet);
+
+		if (ret < 0) {
+			failed = true;
+			dropQueued();
+		}
+	}
+
+	mutex->unlock();
+}
+
+UdpStream::UdpStream(): OutStream(), client(NULL), total_len(0), id(0), failed(false),
+	                frame(0), pacer(NULL), recovery(false), parityGroups(0), sentPos(0) {
+	ptr = data;
+	end = data + UDPSTREAM_BUFSIZE;
+
+	sentMutex = new os::Mutex();
+
+	srand(time(NULL));
+}
+
+UdpStream::~UdpStream() {
+	setClient(NULL);
+	delete sentMutex;
+}
+
+void UdpStream::setClient(WuClient *cli) {
+	// No more callbacks once this returns, then the pacer can go
+	if (client && host)
+		WuHostReplaceClientUserData(host, client, this, NULL);
+
+	if (pacer) {
+		pacer->stop();
+		delete pacer;
+		pacer = NULL;
+	}
+
+	client = cli;
+	congestion.reset();
+
+	if (client && host) {
+		pacer = new PacerThread(client, &congestion, rfb::Server::udpCongestionControl);
+		pacer->start();
+
+		WuHostReplaceClientUserData(host, client, NULL, this);
+	}
+}
+
+void UdpStream::setRecovery(const bool enabled) {
+	size_t slots = 0;
+
+	recovery = enabled;
+
+	if (recovery)
+		slots = rfb::Server::udpRetransmitBuffer * 1024 /
+		        (udpSize + sizeof(uint32_t) * 5);
+
+	os::AutoMutex a(sentMutex);
+
+	if (sent.size() != slots) {
+		sent.clear();
+		sent.resize(slots);
+		sentPos = 0;
+	}
+}
+
+void UdpStream::sendPacket(const uint8_t *buf, size_t len, uint32_t piece) {
+	if (recovery) {
+		os::AutoMutex a(sentMutex);
+
+		if (!sent.empty()) {
+			SentPiece &p = sent[sentPos];
+
+			p.id = id;
+			p.piece = piece;
+			p.resends = 0;
+			p.packet.assign(buf, buf + len);
+
+			sentPos = (sentPos + 1) % sent.size();
+		}
+	}
+
+	if (pacer) {
+		const unsigned dropped = pacer->queue(buf, len);
+		if (dropped)
+			vlog.debug("Pacing queue full, dropped %u stale packets", dropped);
+	} else if (WuHostSendBinary(host, client, buf, len, NULL) < 0) {
+		failed = true;
+	}
+}
+
+void UdpStream::sendParity(const uint32_t pieces, const uint32_t msglen) {
+	const uint32_t DATA_MAX = udpSize;
+
+	uint8_t buf[1400 + sizeof(uint32_t) * 7];
+	uint32_t g;
+
+	for (g = 0; g < parityGroups && !failed; g++) {
+		const uint32_t piece = pieces + g;
+		uint32_t hash;
+
+		memcpy(&buf[20], &msglen, sizeof(uint32_t));
+		memcpy(&buf[24], &parityGroups, sizeof(uint32_t));
+		memcpy(&buf[28], &parity[g * DATA_MAX], DATA_MAX);
+
+		hash = XXH64(&buf[20], DATA_MAX + sizeof(uint32_t) * 2, 0);
+
+		memcpy(buf, &id, sizeof(uint32_t));
+		memcpy(&buf[4], &piece, sizeof(uint32_t));
+		memcpy(&buf[8], &pieces, sizeof(uint32_t));
+		memcpy(&buf[12], &hash, sizeof(uint32_t));
+		memcpy(&buf[16], &frame, sizeof(uint32_t));
+
+		// Nobody asks for parity again, keep it out of the resend buffer
+		if (pacer)
+			pacer->queue(buf, DATA_MAX + sizeof(uint32_t) * 7);
+		else if (WuHostSendBinary(host, client, buf, DATA_MAX + sizeof(uint32_t) * 7,
+		                          NULL) < 0)
+			failed = true;
+	}
+}
+
 // Send one packet, split into N UDP-sized pieces
-static uint8_t udpsend(WuClient *client, const uint8_t *data, unsigned len, uint32_t *id,
-			const uint32_t *frame) {
+void UdpStream::flush() {
 	const uint32_t DATA_MAX = udpSize;
 
+	const uint8_t *src = data;
+	unsigned len = ptr - data;
+	const uint32_t msglen = len;
+	total_len += len;
+
 	uint8_t buf[1400 + sizeof(uint32_t) * 5];
 	const uint32_t pieces = (len / DATA_MAX) + ((len % DATA_MAX) ? 1 : 0);
 
 	uint32_t i;
 
-	for (i = 0; i < pieces; i++) {
+	ptr = data;
+
+	if (!client) {
+		vlog.error("Tried to send udp without a client");
+		return;
+	}
+
+	parityGroups = 0;
+	if (recovery && rfb::Server::udpParity && pieces) {
+		parityGroups = (pieces * rfb::Server::udpParity + 99) / 100;
+		parity.assign(parityGroups * DATA_MAX, 0);
+	}
+
+	for (i = 0; i < pieces && !failed; i++) {
 		const unsigned curlen = len > DATA_MAX ? DATA_MAX : len;
-		const uint32_t hash = XXH64(data, curlen, 0);
+		const uint32_t hash = XXH64(src, curlen, 0);
 
-		memcpy(buf, id, sizeof(uint32_t));
+		memcpy(buf, &id, sizeof(uint32_t));
 		memcpy(&buf[4], &i, sizeof(uint32_t));
 		memcpy(&buf[8], &pieces, sizeof(uint32_t));
 		memcpy(&buf[12], &hash, sizeof(uint32_t));
-		memcpy(&buf[16], frame, sizeof(uint32_t));
+		memcpy(&buf[16], &frame, sizeof(uint32_t));
+
+		memcpy(&buf[20], src, curlen);
+
+		if (parityGroups) {
+			uint8_t *dst = &parity[(i % parityGroups) * DATA_MAX];
+			unsigned k;
 
-		memcpy(&buf[20], data, curlen);
-		data += curlen;
+			for (k = 0; k < curlen; k++)
+				dst[k] ^= src[k];
+		}
+
+		src += curlen;
 		len -= curlen;
 
-		if (WuHostSendBinary(host, client, buf, curlen + sizeof(uint32_t) * 5) < 0)
-			return 1;
+		sendPacket(buf, curlen + sizeof(uint32_t) * 5, i);
 	}
 
-	(*id)++;
+	if (failed)
+		vlog.error("Error sending udp, client gone?");
+	else if (parityGroups)
+		sendParity(pieces, msglen);
 
-	return 0;
+	id++;
 }
 
-UdpStream::UdpStream(): OutStream(), client(NULL), total_len(0), id(0), failed(false),
-	                frame(0) {
-	ptr = data;
-	end = data + UDPSTREAM_BUFSIZE;
+void UdpStream::gotNack(const uint8_t *in, size_t len) {
+	uint32_t nackId, nackPiece;
+	unsigned resent = 0;
+	size_t n;
 
-	srand(time(NULL));
-}
+	os::AutoMutex a(sentMutex);
 
-void UdpStream::flush() {
-	const unsigned len = ptr - data;
-	total_len += len;
+	if (!pacer || sent.empty())
+		return;
 
-	if (client) {
-		if (udpsend(client, data, len, &id, &frame)) {
-			vlog.error("Error sending udp, client gone?");
-			failed = true;
+	for (; len >= sizeof(uint32_t) * 2; in += sizeof(uint32_t) * 2, len -= sizeof(uint32_t) * 2) {
+		memcpy(&nackId, in, sizeof(uint32_t));
+		memcpy(&nackPiece, in + sizeof(uint32_t), sizeof(uint32_t));
+
+		// Newest first, that is what gets asked about
+		for (n = 1; n <= sent.size(); n++) {
+			SentPiece &p = sent[(sentPos + sent.size() - n) % sent.size()];
+
+			if (p.packet.empty())
+				break;
+			if (p.id != nackId || p.piece != nackPiece)
+				continue;
+
+			if (p.resends < MAX_RESENDS) {
+				p.resends++;
+				pacer->queue(p.packet.data(), p.packet.size(), true);
+				resent++;
+			}
+			break;
 		}
-	} else {
-		vlog.error("Tried to send udp without a client");
 	}
 
-	ptr = data;
+	if (resent)
+		vlog.debug("Resent %u pieces on request", resent);
 }
 
 void UdpStream::overrun(size_t needed) {
@@ -157,13 +553,32 @@ void UdpStream::overrun(size_t needed) {
 }
 
 bool UdpStream::isFailed() const {
+	if (pacer && pacer->isFailed()) {
+		vlog.error("Error sending udp, client gone?");
+		return true;
+	}
+
 	return failed;
 }
 
 void UdpStream::clearFailed() {
+	if (pacer)
+		pacer->clearFailed();
 	failed = false;
 }
 
+size_t UdpStream::queuedBytes() const {
+	if (!pacer)
+		return 0;
+	return pacer->queued();
+}
+
+size_t UdpStream::getRate() {
+	if (!pacer)
+		return 0;
+	return congestion.getRate();
+}
+
 void wuGotHttp(const char msg[], const uint32_t msglen, char resp[]) {
 	WuGotHttp(host, msg, msglen, resp);
 }
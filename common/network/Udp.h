@@ -20,11 +20,15 @@
 #define __NETWORK_UDP_H__
 
 #include <stdint.h>
+#include <vector>
 #include <rdr/OutStream.h>
+#include <network/UdpCongestion.h>
 
 void *udpserver(void *unused);
 typedef struct WuClient WuClient;
 
+namespace os { class Mutex; }
+
 namespace network {
 
 	#define UDPSTREAM_BUFSIZE (1024 * 1024)
@@ -32,13 +36,18 @@ namespace network {
 	class UdpStream: public rdr::OutStream {
 		public:
 			UdpStream();
+			virtual ~UdpStream();
 			virtual void flush();
 			virtual size_t length() { return total_len; }
 			virtual void overrun(size_t needed);
 
-			void setClient(WuClient *cli) {
-				client = cli;
-			}
+			// setClient() starts sending to a new client. Packets are sent
+			// by a separate thread, paced if congestion control is on.
+			void setClient(WuClient *cli);
+
+			// setRecovery() enables parity pieces and resends, for clients
+			// that know what to do with them
+			void setRecovery(const bool enabled);
 
 			void setFrameNumber(const unsigned in) {
 				frame = in;
@@ -46,13 +55,50 @@ namespace network {
 
 			bool isFailed() const;
 			void clearFailed();
+
+			// queuedBytes() returns how much data is still waiting to be
+			// paced out
+			size_t queuedBytes() const;
+
+			// getRate() returns the rate the data is paced at, in bytes
+			// per second. 0 without congestion control.
+			size_t getRate();
+
+			UdpCongestion *getCongestion() { return &congestion; }
+
+			// gotNack() resends the pieces listed in a NACK from the
+			// client. Called from the WebUDP thread.
+			void gotNack(const uint8_t *data, size_t len);
+
 		private:
+			class PacerThread;
+
+			void sendPacket(const uint8_t *buf, size_t len, uint32_t piece);
+			void sendParity(const uint32_t pieces, const uint32_t msglen);
+
 			uint8_t data[UDPSTREAM_BUFSIZE];
 			WuClient *client;
 			size_t total_len;
 			uint32_t id;
 			bool failed;
 			uint32_t frame;
+
+			UdpCongestion congestion;
+			PacerThread *pacer;
+
+			bool recovery;
+			std::vector<uint8_t> parity;
+			uint32_t parityGroups;
+
+			// The last pieces sent, for resending
+			struct SentPiece {
+				uint32_t id, piece;
+				unsigned resends;
+				std::vector<uint8_t> packet;
+			};
+			std::vector<SentPiece> sent;
+			size_t sentPos;
+			os::Mutex *sentMutex;
 	};
 }
 
@@ -0,0 +1,261 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// Once an interval (at least a round trip) the rate is adjusted:
+//
+//  - More than 10% loss cuts the rate in proportion to the loss.
+//  - The shortest round trip of the interval exceeding the path's base
+//    round trip by the delay threshold, and still growing, means a queue
+//    is building up; the rate drops below what actually got through.
+//  - Otherwise, if the rate was used, it is raised: doubled while in
+//    startup, by 8% after that, and never beyond 1.5 times the delivery
+//    rate seen lately.
+//
+// The minimum per interval is used instead of a smoothed round trip, as
+// the browser delays some acks and that would read as queueing.
+//
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+
+#include <network/UdpCongestion.h>
+#include <os/Mutex.h>
+#include <rfb/util.h>
+
+using namespace network;
+
+static const size_t START_RATE = 256 * 1024;
+static const size_t MIN_RATE = 32 * 1024;
+static const size_t MAX_RATE = 128 * 1024 * 1024;
+
+// Shortest adjustment interval, if the round trip is shorter
+static const unsigned MIN_INTERVAL = 100;
+
+// The base round trip is forgotten after this long, in case the route
+// changed
+static const unsigned MIN_RTT_WINDOW = 10000;
+
+// Queueing delay considered overuse, or a quarter of the base round
+// trip if that is more
+static const unsigned DELAY_THRESHOLD = 10;
+
+// Packets that never get acked are forgotten beyond this
+static const size_t MAX_TRACKED = 16384;
+
+static inline bool tsnBefore(const uint32_t a, const uint32_t b) {
+	return (int32_t) (a - b) < 0;
+}
+
+UdpCongestion::UdpCongestion() {
+	mutex = new os::Mutex;
+	reset();
+}
+
+UdpCongestion::~UdpCongestion() {
+	delete mutex;
+}
+
+void UdpCongestion::reset() {
+	os::AutoMutex a(mutex);
+
+	inFlight.clear();
+
+	rate = START_RATE;
+	inStartup = true;
+
+	srtt = 0;
+	minRTT = 0;
+	haveRTT = false;
+
+	std::fill(bwSamples, bwSamples + BW_SAMPLES, 0);
+	bwSample = 0;
+
+	gettimeofday(&intervalStart, NULL);
+	minRTTStamp = intervalStart;
+	intervalSent = intervalDelivered = intervalLost = 0;
+	intervalRTT = prevIntervalRTT = 0;
+	lastLoss = 0;
+}
+
+void UdpCongestion::sent(uint32_t tsn, unsigned bytes) {
+	Packet p;
+
+	p.tsn = tsn;
+	p.bytes = bytes;
+	p.done = false;
+	gettimeofday(&p.sent, NULL);
+
+	os::AutoMutex a(mutex);
+
+	// Only a new association goes backwards
+	if (!inFlight.empty() && !tsnBefore(inFlight.back().tsn, tsn))
+		inFlight.clear();
+
+	inFlight.push_back(p);
+	if (inFlight.size() > MAX_TRACKED)
+		inFlight.pop_front();
+
+	intervalSent += bytes;
+}
+
+void UdpCongestion::acked(Packet &p, const struct timeval &now) {
+	const unsigned sample = rfb::msBetween(&p.sent, &now);
+
+	p.done = true;
+	intervalDelivered += p.bytes;
+
+	if (!haveRTT) {
+		srtt = sample;
+		haveRTT = true;
+	} else {
+		srtt = (srtt * 7 + sample) / 8;
+	}
+
+	if (minRTT == 0 || sample < minRTT ||
+	    rfb::msBetween(&minRTTStamp, &now) > MIN_RTT_WINDOW) {
+		minRTT = sample;
+		minRTTStamp = now;
+	}
+
+	if (intervalRTT == 0 || sample < intervalRTT)
+		intervalRTT = sample;
+}
+
+void UdpCongestion::gotSack(uint32_t cumulativeTsnAck, const uint16_t *gaps,
+                            unsigned numGaps) {
+	struct timeval now;
+	std::deque<Packet>::iterator it;
+	uint32_t highest;
+	unsigned i;
+
+	gettimeofday(&now, NULL);
+
+	os::AutoMutex a(mutex);
+
+	while (!inFlight.empty() && !tsnBefore(cumulativeTsnAck, inFlight.front().tsn)) {
+		if (!inFlight.front().done)
+			acked(inFlight.front(), now);
+		inFlight.pop_front();
+	}
+
+	highest = cumulativeTsnAck;
+
+	for (i = 0; i < numGaps; i++) {
+		const uint32_t start = cumulativeTsnAck + gaps[i * 2];
+		const uint32_t end = cumulativeTsnAck + gaps[i * 2 + 1];
+
+		if (tsnBefore(end, start))
+			continue;
+
+		it = std::lower_bound(inFlight.begin(), inFlight.end(), start,
+		                      [](const Packet &p, const uint32_t tsn) {
+		                              return tsnBefore(p.tsn, tsn);
+		                      });
+		for (; it != inFlight.end() && !tsnBefore(end, it->tsn); ++it) {
+			if (!it->done)
+				acked(*it, now);
+		}
+
+		if (tsnBefore(highest, end))
+			highest = end;
+	}
+
+	// Holes below the highest ack are lost, they are skipped over with a
+	// forward TSN rather than resent
+	for (it = inFlight.begin(); it != inFlight.end() && tsnBefore(it->tsn, highest); ++it) {
+		if (!it->done) {
+			it->done = true;
+			intervalLost += it->bytes;
+		}
+	}
+
+	if (rfb::msBetween(&intervalStart, &now) >= std::max(MIN_INTERVAL, srtt))
+		updateRate(now);
+}
+
+void UdpCongestion::updateRate(const struct timeval &now) {
+	const unsigned elapsed = std::max(rfb::msBetween(&intervalStart, &now), 1u);
+	const size_t delivered = intervalDelivered * 1000 / elapsed;
+	const unsigned threshold = std::max(DELAY_THRESHOLD, minRTT / 4);
+	const bool appLimited = intervalSent < rate * elapsed / 1000 / 2;
+	size_t bandwidth;
+	unsigned queueing;
+
+	bwSamples[bwSample++ % BW_SAMPLES] = delivered;
+	bandwidth = *std::max_element(bwSamples, bwSamples + BW_SAMPLES);
+
+	lastLoss = 0;
+	if (intervalLost + intervalDelivered)
+		lastLoss = intervalLost * 100 / (intervalLost + intervalDelivered);
+
+	queueing = 0;
+	if (intervalRTT > minRTT)
+		queueing = intervalRTT - minRTT;
+
+	if (lastLoss > 10) {
+		rate = rate * (100 - lastLoss / 2) / 100;
+		inStartup = false;
+	} else if (queueing > threshold) {
+		// A shrinking queue is left to drain at the current rate
+		if (intervalRTT >= prevIntervalRTT) {
+			rate = std::min(rate, delivered * 85 / 100);
+			inStartup = false;
+		}
+	} else if (!appLimited && lastLoss < 2) {
+		if (inStartup)
+			rate *= 2;
+		else
+			rate = rate * 108 / 100;
+
+		if (!inStartup && bandwidth)
+			rate = std::min(rate, bandwidth * 3 / 2);
+	}
+
+	rate = std::max(std::min(rate, MAX_RATE), MIN_RATE);
+
+	if (intervalRTT)
+		prevIntervalRTT = intervalRTT;
+
+	intervalStart = now;
+	intervalSent = intervalDelivered = intervalLost = 0;
+	intervalRTT = 0;
+}
+
+size_t UdpCongestion::getRate() {
+	os::AutoMutex a(mutex);
+	return rate;
+}
+
+size_t UdpCongestion::getBandwidth() {
+	os::AutoMutex a(mutex);
+	return *std::max_element(bwSamples, bwSamples + BW_SAMPLES);
+}
+
+unsigned UdpCongestion::getRTT() {
+	os::AutoMutex a(mutex);
+	return srtt;
+}
+
+unsigned UdpCongestion::getLoss() {
+	os::AutoMutex a(mutex);
+	return lastLoss;
+}
@@ -0,0 +1,104 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// UdpCongestion estimates the path to a WebUDP client from the SCTP
+// selective acks the browser sends for every data chunk, and derives the
+// rate the UdpStream should pace at. The delay and loss rules follow
+// Google Congestion Control, the delivery rate measurement BBR.
+//
+
+#ifndef __NETWORK_UDPCONGESTION_H__
+#define __NETWORK_UDPCONGESTION_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <deque>
+
+namespace os { class Mutex; }
+
+namespace network {
+
+	class UdpCongestion {
+		public:
+			UdpCongestion();
+			~UdpCongestion();
+
+			// reset() forgets everything learned, for a new client
+			void reset();
+
+			// sent() must be called for every packet handed to the
+			// transport, with the TSN it went out under
+			void sent(uint32_t tsn, unsigned bytes);
+
+			// gotSack() processes a selective ack. The gaps are pairs of
+			// inclusive offsets from the cumulative ack.
+			void gotSack(uint32_t cumulativeTsnAck, const uint16_t *gaps,
+			             unsigned numGaps);
+
+			// getRate() returns the target sending rate in bytes per
+			// second
+			size_t getRate();
+
+			// getBandwidth() returns the recently measured delivery rate
+			// in bytes per second, 0 if not known yet
+			size_t getBandwidth();
+
+			// getRTT() returns the smoothed round trip time in ms
+			unsigned getRTT();
+
+			// getLoss() returns the loss over the last interval, in percent
+			unsigned getLoss();
+
+		private:
+			struct Packet {
+				uint32_t tsn;
+				unsigned bytes;
+				struct timeval sent;
+				bool done;
+			};
+
+			void acked(Packet &p, const struct timeval &now);
+			void updateRate(const struct timeval &now);
+
+			std::deque<Packet> inFlight;
+
+			size_t rate;
+			bool inStartup;
+
+			unsigned srtt;
+			unsigned minRTT;
+			struct timeval minRTTStamp;
+			bool haveRTT;
+
+			static const unsigned BW_SAMPLES = 8;
+			size_t bwSamples[BW_SAMPLES];
+			unsigned bwSample;
+
+			struct timeval intervalStart;
+			size_t intervalSent, intervalDelivered, intervalLost;
+			unsigned intervalRTT, prevIntervalRTT;
+			unsigned lastLoss;
+
+			os::Mutex *mutex;
+	};
+}
+
+#endif // __NETWORK_UDPCONGESTION_H__
@@ -0,0 +1,362 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <network/WebSocketStreams.h>
+#include <rdr/Exception.h>
+
+using namespace network;
+using namespace rdr;
+
+enum { WIRE_BUF_SIZE = 65536 };
+
+//
+// WebSocketInStream
+//
+
+WebSocketInStream::WebSocketInStream(int fd_, SSL* ssl_)
+  : FdInStream(fd_), ssl(ssl_), payloadLeft(0), maskPos(0),
+    discard(false), closed(false)
+{
+  wire = wirePos = wireEnd = new U8[WIRE_BUF_SIZE];
+}
+
+WebSocketInStream::~WebSocketInStream()
+{
+  delete [] wire;
+}
+
+bool WebSocketInStream::fillBuffer(size_t maxSize, bool wait)
+{
+  while (true) {
+    size_t n = decode((U8*)end, maxSize);
+    if (n) {
+      end += n;
+      return true;
+    }
+
+    if (closed)
+      throw EndOfStream();
+
+    // decode() stops short only on a partial header, so this is cheap
+    if (wirePos != wire) {
+      memmove(wire, wirePos, wireEnd - wirePos);
+      wireEnd = wire + (wireEnd - wirePos);
+      wirePos = wire;
+    }
+
+    n = readRaw(wireEnd, WIRE_BUF_SIZE - (wireEnd - wire), wait);
+    if (n == 0)
+      return false;
+    wireEnd += n;
+  }
+}
+
+size_t WebSocketInStream::readRaw(U8* buf, size_t len, bool wait)
+{
+  int n;
+
+  while (true) {
+    // OpenSSL may hold already decrypted data that select() cannot see
+    if (!(ssl && SSL_pending(ssl) > 0) && !waitForData(wait))
+      return 0;
+
+    if (ssl) {
+      ERR_clear_error();
+      n = SSL_read(ssl, buf, len);
+      if (n > 0)
+        return n;
+
+      switch (SSL_get_error(ssl, n)) {
+      case SSL_ERROR_WANT_READ:
+      case SSL_ERROR_WANT_WRITE:
+        break;
+      case SSL_ERROR_ZERO_RETURN:
+        throw EndOfStream();
+      case SSL_ERROR_SYSCALL:
+        if (errno == 0)
+          throw EndOfStream();
+        throw SystemException("SSL_read", errno);
+      default:
+        throw Exception("SSL_read failed: %s",
+                        ERR_error_string(ERR_get_error(), NULL));
+      }
+    } else {
+      do {
+        n = ::recv(fd, (char*)buf, len, 0);
+      } while (n < 0 && errno == EINTR);
+
+      if (n > 0)
+        return n;
+      if (n == 0)
+        throw EndOfStream();
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        throw SystemException("read", errno);
+    }
+
+    if (!wait)
+      return 0;
+  }
+}
+
+bool WebSocketInStream::parseHeader()
+{
+  size_t avail, hdrLen;
+  unsigned opcode;
+  U64 len;
+
+  avail = wireEnd - wirePos;
+  if (avail < 2)
+    return false;
+
+  if (!(wirePos[1] & 0x80))
+    throw Exception("WebSocket: received unmasked frame from client");
+
+  len = wirePos[1] & 0x7f;
+  hdrLen = 2 + 4;
+  if (len == 126)
+    hdrLen += 2;
+  else if (len == 127)
+    hdrLen += 8;
+
+  if (avail < hdrLen)
+    return false;
+
+  if (len == 126) {
+    len = (wirePos[2] << 8) | wirePos[3];
+  } else if (len == 127) {
+    len = 0;
+    for (unsigned i = 0; i < 8; i++)
+      len = (len << 8) | wirePos[2 + i];
+  }
+
+  opcode = wirePos[0] & 0x0f;
+  memcpy(mask, wirePos + hdrLen - 4, 4);
+  maskPos = 0;
+  payloadLeft = len;
+  wirePos += hdrLen;
+
+  switch (opcode) {
+  case 0x0: // continuation
+  case OPCODE_BINARY:
+    discard = false;
+    break;
+  case 0x8: // close
+    discard = true;
+    closed = true;
+    break;
+  case 0x9: // ping
+  case 0xa: // pong
+    // Ignored, same as the proxy does
+    discard = true;
+    break;
+  default:
+    throw Exception("WebSocket: unexpected opcode 0x%x", opcode);
+  }
+
+  return true;
+}
+
+size_t WebSocketInStream::decode(U8* out, size_t maxSize)
+{
+  size_t total = 0;
+
+  while (total < maxSize && !closed) {
+    size_t n;
+
+    if (payloadLeft == 0) {
+      if (!parseHeader())
+        break;
+      continue;
+    }
+
+    n = wireEnd - wirePos;
+    if (n == 0)
+      break;
+    if (n > payloadLeft)
+      n = payloadLeft;
+
+    if (!discard) {
+      if (n > maxSize - total)
+        n = maxSize - total;
+      for (size_t i = 0; i < n; i++)
+        out[total + i] = wirePos[i] ^ mask[(maskPos + i) & 3];
+      total += n;
+    }
+
+    maskPos = (maskPos + n) & 3;
+    wirePos += n;
+    payloadLeft -= n;
+  }
+
+  return total;
+}
+
+//
+// WebSocketOutStream
+//
+
+WebSocketOutStream::WebSocketOutStream(ws_ctx_t* ctx_)
+  : FdOutStream(ctx_->sockfd), ctx(ctx_),
+    headerLen(0), headerSent(0), frameLeft(0)
+{
+  // Frames and TLS records are built from one contiguous run of bytes,
+  // so keep to the plain buffer
+  gather = false;
+
+  // Room for the largest frame header, see writeFrame()
+  reserveHeadroom(sizeof(header));
+
+  // The buffer can move between retries, and partial progress is needed
+  // to behave like send() on a non-blocking socket
+  if (ctx->ssl)
+    SSL_set_mode(ctx->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                           SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+}
+
+WebSocketOutStream::~WebSocketOutStream()
+{
+  // ~Socket has closed the fd by now, so don't let ~FdOutStream push
+  // anything (unframed) at whatever that fd number has become
+  sentUpTo = ptr;
+
+  ws_socket_release(ctx);
+}
+
+bool WebSocketOutStream::flushBuffer(bool wait)
+{
+  size_t n;
+
+  // Start a new frame covering everything buffered so far
+  if (frameLeft == 0 && headerSent == headerLen) {
+    frameLeft = ptr - sentUpTo;
+    if (frameLeft == 0)
+      return true;
+
+    header[0] = 0x80 | OPCODE_BINARY;
+    if (frameLeft < 126) {
+      header[1] = frameLeft;
+      headerLen = 2;
+    } else if (frameLeft < 65536) {
+      header[1] = 126;
+      header[2] = frameLeft >> 8;
+      header[3] = frameLeft;
+      headerLen = 4;
+    } else {
+      header[1] = 127;
+      for (unsigned i = 0; i < 8; i++)
+        header[2 + i] = (U64)frameLeft >> (56 - i * 8);
+      headerLen = 10;
+    }
+    headerSent = 0;
+  }
+
+  n = writeFrame((blocking || wait) ? timeoutms : 0);
+
+  // Timeout?
+  if (n == 0) {
+    // If non-blocking then we're done here
+    if (!blocking && !wait)
+      return false;
+
+    throw TimedOut();
+  }
+
+  return true;
+}
+
+//
+// writeFrame() sends what it can of the pending header and payload of the
+// current frame, returning the number of bytes written or zero on timeout.
+//
+// The header goes into the reserved headroom right in front of sentUpTo,
+// so header and payload leave in a single send() or SSL_write(), and for
+// TLS in a single record.  The bytes before sentUpTo have already been
+// sent, so the remaining header is simply rewritten there on each call in
+// case the buffer has been compacted since.
+//
+
+size_t WebSocketOutStream::writeFrame(int timeoutms)
+{
+  U8* data;
+  size_t len, hdr;
+  ssize_t n;
+
+  hdr = headerLen - headerSent;
+  data = sentUpTo - hdr;
+  memcpy(data, header + headerSent, hdr);
+  len = hdr + frameLeft;
+
+  while (true) {
+    if (!waitForWrite(timeoutms))
+      return 0;
+
+    if (ctx->ssl) {
+      ERR_clear_error();
+      n = SSL_write(ctx->ssl, data, len);
+      if (n <= 0) {
+        switch (SSL_get_error(ctx->ssl, n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+          n = 0;
+          break;
+        case SSL_ERROR_SYSCALL:
+          throw SystemException("SSL_write", errno);
+        default:
+          throw Exception("SSL_write failed: %s",
+                          ERR_error_string(ERR_get_error(), NULL));
+        }
+      }
+    } else {
+      do {
+        n = ::send(fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+      } while (n < 0 && errno == EINTR);
+
+      if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          throw SystemException("write", errno);
+        n = 0;
+      }
+    }
+
+    if (n > 0)
+      break;
+
+    if (timeoutms == 0)
+      return 0;
+  }
+
+  gettimeofday(&lastWrite, NULL);
+
+  if (hdr > (size_t)n)
+    hdr = n;
+  headerSent += hdr;
+  sentUpTo += n - hdr;
+  frameLeft -= n - hdr;
+
+  return n;
+}
@@ -0,0 +1,88 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// WebSocketInStream/WebSocketOutStream carry RFB over a HyBi (RFC 6455)
+// binary WebSocket directly on the client's TCP socket, optionally through
+// the OpenSSL session set up during the websocket handshake.  They replace
+// the websockify proxy thread and its AF_UNIX hop for direct connections.
+//
+
+#ifndef __NETWORK_WEBSOCKET_STREAMS_H__
+#define __NETWORK_WEBSOCKET_STREAMS_H__
+
+#include <rdr/FdInStream.h>
+#include <rdr/FdOutStream.h>
+
+#include "websocket.h"
+
+namespace network {
+
+  class WebSocketInStream : public rdr::FdInStream {
+  public:
+    WebSocketInStream(int fd, SSL* ssl);
+    virtual ~WebSocketInStream();
+
+  private:
+    virtual bool fillBuffer(size_t maxSize, bool wait);
+
+    // Reads raw (still framed) bytes from the socket or TLS session
+    size_t readRaw(rdr::U8* buf, size_t len, bool wait);
+    // Unframes as much buffered payload as fits in maxSize
+    size_t decode(rdr::U8* out, size_t maxSize);
+    bool parseHeader();
+
+    SSL* ssl;
+
+    rdr::U8* wire;
+    rdr::U8* wirePos;
+    rdr::U8* wireEnd;
+
+    rdr::U64 payloadLeft;
+    rdr::U8 mask[4];
+    unsigned maskPos;
+    bool discard;
+    bool closed;
+  };
+
+  class WebSocketOutStream : public rdr::FdOutStream {
+  public:
+    // Takes ownership of ctx, releasing it once the stream is gone
+    WebSocketOutStream(ws_ctx_t* ctx);
+    virtual ~WebSocketOutStream();
+
+    // The TLS session is shared with the reading side, which OpenSSL
+    // doesn't allow from two threads, so writes stay on the caller
+    virtual void startWriter(size_t maxQueued) {}
+
+  private:
+    virtual bool flushBuffer(bool wait);
+
+    size_t writeFrame(int timeoutms);
+
+    ws_ctx_t* ctx;
+
+    rdr::U8 header[10];
+    size_t headerLen;
+    size_t headerSent;
+    size_t frameLeft;
+  };
+
+}
+
+#endif // __NETWORK_WEBSOCKET_STREAMS_H__
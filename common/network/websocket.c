@@ -17,12 +17,14 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <dirent.h>
 #include <inttypes.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -267,7 +269,6 @@ ws_ctx_t *ws_socket(ws_ctx_t *ctx, int socket) {
 }
 
 ws_ctx_t *ws_socket_ssl(ws_ctx_t *ctx, int socket, const char * certfile, const char * keyfile) {
-    int ret;
     char msg[1024];
     const char * use_keyfile;
     ws_socket(ctx, socket);
@@ -304,12 +305,9 @@ ws_ctx_t *ws_socket_ssl(ws_ctx_t *ctx, int socket, const char * certfile, const
 //        fatal(msg);
 //    }
 
-    // Associate socket and ssl object
+    // Associate socket and ssl object, the caller drives SSL_accept()
     ctx->ssl = SSL_new(ctx->ssl_ctx);
-    SSL_set_fd(ctx->ssl, socket);
-
-    ret = SSL_accept(ctx->ssl);
-    if (ret < 0) {
+    if (!ctx->ssl || SSL_set_fd(ctx->ssl, socket) != 1) {
         ERR_print_errors_fp(stderr);
         return NULL;
     }
@@ -317,6 +315,14 @@ ws_ctx_t *ws_socket_ssl(ws_ctx_t *ctx, int socket, const char * certfile, const
     return ctx;
 }
 
+void ws_socket_release(ws_ctx_t *ctx) {
+    if (ctx->ssl)
+        SSL_free(ctx->ssl);
+    if (ctx->ssl_ctx)
+        SSL_CTX_free(ctx->ssl_ctx);
+    free_ws_ctx(ctx);
+}
+
 void ws_socket_free(ws_ctx_t *ctx) {
     if (ctx->ssl) {
         SSL_free(ctx->ssl);
@@ -508,6 +514,35 @@ int encode_hybi(u_char const *src, size_t srclength,
     return len + payload_offset;
 }
 
+/*
+ * Frames binary data in place by writing the header into the bytes just
+ * before payload, which must have HYBI_HEADROOM bytes to spare. Returns
+ * the header length, so the frame starts at payload minus that.
+ */
+int encode_hybi_inplace(char *payload, size_t length)
+{
+    char *target;
+
+    if (length == 0 || length >= 65536) {
+        handler_emsg("Invalid in place frame length %lu\n",
+                     (unsigned long) length);
+        return -1;
+    }
+
+    if (length <= 125) {
+        target = payload - 2;
+        target[1] = (char) length;
+    } else {
+        target = payload - 4;
+        target[1] = (char) 126;
+        target[2] = (char) (length >> 8);
+        target[3] = (char) length;
+    }
+    target[0] = (char)(OPCODE_BINARY | 0x80);
+
+    return payload - target;
+}
+
 int decode_hybi(unsigned char *src, size_t srclength,
                 u_char *target, size_t targsize,
                 unsigned int *opcode, unsigned int *left)
@@ -1551,6 +1586,27 @@ static uint8_t ownerapi(ws_ctx_t *ws_ctx, const char *in, const char * const use
 
         handler_msg("Sent session list to API caller\n");
         ret = 1;
+    } else entry("/api/get_trace") {
+        char *trace;
+        settings.getTraceCb(settings.messager, &trace);
+        if (!trace)
+            goto nope;
+
+        sprintf(buf, "HTTP/1.1 200 OK\r\n"
+                 "Server: KasmVNC/4.0\r\n"
+                 "Connection: close\r\n"
+                 "Content-type: application/json\r\n"
+                 "Content-length: %lu\r\n"
+                 "%s"
+                 "\r\n", strlen(trace), extra_headers ? extra_headers : "");
+        ws_send(ws_ctx, buf, strlen(buf));
+        ws_send(ws_ctx, trace, strlen(trace));
+        weblog(200, wsthread_handler_id, 0, origip, ip, user, 1, origpath, strlen(buf) + strlen(trace));
+
+        free(trace);
+
+        handler_msg("Sent trace to API caller\n");
+        ret = 1;
     } else entry("/api/get_frame_stats") {
         char statbuf[4096], decname[1024];
         unsigned waitfor;
@@ -1803,75 +1859,15 @@ timeout:
     return 1;
 }
 
-ws_ctx_t *do_handshake(int sock, char * const ip) {
-    char handshake[16 * 1024], response[4096], sha1[29], trailer[17];
-    char *scheme, *pre;
+/* handshake holds the complete request, read by the handshake reactor */
+ws_ctx_t *do_handshake(ws_ctx_t *ws_ctx, char *handshake, char * const ip) {
+    char response[4096], sha1[29], trailer[17];
+    const char *scheme = ws_ctx->ssl ? "wss" : "ws";
+    char *pre;
     headers_t *headers;
-    int len, i, offset;
-    ws_ctx_t * ws_ctx;
+    int len;
     char *response_protocol;
 
-    // Peek, but don't read the data
-    len = recv(sock, handshake, 1024, MSG_PEEK);
-    handshake[len] = 0;
-    if (len == 0) {
-        handler_msg("ignoring empty handshake\n");
-        return NULL;
-    } else if ((bcmp(handshake, "\x16", 1) == 0) ||
-               (bcmp(handshake, "\x80", 1) == 0)) {
-        // SSL
-        if (!settings.cert) {
-            handler_msg("SSL connection but no cert specified\n");
-            return NULL;
-        } else if (access(settings.cert, R_OK) != 0) {
-            handler_msg("SSL connection but '%s' not found\n",
-                        settings.cert);
-            return NULL;
-        }
-        ws_ctx = alloc_ws_ctx();
-        ws_socket_ssl(ws_ctx, sock, settings.cert, settings.key);
-        if (! ws_ctx) { return NULL; }
-        scheme = "wss";
-        handler_msg("using SSL socket\n");
-    } else if (settings.ssl_only) {
-        handler_msg("non-SSL connection disallowed\n");
-        return NULL;
-    } else {
-        ws_ctx = alloc_ws_ctx();
-        ws_socket(ws_ctx, sock);
-        if (! ws_ctx) { return NULL; }
-        scheme = "ws";
-        handler_msg("using plain (not SSL) socket\n");
-    }
-    offset = 0;
-    for (i = 0; i < 10; i++) {
-        /* (offset + 1): reserve one byte for the trailing '\0' */
-        if (0 > (len = ws_recv(ws_ctx, handshake + offset, sizeof(handshake) - (offset + 1)))) {
-            handler_emsg("Read error during handshake: %m\n");
-            free_ws_ctx(ws_ctx);
-            return NULL;
-        } else if (0 == len) {
-            handler_emsg("Client closed during handshake\n");
-            free_ws_ctx(ws_ctx);
-            return NULL;
-        }
-        offset += len;
-        handshake[offset] = 0;
-        if (strstr(handshake, "\r\n\r\n")) {
-            break;
-        } else if (sizeof(handshake) <= (size_t)(offset + 1)) {
-            handler_emsg("Oversized handshake\n");
-            send400(ws_ctx, "-", ip, ", too large");
-            free_ws_ctx(ws_ctx);
-            return NULL;
-        } else if (9 == i) {
-            handler_emsg("Incomplete handshake\n");
-            free_ws_ctx(ws_ctx);
-            return NULL;
-        }
-        usleep(10);
-    }
-
     // Proxied?
     char origip[64];
     memcpy(origip, ip, 64);
@@ -2085,33 +2081,376 @@ done:
     return ws_ctx;
 }
 
-void proxy_handler(ws_ctx_t *ws_ctx);
+int proxy_handler(ws_ctx_t *ws_ctx);
+int proxy_init(void);
 
 __thread unsigned wsthread_handler_id;
 
-void *subthread(void *ptr) {
+/*
+ * Handshakes
+ *
+ * The accept thread reads each new connection's request from an epoll
+ * loop: TLS is negotiated and the headers are read without blocking, with
+ * a deadline for the whole request and a limit per source address, so a
+ * client trickling bytes costs a buffer but no thread and can't crowd out
+ * everyone else. Complete requests go to a small fixed pool of workers for
+ * authentication, files, API calls and the WebSocket upgrade, which only
+ * send from there on; the accept thread shuts down any that run past their
+ * own deadline. Established websockets move to the proxy reactor, or to the
+ * VNC server itself in direct mode.
+ */
+
+#define HANDSHAKE_TIMEOUT 10        // seconds to send a complete request
+#define HANDSHAKE_REPLY_TIMEOUT 60  // seconds for a worker to answer it
+#define HANDSHAKE_BUFSIZE (16 * 1024)
+#define MAX_HANDSHAKES 1024         // requests being read at once
+#define MAX_HANDSHAKES_PER_IP 32
+#define HANDSHAKE_WORKERS 8
+#define MAX_QUEUED_HANDSHAKES 256
+
+typedef struct hs_conn_t {
+    int fd;
+    unsigned id;
+    char ip[64];
+    ws_ctx_t *ws_ctx;   // Set once the first byte tells TLS from plain
+    int accepted;       // TLS negotiated, or plain
+    char *buf;
+    unsigned len;
+    time_t deadline;
+    struct hs_conn_t *prev, *next;
+} hs_conn_t;
+
+// Only the accept thread touches these
+static int hs_epfd = -1;
+static hs_conn_t *hs_reading, *hs_reading_tail;
+static unsigned hs_reading_num;
+
+// Complete requests waiting for a worker
+static hs_conn_t *hs_queue, *hs_queue_tail;
+static unsigned hs_queued;
+static pthread_mutex_t hs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hs_cond = PTHREAD_COND_INITIALIZER;
+
+// What each worker is answering, under hs_mutex
+static struct {
+    int fd;
+    time_t deadline;
+} hs_busy[HANDSHAKE_WORKERS];
+
+static time_t hs_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void hs_free(hs_conn_t *c) {
+    free(c->buf);
+    free(c);
+}
+
+static void hs_unlink(hs_conn_t *c) {
+    epoll_ctl(hs_epfd, EPOLL_CTL_DEL, c->fd, NULL);
+
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        hs_reading = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    else
+        hs_reading_tail = c->prev;
+
+    hs_reading_num--;
+}
+
+static void hs_drop(hs_conn_t *c) {
+    hs_unlink(c);
+
+    if (c->ws_ctx) {
+        ws_socket_free(c->ws_ctx);
+        free_ws_ctx(c->ws_ctx);
+    } else {
+        shutdown(c->fd, SHUT_RDWR);
+        close(c->fd);
+    }
+
+    hs_free(c);
+}
+
+/* 0 if the connection should wait for the socket, -1 if it failed */
+static int hs_wait(hs_conn_t *c, int ret) {
+    struct epoll_event ev;
+
+    ev.data.ptr = c;
+
+    if (c->ws_ctx && c->ws_ctx->ssl) {
+        switch (SSL_get_error(c->ws_ctx->ssl, ret)) {
+            case SSL_ERROR_WANT_READ:
+                ev.events = EPOLLIN;
+                break;
+            case SSL_ERROR_WANT_WRITE:
+                ev.events = EPOLLOUT;
+                break;
+            case SSL_ERROR_ZERO_RETURN:
+                handler_emsg("Client closed during handshake\n");
+                return -1;
+            default:
+                handler_emsg("TLS error during handshake\n");
+                ERR_print_errors_fp(stderr);
+                return -1;
+        }
+    } else if (ret == 0) {
+        handler_emsg("Client closed during handshake\n");
+        return -1;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        ev.events = EPOLLIN;
+    } else {
+        handler_emsg("Read error during handshake: %m\n");
+        return -1;
+    }
+
+    epoll_ctl(hs_epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    return 0;
+}
+
+/* Reads as much of the request as there is, 1 once it is complete */
+static int hs_step(hs_conn_t *c) {
+    unsigned char first;
+    unsigned from;
+    ssize_t len;
+    int ret;
+
+    wsthread_handler_id = c->id;
+
+    if (!c->ws_ctx) {
+        // Peek, but don't read the data
+        len = recv(c->fd, &first, 1, MSG_PEEK);
+        if (len <= 0)
+            return hs_wait(c, len);
+
+        if (first == 0x16 || first == 0x80) {
+            // SSL
+            if (!settings.cert) {
+                handler_msg("SSL connection but no cert specified\n");
+                return -1;
+            } else if (access(settings.cert, R_OK) != 0) {
+                handler_msg("SSL connection but '%s' not found\n",
+                            settings.cert);
+                return -1;
+            }
+            c->ws_ctx = alloc_ws_ctx();
+            if (!ws_socket_ssl(c->ws_ctx, c->fd, settings.cert, settings.key))
+                return -1;
+            handler_msg("using SSL socket\n");
+        } else if (settings.ssl_only) {
+            handler_msg("non-SSL connection disallowed\n");
+            return -1;
+        } else {
+            c->ws_ctx = alloc_ws_ctx();
+            ws_socket(c->ws_ctx, c->fd);
+            c->accepted = 1;
+            handler_msg("using plain (not SSL) socket\n");
+        }
+    }
+
+    if (!c->accepted) {
+        ret = SSL_accept(c->ws_ctx->ssl);
+        if (ret <= 0)
+            return hs_wait(c, ret);
+        c->accepted = 1;
+    }
+
+    while (1) {
+        /* (len + 1): reserve one byte for the trailing '\0' */
+        len = ws_recv(c->ws_ctx, c->buf + c->len, HANDSHAKE_BUFSIZE - (c->len + 1));
+        if (len <= 0)
+            return hs_wait(c, len);
+
+        // The end of the headers may straddle two reads
+        from = c->len > 3 ? c->len - 3 : 0;
+        c->len += len;
+        c->buf[c->len] = '\0';
+
+        if (strstr(c->buf + from, "\r\n\r\n"))
+            return 1;
 
-    struct wspass_t * const pass = ptr;
+        if (c->len + 1 >= HANDSHAKE_BUFSIZE) {
+            handler_emsg("Oversized handshake\n");
+            send400(c->ws_ctx, "-", c->ip, ", too large");
+            return -1;
+        }
+    }
+}
+
+static void hs_complete(hs_conn_t *c) {
+    int flags;
+
+    hs_unlink(c);
+
+    // The workers answer with blocking sends, bounded by SO_SNDTIMEO
+    flags = fcntl(c->fd, F_GETFL);
+    fcntl(c->fd, F_SETFL, flags & ~O_NONBLOCK);
+
+    pthread_mutex_lock(&hs_mutex);
+    if (hs_queued >= MAX_QUEUED_HANDSHAKES) {
+        pthread_mutex_unlock(&hs_mutex);
+
+        wserr("Too many requests waiting, dropping %s\n", c->ip);
+        ws_socket_free(c->ws_ctx);
+        free_ws_ctx(c->ws_ctx);
+        hs_free(c);
+        return;
+    }
+
+    c->next = NULL;
+    if (hs_queue_tail)
+        hs_queue_tail->next = c;
+    else
+        hs_queue = c;
+    hs_queue_tail = c;
+    hs_queued++;
+
+    pthread_cond_signal(&hs_cond);
+    pthread_mutex_unlock(&hs_mutex);
+}
+
+static void hs_accept(void) {
+    struct sockaddr_in cli_addr;
+    socklen_t clilen;
+    struct epoll_event ev;
+    char ip[64];
+    hs_conn_t *c;
+    unsigned same;
+    int csock;
+
+    while (1) {
+        clilen = sizeof(cli_addr);
+        csock = accept4(settings.listen_sock, (struct sockaddr *) &cli_addr,
+                        &clilen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (csock < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                error("ERROR on accept");
+            return;
+        }
+
+        inet_ntop(cli_addr.sin_family, &cli_addr.sin_addr, ip, sizeof(ip));
+
+        char logbuf[2][1024];
+        wslog(logbuf[0], settings.handler_id, 0);
+        sprintf(logbuf[1], "got client connection from %s\n", ip);
+        fprintf(stderr, "%s%s", logbuf[0], logbuf[1]);
+
+        // Shed load rather than pile up, e.g. in a reconnect storm, but
+        // never let one address take every place
+        same = 0;
+        for (c = hs_reading; c; c = c->next) {
+            if (!strcmp(c->ip, ip))
+                same++;
+        }
+
+        if (hs_reading_num >= MAX_HANDSHAKES || same >= MAX_HANDSHAKES_PER_IP) {
+            wserr("Too many connections in progress, dropping %s\n", ip);
+            close(csock);
+            continue;
+        }
+
+        const struct timeval tv = { HANDSHAKE_TIMEOUT, 0 };
+        setsockopt(csock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(csock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        if (!(c = calloc(1, sizeof(hs_conn_t))) ||
+            !(c->buf = malloc(HANDSHAKE_BUFSIZE)))
+            { fatal("malloc()"); }
+
+        c->fd = csock;
+        c->id = settings.handler_id;
+        memcpy(c->ip, ip, sizeof(ip));
+        c->deadline = hs_now() + HANDSHAKE_TIMEOUT;
+
+        settings.handler_id += 1;
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(hs_epfd, EPOLL_CTL_ADD, csock, &ev) < 0) {
+            wserr("epoll_ctl: %s\n", strerror(errno));
+            close(csock);
+            hs_free(c);
+            continue;
+        }
+
+        // Oldest first, so expiry only looks at the head
+        c->prev = hs_reading_tail;
+        if (hs_reading_tail)
+            hs_reading_tail->next = c;
+        else
+            hs_reading = c;
+        hs_reading_tail = c;
+        hs_reading_num++;
+    }
+}
 
-    const int csock = pass->csock;
-    wsthread_handler_id = pass->id;
+static void hs_expire(void) {
+    const time_t now = hs_now();
+    unsigned i;
+
+    while (hs_reading && hs_reading->deadline <= now) {
+        wsthread_handler_id = hs_reading->id;
+        wserr("No complete request from %s in time, dropping\n", hs_reading->ip);
+        hs_drop(hs_reading);
+    }
+
+    // Workers stuck sending to a client that doesn't read
+    pthread_mutex_lock(&hs_mutex);
+    for (i = 0; i < HANDSHAKE_WORKERS; i++) {
+        if (hs_busy[i].fd >= 0 && hs_busy[i].deadline <= now) {
+            shutdown(hs_busy[i].fd, SHUT_RDWR);
+            hs_busy[i].fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&hs_mutex);
+}
+
+static void handle_connection(hs_conn_t *c, unsigned worker) {
+
+    const int csock = c->fd;
+    wsthread_handler_id = c->id;
 
     ws_ctx_t *ws_ctx;
 
-    ws_ctx = do_handshake(csock, pass->ip);
+    ws_ctx = do_handshake(c->ws_ctx, c->buf, c->ip);
+
+    // Past the handshake the connection is no longer the watchdog's
+    pthread_mutex_lock(&hs_mutex);
+    hs_busy[worker].fd = -1;
+    pthread_mutex_unlock(&hs_mutex);
+
     if (ws_ctx == NULL) {
         handler_msg("No connection after handshake\n");
         goto out;   // Child process exits
     }
 
-    memcpy(ws_ctx->ip, pass->ip, sizeof(pass->ip));
+    memcpy(ws_ctx->ip, c->ip, sizeof(c->ip));
+
+    // Base64 and hixie framing are left to the proxy
+    if (settings.direct && ws_ctx->hybi && ws_ctx->opcode == OPCODE_BINARY) {
+        if (ws_handoff(ws_ctx)) {
+            handler_msg("connection handed off to VNC server\n");
+            hs_free(c);
+            return;
+        }
+        handler_emsg("direct handoff failed\n");
+        goto out;
+    }
 
-    proxy_handler(ws_ctx);
-    if (pipe_error) {
-        handler_emsg("Closing due to SIGPIPE\n");
+    if (proxy_handler(ws_ctx)) {
+        hs_free(c);
+        return;
     }
 out:
-    free((void *) pass);
+    hs_free(c);
 
     if (ws_ctx) {
         ws_socket_free(ws_ctx);
@@ -2121,53 +2460,94 @@ out:
         close(csock);
     }
     handler_msg("handler exit\n");
+}
+
+static void *handshake_worker(void *arg) {
+    const unsigned worker = (uintptr_t) arg;
+    hs_conn_t *c;
+
+    while (1) {
+        pthread_mutex_lock(&hs_mutex);
+        while (!hs_queue)
+            pthread_cond_wait(&hs_cond, &hs_mutex);
+
+        c = hs_queue;
+        hs_queue = c->next;
+        if (!hs_queue)
+            hs_queue_tail = NULL;
+        hs_queued--;
+
+        hs_busy[worker].fd = c->fd;
+        hs_busy[worker].deadline = hs_now() + HANDSHAKE_REPLY_TIMEOUT;
+        pthread_mutex_unlock(&hs_mutex);
+
+        handle_connection(c, worker);
+    }
 
     return NULL;
 }
 
 void *start_server(void *unused) {
-    int csock;
-    struct sockaddr_in cli_addr;
-    socklen_t clilen;
+    struct epoll_event events[64], ev;
+    pthread_t tid;
+    unsigned i;
+    int n;
 
 //    printf("Waiting for connections on %s:%d\n",
 //            settings.listen_host, settings.listen_port);
 
+    if (proxy_init() < 0)
+        fatal("Unable to start the websocket proxy reactor");
+
+    hs_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (hs_epfd < 0)
+        fatal("Unable to start the websocket handshake reactor");
+
+    fcntl(settings.listen_sock, F_SETFL,
+          fcntl(settings.listen_sock, F_GETFL) | O_NONBLOCK);
+
+    // The listening socket is the one without a connection
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(hs_epfd, EPOLL_CTL_ADD, settings.listen_sock, &ev) < 0)
+        fatal("Unable to watch the websocket listener");
+
+    for (i = 0; i < HANDSHAKE_WORKERS; i++) {
+        hs_busy[i].fd = -1;
+        if (pthread_create(&tid, NULL, handshake_worker, (void *) (uintptr_t) i))
+            fatal("Unable to start the websocket handshake workers");
+        pthread_detach(tid);
+    }
+
     while (1) {
-        clilen = sizeof(cli_addr);
         pipe_error = 0;
-        do {
-            csock = accept(settings.listen_sock,
-                           (struct sockaddr *) &cli_addr,
-                           &clilen);
-        } while (csock == -1 && errno == EINTR);
 
-        if (csock < 0) {
-            error("ERROR on accept");
+        // Wake at least once a second to enforce the deadlines
+        n = epoll_wait(hs_epfd, events, 64, 1000);
+        if (n < 0 && errno != EINTR) {
+            error("ERROR on epoll_wait");
             continue;
         }
-        struct wspass_t *pass = calloc(1, sizeof(struct wspass_t));
-        inet_ntop(cli_addr.sin_family, &cli_addr.sin_addr, pass->ip, sizeof(pass->ip));
 
-        char logbuf[2][1024];
-        wslog(logbuf[0], settings.handler_id, 0);
-        sprintf(logbuf[1], "got client connection from %s\n",
-                    pass->ip);
-        fprintf(stderr, "%s%s", logbuf[0], logbuf[1]);
-
-        pthread_t tid;
-        pass->id = settings.handler_id;
-        pass->csock = csock;
+        for (i = 0; i < (unsigned) n; i++) {
+            hs_conn_t *c = events[i].data.ptr;
 
-        pthread_attr_t attr;
-        pthread_attr_init(&attr);
-        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-
-        pthread_create(&tid, &attr, subthread, pass);
+            if (!c) {
+                hs_accept();
+                continue;
+            }
 
-        pthread_attr_destroy(&attr);
+            switch (hs_step(c)) {
+                case 1:
+                    hs_complete(c);
+                    break;
+                case -1:
+                    hs_drop(c);
+                    break;
+            }
+        }
 
-        settings.handler_id += 1;
+        hs_expire();
     }
     handler_msg("websockify exit\n");
 
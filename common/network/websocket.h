@@ -1,3 +1,6 @@
+#ifndef __NETWORK_WEBSOCKET_H__
+#define __NETWORK_WEBSOCKET_H__
+
 #include <openssl/ssl.h>
 #include <stdint.h>
 #include "GetAPIEnums.h"
@@ -6,6 +9,8 @@
 
 #define BUFSIZE 65536
 #define DBUFSIZE (BUFSIZE * 3) / 4 - 20
+/* Largest hybi header we send, frames are capped at 65535 bytes */
+#define HYBI_HEADROOM 4
 
 #define SERVER_HANDSHAKE_HIXIE "HTTP/1.1 101 Web Socket Protocol Handshake\r\n\
 Upgrade: WebSocket\r\n\
@@ -62,12 +67,6 @@ typedef struct {
     char      ip[64];
 } ws_ctx_t;
 
-struct wspass_t {
-    int csock;
-    unsigned id;
-    char ip[64];
-};
-
 struct kasmpasswd_entry_t;
 
 typedef struct {
@@ -80,6 +79,7 @@ typedef struct {
     const char *passwdfile;
     int ssl_only;
     const char *httpdir;
+    int direct;
 
     void *messager;
     uint8_t *(*screenshotCb)(void *messager, uint16_t w, uint16_t h, const uint8_t q,
@@ -110,6 +110,7 @@ typedef struct {
     void (*clearClipboardCb)(void *messager);
 
     void (*getSessionsCb)(void *messager, char **buf);
+    void (*getTraceCb)(void *messager, char **buf);
 } settings_t;
 
 #ifdef __cplusplus
@@ -122,6 +123,13 @@ ssize_t ws_recv(ws_ctx_t *ctx, void *buf, size_t len);
 
 ssize_t ws_send(ws_ctx_t *ctx, const void *buf, size_t len);
 
+/* Frees the TLS state and the context, but leaves the socket open */
+void ws_socket_release(ws_ctx_t *ctx);
+
+/* Direct mode: pass a handshaken connection to the VNC server in-process */
+int ws_handoff(ws_ctx_t *ctx);
+ws_ctx_t *ws_claim_handoff(uint64_t token);
+
 /* base64.c declarations */
 //int b64_ntop(u_char const *src, size_t srclength, char *target, size_t targsize);
 //int b64_pton(char const *src, u_char *target, size_t targsize);
@@ -158,6 +166,7 @@ int decode_hixie(char *src, size_t srclength,
                  unsigned int *opcode, unsigned int *left);
 int encode_hybi(u_char const *src, size_t srclength,
                 char *target, size_t targsize, unsigned int opcode);
+int encode_hybi_inplace(char *payload, size_t length);
 int decode_hybi(unsigned char *src, size_t srclength,
                 u_char *target, size_t targsize,
                 unsigned int *opcode, unsigned int *left);
@@ -167,3 +176,5 @@ void *start_server(void *unused);
 #ifdef __cplusplus
 } // extern C
 #endif
+
+#endif // __NETWORK_WEBSOCKET_H__
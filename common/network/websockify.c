@@ -16,12 +16,17 @@
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <netdb.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
+#include <pthread.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
 #include "websocket.h"
 
 /*
@@ -35,197 +40,364 @@ char USAGE[] = "Usage: [options] " \
                "  --ssl-only         disallow non-encrypted connections";
 */
 
-extern int pipe_error;
 extern settings_t settings;
 
-static void do_proxy(ws_ctx_t *ws_ctx, int target) {
-    fd_set rlist, wlist, elist;
-    struct timeval tv;
-    int maxfd, client = ws_ctx->sockfd;
-    unsigned int opcode, left, ret;
+void free_ws_ctx(ws_ctx_t *ctx);
+void ws_socket_free(ws_ctx_t *ctx);
+
+/*
+ * Proxy reactor
+ *
+ * All proxied connections are served by a single epoll thread. Each one is
+ * a small non-blocking state machine: data read from one side is queued in
+ * its buffer until the other side has taken all of it, and the epoll
+ * interest of both fds follows what is queued.
+ */
+
+#define MAX_EVENTS 64
+
+typedef struct proxy_conn_t {
+    ws_ctx_t *ws_ctx;
+    int target;
+    unsigned id;
     unsigned int tout_start, tout_end, cout_start, cout_end;
     unsigned int tin_end;
-    ssize_t len, bytes;
+    uint32_t client_want;
+    int dead;
+    struct proxy_conn_t *next;
+} proxy_conn_t;
+
+static int proxy_epfd = -1;
+static int proxy_wakefd = -1;
+
+// Connections waiting to be adopted by the reactor thread
+static proxy_conn_t *proxy_new;
+static pthread_mutex_t proxy_new_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
 
-    tout_start = tout_end = cout_start = cout_end =
-    tin_end = 0;
-    maxfd = client > target ? client+1 : target+1;
+static int would_block(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
 
-    while (1) {
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-
-        FD_ZERO(&rlist);
-        FD_ZERO(&wlist);
-        FD_ZERO(&elist);
-
-        FD_SET(client, &elist);
-        FD_SET(target, &elist);
-
-        if (tout_end == tout_start) {
-            // Nothing queued for target, so read from client
-            FD_SET(client, &rlist);
-        } else {
-            // Data queued for target, so write to it
-            FD_SET(target, &wlist);
-        }
-        if (cout_end == cout_start) {
-            // Nothing queued for client, so read from target
-            FD_SET(target, &rlist);
-        } else {
-            // Data queued for client, so write to it
-            FD_SET(client, &wlist);
-        }
+/* Also notes which direction a TLS operation is waiting on */
+static int client_would_block(proxy_conn_t *c, ssize_t ret) {
+    if (!c->ws_ctx->ssl)
+        return ret < 0 && would_block();
+
+    switch (SSL_get_error(c->ws_ctx->ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            c->client_want |= EPOLLIN;
+            return 1;
+        case SSL_ERROR_WANT_WRITE:
+            c->client_want |= EPOLLOUT;
+            return 1;
+        default:
+            return 0;
+    }
+}
 
-        do {
-            ret = select(maxfd, &rlist, &wlist, &elist, &tv);
-        } while (ret == -1 && errno == EINTR);
-        if (pipe_error) { break; }
+/* Moves as much data as possible without blocking, 0 when finished */
+static int proxy_step(proxy_conn_t *c) {
+    ws_ctx_t *ws_ctx = c->ws_ctx;
+    unsigned int opcode, left;
+    ssize_t len, bytes;
+    int progress, encoded;
 
-        if (FD_ISSET(target, &elist)) {
-            handler_emsg("target exception\n");
-            break;
-        }
-        if (FD_ISSET(client, &elist)) {
-            handler_emsg("client exception\n");
-            break;
-        }
+    c->client_want = 0;
 
-        if (ret == -1) {
-            handler_emsg("select(): %s\n", strerror(errno));
-            break;
-        } else if (ret == 0) {
-            //handler_emsg("select timeout\n");
-            continue;
-        }
+    do {
+        progress = 0;
 
-        if (FD_ISSET(target, &wlist)) {
-            len = tout_end-tout_start;
-            bytes = send(target, ws_ctx->tout_buf + tout_start, len, 0);
-            if (pipe_error) { break; }
+        if (c->tout_end != c->tout_start) {
+            len = c->tout_end - c->tout_start;
+            bytes = send(c->target, ws_ctx->tout_buf + c->tout_start, len,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
             if (bytes < 0) {
-                handler_emsg("target connection error: %s\n",
-                             strerror(errno));
-                break;
-            }
-            tout_start += bytes;
-            if (tout_start >= tout_end) {
-                tout_start = tout_end = 0;
-                traffic(">");
+                if (!would_block()) {
+                    handler_emsg("target connection error: %s\n",
+                                 strerror(errno));
+                    return 0;
+                }
             } else {
-                traffic(">.");
+                c->tout_start += bytes;
+                if (c->tout_start >= c->tout_end) {
+                    c->tout_start = c->tout_end = 0;
+                    traffic(">");
+                } else {
+                    traffic(">.");
+                }
+                progress = 1;
             }
         }
 
-        if (FD_ISSET(client, &wlist)) {
-            len = cout_end-cout_start;
-            bytes = ws_send(ws_ctx, ws_ctx->cout_buf + cout_start, len);
-            if (pipe_error) { break; }
-            if (len < 3) {
-                handler_emsg("len: %d, bytes: %d: %d\n",
-                             (int) len, (int) bytes,
-                             (int) *(ws_ctx->cout_buf + cout_start));
-            }
-            cout_start += bytes;
-            if (cout_start >= cout_end) {
-                cout_start = cout_end = 0;
-                traffic("<");
+        if (c->cout_end != c->cout_start) {
+            len = c->cout_end - c->cout_start;
+            bytes = ws_send(ws_ctx, ws_ctx->cout_buf + c->cout_start, len);
+            if (bytes <= 0) {
+                if (!client_would_block(c, bytes)) {
+                    handler_emsg("client connection error: %s\n",
+                                 strerror(errno));
+                    return 0;
+                }
             } else {
-                traffic("<.");
+                c->cout_start += bytes;
+                if (c->cout_start >= c->cout_end) {
+                    c->cout_start = c->cout_end = 0;
+                    traffic("<");
+                } else {
+                    traffic("<.");
+                }
+                progress = 1;
             }
         }
 
-        if (FD_ISSET(target, &rlist)) {
-            bytes = recv(target, ws_ctx->cin_buf, DBUFSIZE , 0);
-            if (pipe_error) { break; }
-            if (bytes <= 0) {
-                handler_emsg("target closed connection\n");
-                break;
-            }
-            cout_start = 0;
-            if (ws_ctx->hybi) {
-                cout_end = encode_hybi(ws_ctx->cin_buf, bytes,
-                                   ws_ctx->cout_buf, BUFSIZE, ws_ctx->opcode);
+        if (c->cout_end == c->cout_start) {
+            if (ws_ctx->hybi && ws_ctx->opcode == OPCODE_BINARY) {
+                /* Receive straight behind room for the frame header and
+                 * frame it in place, the payload is never copied */
+                char *payload = ws_ctx->cout_buf + HYBI_HEADROOM;
+
+                bytes = recv(c->target, payload, DBUFSIZE, MSG_DONTWAIT);
+                if (bytes == 0 || (bytes < 0 && !would_block())) {
+                    handler_emsg("target closed connection\n");
+                    return 0;
+                }
+                if (bytes > 0) {
+                    encoded = encode_hybi_inplace(payload, bytes);
+                    if (encoded < 0) {
+                        handler_emsg("encoding error\n");
+                        return 0;
+                    }
+                    c->cout_start = HYBI_HEADROOM - encoded;
+                    c->cout_end = HYBI_HEADROOM + bytes;
+                    traffic("{");
+                    progress = 1;
+                }
             } else {
-                cout_end = encode_hixie(ws_ctx->cin_buf, bytes,
-                                    ws_ctx->cout_buf, BUFSIZE);
-            }
-            /*
-            printf("encoded: ");
-            for (i=0; i< cout_end; i++) {
-                printf("%u,", (unsigned char) *(ws_ctx->cout_buf+i));
-            }
-            printf("\n");
-            */
-            if (cout_end < 0) {
-                handler_emsg("encoding error\n");
-                break;
+                bytes = recv(c->target, ws_ctx->cin_buf, DBUFSIZE, MSG_DONTWAIT);
+                if (bytes == 0 || (bytes < 0 && !would_block())) {
+                    handler_emsg("target closed connection\n");
+                    return 0;
+                }
+                if (bytes > 0) {
+                    c->cout_start = 0;
+                    if (ws_ctx->hybi) {
+                        encoded = encode_hybi((u_char *) ws_ctx->cin_buf, bytes,
+                                              ws_ctx->cout_buf, BUFSIZE, ws_ctx->opcode);
+                    } else {
+                        encoded = encode_hixie((u_char *) ws_ctx->cin_buf, bytes,
+                                               ws_ctx->cout_buf, BUFSIZE);
+                    }
+                    if (encoded < 0) {
+                        handler_emsg("encoding error\n");
+                        return 0;
+                    }
+                    c->cout_end = encoded;
+                    traffic("{");
+                    progress = 1;
+                }
             }
-            traffic("{");
         }
 
-        if (FD_ISSET(client, &rlist)) {
-            bytes = ws_recv(ws_ctx, ws_ctx->tin_buf + tin_end, BUFSIZE-1-tin_end);
-            if (pipe_error) { break; }
+        if (c->tout_end == c->tout_start) {
+            bytes = ws_recv(ws_ctx, ws_ctx->tin_buf + c->tin_end,
+                            BUFSIZE-1-c->tin_end);
             if (bytes <= 0) {
-                handler_emsg("client closed connection\n");
-                break;
-            }
-            tin_end += bytes;
-            /*
-            printf("before decode: ");
-            for (i=0; i< bytes; i++) {
-                printf("%u,", (unsigned char) *(ws_ctx->tin_buf+i));
-            }
-            printf("\n");
-            */
-            if (ws_ctx->hybi) {
-                len = decode_hybi(ws_ctx->tin_buf,
-                                  tin_end,
-                                  ws_ctx->tout_buf, BUFSIZE-1,
-                                  &opcode, &left);
+                if (bytes == 0 || !client_would_block(c, bytes)) {
+                    handler_emsg("client closed connection\n");
+                    return 0;
+                }
             } else {
-                len = decode_hixie(ws_ctx->tin_buf,
-                                   tin_end,
-                                   ws_ctx->tout_buf, BUFSIZE-1,
-                                   &opcode, &left);
-            }
+                c->tin_end += bytes;
+                if (ws_ctx->hybi) {
+                    len = decode_hybi((unsigned char *) ws_ctx->tin_buf,
+                                      c->tin_end,
+                                      (u_char *) ws_ctx->tout_buf, BUFSIZE-1,
+                                      &opcode, &left);
+                } else {
+                    len = decode_hixie(ws_ctx->tin_buf,
+                                       c->tin_end,
+                                       (u_char *) ws_ctx->tout_buf, BUFSIZE-1,
+                                       &opcode, &left);
+                }
 
-            if (opcode == 8) {
-                handler_msg("client sent orderly close frame\n");
-                break;
-            }
+                if (opcode == 8) {
+                    handler_msg("client sent orderly close frame\n");
+                    return 0;
+                }
+
+                if (len < 0) {
+                    handler_emsg("decoding error\n");
+                    return 0;
+                }
+                if (left) {
+                    const unsigned tin_start = c->tin_end - left;
+                    memmove(ws_ctx->tin_buf, ws_ctx->tin_buf + tin_start, left);
+                    c->tin_end = left;
+                } else {
+                    c->tin_end = 0;
+                }
 
-            /*
-            printf("decoded: ");
-            for (i=0; i< len; i++) {
-                printf("%u,", (unsigned char) *(ws_ctx->tout_buf+i));
+                traffic("}");
+                c->tout_start = 0;
+                c->tout_end = len;
+                progress = 1;
             }
-            printf("\n");
-            */
-            if (len < 0) {
-                handler_emsg("decoding error\n");
-                break;
+        }
+    } while (progress);
+
+    return 1;
+}
+
+static void proxy_rearm(proxy_conn_t *c) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.ptr = c;
+
+    ev.events = c->client_want;
+    if (c->tout_end == c->tout_start)
+        ev.events |= EPOLLIN;
+    if (c->cout_end != c->cout_start)
+        ev.events |= EPOLLOUT;
+    epoll_ctl(proxy_epfd, EPOLL_CTL_MOD, c->ws_ctx->sockfd, &ev);
+
+    ev.events = 0;
+    if (c->cout_end == c->cout_start)
+        ev.events |= EPOLLIN;
+    if (c->tout_end != c->tout_start)
+        ev.events |= EPOLLOUT;
+    epoll_ctl(proxy_epfd, EPOLL_CTL_MOD, c->target, &ev);
+}
+
+static void proxy_close(proxy_conn_t *c) {
+    epoll_ctl(proxy_epfd, EPOLL_CTL_DEL, c->ws_ctx->sockfd, NULL);
+    epoll_ctl(proxy_epfd, EPOLL_CTL_DEL, c->target, NULL);
+
+    shutdown(c->target, SHUT_RDWR);
+    close(c->target);
+
+    ws_socket_free(c->ws_ctx);
+    free_ws_ctx(c->ws_ctx);
+
+    handler_msg("handler exit\n");
+}
+
+static void proxy_adopt(void) {
+    struct epoll_event ev;
+    proxy_conn_t *c, *next;
+    uint64_t val;
+
+    if (read(proxy_wakefd, &val, sizeof(val)) < 0 && !would_block())
+        wserr("eventfd read: %s\n", strerror(errno));
+
+    pthread_mutex_lock(&proxy_new_mutex);
+    c = proxy_new;
+    proxy_new = NULL;
+    pthread_mutex_unlock(&proxy_new_mutex);
+
+    for (; c; c = next) {
+        next = c->next;
+        wsthread_handler_id = c->id;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(proxy_epfd, EPOLL_CTL_ADD, c->target, &ev) < 0 ||
+            epoll_ctl(proxy_epfd, EPOLL_CTL_ADD, c->ws_ctx->sockfd, &ev) < 0) {
+            handler_emsg("epoll_ctl: %s\n", strerror(errno));
+            proxy_close(c);
+            free(c);
+        }
+    }
+}
+
+static void *proxy_reactor(void *unused) {
+    struct epoll_event events[MAX_EVENTS];
+    proxy_conn_t *c, *dead;
+    int i, n;
+
+    while (1) {
+        n = epoll_wait(proxy_epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            wserr("epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+
+        // Freeing is deferred, a later event in this batch may name the
+        // same connection
+        dead = NULL;
+        for (i = 0; i < n; i++) {
+            c = events[i].data.ptr;
+            if (!c) {
+                proxy_adopt();
+                continue;
             }
-            if (left) {
-                const unsigned tin_start = tin_end - left;
-                //handler_emsg("partial frame from client, %u left, start %u end %u, lens %lu %lu\n",
-                //             left, tin_start, tin_end, bytes, len);
-                memmove(ws_ctx->tin_buf, ws_ctx->tin_buf + tin_start, left);
-                tin_end = left;
+            if (c->dead)
+                continue;
+
+            wsthread_handler_id = c->id;
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) || !proxy_step(c)) {
+                proxy_close(c);
+                c->dead = 1;
+                c->next = dead;
+                dead = c;
             } else {
-                //handler_emsg("handled %lu/%lu bytes\n", bytes, len);
-                tin_end = 0;
+                proxy_rearm(c);
             }
+        }
 
-            traffic("}");
-            tout_start = 0;
-            tout_end = len;
+        while (dead) {
+            c = dead->next;
+            free(dead);
+            dead = c;
         }
     }
+
+    return NULL;
 }
 
-void proxy_handler(ws_ctx_t *ws_ctx) {
+int proxy_init(void) {
+    struct epoll_event ev;
+    pthread_t tid;
+
+    proxy_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (proxy_epfd < 0)
+        return -1;
+
+    proxy_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (proxy_wakefd < 0)
+        goto fail;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(proxy_epfd, EPOLL_CTL_ADD, proxy_wakefd, &ev) < 0)
+        goto fail;
+
+    if (pthread_create(&tid, NULL, proxy_reactor, NULL))
+        goto fail;
+    pthread_detach(tid);
+
+    return 0;
+
+fail:
+    if (proxy_wakefd >= 0)
+        close(proxy_wakefd);
+    close(proxy_epfd);
+    proxy_epfd = proxy_wakefd = -1;
+    return -1;
+}
+
+static int connect_target(ws_ctx_t *ws_ctx) {
 
     char sockname[32];
     sprintf(sockname, ".KasmVNCSock%u", getpid());
@@ -254,13 +426,175 @@ void proxy_handler(ws_ctx_t *ws_ctx) {
 
         handler_emsg("Could not connect to target: %s\n",
                      strerror(errno));
-        return;
+        close(tsock);
+        return -1;
+    }
+
+    return tsock;
+}
+
+/* Returns 1 if the reactor took over the connection */
+int proxy_handler(ws_ctx_t *ws_ctx) {
+    proxy_conn_t *c;
+
+    int tsock = connect_target(ws_ctx);
+    if (tsock < 0)
+        return 0;
+
+    // In direct mode the server expects a handoff token first, zero
+    // meaning the connection stays on this proxy
+    if (settings.direct) {
+        const uint64_t token = 0;
+        if (send(tsock, &token, sizeof(token), MSG_NOSIGNAL) != sizeof(token)) {
+            handler_emsg("Could not send token to target: %s\n",
+                         strerror(errno));
+            close(tsock);
+            return 0;
+        }
+    }
+
+    if (set_nonblocking(tsock) < 0 || set_nonblocking(ws_ctx->sockfd) < 0) {
+        handler_emsg("Could not make sockets non-blocking: %s\n",
+                     strerror(errno));
+        close(tsock);
+        return 0;
     }
 
-    do_proxy(ws_ctx, tsock);
+    if (ws_ctx->ssl)
+        SSL_set_mode(ws_ctx->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                  SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    c = calloc(1, sizeof(proxy_conn_t));
+    c->ws_ctx = ws_ctx;
+    c->target = tsock;
+    c->id = wsthread_handler_id;
+
+    // Only the reactor thread touches epoll and the connection from here on
+    pthread_mutex_lock(&proxy_new_mutex);
+    c->next = proxy_new;
+    proxy_new = c;
+    pthread_mutex_unlock(&proxy_new_mutex);
 
-    shutdown(tsock, SHUT_RDWR);
+    const uint64_t one = 1;
+    if (write(proxy_wakefd, &one, sizeof(one)) < 0)
+        handler_emsg("eventfd write: %s\n", strerror(errno));
+
+    return 1;
+}
+
+/*
+ * Direct mode handoff
+ *
+ * Rather than proxying, the handshaken socket and its TLS state are given
+ * to the VNC server, which does the WebSocket framing itself. The internal
+ * AF_UNIX connection then only carries a random token naming the context,
+ * so the server's accept path and peer naming stay the same.
+ */
+
+#define MAX_HANDOFFS 256
+// The server claims a token as soon as it reads it, anything older was lost
+#define HANDOFF_TIMEOUT 10
+
+static struct {
+    uint64_t token;
+    ws_ctx_t *ctx;
+    time_t expires;
+} handoffs[MAX_HANDOFFS];
+
+static pthread_mutex_t handoff_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static time_t handoff_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+ws_ctx_t *ws_claim_handoff(uint64_t token) {
+    ws_ctx_t *ctx = NULL;
+    unsigned i;
+
+    if (!token)
+        return NULL;
+
+    pthread_mutex_lock(&handoff_mutex);
+    for (i = 0; i < MAX_HANDOFFS; i++) {
+        if (handoffs[i].ctx && handoffs[i].token == token) {
+            ctx = handoffs[i].ctx;
+            handoffs[i].ctx = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&handoff_mutex);
+
+    return ctx;
+}
+
+int ws_handoff(ws_ctx_t *ws_ctx) {
+    uint64_t token = 0;
+    unsigned i, expired;
+    time_t now;
+    int tsock;
+    ssize_t sent;
+
+    if (RAND_bytes((unsigned char *) &token, sizeof(token)) != 1 || !token)
+        return 0;
+
+    // The proxy buffers are not needed anymore
+    free(ws_ctx->cin_buf);
+    free(ws_ctx->cout_buf);
+    free(ws_ctx->tin_buf);
+    free(ws_ctx->tout_buf);
+    ws_ctx->cin_buf = ws_ctx->cout_buf = ws_ctx->tin_buf = ws_ctx->tout_buf = NULL;
+
+    now = handoff_now();
+    expired = 0;
+
+    pthread_mutex_lock(&handoff_mutex);
+    for (i = 0; i < MAX_HANDOFFS; i++) {
+        if (handoffs[i].ctx && handoffs[i].expires <= now) {
+            // Closing the client is all that can be done for it
+            ws_socket_free(handoffs[i].ctx);
+            free_ws_ctx(handoffs[i].ctx);
+            handoffs[i].ctx = NULL;
+            expired++;
+        }
+    }
+    for (i = 0; i < MAX_HANDOFFS; i++) {
+        if (!handoffs[i].ctx) {
+            handoffs[i].token = token;
+            handoffs[i].ctx = ws_ctx;
+            handoffs[i].expires = now + HANDOFF_TIMEOUT;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&handoff_mutex);
+
+    if (expired)
+        handler_emsg("dropped %u unclaimed handoffs\n", expired);
+
+    if (i == MAX_HANDOFFS) {
+        handler_emsg("too many pending handoffs\n");
+        return 0;
+    }
+
+    tsock = connect_target(ws_ctx);
+    if (tsock < 0) {
+        ws_claim_handoff(token);
+        return 0;
+    }
+
+    sent = send(tsock, &token, sizeof(token), MSG_NOSIGNAL);
     close(tsock);
+
+    // If the server did not get the token, it cannot have claimed it
+    if (sent != sizeof(token) && ws_claim_handoff(token)) {
+        handler_emsg("Could not send token to target: %s\n",
+                     strerror(errno));
+        return 0;
+    }
+
+    return 1;
 }
 
 #if 0
@@ -5,6 +5,7 @@
 #include <openssl/ssl.h>
 #include <string.h>
 #include "WuArena.h"
+#include "WuBufferOp.h"
 #include "WuClock.h"
 #include "WuCrypto.h"
 #include "WuMath.h"
@@ -35,12 +36,15 @@ struct Wu {
   void* userData;
   WuErrorFn errorCallback;
   WuErrorFn debugCallback;
+  WuSackFn sackCallback;
+  WuDataFn dataCallback;
   WuWriteFn writeUdpData;
 };
 
 const double kMaxClientTtl = 9.0;
 const double heartbeatInterval = 4.0;
 const int kDefaultMTU = 1400;
+const int kMaxGapAckBlocks = 128;
 
 static void DefaultErrorCallback(const char*, void*) {}
 static void WriteNothing(const uint8_t*, size_t, const WuClient*, void*) {}
@@ -313,6 +317,10 @@ static void WuHandleSctp(Wu* wu, WuClient* client, const uint8_t* buf,
         evt.data = dataChunk->userData;
         evt.length = dataChunk->userDataLength;
         WuPushEvent(wu, evt);
+      } else if (dataChunk->protoId == DCProto_Binary && wu->dataCallback &&
+                 client->user) {
+        wu->dataCallback(dataChunk->userData, dataChunk->userDataLength,
+                         client->user);
       } else if (dataChunk->protoId == DCProto_Binary) {
         WuEvent evt;
         evt.type = WuEvent_BinaryData;
@@ -398,6 +406,33 @@ static void WuHandleSctp(Wu* wu, WuClient* client, const uint8_t* buf,
       client->ttl = kMaxClientTtl;
 
       auto* sack = &chunk->as.sack;
+      uint32_t highestAcked = sack->cumulativeTsnAck;
+
+      if (sack->numGapAckBlocks > 0) {
+        uint16_t lastEnd;
+        ReadScalarSwapped(
+            sack->gapAckBlocks + (sack->numGapAckBlocks - 1) * 4 + 2,
+            &lastEnd);
+        highestAcked += lastEnd;
+      }
+
+      if (wu->sackCallback && client->user) {
+        uint16_t gaps[kMaxGapAckBlocks * 2];
+        WuSack s;
+
+        s.cumulativeTsnAck = sack->cumulativeTsnAck;
+        s.advRecvWindow = sack->advRecvWindow;
+        s.numGapAckBlocks = Min(int32_t(sack->numGapAckBlocks),
+                                kMaxGapAckBlocks);
+        s.gapAckBlocks = gaps;
+
+        for (int32_t i = 0; i < s.numGapAckBlocks * 2; i++) {
+          ReadScalarSwapped(sack->gapAckBlocks + i * 2, &gaps[i]);
+        }
+
+        wu->sackCallback(&s, client->user);
+      }
+
       if (sack->numGapAckBlocks > 0) {
         SctpPacket fwdResponse;
         fwdResponse.sourcePort = sctpPacket.destionationPort;
@@ -408,7 +443,9 @@ static void WuHandleSctp(Wu* wu, WuClient* client, const uint8_t* buf,
         fwdTsnChunk.type = SctpChunk_ForwardTsn;
         fwdTsnChunk.flags = 0;
         fwdTsnChunk.length = SctpChunkLength(4);
-        fwdTsnChunk.as.forwardTsn.newCumulativeTsn = client->tsn;
+        // Only skip the holes, what was sent after the highest ack may
+        // still be on its way
+        fwdTsnChunk.as.forwardTsn.newCumulativeTsn = highestAcked;
         WuSendSctp(wu, client, &fwdResponse, &fwdTsnChunk, 1);
       }
     }
@@ -640,7 +677,8 @@ int32_t WuUpdate(Wu* wu, WuEvent* evt) {
 }
 
 static int32_t WuSendData(Wu* wu, WuClient* client, const uint8_t* data,
-                          int32_t length, DataChanProtoIdentifier proto) {
+                          int32_t length, DataChanProtoIdentifier proto,
+                          uint32_t* tsn = NULL) {
   if (client->state < WuClient_DataChannelOpen) {
     return -1;
   }
@@ -663,6 +701,10 @@ static int32_t WuSendData(Wu* wu, WuClient* client, const uint8_t* data,
   dc->userData = data;
   dc->userDataLength = length;
 
+  if (tsn) {
+    *tsn = dc->tsn;
+  }
+
   WuSendSctp(wu, client, &packet, &rc, 1);
   return 0;
 }
@@ -676,6 +718,11 @@ int32_t WuSendBinary(Wu* wu, WuClient* client, const uint8_t* data,
   return WuSendData(wu, client, data, length, DCProto_Binary);
 }
 
+int32_t WuSendBinaryTsn(Wu* wu, WuClient* client, const uint8_t* data,
+                        int32_t length, uint32_t* tsn) {
+  return WuSendData(wu, client, data, length, DCProto_Binary, tsn);
+}
+
 SDPResult WuExchangeSDP(Wu* wu, const char* sdp, int32_t length) {
   ICESdpFields iceFields;
   if (!ParseSdp(sdp, length, &iceFields)) {
@@ -750,6 +797,14 @@ void WuSetDebugCallback(Wu* wu, WuErrorFn callback) {
   }
 }
 
+void WuSetSackCallback(Wu* wu, WuSackFn callback) {
+  wu->sackCallback = callback;
+}
+
+void WuSetDataCallback(Wu* wu, WuDataFn callback) {
+  wu->dataCallback = callback;
+}
+
 void WuDestroy(Wu* wu) {
   if (!wu) {
     return;
@@ -50,12 +50,34 @@ typedef struct {
   uint16_t port;
 } WuAddress;
 
+/*
+ * A selective ack from the client. The gap ack blocks are start and end
+ * pairs, inclusive offsets from cumulativeTsnAck.
+ */
+typedef struct {
+  uint32_t cumulativeTsnAck;
+  uint32_t advRecvWindow;
+  uint16_t numGapAckBlocks;
+  const uint16_t* gapAckBlocks;
+} WuSack;
+
+typedef void (*WuSackFn)(const WuSack* sack, void* clientUserData);
+
+/*
+ * Binary data from a client with user data set goes to the data callback,
+ * if there is one, instead of becoming an event
+ */
+typedef void (*WuDataFn)(const uint8_t* data, int32_t length,
+                         void* clientUserData);
+
 int32_t WuCreate(const char* host, uint16_t port, int maxClients, Wu** wu);
 void WuDestroy(Wu* wu);
 int32_t WuUpdate(Wu* wu, WuEvent* evt);
 int32_t WuSendText(Wu* wu, WuClient* client, const char* text, int32_t length);
 int32_t WuSendBinary(Wu* wu, WuClient* client, const uint8_t* data,
                      int32_t length);
+int32_t WuSendBinaryTsn(Wu* wu, WuClient* client, const uint8_t* data,
+                        int32_t length, uint32_t* tsn);
 void WuReportError(Wu* wu, const char* error);
 void WuReportDebug(Wu* wu, const char* error);
 void WuRemoveClient(Wu* wu, WuClient* client);
@@ -68,6 +90,8 @@ void WuSetUDPWriteFunction(Wu* wu, WuWriteFn write);
 void WuSetUserData(Wu* wu, void* userData);
 void WuSetErrorCallback(Wu* wu, WuErrorFn callback);
 void WuSetDebugCallback(Wu* wu, WuErrorFn callback);
+void WuSetSackCallback(Wu* wu, WuSackFn callback);
+void WuSetDataCallback(Wu* wu, WuDataFn callback);
 WuAddress WuClientGetAddress(const WuClient* client);
 WuClient* WuFindClient(const Wu* wu, WuAddress address);
 
@@ -22,10 +22,24 @@ int32_t WuHostServe(WuHost* host, WuEvent* evt, int timeout);
 void WuHostRemoveClient(WuHost* wu, WuClient* client);
 int32_t WuHostSendText(WuHost* host, WuClient* client, const char* text,
                        int32_t length);
+/*
+ * tsn, if not NULL, receives the SCTP TSN the data went out under, to be
+ * matched against the selective acks.
+ */
 int32_t WuHostSendBinary(WuHost* host, WuClient* client, const uint8_t* data,
-                         int32_t length);
+                         int32_t length, uint32_t* tsn);
 void WuHostSetErrorCallback(WuHost* host, WuErrorFn callback);
 void WuHostSetDebugCallback(WuHost* host, WuErrorFn callback);
+/*
+ * The sack and data callbacks run on the serving thread and get the
+ * client's user data. Setting the user data here, rather than directly,
+ * synchronizes with them: once this returns, old will not be passed
+ * again. The user data is only replaced if it still is old.
+ */
+void WuHostSetSackCallback(WuHost* host, WuSackFn callback);
+void WuHostSetDataCallback(WuHost* host, WuDataFn callback);
+void WuHostReplaceClientUserData(WuHost* host, WuClient* client, void* old,
+                                 void* user);
 WuClient* WuHostFindClient(const WuHost* host, WuAddress address);
 
 void WuGotHttp(WuHost *host, const char msg[], const uint32_t msglen,
@@ -200,10 +200,10 @@ int32_t WuHostSendText(WuHost* host, WuClient* client, const char* text,
 }
 
 int32_t WuHostSendBinary(WuHost* host, WuClient* client, const uint8_t* data,
-                         int32_t length) {
+                         int32_t length, uint32_t* tsn) {
   if (pthread_mutex_lock(&wumutex))
     abort();
-  int32_t ret = WuSendBinary(host->wu, client, data, length);
+  int32_t ret = WuSendBinaryTsn(host->wu, client, data, length, tsn);
   pthread_mutex_unlock(&wumutex);
 
   return ret;
@@ -217,6 +217,23 @@ void WuHostSetDebugCallback(WuHost* host, WuErrorFn callback) {
   WuSetDebugCallback(host->wu, callback);
 }
 
+void WuHostSetSackCallback(WuHost* host, WuSackFn callback) {
+  WuSetSackCallback(host->wu, callback);
+}
+
+void WuHostSetDataCallback(WuHost* host, WuDataFn callback) {
+  WuSetDataCallback(host->wu, callback);
+}
+
+void WuHostReplaceClientUserData(WuHost* host, WuClient* client, void* old,
+                                 void* user) {
+  if (pthread_mutex_lock(&wumutex))
+    abort();
+  if (WuClientGetUserData(client) == old)
+    WuClientSetUserData(client, user);
+  pthread_mutex_unlock(&wumutex);
+}
+
 void WuHostDestroy(WuHost* host) {
   if (!host) {
     return;
@@ -48,7 +48,15 @@ int32_t ParseSctpPacket(const uint8_t* buf, size_t len, SctpPacket* packet,
           ReadScalarSwapped(buf + offset + chunkOffset, &sack->advRecvWindow);
       chunkOffset +=
           ReadScalarSwapped(buf + offset + chunkOffset, &sack->numGapAckBlocks);
-      ReadScalarSwapped(buf + offset + chunkOffset, &sack->numDupTsn);
+      chunkOffset +=
+          ReadScalarSwapped(buf + offset + chunkOffset, &sack->numDupTsn);
+      sack->gapAckBlocks = buf + offset + chunkOffset;
+
+      // Don't trust the count beyond what the chunk and packet hold
+      const int32_t gapBytes =
+          Min(int32_t(chunk->length) - 16, left - 16);
+      sack->numGapAckBlocks =
+          Min(int32_t(sack->numGapAckBlocks), Max(gapBytes, 0) / 4);
     } else if (chunk->type == Sctp_Heartbeat) {
       auto* p = &chunk->as.heartbeat;
       size_t chunkOffset = 2;  // skip type
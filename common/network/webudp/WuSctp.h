@@ -71,6 +71,7 @@ struct SctpChunk {
       uint32_t advRecvWindow;
       uint16_t numGapAckBlocks;
       uint16_t numDupTsn;
+      const uint8_t* gapAckBlocks;
     } sack;
 
     struct {
@@ -22,6 +22,8 @@
 #include <config.h>
 #endif
 
+#include <assert.h>
+
 #include <rdr/BufferedOutStream.h>
 #include <rdr/Exception.h>
 
@@ -30,32 +32,48 @@ using namespace rdr;
 
 static const size_t DEFAULT_BUF_SIZE = 16384;
 
+// Shared writes smaller than this are cheaper to copy than to track
+static const size_t MIN_SHARED_SIZE = 8192;
+
+// How much the segment chain may hold before writes have to wait for
+// the data to go out
+static const size_t MAX_CHAIN_SIZE = 64 * DEFAULT_BUF_SIZE;
+
+// Sealed buffers kept around for reuse once the data in them is sent
+static const size_t MAX_SPARE_BUFFERS = 16;
+
+static std::shared_ptr<U8> newBuffer(size_t size)
+{
+  return std::shared_ptr<U8>(new U8[size], std::default_delete<U8[]>());
+}
+
 BufferedOutStream::BufferedOutStream()
-  : bufSize(DEFAULT_BUF_SIZE), offset(0)
+  : bufSize(DEFAULT_BUF_SIZE), offset(0), headroom(0),
+    gather(false), segmentBytes(0)
 {
-  ptr = start = sentUpTo = new U8[bufSize];
+  buffer = newBuffer(bufSize);
+  ptr = start = sentUpTo = buffer.get();
   end = start + bufSize;
 }
 
 BufferedOutStream::~BufferedOutStream()
 {
   // FIXME: Complain about non-flushed buffer?
-  delete [] start;
 }
 
 size_t BufferedOutStream::length()
 {
-  return offset + ptr - sentUpTo;
+  return offset + bufferUsage();
 }
 
 size_t BufferedOutStream::bufferUsage()
 {
-  return ptr - sentUpTo;
+  return segmentBytes + (ptr - sentUpTo);
 }
 
 void BufferedOutStream::flush()
 {
-  while (sentUpTo < ptr) {
+  while (bufferUsage() > 0) {
     size_t len;
 
     len = bufferUsage();
@@ -66,30 +84,156 @@ void BufferedOutStream::flush()
     offset += len - bufferUsage();
   }
 
-  // Managed to flush everything?
-  if (sentUpTo == ptr)
-    ptr = sentUpTo = start;
+  // Managed to flush everything? The buffer can only be reused once no
+  // sent segment refers to it any more.
+  if (sentUpTo == ptr && segments.empty() && buffer.use_count() == 1)
+    ptr = sentUpTo = start + headroom;
+}
+
+void BufferedOutStream::writeShared(const std::shared_ptr<const U8>& data,
+                                    size_t length)
+{
+  Segment seg;
+
+  if (!gather || length < MIN_SHARED_SIZE) {
+    writeBytes(data.get(), length);
+    return;
+  }
+
+  // Whatever was written before goes first
+  sealBuffer();
+
+  seg.data = data;
+  seg.length = length;
+  segments.push_back(seg);
+  segmentBytes += length;
+
+  flush();
+
+  while (segmentBytes > MAX_CHAIN_SIZE) {
+    size_t len;
+
+    len = bufferUsage();
+    flushBuffer(true);
+    offset += len - bufferUsage();
+  }
+}
+
+void BufferedOutStream::reserveHeadroom(size_t size)
+{
+  assert(ptr == sentUpTo);
+  assert(size < bufSize / 4);
+  assert(!gather);
+
+  headroom = size;
+  ptr = sentUpTo = start + headroom;
+}
+
+void BufferedOutStream::sealBuffer()
+{
+  Segment seg;
+
+  if (ptr == sentUpTo)
+    return;
+
+  assert(gather);
+
+  // Just extend the last segment if it ends right here
+  if (!segments.empty()) {
+    Segment& last = segments.back();
+    if (!last.data.owner_before(buffer) && !buffer.owner_before(last.data) &&
+        last.data.get() + last.length == sentUpTo) {
+      last.length += ptr - sentUpTo;
+      segmentBytes += ptr - sentUpTo;
+      sentUpTo = ptr;
+      return;
+    }
+  }
+
+  seg.data = std::shared_ptr<const U8>(buffer, sentUpTo);
+  seg.length = ptr - sentUpTo;
+  segments.push_back(seg);
+  segmentBytes += seg.length;
+
+  sentUpTo = ptr;
+}
+
+void BufferedOutStream::consume(size_t length)
+{
+  while ((length > 0) && !segments.empty()) {
+    Segment& seg = segments.front();
+
+    if (length < seg.length) {
+      seg.data = std::shared_ptr<const U8>(seg.data, seg.data.get() + length);
+      seg.length -= length;
+      segmentBytes -= length;
+      return;
+    }
+
+    length -= seg.length;
+    segmentBytes -= seg.length;
+    segments.pop_front();
+  }
+
+  assert(length <= (size_t)(ptr - sentUpTo));
+  sentUpTo += length;
+}
+
+void BufferedOutStream::nextBuffer()
+{
+  size_t i;
+
+  assert(ptr == sentUpTo);
+
+  // The old one is probably free again by the time this one fills up
+  if (spareBuffers.size() < MAX_SPARE_BUFFERS)
+    spareBuffers.push_back(buffer);
+  buffer.reset();
+
+  for (i = 0; i < spareBuffers.size(); i++) {
+    if (spareBuffers[i].use_count() == 1) {
+      buffer = spareBuffers[i];
+      spareBuffers.erase(spareBuffers.begin() + i);
+      break;
+    }
+  }
+
+  if (!buffer)
+    buffer = newBuffer(bufSize);
+
+  start = buffer.get();
+  end = start + bufSize;
+  ptr = sentUpTo = start + headroom;
 }
 
 void BufferedOutStream::overrun(size_t needed)
 {
-  if (needed > bufSize)
+  if (needed > bufSize - headroom)
     throw Exception("BufferedOutStream overrun: "
                     "requested size of %lu bytes exceeds maximum of %lu bytes",
-                    (long unsigned)needed, (long unsigned)bufSize);
+                    (long unsigned)needed, (long unsigned)(bufSize - headroom));
 
   // First try to get rid of the data we have
   flush();
 
   // Still not enough space?
   while (needed > avail()) {
+    // Rather than moving the data, hand the whole buffer to the chain
+    // and carry on in a fresh one
+    if (gather && (bufferUsage() < MAX_CHAIN_SIZE)) {
+      sealBuffer();
+      nextBuffer();
+      continue;
+    }
+
     // Can we shuffle things around?
     // (don't do this if it gains us less than 25%)
-    if (((size_t)(sentUpTo - start) > bufSize / 4) &&
-        (needed < bufSize - (ptr - sentUpTo))) {
-      memmove(start, sentUpTo, ptr - sentUpTo);
-      ptr = start + (ptr - sentUpTo);
-      sentUpTo = start;
+    if (!gather &&
+        ((size_t)(sentUpTo - start - headroom) > bufSize / 4) &&
+        (needed < bufSize - headroom - (ptr - sentUpTo))) {
+      memmove(start + headroom, sentUpTo, ptr - sentUpTo);
+      ptr = start + headroom + (ptr - sentUpTo);
+      sentUpTo = start + headroom;
     } else {
       size_t len;
 
@@ -101,8 +245,8 @@ void BufferedOutStream::overrun(size_t needed)
       offset += len - bufferUsage();
 
        // Managed to flush everything?
-      if (sentUpTo == ptr)
-        ptr = sentUpTo = start;
+      if ((bufferUsage() == 0) && (buffer.use_count() == 1))
+        ptr = sentUpTo = start + headroom;
     }
   }
 }
@@ -24,6 +24,10 @@
 #ifndef __RDR_BUFFEREDOUTSTREAM_H__
 #define __RDR_BUFFEREDOUTSTREAM_H__
 
+#include <deque>
+#include <memory>
+#include <vector>
+
 #include <rdr/OutStream.h>
 
 namespace rdr {
@@ -36,6 +40,9 @@ namespace rdr {
     virtual size_t length();
     virtual void flush();
 
+    virtual void writeShared(const std::shared_ptr<const U8>& data,
+                             size_t length);
+
     size_t bufferUsage();
 
   private:
@@ -48,16 +55,50 @@ namespace rdr {
 
     virtual void overrun(size_t needed);
 
+    void nextBuffer();
+
   private:
     size_t bufSize;
     size_t offset;
+    size_t headroom;
     U8* start;
 
+    std::shared_ptr<U8> buffer;
+    std::vector<std::shared_ptr<U8> > spareBuffers;
+
   protected:
     U8* sentUpTo;
 
+    // With gather set, data leaves the stream as a chain of segments
+    // that each hold a reference to their memory. Large shared writes
+    // and full buffers are appended to the chain rather than copied or
+    // moved around, and the subclass sends the segments followed by
+    // whatever is left between sentUpTo and ptr.
+    struct Segment {
+      std::shared_ptr<const U8> data;
+      size_t length;
+    };
+
+    bool gather;
+    std::deque<Segment> segments;
+    size_t segmentBytes;
+
   protected:
     BufferedOutStream();
+
+    // reserveHeadroom() keeps the given number of bytes free in front of
+    // the buffered data, so that a subclass can prepend framing in place
+    // when flushing. Must be called while the buffer is empty, and
+    // cannot be combined with gather.
+    void reserveHeadroom(size_t size);
+
+    // sealBuffer() moves the bytes between sentUpTo and ptr to the end
+    // of the segment chain, without copying them
+    void sealBuffer();
+
+    // consume() drops the given number of sent bytes, from the segments
+    // first and then from the buffer
+    void consume(size_t length);
   };
 
 }
@@ -101,6 +101,23 @@ bool FdInStream::fillBuffer(size_t maxSize, bool wait)
 //
 
 size_t FdInStream::readWithTimeoutOrCallback(void* buf, size_t len, bool wait)
+{
+  int n;
+
+  if (!waitForData(wait))
+    return 0;
+
+  do {
+    n = ::recv(fd, (char*)buf, len, 0);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) throw SystemException("read",errno);
+  if (n == 0) throw EndOfStream();
+
+  return n;
+}
+
+bool FdInStream::waitForData(bool wait)
 {
   int n;
   while (true) {
@@ -123,20 +140,11 @@ size_t FdInStream::readWithTimeoutOrCallback(void* buf, size_t len, bool wait)
       n = select(fd+1, &fds, 0, 0, tvp);
     } while (n < 0 && errno == EINTR);
 
-    if (n > 0) break;
+    if (n > 0) return true;
     if (n < 0) throw SystemException("select",errno);
-    if (!wait) return 0;
+    if (!wait) return false;
     if (!blockCallback) throw TimedOut();
 
     blockCallback->blockCallback();
   }
-
-  do {
-    n = ::recv(fd, (char*)buf, len, 0);
-  } while (n < 0 && errno == EINTR);
-
-  if (n < 0) throw SystemException("read",errno);
-  if (n == 0) throw EndOfStream();
-
-  return n;
 }
@@ -45,12 +45,21 @@ namespace rdr {
     void setBlockCallback(FdInStreamBlockCallback* blockCallback);
     int getFd() { return fd; }
 
+  protected:
+    // waitForData() blocks until the fd is readable, honouring the timeout
+    // and block callback.  Returns false if wait is false and nothing is
+    // available yet.
+    bool waitForData(bool wait);
+
   private:
     virtual bool fillBuffer(size_t maxSize, bool wait);
 
     size_t readWithTimeoutOrCallback(void* buf, size_t len, bool wait=true);
 
+  protected:
     int fd;
+
+  private:
     bool closeWhenDone;
     int timeoutms;
     FdInStreamBlockCallback* blockCallback;
@@ -33,17 +33,22 @@
 #else
 #include <sys/types.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/time.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <linux/errqueue.h>
 #endif
 
-/* Old systems have select() in sys/time.h */
-#ifdef HAVE_SYS_SELECT_H
-#include <sys/select.h>
-#endif
+#include <deque>
+#include <thread>
 
+#include <os/Mutex.h>
+#include <os/Thread.h>
 #include <rdr/FdOutStream.h>
 #include <rdr/Exception.h>
 #include <rfb/util.h>
@@ -51,16 +56,513 @@
 
 using namespace rdr;
 
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+// How long the writer thread waits for the socket at a time, so that a
+// stop request doesn't go unnoticed for long
+static const int WRITER_POLL_MS = 50;
+
+// Segments gathered into a single sendmsg()
+static const int MAX_IOV = 64;
+
+// How much the writer takes off the queue at a time
+static const size_t WRITER_BATCH_SIZE = 256 * 1024;
+
+// Zero copy has a fixed cost for pinning the pages and the completion,
+// which only pays off for large segments
+static const size_t ZEROCOPY_MIN_SIZE = 64 * 1024;
+
+// How long zero copy sends are held on to after the writer has stopped
+static const int ZEROCOPY_REAP_MS = 10000;
+
+//
+// WriterThread owns the socket while it runs. flush() hands the buffered
+// segments over to the queue, by reference, and carries on. The queue
+// space is given back as soon as the writer picks the segments up.
+//
+
+class FdOutStream::WriterThread : public os::Thread {
+public:
+  WriterThread(FdOutStream* stream, size_t maxQueued);
+  ~WriterThread();
+
+  bool queue(std::deque<Segment>* segments, size_t length, bool wait);
+  size_t queued();
+
+  void setTimeout(int timeoutms);
+  unsigned getIdleTime();
+
+  void stop();
+
+  void reapZeroCopy();
+
+protected:
+  void worker();
+
+private:
+  bool writeBatch(std::deque<Segment>* batch);
+
+  void wake();
+  void waitForCompletions();
+
+  FdOutStream* stream;
+
+  size_t maxQueued;
+  size_t queuedBytes;
+  size_t inFlight;
+  std::deque<Segment> segments;
+
+  int timeoutms;
+  struct timeval lastWrite;
+
+  bool stopRequested;
+  bool timedOut;
+  Exception* exception;
+
+  // Zero copy sends keep their segment until the kernel is done with it
+  struct ZeroCopySend {
+    U32 id;
+    Segment seg;
+  };
+
+  bool zeroCopy;
+  U32 nextZeroCopyId;
+  std::deque<ZeroCopySend> zeroCopyPending;
+  // Wakes the writer while it waits on the socket for completions
+  int wakeFd;
+
+  static void reapZeroCopy(int fd, std::deque<ZeroCopySend>* pending);
+  static void reaper(int fd, std::deque<ZeroCopySend> pending);
+
+  os::Mutex* mutex;
+  os::Condition* producerCond;
+  os::Condition* consumerCond;
+};
+
+FdOutStream::WriterThread::WriterThread(FdOutStream* stream_, size_t maxQueued_)
+  : stream(stream_), maxQueued(maxQueued_), queuedBytes(0), inFlight(0),
+    timeoutms(stream_->timeoutms), lastWrite(stream_->lastWrite),
+    stopRequested(false), timedOut(false), exception(NULL),
+    zeroCopy(stream_->zeroCopy), nextZeroCopyId(0), wakeFd(-1)
+{
+  mutex = new os::Mutex();
+  producerCond = new os::Condition(mutex);
+  consumerCond = new os::Condition(mutex);
+
+  if (zeroCopy) {
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeFd < 0)
+      zeroCopy = false;
+  }
+}
+
+FdOutStream::WriterThread::~WriterThread()
+{
+  if (wakeFd >= 0)
+    close(wakeFd);
+
+  delete exception;
+
+  delete consumerCond;
+  delete producerCond;
+  delete mutex;
+}
+
+bool FdOutStream::WriterThread::queue(std::deque<Segment>* segs,
+                                      size_t length, bool wait)
+{
+  std::deque<Segment>::iterator iter;
+
+  os::AutoMutex a(mutex);
+
+  while (true) {
+    if (timedOut)
+      throw TimedOut();
+    if (exception != NULL)
+      throw Exception(*exception);
+
+    // An empty queue takes anything, or large segments would never fit
+    if (queuedBytes == 0 || queuedBytes + length <= maxQueued)
+      break;
+
+    if (!wait)
+      return false;
+
+    producerCond->wait();
+  }
+
+  for (iter = segs->begin(); iter != segs->end(); ++iter)
+    segments.push_back(*iter);
+  segs->clear();
+  queuedBytes += length;
+
+  consumerCond->signal();
+  wake();
+
+  return true;
+}
+
+size_t FdOutStream::WriterThread::queued()
+{
+  os::AutoMutex a(mutex);
+  return queuedBytes + inFlight;
+}
+
+void FdOutStream::WriterThread::setTimeout(int timeoutms_)
+{
+  os::AutoMutex a(mutex);
+  timeoutms = timeoutms_;
+}
+
+unsigned FdOutStream::WriterThread::getIdleTime()
+{
+  os::AutoMutex a(mutex);
+  return rfb::msSince(&lastWrite);
+}
+
+void FdOutStream::WriterThread::stop()
+{
+  mutex->lock();
+  stopRequested = true;
+  consumerCond->signal();
+  wake();
+  mutex->unlock();
+
+  wait();
+
+  // Let the stream continue where we left off
+  stream->lastWrite = lastWrite;
+}
+
+void FdOutStream::WriterThread::worker()
+{
+  mutex->lock();
+
+  while (true) {
+    std::deque<Segment> batch;
+    size_t length;
+    bool done;
+
+    if (segments.empty()) {
+      if (stopRequested)
+        break;
+
+      if (zeroCopyPending.empty()) {
+        consumerCond->wait();
+        continue;
+      }
+
+      // Unreaped completions keep the socket in POLLERR, which would
+      // have the main loop spinning on it until the next update
+      mutex->unlock();
+      waitForCompletions();
+      mutex->lock();
+      continue;
+    }
+
+    length = 0;
+    while (!segments.empty() && (batch.size() < MAX_IOV) &&
+           (length < WRITER_BATCH_SIZE)) {
+      length += segments.front().length;
+      batch.push_back(segments.front());
+      segments.pop_front();
+    }
+
+    queuedBytes -= length;
+    inFlight = length;
+
+    producerCond->signal();
+
+    mutex->unlock();
+
+    done = false;
+    try {
+      done = writeBatch(&batch);
+    } catch (TimedOut&) {
+      os::AutoMutex a(mutex);
+      timedOut = true;
+    } catch (Exception& e) {
+      os::AutoMutex a(mutex);
+      exception = new Exception("%s", e.str());
+    }
+
+    // Let go of the memory outside the lock
+    batch.clear();
+
+    mutex->lock();
+
+    inFlight = 0;
+
+    // Either the connection is dead or we are being stopped, in both
+    // cases there is no point in trying the rest. Stay around until
+    // stopped though, so that stop() always has a thread to join.
+    if (!done) {
+      segments.clear();
+      queuedBytes = 0;
+      producerCond->broadcast();
+    }
+  }
+
+  mutex->unlock();
+
+  // The kernel may still be reading from the memory of these, and it
+  // could be reused once we let go. stop() is called from the main
+  // loop though, so another thread has to wait for them.
+  reapZeroCopy();
+  if (zeroCopyPending.empty())
+    return;
+
+  int fd = fcntl(stream->fd, F_DUPFD_CLOEXEC, 0);
+  if (fd < 0) {
+    zeroCopyPending.clear();
+    return;
+  }
+
+  try {
+    std::thread(reaper, fd, std::move(zeroCopyPending)).detach();
+  } catch (std::exception&) {
+    close(fd);
+  }
+  zeroCopyPending.clear();
+}
+
+bool FdOutStream::WriterThread::writeBatch(std::deque<Segment>* batch)
+{
+  struct iovec iov[MAX_IOV];
+  int waited;
+
+  waited = 0;
+
+  while (!batch->empty()) {
+    size_t n, left;
+    int iovcnt, flags;
+    int timeout;
+    bool stopping;
+
+    mutex->lock();
+    timeout = timeoutms;
+    stopping = stopRequested;
+    mutex->unlock();
+
+    // Free what we can before holding on to more
+    if (!zeroCopyPending.empty())
+      reapZeroCopy();
+
+    flags = 0;
+    if (zeroCopy && !stopping &&
+        (batch->front().length >= ZEROCOPY_MIN_SIZE)) {
+      // Large segments go on their own, so they can be tracked
+      iov[0].iov_base = (void*)batch->front().data.get();
+      iov[0].iov_len = batch->front().length;
+      iovcnt = 1;
+      flags = MSG_ZEROCOPY;
+    } else {
+      std::deque<Segment>::const_iterator iter;
+
+      iovcnt = 0;
+      for (iter = batch->begin(); iter != batch->end(); ++iter) {
+        if (zeroCopy && !stopping && (iovcnt > 0) &&
+            (iter->length >= ZEROCOPY_MIN_SIZE))
+          break;
+        iov[iovcnt].iov_base = (void*)iter->data.get();
+        iov[iovcnt].iov_len = iter->length;
+        iovcnt++;
+      }
+    }
+
+    // Once stopped, only write what the socket takes right away
+    try {
+      n = stream->writeWithTimeout(iov, iovcnt,
+                                   stopping ? 0 : WRITER_POLL_MS, flags);
+    } catch (SystemException& e) {
+      // Out of locked memory to pin the pages, so just copy from now on
+      if (!(flags & MSG_ZEROCOPY) || (e.err != ENOBUFS))
+        throw;
+      zeroCopy = false;
+      continue;
+    }
+    if (n == 0) {
+      if (stopping)
+        return false;
+
+      waited += WRITER_POLL_MS;
+      if (timeout != -1 && waited >= timeout)
+        throw TimedOut();
+
+      continue;
+    }
+
+    if (flags & MSG_ZEROCOPY) {
+      ZeroCopySend zc;
+      zc.id = nextZeroCopyId++;
+      zc.seg = batch->front();
+      zeroCopyPending.push_back(zc);
+    }
+
+    mutex->lock();
+    gettimeofday(&lastWrite, NULL);
+    mutex->unlock();
+
+    left = n;
+    while (left > 0) {
+      Segment& seg = batch->front();
+
+      if (left < seg.length) {
+        seg.data = std::shared_ptr<const U8>(seg.data, seg.data.get() + left);
+        seg.length -= left;
+        break;
+      }
+
+      left -= seg.length;
+      batch->pop_front();
+    }
+
+    waited = 0;
+  }
+
+  return true;
+}
+
+//
+// reapZeroCopy() reads the completions the kernel queues on the socket's
+// error queue. Each covers a range of zero copy sends, numbered by the
+// order they were made in, whose memory is then free to go. The queue
+// is emptied completely, as anything left in it keeps the socket in
+// POLLERR.
+//
+
+void FdOutStream::WriterThread::reapZeroCopy()
+{
+  reapZeroCopy(stream->fd, &zeroCopyPending);
+}
+
+void FdOutStream::WriterThread::reapZeroCopy(int fd,
+                                             std::deque<ZeroCopySend>* pending)
+{
+  while (true) {
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    union {
+      char buf[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+      struct cmsghdr align;
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      return;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      const struct sock_extended_err* serr;
+      std::deque<ZeroCopySend>::iterator iter;
+
+      if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+        continue;
+
+      serr = (const struct sock_extended_err*)CMSG_DATA(cmsg);
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      // ee_info to ee_data, inclusive, and the ids wrap around
+      iter = pending->begin();
+      while (iter != pending->end()) {
+        if ((U32)(iter->id - serr->ee_info) <=
+            (U32)(serr->ee_data - serr->ee_info))
+          iter = pending->erase(iter);
+        else
+          ++iter;
+      }
+    }
+  }
+}
+
+//
+// reaper() holds on to the sends of a stopped writer until the kernel is
+// done with them, on its own copy of the fd so that it can't end up
+// reading from a new socket if the number is reused. It is not in a
+// hurry, so it just checks now and then.
+//
+
+void FdOutStream::WriterThread::reaper(int fd,
+                                       std::deque<ZeroCopySend> pending)
+{
+  int waited;
+
+  for (waited = 0; waited < ZEROCOPY_REAP_MS; waited += WRITER_POLL_MS) {
+    poll(NULL, 0, WRITER_POLL_MS);
+    reapZeroCopy(fd, &pending);
+    if (pending.empty())
+      break;
+  }
+
+  close(fd);
+}
+
+void FdOutStream::WriterThread::wake()
+{
+  const uint64_t one = 1;
+  ssize_t ret;
+
+  if (wakeFd < 0)
+    return;
+
+  // Can only fail if the counter is already huge, which still wakes us
+  ret = write(wakeFd, &one, sizeof(one));
+  (void)ret;
+}
+
+void FdOutStream::WriterThread::waitForCompletions()
+{
+  struct pollfd pfd[2];
+  uint64_t count;
+  ssize_t ret;
+
+  pfd[0].fd = stream->fd;
+  pfd[0].events = 0;
+  pfd[1].fd = wakeFd;
+  pfd[1].events = POLLIN;
+
+  if (poll(pfd, 2, -1) < 0)
+    return;
+
+  if (pfd[0].revents & POLLERR)
+    reapZeroCopy();
+
+  // A hung up socket stays readable, so don't spin on it while the
+  // completions trickle in
+  if ((pfd[0].revents & (POLLHUP | POLLNVAL)) && !(pfd[1].revents & POLLIN))
+    poll(&pfd[1], 1, WRITER_POLL_MS);
+
+  ret = read(wakeFd, &count, sizeof(count));
+  (void)ret;
+}
+
 FdOutStream::FdOutStream(int fd_, bool blocking_, int timeoutms_)
-  : fd(fd_), blocking(blocking_), timeoutms(timeoutms_)
+  : fd(fd_), blocking(blocking_), timeoutms(timeoutms_), writer(NULL),
+    zeroCopy(false)
 {
+  gather = true;
+
   gettimeofday(&lastWrite, NULL);
 }
 
 FdOutStream::~FdOutStream()
 {
+  stopWriter();
+
   try {
-    while (sentUpTo != ptr)
+    while (bufferUsage() != 0)
       flushBuffer(true);
   } catch (Exception&) {
   }
@@ -68,6 +570,8 @@ FdOutStream::~FdOutStream()
 
 void FdOutStream::setTimeout(int timeoutms_) {
   timeoutms = timeoutms_;
+  if (writer)
+    writer->setTimeout(timeoutms);
 }
 
 void FdOutStream::setBlocking(bool blocking_) {
@@ -76,13 +580,76 @@ void FdOutStream::setBlocking(bool blocking_) {
 
 unsigned FdOutStream::getIdleTime()
 {
+  if (writer)
+    return writer->getIdleTime();
   return rfb::msSince(&lastWrite);
 }
 
+void FdOutStream::startWriter(size_t maxQueued)
+{
+  if (writer)
+    return;
+
+  writer = new WriterThread(this, maxQueued);
+  writer->start();
+}
+
+void FdOutStream::stopWriter()
+{
+  if (!writer)
+    return;
+
+  writer->stop();
+  delete writer;
+  writer = NULL;
+}
+
+size_t FdOutStream::queuedBytes()
+{
+  if (!writer)
+    return 0;
+  return writer->queued();
+}
+
+bool FdOutStream::enableZeroCopy()
+{
+  int one = 1;
+
+  if (!gather || writer)
+    return false;
+
+  if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+    return false;
+
+  zeroCopy = true;
+
+  return true;
+}
+
 bool FdOutStream::flushBuffer(bool wait)
 {
-  size_t n = writeWithTimeout((const void*) sentUpTo,
-                              ptr - sentUpTo,
+  struct iovec iov[MAX_IOV];
+  std::deque<Segment>::const_iterator iter;
+  int iovcnt;
+
+  if (writer)
+    return queueBuffer(wait);
+
+  iovcnt = 0;
+  for (iter = segments.begin(); iter != segments.end(); ++iter) {
+    if (iovcnt == MAX_IOV)
+      break;
+    iov[iovcnt].iov_base = (void*)iter->data.get();
+    iov[iovcnt].iov_len = iter->length;
+    iovcnt++;
+  }
+  if ((iovcnt < MAX_IOV) && (sentUpTo != ptr)) {
+    iov[iovcnt].iov_base = sentUpTo;
+    iov[iovcnt].iov_len = ptr - sentUpTo;
+    iovcnt++;
+  }
+
+  size_t n = writeWithTimeout(iov, iovcnt,
                               (blocking || wait)? timeoutms : 0);
 
   // Timeout?
@@ -94,63 +661,101 @@ bool FdOutStream::flushBuffer(bool wait)
     throw TimedOut();
   }
 
-  sentUpTo += n;
+  gettimeofday(&lastWrite, NULL);
+
+  consume(n);
+
+  return true;
+}
+
+bool FdOutStream::queueBuffer(bool wait)
+{
+  sealBuffer();
+
+  if (!writer->queue(&segments, segmentBytes, blocking || wait))
+    return false;
+
+  segmentBytes = 0;
 
   return true;
 }
 
 //
 // writeWithTimeout() writes up to the given length in bytes from the given
-// buffer to the file descriptor.  If there is a timeout set and that timeout
-// expires, it throws a TimedOut exception.  Otherwise it returns the number of
-// bytes written.  It never attempts to send() unless select() indicates that
-// the fd is writable - this means it can be used on an fd which has been set
-// non-blocking.  It also has to cope with the annoying possibility of both
-// select() and send() returning EINTR.
+// buffers to the file descriptor.  If there is a timeout set and that
+// timeout expires, it returns 0.  Otherwise it returns the number of bytes
+// written.  The socket usually has room, so the write is tried right away
+// and poll() is only used once it reports that it is full.  The writes
+// never block, so it can be used on an fd which has been set non-blocking.
 //
 
-size_t FdOutStream::writeWithTimeout(const void* data, size_t length, int timeoutms)
+size_t FdOutStream::writeWithTimeout(const struct iovec* iov, int iovcnt,
+                                     int timeoutms, int flags)
 {
-  int n;
+  struct msghdr msg;
+  struct timeval start;
+  bool polled;
+  ssize_t n;
 
-  do {
-    fd_set fds;
-    struct timeval tv;
-    struct timeval* tvp = &tv;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec*)iov;
+  msg.msg_iovlen = iovcnt;
+
+  gettimeofday(&start, NULL);
+  polled = false;
+
+  while (true) {
+    int remaining;
+
+    do {
+      n = ::sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL | flags);
+    } while (n < 0 && (errno == EINTR));
+
+    if (n >= 0)
+      return n;
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      throw SystemException("write", errno);
 
+    // poll() also returns for other things than room in the socket, so
+    // the timeout is for the whole call
+    remaining = timeoutms;
     if (timeoutms != -1) {
-      tv.tv_sec = timeoutms / 1000;
-      tv.tv_usec = (timeoutms % 1000) * 1000;
-    } else {
-      tvp = NULL;
+      remaining = timeoutms - rfb::msSince(&start);
+      if (remaining <= 0) {
+        if (polled)
+          return 0;
+        remaining = 0;
+      }
     }
 
-    FD_ZERO(&fds);
-    FD_SET(fd, &fds);
-    n = select(fd+1, 0, &fds, 0, tvp);
-  } while (n < 0 && errno == EINTR);
+    if (!waitForWrite(remaining))
+      return 0;
 
-  if (n < 0)
-    throw SystemException("select", errno);
+    polled = true;
+  }
+}
 
-  if (n == 0)
-    return 0;
+bool FdOutStream::waitForWrite(int timeoutms)
+{
+  struct pollfd pfd;
+  int n;
+
+  // POLLERR is always reported, and with zero copy it just means that
+  // there are completions to pick up
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
 
   do {
-    // select only guarantees that you can write SO_SNDLOWAT without
-    // blocking, which is normally 1. Use MSG_DONTWAIT to avoid
-    // blocking, when possible.
-#ifndef MSG_DONTWAIT
-    n = ::send(fd, (const char*)data, length, 0);
-#else
-    n = ::send(fd, (const char*)data, length, MSG_DONTWAIT);
-#endif
-  } while (n < 0 && (errno == EINTR));
+    n = poll(&pfd, 1, timeoutms);
+  } while (n < 0 && errno == EINTR);
 
   if (n < 0)
-    throw SystemException("write", errno);
+    throw SystemException("poll", errno);
 
-  gettimeofday(&lastWrite, NULL);
+  // Only the writer thread writes while it runs
+  if ((n != 0) && (pfd.revents & POLLERR) && writer)
+    writer->reapZeroCopy();
 
-  return n;
+  return n != 0;
 }
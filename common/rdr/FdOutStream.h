@@ -28,6 +28,8 @@
 
 #include <rdr/BufferedOutStream.h>
 
+struct iovec;
+
 namespace rdr {
 
   class FdOutStream : public BufferedOutStream {
@@ -43,13 +45,48 @@ namespace rdr {
 
     unsigned getIdleTime();
 
+    // startWriter() hands the actual writes to a separate thread. Data
+    // leaving the buffer is then queued, up to maxQueued bytes, and
+    // written out in the background so that the caller can get on with
+    // producing more. Errors from the writer are thrown from the next
+    // flush. stopWriter() pushes out what can be written without
+    // waiting, drops the rest and goes back to writing directly.
+    virtual void startWriter(size_t maxQueued);
+    void stopWriter();
+
+    // queuedBytes() returns how much data is waiting for the writer
+    size_t queuedBytes();
+
+    // enableZeroCopy() lets the writer thread send large segments with
+    // MSG_ZEROCOPY, so the kernel reads them straight from our memory.
+    // Must be called before startWriter(). Returns false if the socket
+    // doesn't support it, e.g. when it isn't TCP.
+    bool enableZeroCopy();
+
+  protected:
+    // waitForWrite() blocks until the fd is writable, has an error
+    // pending or the timeout expires.  Returns false on timeout.
+    bool waitForWrite(int timeoutms);
+
   private:
     virtual bool flushBuffer(bool wait);
-    size_t writeWithTimeout(const void* data, size_t length, int timeoutms);
+    size_t writeWithTimeout(const struct iovec* iov, int iovcnt,
+                            int timeoutms, int flags=0);
+
+    bool queueBuffer(bool wait);
+
+    class WriterThread;
+    friend class WriterThread;
+
+  protected:
     int fd;
     bool blocking;
     int timeoutms;
     struct timeval lastWrite;
+
+  private:
+    WriterThread* writer;
+    bool zeroCopy;
   };
 
 }
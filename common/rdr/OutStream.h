@@ -27,6 +27,7 @@
 #include <rdr/types.h>
 #include <rdr/InStream.h>
 #include <string.h> // for memcpy
+#include <memory>
 
 namespace rdr {
 
@@ -96,6 +97,15 @@ namespace rdr {
       }
     }
 
+    // writeShared() writes length bytes starting at data.get(). Streams
+    // that can send straight from the caller's memory keep a reference
+    // instead of copying, so the data must not change afterwards.
+
+    virtual void writeShared(const std::shared_ptr<const U8>& data,
+                             size_t length) {
+      writeBytes(data.get(), length);
+    }
+
     // copyBytes() efficiently transfers data between streams
 
     void copyBytes(InStream* is, size_t length) {
@@ -26,11 +26,16 @@
 #include <rfb/Exception.h>
 #include <rfb/LogWriter.h>
 #include <rfb/ServerCore.h>
+#include <rfb/Trace.h>
 #include <rfb/ComparingUpdateTracker.h>
+#include <rfb/cpuid.h>
+#include <rfb/tilecmp.h>
 
 #include <rfb/adler32.h>
 #include <rfb/xxhash.h>
 
+#include <tbb/parallel_for.h>
+
 using namespace rfb;
 
 static LogWriter vlog("ComparingUpdateTracker");
@@ -171,7 +176,8 @@ public:
 		//memset(starts, 0, NUM_TOTALS * sizeof(uint32_t));
 		//memset(curs, 0, NUM_TOTALS * sizeof(uint32_t));
 
-		for (uint_fast32_t y = 0; y < h; y++) {
+		// Rows are independent, only the totals need a serial pass
+		tbb::parallel_for(static_cast<uint_fast32_t>(0), h, [&](uint_fast32_t y) {
 			const uint8_t *inptr0 = olddata;
 			inptr0 += y * lineBytes;
 			for (uint_fast32_t x = 0; x < w; x += SCROLLBLOCK_SIZE) {
@@ -180,10 +186,15 @@ public:
 
 				const uint_fast32_t idx = (y << hashShift) + x / SCROLLBLOCK_SIZE;
 				hashtable[idx].hash = XXH64(inptr0, blockBytes, 0);
-				totals[hashtable[idx].hash % NUM_TOTALS]++;
 
 				inptr0 += blockBytes;
 			}
+		});
+
+		for (uint_fast32_t y = 0; y < h; y++) {
+			const hashdata_t *src = &hashtable[y << hashShift];
+			for (uint_fast32_t x = 0; x + SCROLLBLOCK_SIZE <= w; x += SCROLLBLOCK_SIZE)
+				totals[src[x / SCROLLBLOCK_SIZE].hash % NUM_TOTALS]++;
 		}
 
 		// calculate number of unique 21-bit hashes
@@ -453,16 +464,16 @@ public:
 		// We need to make a copy, since the comparer incrementally updates its copy
 		memcpy((uint8_t *) olddata, ptr, w * h * d);
 
-		Adler32 rolling(blockBytes);
-
 		//memset(hashtable, 0, hashw * h * sizeof(uint32_t));
 		//memset(idxtable, 0, w * h * sizeof(uint32_t));
 		memset(totals, 0, NUM_TOTALS * sizeof(uint32_t));
 		//memset(starts, 0, NUM_TOTALS * sizeof(uint32_t));
 		//memset(curs, 0, NUM_TOTALS * sizeof(uint32_t));
 
-		const uint8_t *prevptr = NULL;
-		for (uint_fast32_t y = 0; y < h; y++) {
+		// Rows are independent, only the totals need a serial pass
+		tbb::parallel_for(static_cast<uint_fast32_t>(0), h, [&](uint_fast32_t y) {
+			Adler32 rolling(blockBytes);
+			const uint8_t *prevptr = NULL;
 			const uint8_t *inptr0 = olddata;
 			inptr0 += y * lineBytes;
 			for (uint_fast32_t x = 0; x < w - (SCROLLBLOCK_SIZE - 1); x++) {
@@ -482,11 +493,16 @@ public:
 				}
 				const uint_fast32_t idx = (y << hashShift) + x;
 				hashtable[idx].hash = rolling.hash;
-				totals[rolling.hash % NUM_TOTALS]++;
 
 				prevptr = inptr0;
 				inptr0 += d;
 			}
+		});
+
+		for (uint_fast32_t y = 0; y < h; y++) {
+			const hashdata_t *src = &hashtable[y << hashShift];
+			for (uint_fast32_t x = 0; x < w - (SCROLLBLOCK_SIZE - 1); x++)
+				totals[src[x].hash % NUM_TOTALS]++;
 		}
 
 		// calculate number of unique 21-bit hashes
@@ -680,6 +696,8 @@ ComparingUpdateTracker::ComparingUpdateTracker(PixelBuffer* buffer)
       scrollHasher = new scrollHasher_bothDir_t;
     else
       scrollHasher = new scrollHasher_vert_t;
+
+    arena.initialize(cpu_info::cores_count);
 }
 
 ComparingUpdateTracker::~ComparingUpdateTracker()
@@ -734,18 +752,44 @@ bool ComparingUpdateTracker::compare(bool skipScrollDetection, const Region &ski
   if (atLeast64 && Server::detectScrolling && !skipScrollDetection &&
       (changedArea * 100) / (fb->width() * fb->height()) > (unsigned) Server::scrollDetectLimit) {
     detectScroll = true;
+    TraceSpan span("scroll detect");
     Rect pos(0, 0, oldFb.width(), oldFb.height());
     int unused;
-    scrollHasher->calcHashes(oldFb.getBuffer(pos, &unused), oldFb.width(), oldFb.height(),
-    				oldFb.getPF().bpp / 8);
+    arena.execute([&] {
+      scrollHasher->calcHashes(oldFb.getBuffer(pos, &unused), oldFb.width(), oldFb.height(),
+                               oldFb.getPF().bpp / 8);
+    });
     // Invalidating lossy areas is not needed, the lossy region tracking tracks copies too
   }
 
   copyPassRects.clear();
 
+  tiles.clear();
+  tileGroups.clear();
+  for (i = rects.begin(); i != rects.end(); i++) {
+    addTiles(*i);
+    tileGroups.push_back(tiles.size());
+  }
+
   Region newChanged;
-  for (i = rects.begin(); i != rects.end(); i++)
-    compareRect(*i, &newChanged, skipCursorArea);
+  size_t begin = 0;
+  if (detectScroll && !Server::detectHorizontal) {
+    // Aligning the rects for scroll detection can make them overlap, and
+    // then each rect must see the oldFb as updated by the ones before it
+    for (size_t g = 0; g < tileGroups.size(); g++) {
+      compareTiles(begin, tileGroups[g]);
+      collectTiles(tiles.data() + begin, tiles.data() + tileGroups[g],
+                   &newChanged, skipCursorArea);
+      begin = tileGroups[g];
+    }
+  } else {
+    compareTiles(0, tiles.size());
+    for (size_t g = 0; g < tileGroups.size(); g++) {
+      collectTiles(tiles.data() + begin, tiles.data() + tileGroups[g],
+                   &newChanged, skipCursorArea);
+      begin = tileGroups[g];
+    }
+  }
 
   changed.get_rects(&rects);
   for (i = rects.begin(); i != rects.end(); i++)
@@ -820,143 +864,170 @@ static void tryMerge(std::vector<CopyPassRect> &copyPassRects,
  }
 }
 
-void ComparingUpdateTracker::compareRect(const Rect& inr, Region* newChanged,
-                                         const Region &skipCursorArea)
+void ComparingUpdateTracker::addTiles(const Rect& inr)
 {
-    Rect r = inr;
-    if (detectScroll && !Server::detectHorizontal)
-      r.tl.x &= ~(BLOCK_SIZE - 1);
-
-  if (!r.enclosed_by(fb->getRect())) {
-    Rect safe;
-    // Crop the rect and try again
-    safe = r.intersect(fb->getRect());
-    if (!safe.is_empty())
-      compareRect(safe, newChanged, skipCursorArea);
+  Rect r = inr;
+  if (detectScroll && !Server::detectHorizontal)
+    r.tl.x &= ~(BLOCK_SIZE - 1);
+
+  r = r.intersect(fb->getRect());
+  if (r.is_empty())
     return;
+
+  for (int blockTop = r.tl.y; blockTop < r.br.y; blockTop += BLOCK_SIZE) {
+    int blockBottom = __rfbmin(blockTop+BLOCK_SIZE, r.br.y);
+    for (int blockLeft = r.tl.x; blockLeft < r.br.x; blockLeft += BLOCK_SIZE) {
+      int blockRight = __rfbmin(blockLeft+BLOCK_SIZE, r.br.x);
+      Tile tile = {Rect(blockLeft, blockTop, blockRight, blockBottom), -1};
+      tiles.push_back(tile);
+    }
   }
+}
+
+void ComparingUpdateTracker::compareTiles(size_t begin, size_t end)
+{
+  if (begin == end)
+    return;
+
+  TraceSpan span("compare tiles");
 
+  arena.execute([&] {
+    tbb::parallel_for(begin, end, [&](size_t t) {
+      compareTile(&tiles[t]);
+    });
+  });
+}
+
+// Finds the first changed row of the tile, if any, and brings the oldFb
+// up to date from there on. Tiles never overlap within a single call to
+// compareTiles(), so this is safe to run concurrently.
+void ComparingUpdateTracker::compareTile(Tile* tile)
+{
+  const Rect& r = tile->rect;
   int bytesPerPixel = fb->getPF().bpp/8;
-  int oldStride;
-  rdr::U8* oldData = oldFb.getBufferRW(r, &oldStride);
+  int blockWidthInBytes = r.width() * bytesPerPixel;
+
+  int oldStride, fbStride;
+  rdr::U8* oldPtr = oldFb.getBufferRW(r, &oldStride);
+  const rdr::U8* newPtr = fb->getBuffer(r, &fbStride);
   int oldStrideBytes = oldStride * bytesPerPixel;
+  int newStrideBytes = fbStride * bytesPerPixel;
+
+  tile->firstChanged = -1;
+
+  if (blockWidthInBytes % TILEHASH_CHUNK == 0) {
+    int first = tileCompare(oldPtr, oldStrideBytes, newPtr, newStrideBytes,
+                            blockWidthInBytes, r.height());
+    if (first >= 0)
+      tile->firstChanged = r.tl.y + first;
+
+    oldFb.commitBufferRW(r);
+    return;
+  }
+
+  for (int y = r.tl.y; y < r.br.y; y++)
+  {
+    if (memcmp(oldPtr, newPtr, blockWidthInBytes) != 0)
+    {
+      // A block has changed - copy the remainder to the oldFb
+      tile->firstChanged = y;
+      for (int y2 = y; y2 < r.br.y; y2++)
+      {
+        memcpy(oldPtr, newPtr, blockWidthInBytes);
+        newPtr += newStrideBytes;
+        oldPtr += oldStrideBytes;
+      }
+      break;
+    }
+
+    newPtr += newStrideBytes;
+    oldPtr += oldStrideBytes;
+  }
+
+  oldFb.commitBufferRW(r);
+}
+
+// Turns the compared tiles of one changed rect into changed blocks, or
+// copies when scroll detection finds them elsewhere in the old frame. The
+// scroll search keeps state between blocks, so this part runs in order.
+void ComparingUpdateTracker::collectTiles(const Tile* begin, const Tile* end,
+                                          Region* newChanged,
+                                          const Region &skipCursorArea)
+{
+  int bytesPerPixel = fb->getPF().bpp/8;
 
   std::vector<Rect> changedBlocks;
 
-  for (int blockTop = r.tl.y; blockTop < r.br.y; blockTop += BLOCK_SIZE)
+  for (const Tile* tile = begin; tile != end; tile++)
   {
-    // Get a strip of the source buffer
-    Rect pos(r.tl.x, blockTop, r.br.x, __rfbmin(r.br.y, blockTop+BLOCK_SIZE));
+    const int blockLeft = tile->rect.tl.x;
+    const int blockTop = tile->rect.tl.y;
+    const int blockRight = tile->rect.br.x;
+    const int blockBottom = tile->rect.br.y;
+    const bool changed = tile->firstChanged >= 0;
+
+    if (!changed || (changed && !detectScroll) ||
+        (skipCursorArea.numRects() &&
+         !skipCursorArea.intersect(tile->rect).is_empty())) {
+      if (changed || skipCursorArea.numRects())
+        changedBlocks.push_back(tile->rect);
+      continue;
+    }
+
+    if (blockRight - blockLeft < SCROLLBLOCK_SIZE) {
+      // Block too small, put it out outright as changed
+      changedBlocks.push_back(tile->rect);
+      continue;
+    }
+
     int fbStride;
-    const rdr::U8* newBlockPtr = fb->getBuffer(pos, &fbStride);
+    const rdr::U8* newBlockPtr = fb->getBuffer(tile->rect, &fbStride);
     int newStrideBytes = fbStride * bytesPerPixel;
 
-    rdr::U8* oldBlockPtr = oldData;
-    int blockBottom = __rfbmin(blockTop+BLOCK_SIZE, r.br.y);
+    uint_fast32_t outx, outy, outlines;
 
-    for (int blockLeft = r.tl.x; blockLeft < r.br.x; blockLeft += BLOCK_SIZE)
-    {
-      const rdr::U8* newPtr = newBlockPtr;
-      rdr::U8* oldPtr = oldBlockPtr;
+    // First, try to find a full block
+    outlines = 0;
+    if (blockBottom - blockTop == SCROLLBLOCK_SIZE)
+      scrollHasher->findBlock(newBlockPtr, blockLeft, blockTop, &outx, &outy,
+                             &outlines);
 
-      int blockRight = __rfbmin(blockLeft+BLOCK_SIZE, r.br.x);
-      int blockWidthInBytes = (blockRight-blockLeft) * bytesPerPixel;
-      bool changed = false;
-      int y;
+    if (outlines == SCROLLBLOCK_SIZE) {
+      // Perfect match!
+      tryMerge(copyPassRects, blockTop, blockLeft, blockRight, outlines, outx, outy);
 
-      for (y = blockTop; y < blockBottom; y++)
-      {
-        if (memcmp(oldPtr, newPtr, blockWidthInBytes) != 0)
-        {
-          // A block has changed - copy the remainder to the oldFb
-          changed = true;
-          const rdr::U8* savedPtr = newPtr;
-          for (int y2 = y; y2 < blockBottom; y2++)
-          {
-            memcpy(oldPtr, newPtr, blockWidthInBytes);
-            newPtr += newStrideBytes;
-            oldPtr += oldStrideBytes;
-          }
-          newPtr = savedPtr;
-          break;
-        }
-
-        newPtr += newStrideBytes;
-        oldPtr += oldStrideBytes;
-      }
+      scrollHasher->invalidate(blockLeft, blockTop, outlines);
+      continue;
+    }
 
-      if (!changed || (changed && !detectScroll) ||
-          (skipCursorArea.numRects() &&
-           !skipCursorArea.intersect(Rect(blockLeft, blockTop, blockRight, blockBottom)).is_empty())) {
-        if (changed || skipCursorArea.numRects())
-          changedBlocks.push_back(Rect(blockLeft, blockTop,
-                                       blockRight, blockBottom));
+    int y = tile->firstChanged;
+    const rdr::U8* newPtr = newBlockPtr + (y - blockTop) * newStrideBytes;
 
-        oldBlockPtr += blockWidthInBytes;
-        newBlockPtr += blockWidthInBytes;
+    for (; y < blockBottom; y += outlines)
+    {
+      // We have the first changed line. Find the best match, if any
+      scrollHasher->findBestMatch(newPtr, blockBottom - y, blockLeft, y,
+                                  &outx, &outy, &outlines);
+
+      if (!outlines) {
+        // Heuristic, if a line did not match, probably
+        // the next few won't either
+        changedBlocks.push_back(Rect(blockLeft, y,
+                                     blockRight, __rfbmin(y + 4, blockBottom)));
+        y += 4;
+        newPtr += newStrideBytes * 4;
         continue;
       }
 
-      uint_fast32_t outx, outy, outlines;
-      if (blockRight - blockLeft < SCROLLBLOCK_SIZE) {
-        // Block too small, put it out outright as changed
-        changedBlocks.push_back(Rect(blockLeft, blockTop,
-                                     blockRight, blockBottom));
-      } else {
-        // First, try to find a full block
-        outlines = 0;
-        if (blockBottom - blockTop == SCROLLBLOCK_SIZE)
-          scrollHasher->findBlock(newBlockPtr, blockLeft, blockTop, &outx, &outy,
-                                 &outlines);
-
-        if (outlines == SCROLLBLOCK_SIZE) {
-          // Perfect match!
-          // success += outlines;
-          tryMerge(copyPassRects, blockTop, blockLeft, blockRight, outlines, outx, outy);
-
-          scrollHasher->invalidate(blockLeft, blockTop, outlines);
-
-          oldBlockPtr += blockWidthInBytes;
-          newBlockPtr += blockWidthInBytes;
-          continue;
-        }
-
-        for (; y < blockBottom; y += outlines)
-        {
-          // We have the first changed line. Find the best match, if any
-          scrollHasher->findBestMatch(newPtr, blockBottom - y, blockLeft, y,
-                                      &outx, &outy, &outlines);
-
-          if (!outlines) {
-            // Heuristic, if a line did not match, probably
-            // the next few won't either
-            changedBlocks.push_back(Rect(blockLeft, y,
-                                         blockRight, __rfbmin(y + 4, blockBottom)));
-            y += 4;
-            newPtr += newStrideBytes * 4;
-            // unfound += 4;
-            continue;
-          }
-          // success += outlines;
-
-          // Try to merge it with the last rect
-          tryMerge(copyPassRects, y, blockLeft, blockRight, outlines, outx, outy);
-
-          scrollHasher->invalidate(blockLeft, y, outlines);
-
-          newPtr += newStrideBytes * outlines;
-        }
-      }
+      // Try to merge it with the last rect
+      tryMerge(copyPassRects, y, blockLeft, blockRight, outlines, outx, outy);
 
-      oldBlockPtr += blockWidthInBytes;
-      newBlockPtr += blockWidthInBytes;
-    }
+      scrollHasher->invalidate(blockLeft, y, outlines);
 
-    oldData += oldStrideBytes * BLOCK_SIZE;
+      newPtr += newStrideBytes * outlines;
+    }
   }
 
-  oldFb.commitBufferRW(r);
-
   if (!changedBlocks.empty()) {
     Region temp;
     temp.setOrderedRects(changedBlocks);
@@ -19,6 +19,10 @@
 #ifndef __RFB_COMPARINGUPDATETRACKER_H__
 #define __RFB_COMPARINGUPDATETRACKER_H__
 
+#include <vector>
+
+#include <tbb/task_arena.h>
+
 #include <rfb/UpdateTracker.h>
 
 class scrollHasher_t;
@@ -51,7 +55,20 @@ namespace rfb {
     rdr::U8 changedPerc;
 
   private:
-    void compareRect(const Rect& r, Region* newchanged, const Region &skipCursorArea);
+    // The compare pass works on 64x64 tiles, which are compared (and
+    // copied to oldFb) in parallel. Scroll detection and region building
+    // then run over the results in the original order.
+    struct Tile {
+      Rect rect;
+      int firstChanged; // First row that differs, -1 if none
+    };
+
+    void addTiles(const Rect& r);
+    void compareTiles(size_t begin, size_t end);
+    void compareTile(Tile* tile);
+    void collectTiles(const Tile* begin, const Tile* end,
+                      Region* newChanged, const Region &skipCursorArea);
+
     PixelBuffer* fb;
     ManagedPixelBuffer oldFb;
     bool firstCompare;
@@ -61,6 +78,10 @@ namespace rfb {
     rdr::U32 totalPixels, missedPixels;
     scrollHasher_t *scrollHasher;
     std::vector<CopyPassRect> copyPassRects;
+
+    std::vector<Tile> tiles;
+    std::vector<size_t> tileGroups; // End of each changed rect's tiles
+    tbb::task_arena arena;
   };
 
 }
@@ -61,7 +61,7 @@ ConnParams::ConnParams()
     supportsSetDesktopSize(false), supportsFence(false),
     supportsContinuousUpdates(false), supportsExtendedClipboard(false),
     supportsDisconnectNotify(false),
-    supportsUdp(false),
+    supportsUdp(false), supportsUdpRecovery(false),
     compressLevel(2), qualityLevel(-1), fineQualityLevel(-1),
     subsampling(subsampleUndefined), name_(0), cursorPos_(0, 0), verStrPos(0),
     ledState_(ledUnknown), shandler(NULL)
@@ -150,6 +150,7 @@ void ConnParams::setEncodings(int nEncodings, const rdr::S32* encodings)
   supportsWEBP = false;
   supportsQOI = false;
   supportsDisconnectNotify = false;
+  supportsUdpRecovery = false;
   compressLevel = -1;
   qualityLevel = -1;
   fineQualityLevel = -1;
@@ -223,6 +224,10 @@ void ConnParams::setEncodings(int nEncodings, const rdr::S32* encodings)
       supportsDisconnectNotify = true;
       clientparlog("disconnectNotify", true);
       break;
+    case pseudoEncodingKasmUdpRecovery:
+      supportsUdpRecovery = true;
+      clientparlog("udpRecovery", true);
+      break;
     case pseudoEncodingFence:
       supportsFence = true;
       clientparlog("fence", true);
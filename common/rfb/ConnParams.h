@@ -121,6 +121,7 @@ namespace rfb {
     bool supportsDisconnectNotify;
 
     bool supportsUdp;
+    bool supportsUdpRecovery;
 
     int compressLevel;
     int qualityLevel;
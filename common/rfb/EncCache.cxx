@@ -18,55 +18,231 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
  * USA.
  */
+#include <string.h>
+
+#include <os/Mutex.h>
 #include <rfb/EncCache.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/ServerCore.h>
+
+#define XXH_STATIC_LINKING_ONLY
+#include <rfb/xxhash.h>
 
 using namespace rfb;
 
-EncCache::EncCache() {
-  enabled = false;
+static LogWriter vlog("EncCache");
+
+EncCache::EncCache() : enabled(false), current(0), arenaSize(0),
+                       shareOpen(false), frames(0) {
+  mutex = new os::Mutex;
+
+  for (unsigned i = 0; i < 2; i++) {
+    arenas[i].data = NULL;
+    arenas[i].used = 0;
+  }
+
+  memset(&stats, 0, sizeof(stats));
 }
 
 EncCache::~EncCache() {
+  clear();
+  delete mutex;
 }
 
-void EncCache::clear() {
-  std::map<EncId, const void *>::iterator it;
-  for (it = cache.begin(); it != cache.end(); it++)
-    free((void *) it->second);
+EncId EncCache::makeId(const PixelBuffer *pb, uint8_t type,
+                       uint8_t quality, bool lowQuality) {
+  XXH64_state_t state;
+  const uint8_t *buffer;
+  char pfstr[256];
+  EncId id;
+  int stride;
 
-  cache.clear();
-}
+  const Rect rect = pb->getRect();
+  const size_t rowBytes = rect.width() * (pb->getPF().bpp / 8);
 
-void EncCache::add(uint8_t type, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
-                   uint32_t len, const void *data) {
+  // The format decides what the bytes mean, so it seeds the hash
+  pb->getPF().print(pfstr, sizeof(pfstr));
+  XXH64_reset(&state, XXH64(pfstr, strlen(pfstr), 0));
 
-  EncId id;
+  buffer = pb->getBuffer(rect, &stride);
+  stride *= pb->getPF().bpp / 8;
+  for (int y = 0; y < rect.height(); y++)
+    XXH64_update(&state, buffer + y * stride, rowBytes);
 
+  id.hash = XXH64_digest(&state);
+  id.w = rect.width();
+  id.h = rect.height();
   id.type = type;
-  id.x = x;
-  id.y = y;
-  id.w = w;
-  id.h = h;
-  id.len = len;
+  id.quality = quality;
+  id.lowQuality = lowQuality;
 
-  cache[id] = data;
+  return id;
 }
 
-const void *EncCache::get(uint8_t type, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
-                          uint32_t &len) const {
+bool EncCache::get(const EncId &id, std::vector<uint8_t> &out) {
+  os::AutoMutex a(mutex);
 
-  EncId id;
+  stats.lookups++;
 
-  id.type = type;
-  id.x = x;
-  id.y = y;
-  id.w = w;
-  id.h = h;
+  for (unsigned i = 0; i < 2; i++) {
+    Arena &arena = arenas[current ^ i];
+    std::unordered_map<EncId, Entry, EncIdHash>::const_iterator it;
+
+    it = arena.index.find(id);
+    if (it == arena.index.end())
+      continue;
+
+    out.resize(it->second.len);
+    memcpy(&out[0], arena.data + it->second.offset, it->second.len);
+
+    // Still in use, so move it out of the generation dropped next
+    if (i)
+      store(id, &out[0], out.size());
+
+    stats.hits++;
+    stats.bytesSaved += out.size();
+    return true;
+  }
+
+  return false;
+}
+
+void EncCache::add(const EncId &id, const std::vector<uint8_t> &data) {
+  os::AutoMutex a(mutex);
+
+  if (data.empty())
+    return;
+
+  if (!arenaSize) {
+    arenaSize = (size_t) Server::encCacheSize * 1024 * 1024 / 2;
+    if (!arenaSize)
+      return;
+
+    for (unsigned i = 0; i < 2; i++)
+      arenas[i].data = new uint8_t[arenaSize];
+  }
+
+  store(id, &data[0], data.size());
+}
+
+void EncCache::store(const EncId &id, const uint8_t *data, size_t len) {
+  if (len > arenaSize)
+    return;
+
+  if (arenas[current].used + len > arenaSize) {
+    current ^= 1;
+    arenas[current].used = 0;
+    arenas[current].index.clear();
+  }
+
+  Arena &arena = arenas[current];
+  Entry entry;
+
+  entry.offset = arena.used;
+  entry.len = len;
+
+  if (!arena.index.insert(std::make_pair(id, entry)).second)
+    return;
+
+  memcpy(arena.data + arena.used, data, len);
+  arena.used += len;
+}
 
-  std::map<EncId, const void *>::const_iterator it = cache.find(id);
-  if (it == cache.end())
-    return NULL;
+EncCache::ShareId EncCache::makeShareId(uint64_t group, const Rect &rect,
+                                        uint8_t quality) {
+  ShareId id;
 
-  len = it->first.len;
+  id.group = group;
+  id.x = rect.tl.x;
+  id.y = rect.tl.y;
+  id.w = rect.width();
+  id.h = rect.height();
+  id.quality = quality;
+
+  return id;
+}
+
+void EncCache::beginShare() {
+  os::AutoMutex a(mutex);
+
+  shared.clear();
+  shareOpen = enabled;
+}
+
+void EncCache::endShare() {
+  os::AutoMutex a(mutex);
+
+  shareOpen = false;
+  shared.clear();
+}
+
+std::shared_ptr<const EncodedRect> EncCache::getShared(uint64_t group,
+                                                       const Rect &rect,
+                                                       uint8_t quality) {
+  os::AutoMutex a(mutex);
+  std::unordered_map<ShareId, std::shared_ptr<const EncodedRect>,
+                     ShareIdHash>::const_iterator it;
+
+  if (!shareOpen)
+    return nullptr;
+
+  stats.shareLookups++;
+
+  it = shared.find(makeShareId(group, rect, quality));
+  if (it == shared.end())
+    return nullptr;
+
+  stats.shareHits++;
   return it->second;
 }
+
+void EncCache::addShared(uint64_t group, const Rect &rect, uint8_t quality,
+                         const std::shared_ptr<const EncodedRect> &encoded) {
+  os::AutoMutex a(mutex);
+
+  if (!shareOpen)
+    return;
+
+  shared.insert(std::make_pair(makeShareId(group, rect, quality), encoded));
+}
+
+void EncCache::clear() {
+  os::AutoMutex a(mutex);
+
+  for (unsigned i = 0; i < 2; i++) {
+    delete [] arenas[i].data;
+    arenas[i].data = NULL;
+    arenas[i].used = 0;
+    arenas[i].index.clear();
+  }
+
+  arenaSize = 0;
+}
+
+EncCache::Stats EncCache::getStats() const {
+  os::AutoMutex a(mutex);
+  return stats;
+}
+
+void EncCache::frameDone() {
+  os::AutoMutex a(mutex);
+
+  frames++;
+  if (frames < (unsigned) Server::frameRate * 10)
+    return;
+
+  if (stats.lookups)
+    vlog.debug("%u of %u rects reused (%.1f%%), %lu KiB not re-encoded, "
+               "%lu KiB cached",
+               stats.hits, stats.lookups, stats.hits * 100.0 / stats.lookups,
+               (unsigned long) (stats.bytesSaved / 1024),
+               (unsigned long) ((arenas[0].used + arenas[1].used) / 1024));
+  if (stats.shareLookups)
+    vlog.debug("%u of %u rects shared between viewers (%.1f%%)",
+               stats.shareHits, stats.shareLookups,
+               stats.shareHits * 100.0 / stats.shareLookups);
+
+  memset(&stats, 0, sizeof(stats));
+  frames = 0;
+}
@@ -21,26 +21,61 @@
 #ifndef __RFB_ENCCACHE_H__
 #define __RFB_ENCCACHE_H__
 
-#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <rdr/types.h>
+#include <rfb/Palette.h>
+#include <rfb/Rect.h>
 
 #include <stdint.h>
 #include <stdlib.h>
 
+namespace os { class Mutex; }
+
 namespace rfb {
 
+  class PixelBuffer;
+
+  //
+  // EncCache shares compressed full colour rects between the viewers of
+  // one screen. Entries are keyed by what the encoder actually sees, the
+  // pixels in their final format plus encoder and quality, so any viewer
+  // asking for the same rect with the same parameters gets the same bytes,
+  // in this frame or a later one.
+  //
+  // Data lives in two bump allocated arenas of half the budget each. Once
+  // the current one fills up the older one is dropped wholesale and reused,
+  // which keeps eviction O(1) and avoids a malloc per entry.
+  //
+  // While the server pushes one frame to all viewers it also opens a share
+  // window. Viewers whose encoding parameters hash to the same group then
+  // pick up each other's complete per-rect results, analysis included,
+  // keyed by position alone since the framebuffer cannot change meanwhile.
+  //
+
+  // Result of analysing and possibly compressing one rect
+  struct EncodedRect {
+    uint8_t type;
+    uint8_t isWebp;
+    Palette palette;
+    std::vector<uint8_t> compressed;
+  };
+
   struct EncId {
+    uint64_t hash;
+    uint16_t w, h;
     uint8_t type;
-    uint16_t x, y, w, h;
-    uint32_t len;
-
-    bool operator <(const EncId &other) const {
-      return type < other.type ||
-             x < other.x ||
-             y < other.y ||
-             w < other.w ||
-             h < other.h;
+    uint8_t quality;
+    bool lowQuality;
+
+    bool operator ==(const EncId &other) const {
+      return hash == other.hash &&
+             w == other.w && h == other.h &&
+             type == other.type &&
+             quality == other.quality &&
+             lowQuality == other.lowQuality;
     }
   };
 
@@ -49,16 +84,91 @@ namespace rfb {
     EncCache();
     ~EncCache();
 
+    // Builds the key for encoding pb, which must be the exact buffer
+    // that is handed to the encoder
+    static EncId makeId(const PixelBuffer *pb, uint8_t type,
+                        uint8_t quality, bool lowQuality);
+
+    bool get(const EncId &id, std::vector<uint8_t> &out);
+    void add(const EncId &id, const std::vector<uint8_t> &data);
+
+    // Per-frame sharing of whole rect results, see above
+    void beginShare();
+    void endShare();
+    bool sharing() const { return shareOpen; }
+
+    std::shared_ptr<const EncodedRect> getShared(uint64_t group, const Rect &rect,
+                                                 uint8_t quality);
+    void addShared(uint64_t group, const Rect &rect, uint8_t quality,
+                   const std::shared_ptr<const EncodedRect> &encoded);
+
+    // Drops all entries and releases the arenas
     void clear();
-    void add(uint8_t type, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
-             uint32_t len, const void *data);
-    const void *get(uint8_t type, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
-                    uint32_t &len) const;
+    // Called once per frame, logs the hit rate now and then
+    void frameDone();
+
+    struct Stats {
+      unsigned lookups, hits;
+      size_t bytesSaved;
+      unsigned shareLookups, shareHits;
+    };
+    Stats getStats() const;
 
     bool enabled;
 
   protected:
-    std::map<EncId, const void *> cache;
+    struct EncIdHash {
+      size_t operator ()(const EncId &id) const { return id.hash; }
+    };
+
+    struct Entry {
+      size_t offset;
+      uint32_t len;
+    };
+
+    struct Arena {
+      uint8_t *data;
+      size_t used;
+      std::unordered_map<EncId, Entry, EncIdHash> index;
+    };
+
+    struct ShareId {
+      uint64_t group;
+      int16_t x, y, w, h;
+      uint8_t quality;
+
+      bool operator ==(const ShareId &other) const {
+        return group == other.group &&
+               x == other.x && y == other.y &&
+               w == other.w && h == other.h &&
+               quality == other.quality;
+      }
+    };
+
+    struct ShareIdHash {
+      size_t operator ()(const ShareId &id) const {
+        return id.group ^ ((size_t) id.x << 48) ^ ((size_t) id.y << 32) ^
+               ((size_t) id.w << 16) ^ id.h ^ ((size_t) id.quality << 56);
+      }
+    };
+
+    static ShareId makeShareId(uint64_t group, const Rect &rect,
+                               uint8_t quality);
+
+    void store(const EncId &id, const uint8_t *data, size_t len);
+
+    os::Mutex *mutex;
+
+    Arena arenas[2];
+    unsigned current;
+    size_t arenaSize;
+
+    bool shareOpen;
+    std::unordered_map<ShareId, std::shared_ptr<const EncodedRect>,
+                       ShareIdHash> shared;
+
+    Stats stats;
+    unsigned frames;
   };
 }
 
@@ -25,14 +25,20 @@
 #include <rfb/EncodeManager.h>
 #include <rfb/Encoder.h>
 #include <rfb/Palette.h>
-#include <rfb/scale_sse2.h>
+#include <rfb/rectanalysis.h>
+#include <rfb/ScaleCache.h>
+#include <rfb/ScaleFilters.h>
+#include <rfb/scale.h>
 #include <rfb/SConnection.h>
 #include <rfb/ServerCore.h>
 #include <rfb/SMsgWriter.h>
+#include <rfb/Trace.h>
 #include <rfb/UpdateTracker.h>
 #include <rfb/LogWriter.h>
 #include <rfb/Exception.h>
 #include <rfb/Watermark.h>
+#define XXH_STATIC_LINKING_ONLY
+#include <rfb/xxhash.h>
 
 #include <execution>
 #include <rfb/HextileEncoder.h>
@@ -67,6 +73,13 @@ static constexpr int SolidSearchBlock = 16;
 // Don't bother with blocks smaller than this
 static constexpr int SolidBlockMinArea = 2048;
 
+// Converted rects borrow their memory from a pool per thread. Only a
+// few are ever in use at once, and anything larger than a subrect is
+// rare enough to not keep around.
+static constexpr size_t ScratchPoolSize = 4;
+static constexpr size_t ScratchMaxSize = SubRectMaxArea * 4;
+static thread_local std::vector<std::vector<rdr::U8> > scratchPool;
+
 namespace rfb {
 
 enum EncoderClass {
@@ -167,10 +180,11 @@ static void updateMaxVideoRes(uint16_t *x, uint16_t *y) {
   }
 }
 
-EncodeManager::EncodeManager(SConnection *conn_, EncCache *encCache_, const FFmpeg& ffmpeg_, const video_encoders::EncoderProbe &encoder_probe_) :
+EncodeManager::EncodeManager(SConnection *conn_, EncCache *encCache_, ScaleCache *scaleCache_,
+                             const FFmpeg& ffmpeg_, const video_encoders::EncoderProbe &encoder_probe_) :
     conn(conn_), dynamicQualityMin(-1), dynamicQualityOff(-1), areaCur(0), videoDetected(false), videoTimer(this),
     watermarkStats(0), maxEncodingTime(0), framesSinceEncPrint(0), ffmpeg(ffmpeg_), ffmpeg_available(ffmpeg.is_available()),
-    encoder_probe(encoder_probe_), encCache(encCache_)
+    encoder_probe(encoder_probe_), encCache(encCache_), scaleCache(scaleCache_)
 {
     encoders.resize(encoderClassMax, nullptr);
     activeEncoders.resize(encoderTypeMax, encoderRaw);
@@ -509,7 +523,10 @@ bool EncodeManager::updateVideo(const Region &changed, const ScreenSet &layout,
         return false;
 
     static const Palette palette;
-    screen_encoder_manager->writeRect(pb, palette);
+    {
+        TraceSpan span("video encode");
+        screen_encoder_manager->writeRect(pb, palette);
+    }
 
     std::vector<Rect> rects;
     changed.get_rects(&rects);
@@ -994,10 +1011,9 @@ void EncodeManager::updateVideoStats(const std::vector<Rect> &rects, const Pixel
   }
 }
 
-PixelBuffer *rfb::nearestScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
-                                 const float diff)
+void rfb::nearestScaleRect(const PixelBuffer *pb, ModifiablePixelBuffer *newpb,
+                           const Rect &r, const float diff)
 {
-  ManagedPixelBuffer *newpb = new ManagedPixelBuffer(pb->getPF(), w, h);
   uint16_t x, y;
   int oldstride, newstride;
   const rdr::U8 *oldpxorig = pb->getBuffer(pb->getRect(), &oldstride);
@@ -1006,23 +1022,28 @@ PixelBuffer *rfb::nearestScale(const PixelBuffer *pb, const uint16_t w, const ui
   const uint16_t bpp = pb->getPF().bpp / 8;
   const float rowstep = 1 / diff;
 
-  for (y = 0; y < h; y++) {
+  if (bpp == 4) {
+    scaleNearest(oldpxorig, oldstride, newpx, newstride, diff,
+                 r.tl.x, r.tl.y, r.br.x, r.br.y);
+    return;
+  }
+
+  newpx += newstride * bpp * r.tl.y;
+
+  for (y = r.tl.y; y < r.br.y; y++) {
     const uint16_t ny = rowstep * y;
     oldpx = oldpxorig + oldstride * bpp * ny;
-    for (x = 0; x < w; x++) {
+    for (x = r.tl.x; x < r.br.x; x++) {
       const uint16_t newx = x / diff;
       memcpy(&newpx[x * bpp], &oldpx[newx * bpp], bpp);
     }
     newpx += newstride * bpp;
   }
-
-  return newpb;
 }
 
-PixelBuffer *rfb::bilinearScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
-                                 const float diff)
+void rfb::bilinearScaleRect(const PixelBuffer *pb, ModifiablePixelBuffer *newpb,
+                            const Rect &r, const float diff)
 {
-  ManagedPixelBuffer *newpb = new ManagedPixelBuffer(pb->getPF(), w, h);
   uint16_t x, y;
   int oldstride, newstride;
   const rdr::U8 *oldpx = pb->getBuffer(pb->getRect(), &oldstride);
@@ -1030,7 +1051,16 @@ PixelBuffer *rfb::bilinearScale(const PixelBuffer *pb, const uint16_t w, const u
   const uint16_t bpp = pb->getPF().bpp / 8;
   const float invdiff = 1 / diff;
 
-  for (y = 0; y < h; y++) {
+  if (bpp == 4) {
+    scaleBilinear(oldpx, oldstride, newpx, newstride,
+                  newpb->width(), newpb->height(), diff,
+                  r.tl.x, r.tl.y, r.br.x, r.br.y);
+    return;
+  }
+
+  newpx += newstride * bpp * r.tl.y;
+
+  for (y = r.tl.y; y < r.br.y; y++) {
     const float ny = y * invdiff;
     const uint16_t lowy = ny;
     const uint16_t highy = lowy + 1;
@@ -1040,7 +1070,7 @@ PixelBuffer *rfb::bilinearScale(const PixelBuffer *pb, const uint16_t w, const u
     const rdr::U8 *lowyptr = oldpx + oldstride * bpp * lowy;
     const rdr::U8 *highyptr = oldpx + oldstride * bpp * highy;
 
-    for (x = 0; x < w; x++) {
+    for (x = r.tl.x; x < r.br.x; x++) {
       const float nx = x * invdiff;
       const uint16_t lowx = nx;
       const uint16_t highx = lowx + 1;
@@ -1063,6 +1093,24 @@ PixelBuffer *rfb::bilinearScale(const PixelBuffer *pb, const uint16_t w, const u
     }
     newpx += newstride * bpp;
   }
+}
+
+PixelBuffer *rfb::nearestScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
+                                 const float diff)
+{
+  ManagedPixelBuffer *newpb = new ManagedPixelBuffer(pb->getPF(), w, h);
+
+  nearestScaleRect(pb, newpb, newpb->getRect(), diff);
+
+  return newpb;
+}
+
+PixelBuffer *rfb::bilinearScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
+                                 const float diff)
+{
+  ManagedPixelBuffer *newpb = new ManagedPixelBuffer(pb->getPF(), w, h);
+
+  bilinearScaleRect(pb, newpb, newpb->getRect(), diff);
 
   return newpb;
 }
@@ -1071,7 +1119,7 @@ PixelBuffer *rfb::progressiveBilinearScale(const PixelBuffer *pb,
                                  const uint16_t tgtw, const uint16_t tgth,
                                  const float tgtdiff)
 {
-  if (cpu_info::has_sse2) {
+  if (pb->getPF().bpp == 32) {
     if (tgtdiff >= 0.5f) {
       ManagedPixelBuffer *newpb = new ManagedPixelBuffer(pb->getPF(), tgtw, tgth);
 
@@ -1079,7 +1127,8 @@ PixelBuffer *rfb::progressiveBilinearScale(const PixelBuffer *pb,
       const rdr::U8 *oldpx = pb->getBuffer(pb->getRect(), &oldstride);
       rdr::U8 *newpx = newpb->getBufferRW(newpb->getRect(), &newstride);
 
-      SSE2_scale(oldpx, tgtw, tgth, newpx, oldstride, newstride, tgtdiff);
+      scaleBilinear(oldpx, oldstride, newpx, newstride, tgtw, tgth, tgtdiff,
+                    0, 0, tgtw, tgth);
       return newpb;
     }
 
@@ -1100,7 +1149,8 @@ PixelBuffer *rfb::progressiveBilinearScale(const PixelBuffer *pb,
       rdr::U8 *newpx = ((ManagedPixelBuffer *) newpb)->getBufferRW(newpb->getRect(),
                                                                    &newstride);
 
-      SSE2_halve(oldpx, neww, newh, newpx, oldstride, newstride);
+      scaleHalve(oldpx, oldstride, newpx, newstride, neww, newh,
+                 0, 0, neww, newh);
 
       if (del)
         delete pb;
@@ -1121,13 +1171,14 @@ PixelBuffer *rfb::progressiveBilinearScale(const PixelBuffer *pb,
       rdr::U8 *newpx = ((ManagedPixelBuffer *) newpb)->getBufferRW(newpb->getRect(),
                                                                    &newstride);
 
-      SSE2_scale(oldpx, tgtw, tgth, newpx, oldstride, newstride, tgtw / (float) oldw);
+      scaleBilinear(oldpx, oldstride, newpx, newstride, tgtw, tgth,
+                    tgtw / (float) oldw, 0, 0, tgtw, tgth);
       if (del)
         delete pb;
     }
 
     return newpb;
-  } // SSE2
+  } // 32bpp
 
   if (tgtdiff >= 0.5f)
     return bilinearScale(pb, tgtw, tgth, tgtdiff);
@@ -1163,16 +1214,34 @@ PixelBuffer *rfb::progressiveBilinearScale(const PixelBuffer *pb,
   return newpb;
 }
 
+PixelBuffer *rfb::filterScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
+                              const unsigned filter)
+{
+  if (pb->getPF().bpp != 32)
+    return progressiveBilinearScale(pb, w, h, w / (float) pb->width());
+
+  ManagedPixelBuffer *newpb = new ManagedPixelBuffer(pb->getPF(), w, h);
+  const ScaleWeights xw(filter, pb->width(), w);
+  const ScaleWeights yw(filter, pb->height(), h);
+
+  int oldstride, newstride;
+  const rdr::U8 *oldpx = pb->getBuffer(pb->getRect(), &oldstride);
+  rdr::U8 *newpx = newpb->getBufferRW(newpb->getRect(), &newstride);
+
+  scaleFilter(oldpx, oldstride, newpx, newstride, xw, yw, 0, 0, w, h);
+
+  return newpb;
+}
+
 void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
                                const struct timeval *start,
                                const bool mainScreen)
 {
-  std::vector<Rect> rects, subrects, scaledrects;
-  std::vector<uint8_t> encoderTypes;
-  std::vector<uint8_t> isWebp, fromCache;
-  std::vector<Palette> palettes;
-  std::vector<std::vector<uint8_t> > compresseds;
-  std::vector<uint32_t> ms;
+  std::vector<Rect> &rects = frameRects;
+  std::vector<Rect> &subrects = frameSubrects;
+  std::vector<Rect> &scaledrects = frameScaledrects;
+  std::vector<std::shared_ptr<const EncodedRect> > &encoded = frameEncoded;
+  std::vector<uint32_t> &ms = frameMs;
 
   webpTookTooLong.store(false, std::memory_order_relaxed);
   changed.get_rects(&rects);
@@ -1187,6 +1256,7 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
     rects.push_back(pb->getRect());
   }
 
+  subrects.clear();
   subrects.reserve(rects.size() * 1.5f);
 
   for (const auto& rect : rects) {
@@ -1229,22 +1299,29 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
 
   const size_t subrects_size = subrects.size();
 
-  encoderTypes.resize(subrects_size);
-  isWebp.resize(subrects_size);
-  fromCache.resize(subrects_size);
-  palettes.resize(subrects_size);
-  compresseds.resize(subrects_size);
+  encoded.resize(subrects_size);
   scaledrects.resize(subrects_size);
   ms.resize(subrects_size);
 
+  // Anything still shared with another viewer is left to them
+  if (rectPool.size() < subrects_size)
+    rectPool.resize(subrects_size);
+  for (uint32_t i = 0; i < subrects_size; ++i) {
+    if (!rectPool[i] || rectPool[i].use_count() > 1)
+      rectPool[i] = std::make_shared<EncodedRect>();
+  }
+
   // In case the current resolution is above the max video res, and video was detected,
   // scale to that res, keeping aspect ratio
   struct timeval scalestart;
   gettimeofday(&scalestart, NULL);
 
   const PixelBuffer *scaledpb = NULL;
+  bool ownScaled = true;
   if (videoDetected && !video_mode_available &&
       (maxVideoX < pb->getRect().width() || maxVideoY < pb->getRect().height())) {
+    TraceSpan span("scale");
+
     const float xdiff = maxVideoX / (float) pb->getRect().width();
     const float ydiff = maxVideoY / (float) pb->getRect().height();
 
@@ -1252,19 +1329,32 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
 
     const uint16_t neww = pb->getRect().width() * diff;
     const uint16_t newh = pb->getRect().height() * diff;
-    switch (Server::videoScaling) {
-      case 0:
-        scaledpb = nearestScale(pb, neww, newh,
-                      diff);
-      break;
-      case 1:
-        scaledpb = bilinearScale(pb, neww, newh,
-                      diff);
-      break;
-      case 2:
-        scaledpb = progressiveBilinearScale(pb, neww, newh,
-                      diff);
-      break;
+
+    // The screen itself has a shared copy that follows the damage
+    if (mainScreen && scaleCache) {
+      scaledpb = scaleCache->get(pb, neww, newh, diff, Server::videoScaling);
+      ownScaled = false;
+    } else {
+      switch (Server::videoScaling) {
+        case 0:
+          scaledpb = nearestScale(pb, neww, newh,
+                        diff);
+        break;
+        case 1:
+          scaledpb = bilinearScale(pb, neww, newh,
+                        diff);
+        break;
+        case 2:
+          scaledpb = progressiveBilinearScale(pb, neww, newh,
+                        diff);
+        break;
+        case 3:
+          scaledpb = filterScale(pb, neww, newh, scaleFilterArea);
+        break;
+        case 4:
+          scaledpb = filterScale(pb, neww, newh, scaleFilterBicubic);
+        break;
+      }
     }
 
     for (uint32_t i = 0; i < subrects_size; ++i) {
@@ -1292,18 +1382,41 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
   }
   scalingTime = msSince(&scalestart);
 
-    arena.execute([&] {
-        tbb::parallel_for(static_cast<size_t>(0), subrects_size, [&](size_t i) {
-            encoderTypes[i] = getEncoderType(subrects[i], pb, &palettes[i], compresseds[i],
-                        &isWebp[i], &fromCache[i],
-                        scaledpb, scaledrects[i], ms[i]);
-            checkWebpFallback(start);
-        });
+  // Viewers with the same parameters get the same results for the same
+  // rects of the main screen during one server frame
+  uint64_t shareGroup = 0;
+  if (mainScreen && encCache->sharing())
+    shareGroup = getShareGroup(scaledpb != NULL);
+
+  arena.execute([&] {
+    tbb::parallel_for(static_cast<size_t>(0), subrects_size, [&](size_t i) {
+      TraceSpan span("encode rect");
+      uint8_t quality = 0;
+      if (shareGroup) {
+        quality = scaledQuality(subrects[i]);
+        encoded[i] = encCache->getShared(shareGroup, subrects[i], quality);
+        if (encoded[i]) {
+          ms[i] = 0;
+          return;
+        }
+      }
+
+      const std::shared_ptr<EncodedRect> &result = rectPool[i];
+      result->compressed.clear();
+      result->type = getEncoderType(subrects[i], pb, &result->palette,
+                                    result->compressed, &result->isWebp,
+                                    scaledpb, scaledrects[i], ms[i]);
+      checkWebpFallback(start);
+
+      if (shareGroup)
+        encCache->addShared(shareGroup, subrects[i], quality, result);
+      encoded[i] = result;
     });
+  });
 
   for (uint32_t i = 0; i < subrects_size; ++i) {
-    if (encoderTypes[i] == encoderFullColour) {
-      if (isWebp[i])
+    if (encoded[i]->type == encoderFullColour) {
+      if (encoded[i]->isWebp)
         webpstats.ms += ms[i];
       else
         jpegstats.ms += ms[i]; // Also covers QOI for now
@@ -1331,26 +1444,95 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
   if (webpTookTooLong.load(std::memory_order_relaxed))
     activeEncoders[encoderFullColour] = encoderTightJPEG;
 
+  tightPayloads.resize(subrects_size);
+  for (uint32_t i = 0; i < subrects_size; ++i)
+    tightPayloads[i].clear();
+
+  if (Server::parallelZlib && arena.max_concurrency() > 1)
+    compressTightRects(pb);
+
+  TraceSpan writeSpan("write");
+
   for (uint32_t i = 0; i < subrects_size; ++i) {
-    if (encCache->enabled && !compresseds[i].empty() && !fromCache[i] &&
-    !encoders[encoderTightQOI]->isSupported()) {
-      void *tmp = malloc(compresseds[i].size());
-      memcpy(tmp, &compresseds[i][0], compresseds[i].size());
-      encCache->add(isWebp[i] ? encoderTightWEBP : encoderTightJPEG,
-                    subrects[i].tl.x, subrects[i].tl.y, subrects[i].width(), subrects[i].height(),
-                    compresseds[i].size(), tmp);
+    if (!tightPayloads[i].empty()) {
+      Encoder *encoder = startRect(subrects[i], encoded[i]->type);
+      ((TightEncoder *) encoder)->writeOnly(tightPayloads[i]);
+      endRect();
+      continue;
     }
 
-    writeSubRect(subrects[i], pb, encoderTypes[i], palettes[i], compresseds[i], isWebp[i]);
+    writeSubRect(subrects[i], pb, encoded[i]);
   }
 
-  if (scaledpb)
+  // Let go of the results so the pools can recycle them
+  encoded.clear();
+
+  if (scaledpb && ownScaled)
     delete scaledpb;
 }
 
+//
+// compressTightRects() does the zlib work of the Tight rects in this
+// batch ahead of writing them. The client decompresses each of Tight's
+// four zlib streams on its own and any rect can use any stream, so the
+// rects are dealt out to the streams by size, the streams are worked on
+// in parallel, and each stream's rects still reach the client in the
+// order they were compressed.
+//
+
+void EncodeManager::compressTightRects(const PixelBuffer* pb)
+{
+  TightEncoder *tight = (TightEncoder *) encoders[encoderTight];
+  size_t load[4] = { 0, 0, 0, 0 };
+  unsigned count = 0;
+
+  for (unsigned s = 0; s < 4; s++)
+    tightStreamRects[s].clear();
+
+  for (uint32_t i = 0; i < frameSubrects.size(); ++i) {
+    const EncodedRect &encoded = *frameEncoded[i];
+    unsigned best = 0;
+
+    // Tight writes single colour rects as fills, whatever the type
+    if (encoded.palette.size() == 1 || !encoded.compressed.empty() ||
+        activeEncoders[encoded.type] != encoderTight)
+      continue;
+
+    for (unsigned s = 1; s < 4; s++) {
+      if (load[s] < load[best])
+        best = s;
+    }
+
+    tightStreamRects[best].push_back(i);
+    load[best] += frameSubrects[i].area();
+    count++;
+  }
+
+  // Not worth it, let writeSubRect() handle it as usual
+  if (count < 2)
+    return;
+
+  arena.execute([&] {
+    tbb::parallel_for(0, 4, [&](int s) {
+      TraceSpan span("compress zlib");
+
+      for (const uint32_t i : tightStreamRects[s]) {
+        PixelBuffer *ppb;
+
+        ppb = preparePixelBuffer(frameSubrects[i], pb,
+                                 tight->flags & EncoderUseNativePF ?
+                                 false : true);
+        tight->compressOnly(ppb, frameEncoded[i]->palette, s,
+                            tightPayloads[i]);
+        delete ppb;
+      }
+    });
+  });
+}
+
 uint8_t EncodeManager::getEncoderType(const Rect& rect, const PixelBuffer *pb,
                                       Palette *pal, std::vector<uint8_t> &compressed,
-                                      uint8_t *isWebp, uint8_t *fromCache,
+                                      uint8_t *isWebp,
                                       const PixelBuffer *scaledpb, const Rect& scaledrect,
                                       uint32_t &ms) const
 {
@@ -1371,8 +1553,11 @@ uint8_t EncodeManager::getEncoderType(const Rect& rect, const PixelBuffer *pb,
   ppb = preparePixelBuffer(rect, pb, true);
   info.palette = pal;
 
-  if (!analyseRect(ppb, &info, maxColours))
-    info.palette->clear();
+  {
+    TraceSpan span("analyseRect");
+    if (!analyseRect(ppb, &info, maxColours))
+      info.palette->clear();
+  }
 
   // Different encoders might have different RLE overhead, but
   // here we do a guess at RLE being the better choice if reduces
@@ -1403,69 +1588,61 @@ uint8_t EncodeManager::getEncoderType(const Rect& rect, const PixelBuffer *pb,
     type = encoderFullColour;
 
   *isWebp = 0;
-  *fromCache = 0;
   ms = 0;
   if (type == encoderFullColour) {
-    uint32_t len;
-    const void *data;
     struct timeval start;
     gettimeofday(&start, NULL);
 
+    // Same choice as writeSubRect() makes for the compressed data
+    int fullColour = activeEncoders[encoderFullColour];
+    if (fullColour != encoderTightQOI && webpTookTooLong)
+      fullColour = encoderTightJPEG;
+
     if (encCache && video_mode_available) {
       // nop, send this as a skip rect
-    } else if (encCache->enabled &&
-        (data = encCache->get(activeEncoders[encoderFullColour],
-                              rect.tl.x, rect.tl.y, rect.width(), rect.height(),
-                              len))) {
-      compressed.resize(len);
-      memcpy(&compressed[0], data, len);
-      *fromCache = 1;
-    } else if (activeEncoders[encoderFullColour] == encoderTightWEBP && !webpTookTooLong) {
+    } else if (fullColour == encoderTightWEBP ||
+               fullColour == encoderTightQOI ||
+               fullColour == encoderTightJPEG) {
+      const Encoder *encoder = encoders[fullColour];
+      const uint8_t quality = scaledQuality(rect);
+      bool fromCache = false;
+      EncId id;
+
       if (scaledpb) {
         delete ppb;
         ppb = preparePixelBuffer(scaledrect, scaledpb,
-                                 encoders[encoderTightWEBP]->flags & EncoderUseNativePF ?
+                                 encoder->flags & EncoderUseNativePF ?
                                  false : true);
-      } else if (encoders[encoderTightWEBP]->flags & EncoderUseNativePF) {
+      } else if (encoder->flags & EncoderUseNativePF) {
         delete ppb;
         ppb = preparePixelBuffer(rect, pb, false);
       }
 
-      ((TightWEBPEncoder *) encoders[encoderTightWEBP])->compressOnly(ppb,
-                                                                      scaledQuality(rect),
-                                                                      compressed,
-                                                                      videoDetected);
-      *isWebp = 1;
-    } else if (activeEncoders[encoderFullColour] == encoderTightQOI) {
-      if (scaledpb) {
-        delete ppb;
-        ppb = preparePixelBuffer(scaledrect, scaledpb,
-                                 encoders[encoderTightQOI]->flags & EncoderUseNativePF ?
-                                 false : true);
-      } else if (encoders[encoderTightQOI]->flags & EncoderUseNativePF) {
-        delete ppb;
-        ppb = preparePixelBuffer(rect, pb, false);
+      if (encCache->enabled) {
+        id = EncCache::makeId(ppb, fullColour, quality, videoDetected);
+        fromCache = encCache->get(id, compressed);
       }
 
-      ((TightQOIEncoder *) encoders[encoderTightQOI])->compressOnly(ppb,
-                                                                      scaledQuality(rect),
-                                                                      compressed,
-                                                                      videoDetected);
-    } else if (activeEncoders[encoderFullColour] == encoderTightJPEG || webpTookTooLong) {
-      if (scaledpb) {
-        delete ppb;
-        ppb = preparePixelBuffer(scaledrect, scaledpb,
-                                 encoders[encoderTightJPEG]->flags & EncoderUseNativePF ?
-                                 false : true);
-      } else if (encoders[encoderTightJPEG]->flags & EncoderUseNativePF) {
-        delete ppb;
-        ppb = preparePixelBuffer(rect, pb, false);
+      if (fromCache) {
+        // Nothing to do
+      } else if (fullColour == encoderTightWEBP) {
+        TraceSpan span("compress webp");
+        ((TightWEBPEncoder *) encoder)->compressOnly(ppb, quality, compressed,
+                                                     videoDetected);
+      } else if (fullColour == encoderTightQOI) {
+        TraceSpan span("compress qoi");
+        ((TightQOIEncoder *) encoder)->compressOnly(ppb, quality, compressed,
+                                                    videoDetected);
+      } else {
+        TraceSpan span("compress jpeg");
+        ((TightJPEGEncoder *) encoder)->compressOnly(ppb, quality, compressed,
+                                                     videoDetected);
       }
 
-      ((TightJPEGEncoder *) encoders[encoderTightJPEG])->compressOnly(ppb,
-                                                                      scaledQuality(rect),
-                                                                      compressed,
-                                                                      videoDetected);
+      if (encCache->enabled && !fromCache)
+        encCache->add(id, compressed);
+
+      *isWebp = fullColour == encoderTightWEBP;
     }
 
     ms = msSince(&start);
@@ -1476,38 +1653,72 @@ uint8_t EncodeManager::getEncoderType(const Rect& rect, const PixelBuffer *pb,
   return type;
 }
 
+// Everything besides the pixels and the per-rect quality that goes into
+// getEncoderType(), so equal groups give equal results for equal rects
+uint64_t EncodeManager::getShareGroup(bool scaled) const
+{
+  XXH64_state_t state;
+  char pfstr[256];
+  uint16_t flags;
+
+  conn->cp.pf().print(pfstr, sizeof(pfstr));
+
+  flags = conn->cp.supportsQOI |
+          videoDetected << 1 |
+          video_mode_available << 2 |
+          webpTookTooLong << 3 |
+          scaled << 4;
+
+  XXH64_reset(&state, 0);
+  XXH64_update(&state, pfstr, strlen(pfstr));
+  XXH64_update(&state, &activeEncoders[0],
+               activeEncoders.size() * sizeof(activeEncoders[0]));
+  XXH64_update(&state, &flags, sizeof(flags));
+  if (scaled) {
+    XXH64_update(&state, &maxVideoX, sizeof(maxVideoX));
+    XXH64_update(&state, &maxVideoY, sizeof(maxVideoY));
+  }
+
+  // Zero means no sharing
+  return XXH64_digest(&state) | 1;
+}
+
 void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb,
-                                 const uint8_t type, const Palette &pal,
-                                 const std::vector<uint8_t> &compressed,
-                                 const uint8_t isWebp)
+                                 const std::shared_ptr<const EncodedRect> &encoded)
 {
   PixelBuffer *ppb;
   Encoder *encoder;
+  const uint8_t isWebp = encoded->isWebp;
+  const size_t length = encoded->compressed.size();
+
+  encoder = startRect(rect, encoded->type, length == 0, isWebp ? STARTRECT_OVERRIDE_WEBP : STARTRECT_NO_OVERRIDE);
 
-  encoder = startRect(rect, type, compressed.size() == 0, isWebp ? STARTRECT_OVERRIDE_WEBP : STARTRECT_NO_OVERRIDE);
+  if (length) {
+    // The stream may send straight from the rect, which keeps it out of
+    // the pools until then
+    const std::shared_ptr<const rdr::U8> compressed(encoded, encoded->compressed.data());
 
-  if (compressed.size()) {
     if (isWebp) {
-      ((TightWEBPEncoder *) encoder)->writeOnly(compressed);
+      ((TightWEBPEncoder *) encoder)->writeOnly(compressed, length);
       webpstats.area += rect.area();
       webpstats.rects++;
     } else if (encoders[encoderTightQOI]->isSupported()) {
-      ((TightQOIEncoder *) encoder)->writeOnly(compressed);
+      ((TightQOIEncoder *) encoder)->writeOnly(compressed, length);
       jpegstats.area += rect.area(); // Also QOI for now
       jpegstats.rects++;
     } else {
-      ((TightJPEGEncoder *) encoder)->writeOnly(compressed);
+      ((TightJPEGEncoder *) encoder)->writeOnly(compressed, length);
       jpegstats.area += rect.area();
       jpegstats.rects++;
     }
-    } else {
+  } else {
     if (encoder->flags & EncoderUseNativePF) {
       ppb = preparePixelBuffer(rect, pb, false);
     } else {
       ppb = preparePixelBuffer(rect, pb, true);
     }
 
-    encoder->writeRect(ppb, pal);
+    encoder->writeRect(ppb, encoded->palette);
     delete ppb;
   }
 
@@ -1632,10 +1843,8 @@ PixelBuffer* EncodeManager::preparePixelBuffer(const Rect& rect,
 
   // Do wo need to convert the data?
   if (convert && !conn->cp.pf().equal(pb->getPF())) {
-    ManagedPixelBuffer *convertedPixelBuffer = new ManagedPixelBuffer;
-
-    convertedPixelBuffer->setPF(conn->cp.pf());
-    convertedPixelBuffer->setSize(rect.width(), rect.height());
+    ConvertedPixelBuffer *convertedPixelBuffer =
+      new ConvertedPixelBuffer(conn->cp.pf(), rect.width(), rect.height());
 
     buffer = pb->getBuffer(rect, &stride);
     convertedPixelBuffer->imageRect(pb->getPF(),
@@ -1681,6 +1890,35 @@ bool EncodeManager::analyseRect(const PixelBuffer *pb,
   }
 }
 
+EncodeManager::ConvertedPixelBuffer::ConvertedPixelBuffer(const PixelFormat& pf,
+                                                          int width, int height)
+{
+  size_t needed;
+
+  format = pf;
+  width_ = width;
+  height_ = height;
+  stride = width;
+
+  if (!scratchPool.empty()) {
+    mem.swap(scratchPool.back());
+    scratchPool.pop_back();
+  }
+
+  // Never shrunk, so a reused buffer is not cleared again
+  needed = (size_t)width * height * (pf.bpp/8);
+  if (mem.size() < needed)
+    mem.resize(needed);
+
+  data = mem.data();
+}
+
+EncodeManager::ConvertedPixelBuffer::~ConvertedPixelBuffer()
+{
+  if (scratchPool.size() < ScratchPoolSize && mem.size() <= ScratchMaxSize)
+    scratchPool.push_back(std::move(mem));
+}
+
 void EncodeManager::OffsetPixelBuffer::update(const PixelFormat& pf,
                                               int width, int height,
                                               const rdr::U8* data_,
@@ -31,6 +31,7 @@
 #include <rfb/UpdateTracker.h>
 
 #include <atomic>
+#include <memory>
 #include <sys/time.h>
 #include <tbb/task_arena.h>
 
@@ -52,6 +53,8 @@ namespace rfb {
   class PixelBuffer;
   class RenderedCursor;
   class EncCache;
+  class ScaleCache;
+  struct EncodedRect;
   struct Rect;
 
   struct RectInfo;
@@ -59,7 +62,8 @@ namespace rfb {
 
   class EncodeManager: public Timer::Callback {
   public:
-    EncodeManager(SConnection* conn, EncCache *encCache, const FFmpeg& ffmpeg, const video_encoders::EncoderProbe &encoder_probe_);
+    EncodeManager(SConnection* conn, EncCache *encCache, ScaleCache *scaleCache,
+                  const FFmpeg& ffmpeg, const video_encoders::EncoderProbe &encoder_probe_);
     ~EncodeManager() override;
 
     void logStats();
@@ -127,17 +131,17 @@ namespace rfb {
                     const struct timeval *start = nullptr,
                     bool mainScreen = false);
     void checkWebpFallback(const struct timeval *start);
+    void compressTightRects(const PixelBuffer* pb);
     void updateVideoStats(const std::vector<Rect> &rects, const PixelBuffer* pb);
 
-    void writeSubRect(const Rect& rect, const PixelBuffer *pb, uint8_t type,
-                      const Palette& pal, const std::vector<uint8_t> &compressed,
-                      uint8_t isWebp);
+    void writeSubRect(const Rect& rect, const PixelBuffer *pb,
+                      const std::shared_ptr<const EncodedRect> &encoded);
 
     uint8_t getEncoderType(const Rect& rect, const PixelBuffer *pb, Palette *pal,
                            std::vector<uint8_t> &compressed, uint8_t *isWebp,
-                           uint8_t *fromCache,
                            const PixelBuffer *scaledpb, const Rect& scaledrect,
                            uint32_t &ms) const;
+    uint64_t getShareGroup(bool scaled) const;
 
     bool handleTimeout(Timer* t) override;
 
@@ -226,6 +230,29 @@ namespace rfb {
     const video_encoders::EncoderProbe &encoder_probe;
 
     EncCache *encCache;
+    ScaleCache *scaleCache;
+
+    // Per-frame scratch for writeRects(), kept so that steady updates
+    // reuse the same storage instead of allocating it for every frame
+    std::vector<Rect> frameRects, frameSubrects, frameScaledrects;
+    std::vector<uint32_t> frameMs;
+    std::vector<std::shared_ptr<const EncodedRect> > frameEncoded;
+    // Results are recycled once no other viewer holds on to them
+    std::vector<std::shared_ptr<EncodedRect> > rectPool;
+    // Per connection, as they depend on the state of the zlib streams
+    std::vector<std::vector<uint8_t> > tightPayloads;
+    std::vector<uint32_t> tightStreamRects[4];
+
+    // A rect converted to the client's pixel format. The memory comes
+    // from a small pool per thread instead of a new allocation per rect.
+    class ConvertedPixelBuffer : public FullFramePixelBuffer {
+    public:
+      ConvertedPixelBuffer(const PixelFormat& pf, int width, int height);
+      ~ConvertedPixelBuffer() override;
+
+    private:
+      std::vector<rdr::U8> mem;
+    };
 
     class OffsetPixelBuffer : public FullFramePixelBuffer {
     public:
@@ -246,6 +273,16 @@ namespace rfb {
                             const float diff);
   PixelBuffer *progressiveBilinearScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
                             const float diff);
+  // filter is one of the ScaleFilters ids or scaleFilterArea, any ratio
+  PixelBuffer *filterScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
+                            const unsigned filter);
+
+  // Only (re)compute the pixels within r of newpb, which holds pb scaled
+  // by diff
+  void nearestScaleRect(const PixelBuffer *pb, ModifiablePixelBuffer *newpb,
+                        const Rect &r, const float diff);
+  void bilinearScaleRect(const PixelBuffer *pb, ModifiablePixelBuffer *newpb,
+                         const Rect &r, const float diff);
 }
 
 #endif
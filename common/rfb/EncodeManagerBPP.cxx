@@ -29,13 +29,17 @@ inline bool EncodeManager::checkSolidTile(const Rect& r,
 {
   int w, h;
   const rdr::UBPP* buffer;
-  int stride, pad;
+  int stride;
 
   w = r.width();
   h = r.height();
 
   buffer = (const rdr::UBPP*)pb->getBuffer(r, &stride);
-  pad = stride - w;
+
+#if BPP == 32
+  return solidRect32(buffer, stride, w, h, colourValue);
+#else
+  const int pad = stride - w;
 
   while (h--) {
     int w_ = w;
@@ -48,25 +52,62 @@ inline bool EncodeManager::checkSolidTile(const Rect& r,
   }
 
   return true;
+#endif
 }
 
 inline bool EncodeManager::analyseRect(int width, int height,
                                        const rdr::UBPP* buffer, int stride,
                                        struct RectInfo *info, int maxColours) const
 {
-  int pad;
-
   rdr::UBPP colour;
   int count;
 
   info->rleRuns = 0;
   info->palette->clear();
 
-  pad = stride - width;
-
   // For efficiency, we only update the palette on changes in colour
   colour = buffer[0];
   count = 0;
+
+#if BPP == 32
+  // The kernel finds the changes, we only visit those pixels
+  rdr::U16 changes[RECTANALYSIS_CHUNK];
+
+  while (height--) {
+    for (int x = 0; x < width; x += RECTANALYSIS_CHUNK) {
+      int len, last;
+      unsigned n, i;
+
+      len = width - x;
+      if (len > RECTANALYSIS_CHUNK)
+        len = RECTANALYSIS_CHUNK;
+
+      n = colourChanges32(buffer + x, len, colour, changes);
+
+      last = 0;
+      for (i = 0; i < n; i++) {
+        count += changes[i] - last;
+
+        if (!info->palette->insert(colour, count))
+          return false;
+        if (info->palette->size() > maxColours)
+          return false;
+
+        // FIXME: This doesn't account for switching lines
+        info->rleRuns++;
+
+        colour = buffer[x + changes[i]];
+        count = 0;
+        last = changes[i];
+      }
+
+      count += len - last;
+    }
+    buffer += stride;
+  }
+#else
+  const int pad = stride - width;
+
   while (height--) {
     int w_ = width;
     while (w_--) {
@@ -87,6 +128,7 @@ inline bool EncodeManager::analyseRect(int width, int height,
     }
     buffer += pad;
   }
+#endif
 
   // Make sure the final pixels also get counted
   if (!info->palette->insert(colour, count))
@@ -25,6 +25,7 @@
 #include <rdr/OutStream.h>
 #include <rfb/Exception.h>
 #include <rfb/PixelFormat.h>
+#include <rfb/pixelconv.h>
 #include <rfb/util.h>
 
 #ifdef _WIN32
@@ -385,33 +386,46 @@ void PixelFormat::bufferFromBuffer(rdr::U8* dst, const PixelFormat &srcPF,
     }
   } else if (is888() && srcPF.is888()) {
     // Optimised common case A: byte shuffling (e.g. endian conversion)
-    rdr::U8 *d[4], *s[4];
+    rdr::U8 *d[4];
+    int dstOffset[4], srcOffset[4];
+    rdr::U8 order[4];
     int dstPad, srcPad;
+    int i;
 
+    // Where red, green, blue and the padding are in each pixel
     if (bigEndian) {
-      s[0] = dst + (24 - redShift)/8;
-      s[1] = dst + (24 - greenShift)/8;
-      s[2] = dst + (24 - blueShift)/8;
-      s[3] = dst + (24 - (48 - redShift - greenShift - blueShift))/8;
+      dstOffset[0] = (24 - redShift)/8;
+      dstOffset[1] = (24 - greenShift)/8;
+      dstOffset[2] = (24 - blueShift)/8;
+      dstOffset[3] = (24 - (48 - redShift - greenShift - blueShift))/8;
     } else {
-      s[0] = dst + redShift/8;
-      s[1] = dst + greenShift/8;
-      s[2] = dst + blueShift/8;
-      s[3] = dst + (48 - redShift - greenShift - blueShift)/8;
+      dstOffset[0] = redShift/8;
+      dstOffset[1] = greenShift/8;
+      dstOffset[2] = blueShift/8;
+      dstOffset[3] = (48 - redShift - greenShift - blueShift)/8;
     }
 
     if (srcPF.bigEndian) {
-      d[(24 - srcPF.redShift)/8] = s[0];
-      d[(24 - srcPF.greenShift)/8] = s[1];
-      d[(24 - srcPF.blueShift)/8] = s[2];
-      d[(24 - (48 - srcPF.redShift - srcPF.greenShift - srcPF.blueShift))/8] = s[3];
+      srcOffset[0] = (24 - srcPF.redShift)/8;
+      srcOffset[1] = (24 - srcPF.greenShift)/8;
+      srcOffset[2] = (24 - srcPF.blueShift)/8;
+      srcOffset[3] = (24 - (48 - srcPF.redShift - srcPF.greenShift - srcPF.blueShift))/8;
     } else {
-      d[srcPF.redShift/8] = s[0];
-      d[srcPF.greenShift/8] = s[1];
-      d[srcPF.blueShift/8] = s[2];
-      d[(48 - srcPF.redShift - srcPF.greenShift - srcPF.blueShift)/8] = s[3];
+      srcOffset[0] = srcPF.redShift/8;
+      srcOffset[1] = srcPF.greenShift/8;
+      srcOffset[2] = srcPF.blueShift/8;
+      srcOffset[3] = (48 - srcPF.redShift - srcPF.greenShift - srcPF.blueShift)/8;
     }
 
+    for (i = 0; i < 4; i++)
+      order[dstOffset[i]] = srcOffset[i];
+
+    if (shuffle888(dst, src, w, h, dstStride, srcStride, order))
+      return;
+
+    for (i = 0; i < 4; i++)
+      d[srcOffset[i]] = dst + dstOffset[i];
+
     dstPad = (dstStride - w) * 4;
     srcPad = (srcStride - w) * 4;
     while (h--) {
@@ -440,6 +454,20 @@ void PixelFormat::bufferFromBuffer(rdr::U8* dst, const PixelFormat &srcPF,
                                     w, h, dstStride, srcStride);
       break;
     case 16:
+      {
+        // Where the channels end up in a little endian load of a pixel
+        const int srcShift[3] = {
+          srcPF.bigEndian ? 24 - srcPF.redShift : srcPF.redShift,
+          srcPF.bigEndian ? 24 - srcPF.greenShift : srcPF.greenShift,
+          srcPF.bigEndian ? 24 - srcPF.blueShift : srcPF.blueShift
+        };
+        const int max[3] = { redMax, greenMax, blueMax };
+        const int shift[3] = { redShift, greenShift, blueShift };
+
+        if (convert888to16((rdr::U16*)dst, src, w, h, dstStride, srcStride,
+                           srcShift, max, shift, endianMismatch))
+          break;
+      }
       directBufferFromBufferFrom888((rdr::U16*)dst, srcPF, src,
                                     w, h, dstStride, srcStride);
       break;
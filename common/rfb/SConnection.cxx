@@ -282,6 +282,8 @@ void SConnection::setEncodings(int nEncodings, const rdr::S32 *encodings) {
     }
 
     SMsgHandler::setEncodings(nEncodings, encodings);
+
+    udps->setRecovery(cp.supportsUdpRecovery);
 }
 
 void SConnection::clearBinaryClipboard()
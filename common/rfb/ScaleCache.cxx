@@ -0,0 +1,276 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <math.h>
+
+#include <rfb/EncodeManager.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/ScaleCache.h>
+#include <rfb/ScaleFilters.h>
+#include <rfb/ServerCore.h>
+#include <rfb/scale.h>
+
+using namespace rfb;
+
+static LogWriter vlog("ScaleCache");
+
+ScaleCache::ScaleCache() {
+}
+
+ScaleCache::~ScaleCache() {
+  clear();
+}
+
+void ScaleCache::add_changed(const Region &changed) {
+  std::list<Shadow*>::iterator it;
+
+  for (it = shadows.begin(); it != shadows.end(); ++it)
+    (*it)->dirty.assign_union(changed);
+}
+
+const PixelBuffer *ScaleCache::get(const PixelBuffer *pb, uint16_t w, uint16_t h,
+                                   float diff, int method) {
+  std::list<Shadow*>::iterator it;
+  Shadow *s = NULL;
+
+  for (it = shadows.begin(); it != shadows.end(); ++it) {
+    if ((*it)->w == w && (*it)->h == h && (*it)->diff == diff &&
+        (*it)->method == method) {
+      s = *it;
+      shadows.splice(shadows.begin(), shadows, it);
+      break;
+    }
+  }
+
+  if (!s) {
+    s = new Shadow;
+    s->w = w;
+    s->h = h;
+    s->diff = diff;
+    s->method = method;
+    s->src = NULL;
+    shadows.push_front(s);
+
+    vlog.debug("Keeping a %ux%u copy of the screen for video", w, h);
+  }
+
+  // A different framebuffer means starting over
+  if (s->src != pb || !s->srcRect.equals(pb->getRect()) ||
+      !s->pf.equal(pb->getPF())) {
+    release(s);
+
+    s->src = pb;
+    s->srcRect = pb->getRect();
+    s->pf = pb->getPF();
+    build(s);
+
+    s->dirty = s->srcRect;
+  }
+
+  s->idle = 0;
+
+  refresh(s);
+
+  return (const PixelBuffer *) s->steps.back().out;
+}
+
+void ScaleCache::frameDone() {
+  std::list<Shadow*>::iterator it, next;
+
+  for (it = shadows.begin(); it != shadows.end(); it = next) {
+    next = it;
+    ++next;
+
+    if (++(*it)->idle < (unsigned) Server::frameRate * 10)
+      continue;
+
+    release(*it);
+    delete *it;
+    shadows.erase(it);
+  }
+}
+
+void ScaleCache::trim(size_t keep) {
+  while (shadows.size() > keep) {
+    release(shadows.back());
+    delete shadows.back();
+    shadows.pop_back();
+  }
+}
+
+void ScaleCache::clear() {
+  std::list<Shadow*>::iterator it;
+
+  for (it = shadows.begin(); it != shadows.end(); ++it) {
+    release(*it);
+    delete *it;
+  }
+
+  shadows.clear();
+}
+
+//
+// build() sets up the same passes EncodeManager's scalers make for the
+// method, progressiveBilinearScale() being a chain of halvings and a
+// final scale, and the filters a single pass.
+//
+
+void ScaleCache::build(Shadow *s) {
+  Step step;
+
+  step.xw = step.yw = NULL;
+
+  // The rfb/scale.h kernels want 32bpp, others get the generic bilinear
+  const bool fast = s->pf.bpp == 32;
+
+  if (s->method == 0 || s->method == 1) {
+    step.type = s->method == 0 ? STEP_NEAREST : STEP_BILINEAR;
+    step.diff = s->diff;
+    step.out = new ManagedPixelBuffer(s->pf, s->w, s->h);
+    s->steps.push_back(step);
+    return;
+  }
+
+  if ((s->method == 3 || s->method == 4) && fast) {
+    const unsigned filter = s->method == 3 ? scaleFilterArea : scaleFilterBicubic;
+
+    step.type = STEP_FILTER;
+    step.diff = s->diff;
+    step.out = new ManagedPixelBuffer(s->pf, s->w, s->h);
+    step.xw = new ScaleWeights(filter, s->srcRect.width(), s->w);
+    step.yw = new ScaleWeights(filter, s->srcRect.height(), s->h);
+    s->steps.push_back(step);
+    return;
+  }
+
+  if (s->diff >= 0.5f) {
+    step.type = fast ? STEP_SCALE : STEP_BILINEAR;
+    step.diff = s->diff;
+    step.out = new ManagedPixelBuffer(s->pf, s->w, s->h);
+    s->steps.push_back(step);
+    return;
+  }
+
+  uint16_t neww, newh;
+
+  neww = s->srcRect.width();
+  newh = s->srcRect.height();
+
+  do {
+    neww /= 2;
+    newh /= 2;
+
+    step.type = fast ? STEP_HALVE : STEP_BILINEAR;
+    step.diff = 0.5f;
+    step.out = new ManagedPixelBuffer(s->pf, neww, newh);
+    s->steps.push_back(step);
+  } while (s->w * 2 < neww);
+
+  // Final, non-halving step
+  if (s->w != neww || s->h != newh) {
+    step.type = fast ? STEP_SCALE : STEP_BILINEAR;
+    step.diff = s->w / (float) neww;
+    step.out = new ManagedPixelBuffer(s->pf, s->w, s->h);
+    s->steps.push_back(step);
+  }
+}
+
+void ScaleCache::release(Shadow *s) {
+  std::vector<Step>::iterator it;
+
+  for (it = s->steps.begin(); it != s->steps.end(); ++it) {
+    delete it->out;
+    delete it->xw;
+    delete it->yw;
+  }
+
+  s->steps.clear();
+}
+
+void ScaleCache::refresh(Shadow *s) {
+  Region dirty;
+
+  dirty = s->dirty.intersect(s->srcRect);
+  s->dirty.clear();
+
+  for (size_t i = 0; i < s->steps.size(); i++) {
+    const Step &step = s->steps[i];
+    const PixelBuffer *src = i ? s->steps[i - 1].out : s->src;
+    std::vector<Rect> rects;
+    std::vector<Rect>::const_iterator rect;
+    Region scaled;
+
+    if (dirty.is_empty())
+      return;
+
+    // A target pixel reads source pixels up to a filter's taps away
+    int pad = 1;
+    if (step.type == STEP_FILTER)
+      pad = (step.xw->taps > step.yw->taps ? step.xw->taps : step.yw->taps) + 1;
+
+    dirty.get_rects(&rects);
+    for (rect = rects.begin(); rect != rects.end(); ++rect)
+      scaled.assign_union(mapRect(*rect, step.diff, pad, step.out->getRect()));
+
+    int oldstride, newstride;
+    const rdr::U8 *oldpx = src->getBuffer(src->getRect(), &oldstride);
+    rdr::U8 *newpx = step.out->getBufferRW(step.out->getRect(), &newstride);
+
+    scaled.get_rects(&rects);
+    for (rect = rects.begin(); rect != rects.end(); ++rect) {
+      switch (step.type) {
+      case STEP_NEAREST:
+        nearestScaleRect(src, step.out, *rect, step.diff);
+        break;
+      case STEP_BILINEAR:
+        bilinearScaleRect(src, step.out, *rect, step.diff);
+        break;
+      case STEP_HALVE:
+        scaleHalve(oldpx, oldstride, newpx, newstride,
+                   step.out->width(), step.out->height(),
+                   rect->tl.x, rect->tl.y, rect->br.x, rect->br.y);
+        break;
+      case STEP_SCALE:
+        scaleBilinear(oldpx, oldstride, newpx, newstride,
+                      step.out->width(), step.out->height(), step.diff,
+                      rect->tl.x, rect->tl.y, rect->br.x, rect->br.y);
+        break;
+      case STEP_FILTER:
+        scaleFilter(oldpx, oldstride, newpx, newstride, *step.xw, *step.yw,
+                    rect->tl.x, rect->tl.y, rect->br.x, rect->br.y);
+        break;
+      }
+    }
+
+    dirty = scaled;
+  }
+}
+
+// Target pixel x reads source pixels around x / diff, at most pad of them
+// on either side, so everything that close to the mapped area may have
+// changed
+Rect ScaleCache::mapRect(const Rect &r, float diff, int pad, const Rect &bounds) {
+  Rect out;
+
+  out.tl.x = floorf((r.tl.x - pad) * diff) - 1;
+  out.tl.y = floorf((r.tl.y - pad) * diff) - 1;
+  out.br.x = ceilf((r.br.x + pad - 1) * diff) + 1;
+  out.br.y = ceilf((r.br.y + pad - 1) * diff) + 1;
+
+  return out.intersect(bounds);
+}
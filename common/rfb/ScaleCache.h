@@ -0,0 +1,106 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_SCALECACHE_H__
+#define __RFB_SCALECACHE_H__
+
+#include <list>
+#include <vector>
+
+#include <rfb/PixelFormat.h>
+#include <rfb/Rect.h>
+#include <rfb/Region.h>
+
+#include <stdint.h>
+
+namespace rfb {
+
+  class ManagedPixelBuffer;
+  class PixelBuffer;
+  class ScaleWeights;
+
+  //
+  // ScaleCache keeps the downscaled copies of the framebuffer that video
+  // mode encodes from, one per target size and method, shared by all
+  // viewers asking for the same. The server hands it the damage of every
+  // frame, and a copy then only rescales the target pixels that damage
+  // can reach, the filter's border included, instead of the whole
+  // screen. The results are the same as scaling everything anew.
+  //
+
+  class ScaleCache {
+  public:
+    ScaleCache();
+    ~ScaleCache();
+
+    // Areas of the framebuffer that changed, in its coordinates
+    void add_changed(const Region &changed);
+
+    // Returns pb scaled by diff to w x h, method as in Server::videoScaling.
+    // The cache owns the buffer, it stays valid for the current frame.
+    const PixelBuffer *get(const PixelBuffer *pb, uint16_t w, uint16_t h,
+                           float diff, int method);
+
+    // Called once per frame, drops copies nobody asked for in a while
+    void frameDone();
+    // Drops the least recently asked for copies beyond keep
+    void trim(size_t keep);
+    // Drops all copies
+    void clear();
+
+  protected:
+    enum StepType {
+      STEP_NEAREST,
+      STEP_BILINEAR,
+      STEP_HALVE,
+      STEP_SCALE,
+      STEP_FILTER
+    };
+
+    // One pass of the scaler, reading the previous step's output
+    struct Step {
+      StepType type;
+      float diff;
+      ManagedPixelBuffer *out;
+      ScaleWeights *xw, *yw;
+    };
+
+    struct Shadow {
+      uint16_t w, h;
+      float diff;
+      int method;
+
+      const PixelBuffer *src;
+      Rect srcRect;
+      PixelFormat pf;
+
+      std::vector<Step> steps;
+      Region dirty;
+      unsigned idle;
+    };
+
+    static void build(Shadow *s);
+    static void release(Shadow *s);
+    static void refresh(Shadow *s);
+    static Rect mapRect(const Rect &r, float diff, int pad, const Rect &bounds);
+
+    // Most recently asked for first
+    std::list<Shadow*> shadows;
+  };
+}
+
+#endif
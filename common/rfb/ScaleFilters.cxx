@@ -123,3 +123,34 @@ void ScaleFilters::makeWeightTabs(int filter_id, int src_x, int dst_x, SFilterWe
     }
   }
 }
+
+void ScaleFilters::makeAreaWeightTabs(int src_x, int dst_x, SFilterWeightTab **pWeightTabs) {
+  double ratio = (double)dst_x / src_x;
+  double s0, s1, cover;
+  int i, sum, biggest;
+
+  *pWeightTabs = new SFilterWeightTab[dst_x];
+  SFilterWeightTab *weightTabs = *pWeightTabs;
+
+  for (int x = 0; x < dst_x; x++) {
+    // The dest pixel covers [s0, s1) of the source
+    s0 = x / ratio;
+    s1 = __rfbmin((x + 1) / ratio, double(src_x));
+
+    int i0 = __rfbmin(int(s0), src_x - 1);
+    int i1 = __rfbmax(int(ceil(s1 - SCALE_ERROR)), i0 + 1);
+
+    weightTabs[x].i0 = i0; weightTabs[x].i1 = i1;
+    weightTabs[x].weight = new short[i1-i0];
+
+    for (sum = 0, biggest = 0, i = i0; i < i1; i++) {
+      cover = __rfbmin(i + 1.0, s1) - __rfbmax(double(i), s0);
+      weightTabs[x].weight[i-i0] = (short)__rfbmax(floor(cover / (s1 - s0) * WEIGHT_OF_ONE + 0.5), 0.0);
+      sum += weightTabs[x].weight[i-i0];
+      if (weightTabs[x].weight[i-i0] > weightTabs[x].weight[biggest]) biggest = i-i0;
+    }
+
+    // Rounding must not change the brightness
+    weightTabs[x].weight[biggest] += WEIGHT_OF_ONE - sum;
+  }
+}
@@ -39,6 +39,9 @@ namespace rfb {
   const unsigned int scaleFilterBicubic = 2;
 
   const unsigned int scaleFilterMaxNumber = 2;
+
+  // Not a point filter, see makeAreaWeightTabs()
+  const unsigned int scaleFilterArea = scaleFilterMaxNumber + 1;
   const unsigned int defaultScaleFilter = scaleFilterBilinear;
 
   //
@@ -70,6 +73,10 @@ namespace rfb {
 
     void makeWeightTabs(int filter, int src_x, int dst_x, SFilterWeightTab **weightTabs);
 
+    // Each dest pixel averages the source pixels it covers, weighted by
+    // how much of them it covers
+    void makeAreaWeightTabs(int src_x, int dst_x, SFilterWeightTab **weightTabs);
+
   protected:
     void initFilters();
 
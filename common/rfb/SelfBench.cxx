@@ -21,6 +21,7 @@
 #include <rfb/LogWriter.h>
 #include <rfb/SConnection.h>
 #include <rfb/ServerCore.h>
+#include <rfb/ScaleFilters.h>
 #include <rfb/PixelBuffer.h>
 #include <rfb/TightJPEGEncoder.h>
 #include <rfb/TightWEBPEncoder.h>
@@ -153,6 +154,15 @@ void SelfBench() {
 		delete pb;
 	});
 
+	benchmark("Area average scaling to 40%", RUNS, [&f1](uint32_t) {
+		PixelBuffer *pb = filterScale(&f1, WIDTH * 0.4, HEIGHT * 0.4, scaleFilterArea);
+		delete pb;
+	});
+	benchmark("Bicubic scaling to 80%", RUNS, [&f1](uint32_t) {
+		PixelBuffer *pb = filterScale(&f1, WIDTH * 0.8, HEIGHT * 0.8, scaleFilterBicubic);
+		delete pb;
+	});
+
 	// Analysis
 	auto *comparer = new ComparingUpdateTracker(&screen);
 	Region cursorReg;
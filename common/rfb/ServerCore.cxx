@@ -147,6 +147,22 @@ rfb::IntParameter rfb::Server::rectThreads
 ("RectThreads",
  "Use this many threads to compress rects in parallel. Default 0 (auto), 1 = off",
  0, 0, 64);
+rfb::IntParameter rfb::Server::encCacheSize
+("EncCacheSize",
+ "Memory in MiB for sharing encoded rects between viewers. 0 = off",
+ 32, 0, 1024);
+rfb::IntParameter rfb::Server::sendQueueSize
+("SendQueueSize",
+ "KiB of encoded data queued per client for a separate writer thread. 0 = write from the main thread",
+ 4096, 0, 262144);
+rfb::BoolParameter rfb::Server::zeroCopySend
+("ZeroCopySend",
+ "Let the writer thread send large rects to TCP viewers without copying them into the kernel",
+ false);
+rfb::BoolParameter rfb::Server::parallelZlib
+("ParallelZlib",
+ "Compress Tight palette and lossless rects on several threads, spread over its four zlib streams",
+ true);
 rfb::IntParameter rfb::Server::jpegVideoQuality
 ("JpegVideoQuality",
  "The JPEG quality to use when in video mode",
@@ -256,12 +272,18 @@ rfb::IntParameter rfb::Server::videoArea
  45, 1, 100);
 rfb::IntParameter rfb::Server::videoScaling
 ("VideoScaling",
- "Scaling method to use when in downscaled video mode. 0 = nearest, 1 = bilinear, 2 = prog bilinear",
- 2, 0, 2);
+ "Scaling method to use when in downscaled video mode. 0 = nearest, 1 = bilinear, 2 = prog bilinear, "
+ "3 = area average, 4 = bicubic",
+ 2, 0, 4);
 rfb::BoolParameter rfb::Server::printVideoArea
 ("PrintVideoArea",
  "Print the detected video area % value.",
  false);
+rfb::IntParameter rfb::Server::traceBufferSize
+("TraceBufferSize",
+ "Number of update path timings each thread keeps for /api/get_trace. "
+ "0 turns tracing off",
+ 0, 0, 1 << 20);
 rfb::IntParameter rfb::Server::videoQualityCRFCQP
 ("VideoQualityCRFCQP",
  "The CRF/CPQ value to use when encoding video",
@@ -270,6 +292,11 @@ rfb::IntParameter rfb::Server::groupOfPicture
 ("GroupOfPicture",
  "The number of frames to group together for encoding",
  24, 0, 100);
+rfb::BoolParameter rfb::Server::videoRegionOfInterest
+("VideoRegionOfInterest",
+ "Tell the video encoder which parts of the screen changed, so it spends "
+ "its bits there and skips the rest",
+ true);
 rfb::StringParameter rfb::Server::driNode
 ("drinode",
  "Path to the hardware acceleration device (e.g. /dev/dri/renderD128)",
@@ -278,6 +305,11 @@ rfb::StringParameter rfb::Server::kasmPasswordFile
 ("KasmPasswordFile",
  "Password file for BasicAuth, created with the kasmvncpasswd utility.",
  "~/.kasmpasswd");
+rfb::StringParameter rfb::Server::shmExportSocket
+("ShmExportSocket",
+ "Unix socket local programs connect to for a shared memory copy of the "
+ "framebuffer. Off if empty.",
+ "");
 
 rfb::StringParameter rfb::Server::publicIP
 ("publicIP",
@@ -298,6 +330,30 @@ rfb::IntParameter rfb::Server::udpPort
  "Which port to use for UDP. Default same as websocket",
  0, 0, 65535);
 
+rfb::BoolParameter rfb::Server::udpCongestionControl
+("udpCongestionControl",
+ "Pace UDP data at a rate estimated from the client's acks, and limit "
+ "updates to what fits",
+ true);
+
+rfb::IntParameter rfb::Server::udpParity
+("udpParity",
+ "Parity pieces to add to UDP messages, in percent of the data pieces. "
+ "Only for clients that can recover lost pieces with them. 0 = off",
+ 10, 0, 100);
+
+rfb::IntParameter rfb::Server::udpRetransmitBuffer
+("udpRetransmitBuffer",
+ "KiB of recently sent UDP data kept per client to resend pieces it "
+ "reports lost. 0 = off",
+ 2048, 0, 65536);
+
+rfb::BoolParameter rfb::Server::websocketDirect
+("WebsocketDirect",
+ "Serve binary websocket clients directly from the VNC server, instead of "
+ "proxying them through a thread and an internal socket.",
+ false);
+
 rfb::StringParameter rfb::Server::videoCodec
 ("videoCodec",
  "If set, use this codec to send a video stream for WebCodecs. Supported options: auto, h264, h264_vaapi, h265, h265_vaapi, av1, av1_vaapi",
@@ -42,6 +42,10 @@ namespace rfb {
         static IntParameter treatLossless;
         static IntParameter scrollDetectLimit;
         static IntParameter rectThreads;
+        static IntParameter encCacheSize;
+        static IntParameter sendQueueSize;
+        static BoolParameter zeroCopySend;
+        static BoolParameter parallelZlib;
         static IntParameter DLP_ClipSendMax;
         static IntParameter DLP_ClipAcceptMax;
         static IntParameter DLP_ClipDelay;
@@ -70,14 +74,21 @@ namespace rfb {
         static IntParameter videoScaling;
         static IntParameter videoQualityCRFCQP;
         static IntParameter groupOfPicture;
+        static BoolParameter videoRegionOfInterest;
         static StringParameter driNode;
         static IntParameter udpFullFrameFrequency;
         static IntParameter udpPort;
+        static BoolParameter udpCongestionControl;
+        static IntParameter udpParity;
+        static IntParameter udpRetransmitBuffer;
+        static BoolParameter websocketDirect;
         static StringParameter kasmPasswordFile;
+        static StringParameter shmExportSocket;
         static StringParameter publicIP;
         static StringParameter stunServer;
         static StringParameter videoCodec;
         static BoolParameter printVideoArea;
+        static IntParameter traceBufferSize;
         static BoolParameter protocol3_3;
         static BoolParameter alwaysShared;
         static BoolParameter neverShared;
@@ -0,0 +1,378 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <vector>
+
+#include <rdr/Exception.h>
+#include <rdr/MemOutStream.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/ShmExport.h>
+
+using namespace rfb;
+
+static LogWriter vlog("ShmExport");
+
+// The pixels start on their own page
+static const size_t dataOffset = (sizeof(struct kasmvnc_shm_header) + 4095) & ~(size_t) 4095;
+
+ShmExport::ShmExport(const char *path_)
+  : path(path_), listenFd(-1), memFd(-1), header(NULL), mapped(0),
+    stale(true)
+{
+  struct sockaddr_un addr;
+
+  if (path.size() >= sizeof(addr.sun_path))
+    throw rdr::Exception("ShmExport: socket path too long");
+
+  memFd = memfd_create("kasmvnc-framebuffer", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memFd < 0)
+    throw rdr::SystemException("memfd_create", errno);
+
+  // Consumers must never find their mapping cut short
+  if (fcntl(memFd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+    int e = errno;
+    close(memFd);
+    throw rdr::SystemException("fcntl(F_ADD_SEALS)", e);
+  }
+
+  try {
+    resize(dataOffset);
+  } catch (...) {
+    close(memFd);
+    throw;
+  }
+
+  header->magic = KASMVNC_SHM_MAGIC;
+  header->version = KASMVNC_SHM_VERSION;
+  header->data_offset = dataOffset;
+  header->size = dataOffset;
+  header->flags = KASMVNC_SHM_FLAG_FULL;
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (listenFd < 0) {
+    int e = errno;
+    munmap(header, mapped);
+    close(memFd);
+    throw rdr::SystemException("socket", e);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path.c_str());
+
+  // A previous server may have left it behind
+  unlink(path.c_str());
+
+  // Created owner-only, there must be no moment anyone else can connect
+  mode_t oldMask = umask(077);
+  int ret = bind(listenFd, (struct sockaddr *) &addr, sizeof(addr));
+  umask(oldMask);
+
+  if (ret < 0 || listen(listenFd, 5) < 0) {
+    int e = errno;
+    close(listenFd);
+    munmap(header, mapped);
+    close(memFd);
+    throw rdr::SystemException(path.c_str(), e);
+  }
+
+  vlog.info("Exporting the framebuffer on %s", path.c_str());
+}
+
+ShmExport::~ShmExport()
+{
+  std::list<Consumer>::iterator it;
+
+  for (it = consumers.begin(); it != consumers.end(); ++it) {
+    close(it->sock);
+    close(it->eventFd);
+  }
+
+  close(listenFd);
+  unlink(path.c_str());
+
+  munmap(header, mapped);
+  close(memFd);
+}
+
+void ShmExport::resize(size_t needed)
+{
+  void *map;
+
+  if (needed <= mapped)
+    return;
+
+  if (ftruncate(memFd, needed) < 0)
+    throw rdr::SystemException("ftruncate", errno);
+
+  map = mmap(NULL, needed, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+  if (map == MAP_FAILED)
+    throw rdr::SystemException("mmap", errno);
+
+  if (header)
+    munmap(header, mapped);
+
+  header = (struct kasmvnc_shm_header *) map;
+  mapped = needed;
+}
+
+void ShmExport::accept()
+{
+  Consumer c;
+  char fdPath[64];
+  int roFd;
+
+  c.sock = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (c.sock < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      vlog.error("accept: %s", strerror(errno));
+    return;
+  }
+
+  c.eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (c.eventFd < 0) {
+    vlog.error("eventfd: %s", strerror(errno));
+    close(c.sock);
+    return;
+  }
+
+  // Reopening through /proc gives a descriptor that cannot write
+  snprintf(fdPath, sizeof(fdPath), "/proc/self/fd/%d", memFd);
+  roFd = open(fdPath, O_RDONLY | O_CLOEXEC);
+  if (roFd < 0) {
+    vlog.error("%s: %s", fdPath, strerror(errno));
+    close(c.eventFd);
+    close(c.sock);
+    return;
+  }
+
+  char version = KASMVNC_SHM_VERSION;
+  struct iovec iov;
+  struct msghdr msg;
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct cmsghdr *cmsg;
+  int fds[2] = { roFd, c.eventFd };
+
+  iov.iov_base = &version;
+  iov.iov_len = 1;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (sendmsg(c.sock, &msg, MSG_NOSIGNAL) != 1) {
+    vlog.error("sendmsg: %s", strerror(errno));
+    close(roFd);
+    close(c.eventFd);
+    close(c.sock);
+    return;
+  }
+
+  close(roFd);
+
+  consumers.push_back(c);
+  vlog.info("Consumer connected, %u in total", (unsigned) consumers.size());
+}
+
+void ShmExport::dropClosed()
+{
+  std::list<Consumer>::iterator it, next;
+  char buf[64];
+  ssize_t ret;
+
+  for (it = consumers.begin(); it != consumers.end(); it = next) {
+    next = it;
+    ++next;
+
+    // Anything they send is ignored, only the hangup matters
+    do {
+      ret = recv(it->sock, buf, sizeof(buf), MSG_DONTWAIT);
+    } while (ret > 0);
+
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINTR))
+      continue;
+
+    close(it->sock);
+    close(it->eventFd);
+    consumers.erase(it);
+
+    vlog.info("Consumer disconnected, %u left", (unsigned) consumers.size());
+  }
+}
+
+void ShmExport::update(const PixelBuffer *pb, const ScreenSet &layout_,
+                       const Region &changed)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator ri;
+  ScreenSet::const_iterator si;
+  struct timespec now;
+  bool full;
+  int bytesPerPixel, stride, srcStride;
+  unsigned i;
+
+  dropClosed();
+
+  if (consumers.empty()) {
+    stale = true;
+    return;
+  }
+
+  const PixelFormat &newPF = pb->getPF();
+  bytesPerPixel = newPF.bpp / 8;
+  stride = pb->width() * bytesPerPixel;
+
+  full = stale || !newPF.equal(pf) || pb->width() != header->width ||
+         pb->height() != header->height;
+
+  if (full)
+    rects.push_back(pb->getRect());
+  else
+    changed.intersect(pb->getRect()).get_rects(&rects);
+
+  if (rects.empty() && layout_ == layout)
+    return;
+
+  try {
+    resize(dataOffset + (size_t) stride * pb->height());
+  } catch (rdr::Exception &e) {
+    vlog.error("%s", e.str());
+    return;
+  }
+
+  // Odd while we write
+  __atomic_store_n(&header->seq, header->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  rdr::U8 *data = (rdr::U8 *) header + dataOffset;
+
+  for (ri = rects.begin(); ri != rects.end(); ++ri) {
+    const rdr::U8 *src = pb->getBuffer(*ri, &srcStride);
+    rdr::U8 *dst = data + (size_t) ri->tl.y * stride + ri->tl.x * bytesPerPixel;
+    const int w = ri->width() * bytesPerPixel;
+
+    srcStride *= bytesPerPixel;
+
+    if (w == stride && srcStride == stride) {
+      memcpy(dst, src, (size_t) stride * ri->height());
+      continue;
+    }
+
+    for (int y = 0; y < ri->height(); y++) {
+      memcpy(dst, src, w);
+      dst += stride;
+      src += srcStride;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  header->frame++;
+  header->timestamp_us = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+  header->size = mapped;
+
+  header->width = pb->width();
+  header->height = pb->height();
+  header->stride = stride;
+
+  // Only the protocol form of the pixel format is public
+  rdr::MemOutStream pfOut(16);
+  newPF.write(&pfOut);
+  const rdr::U8 *pfData = (const rdr::U8 *) pfOut.data();
+
+  header->bpp = pfData[0];
+  header->depth = pfData[1];
+  header->big_endian = pfData[2];
+  header->true_colour = pfData[3];
+  header->red_max = pfData[4] << 8 | pfData[5];
+  header->green_max = pfData[6] << 8 | pfData[7];
+  header->blue_max = pfData[8] << 8 | pfData[9];
+  header->red_shift = pfData[10];
+  header->green_shift = pfData[11];
+  header->blue_shift = pfData[12];
+
+  header->num_screens = 0;
+  for (si = layout_.begin(); si != layout_.end(); ++si) {
+    struct kasmvnc_shm_screen *s;
+
+    if (header->num_screens == KASMVNC_SHM_MAX_SCREENS)
+      break;
+
+    s = &header->screens[header->num_screens++];
+    s->id = si->id;
+    s->flags = si->flags;
+    s->x = si->dimensions.tl.x;
+    s->y = si->dimensions.tl.y;
+    s->w = si->dimensions.width();
+    s->h = si->dimensions.height();
+  }
+
+  header->flags = 0;
+  header->num_rects = 0;
+  if (full || rects.size() > KASMVNC_SHM_MAX_RECTS) {
+    header->flags |= KASMVNC_SHM_FLAG_FULL;
+  } else {
+    for (i = 0; i < rects.size(); i++) {
+      header->rects[i].x = rects[i].tl.x;
+      header->rects[i].y = rects[i].tl.y;
+      header->rects[i].w = rects[i].width();
+      header->rects[i].h = rects[i].height();
+    }
+    header->num_rects = rects.size();
+  }
+
+  __atomic_store_n(&header->seq, header->seq + 1, __ATOMIC_RELEASE);
+
+  pf = newPF;
+  layout = layout_;
+  stale = false;
+
+  std::list<Consumer>::iterator it;
+  for (it = consumers.begin(); it != consumers.end(); ++it) {
+    const uint64_t one = 1;
+
+    // Only fails if they let the counter overflow, nothing to wake then
+    if (write(it->eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      vlog.error("eventfd write: %s", strerror(errno));
+  }
+}
@@ -0,0 +1,93 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_SHMEXPORT_H__
+#define __RFB_SHMEXPORT_H__
+
+#include <list>
+#include <string>
+
+#include <rfb/PixelFormat.h>
+#include <rfb/Region.h>
+#include <rfb/ScreenSet.h>
+#include <rfb/shmExportTypes.h>
+
+#include <stddef.h>
+
+namespace rfb {
+
+  class PixelBuffer;
+
+  //
+  // ShmExport publishes the framebuffer to local processes through a
+  // memfd, so recorders and other sidecars can read the pixels without
+  // going through an encoder. Only the damage of each frame is copied
+  // in. The layout is described in shmExportTypes.h.
+  //
+
+  class ShmExport {
+  public:
+    // Listens on the unix socket at path, replacing any stale one.
+    // Throws rdr::SystemException on failure.
+    ShmExport(const char *path);
+    ~ShmExport();
+
+    // The listening socket, readable when a consumer is waiting
+    int getFd() const { return listenFd; }
+
+    // Accepts a waiting consumer and hands it the segment
+    void accept();
+
+    bool hasConsumers() const { return !consumers.empty(); }
+
+    // Forgets the consumers that hung up
+    void dropClosed();
+
+    // Copies the changed parts of pb in, publishes the frame and wakes
+    // the consumers. Does nothing without any.
+    void update(const PixelBuffer *pb, const ScreenSet &layout,
+                const Region &changed);
+
+    // The next update copies everything
+    void invalidate() { stale = true; }
+
+  protected:
+    struct Consumer {
+      int sock;
+      int eventFd;
+    };
+
+    void resize(size_t needed);
+
+    std::string path;
+    int listenFd;
+    int memFd;
+
+    struct kasmvnc_shm_header *header;
+    size_t mapped;
+
+    std::list<Consumer> consumers;
+    bool stale;
+
+    // What the segment holds now
+    PixelFormat pf;
+    ScreenSet layout;
+  };
+
+}
+
+#endif
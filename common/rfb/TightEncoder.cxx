@@ -79,19 +79,57 @@ void TightEncoder::setCompressLevel(int level)
 
 void TightEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
 {
+  rdr::OutStream* os;
+
+  os = conn->getOutStream(conn->cp.supportsUdp);
+
   switch (palette.size()) {
   case 0:
-    writeFullColourRect(pb, palette);
+    writeFullColourRect(pb, palette, os, 0);
     break;
   case 1:
     Encoder::writeSolidRect(pb, palette);
     break;
   case 2:
-    writeMonoRect(pb, palette);
+    writeMonoRect(pb, palette, os, 1);
+    break;
+  default:
+    writeIndexedRect(pb, palette, os, 2);
+  }
+}
+
+void TightEncoder::compressOnly(const PixelBuffer* pb, const Palette& palette,
+                                int streamId, std::vector<uint8_t> &out)
+{
+  rdr::MemOutStream* os;
+
+  assert(palette.size() != 1);
+
+  os = &rectStreams[streamId];
+  os->clear();
+
+  switch (palette.size()) {
+  case 0:
+    writeFullColourRect(pb, palette, os, streamId);
+    break;
+  case 2:
+    writeMonoRect(pb, palette, os, streamId);
     break;
   default:
-    writeIndexedRect(pb, palette);
+    writeIndexedRect(pb, palette, os, streamId);
   }
+
+  out.assign((const uint8_t *) os->data(),
+             (const uint8_t *) os->data() + os->length());
+}
+
+void TightEncoder::writeOnly(const std::vector<uint8_t> &out) const
+{
+  rdr::OutStream* os;
+
+  os = conn->getOutStream(conn->cp.supportsUdp);
+
+  os->writeBytes(&out[0], out.size());
 }
 
 void TightEncoder::writeSolidRect(int width, int height,
@@ -106,7 +144,8 @@ void TightEncoder::writeSolidRect(int width, int height,
   writePixels(colour, pf, 1, os);
 }
 
-void TightEncoder::writeMonoRect(const PixelBuffer* pb, const Palette& palette)
+void TightEncoder::writeMonoRect(const PixelBuffer* pb, const Palette& palette,
+                                 rdr::OutStream* os, int streamId)
 {
   const rdr::U8* buffer;
   int stride;
@@ -116,19 +155,20 @@ void TightEncoder::writeMonoRect(const PixelBuffer* pb, const Palette& palette)
   switch (pb->getPF().bpp) {
   case 32:
     writeMonoRect(pb->width(), pb->height(), (rdr::U32*)buffer, stride,
-                  pb->getPF(), palette);
+                  pb->getPF(), palette, os, streamId);
     break;
   case 16:
     writeMonoRect(pb->width(), pb->height(), (rdr::U16*)buffer, stride,
-                  pb->getPF(), palette);
+                  pb->getPF(), palette, os, streamId);
     break;
   default:
     writeMonoRect(pb->width(), pb->height(), (rdr::U8*)buffer, stride,
-                  pb->getPF(), palette);
+                  pb->getPF(), palette, os, streamId);
   }
 }
 
-void TightEncoder::writeIndexedRect(const PixelBuffer* pb, const Palette& palette)
+void TightEncoder::writeIndexedRect(const PixelBuffer* pb, const Palette& palette,
+                                    rdr::OutStream* os, int streamId)
 {
   const rdr::U8* buffer;
   int stride;
@@ -138,30 +178,27 @@ void TightEncoder::writeIndexedRect(const PixelBuffer* pb, const Palette& palett
   switch (pb->getPF().bpp) {
   case 32:
     writeIndexedRect(pb->width(), pb->height(), (rdr::U32*)buffer, stride,
-                     pb->getPF(), palette);
+                     pb->getPF(), palette, os, streamId);
     break;
   case 16:
     writeIndexedRect(pb->width(), pb->height(), (rdr::U16*)buffer, stride,
-                     pb->getPF(), palette);
+                     pb->getPF(), palette, os, streamId);
     break;
   default:
     // It's more efficient to just do raw pixels
-    writeFullColourRect(pb, palette);
+    writeFullColourRect(pb, palette, os, streamId);
   }
 }
 
-void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& palette)
+void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& palette,
+                                       rdr::OutStream* os, int streamId)
 {
-  const int streamId = 0;
-
-  rdr::OutStream* os;
   rdr::OutStream* zos;
   int length;
 
   const rdr::U8* buffer;
   int stride, h;
 
-  os = conn->getOutStream(conn->cp.supportsUdp);
   if (conn->cp.supportsUdp || zlibNeedsReset)
     os->writeU8((streamId << 4) | (1 << streamId));
   else
@@ -173,7 +210,7 @@ void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& pal
   else
     length = pb->getRect().area() * 3;
 
-  zos = getZlibOutStream(streamId, rawZlibLevel, length);
+  zos = getZlibOutStream(streamId, rawZlibLevel, length, os);
 
   // And then just dump all the raw pixels
   buffer = pb->getBuffer(pb->getRect(), &stride);
@@ -185,7 +222,7 @@ void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& pal
   }
 
   // Finish the zlib stream
-  flushZlibOutStream(zos);
+  flushZlibOutStream(zos, os, streamId);
 }
 
 void TightEncoder::writePixels(const rdr::U8* buffer, const PixelFormat& pf,
@@ -231,17 +268,18 @@ void TightEncoder::writeCompact(rdr::OutStream* os, rdr::U32 value)
   }
 }
 
-rdr::OutStream* TightEncoder::getZlibOutStream(int streamId, int level, size_t length)
+rdr::OutStream* TightEncoder::getZlibOutStream(int streamId, int level, size_t length,
+                                               rdr::OutStream* os)
 {
   // Minimum amount of data to be compressed. This value should not be
   // changed, doing so will break compatibility with existing clients.
   if (length < 12)
-    return conn->getOutStream(conn->cp.supportsUdp);
+    return os;
 
   assert(streamId >= 0);
   assert(streamId < 4);
 
-  zlibStreams[streamId].setUnderlying(&memStream);
+  zlibStreams[streamId].setUnderlying(&memStreams[streamId]);
   zlibStreams[streamId].setCompressionLevel(level);
   if (conn->cp.supportsUdp || zlibNeedsReset)
     zlibStreams[streamId].resetDeflate();
@@ -249,23 +287,24 @@ rdr::OutStream* TightEncoder::getZlibOutStream(int streamId, int level, size_t l
   return &zlibStreams[streamId];
 }
 
-void TightEncoder::flushZlibOutStream(rdr::OutStream* os_)
+void TightEncoder::flushZlibOutStream(rdr::OutStream* zos_, rdr::OutStream* os,
+                                      int streamId)
 {
-  rdr::OutStream* os;
   rdr::ZlibOutStream* zos;
+  rdr::MemOutStream* memStream;
 
-  zos = dynamic_cast<rdr::ZlibOutStream*>(os_);
+  zos = dynamic_cast<rdr::ZlibOutStream*>(zos_);
   if (zos == NULL)
     return;
 
   zos->flush();
   zos->setUnderlying(NULL);
 
-  os = conn->getOutStream(conn->cp.supportsUdp);
+  memStream = &memStreams[streamId];
 
-  writeCompact(os, memStream.length());
-  os->writeBytes(memStream.data(), memStream.length());
-  memStream.clear();
+  writeCompact(os, memStream->length());
+  os->writeBytes(memStream->data(), memStream->length());
+  memStream->clear();
 }
 
 void TightEncoder::resetZlib()
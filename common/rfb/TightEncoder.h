@@ -24,6 +24,9 @@
 #include <rdr/ZlibOutStream.h>
 #include <rfb/Encoder.h>
 
+#include <stdint.h>
+#include <vector>
+
 namespace rfb {
 
   class TightEncoder : public Encoder {
@@ -46,40 +49,60 @@ namespace rfb {
                             const rdr::U8 a);
     void resetZlib();
 
+    // Encodes a rect that isn't solid like writeRect() does, but through
+    // the given zlib stream and into out. Different streams can be worked
+    // on in parallel, as long as every stream's results are then written
+    // in the order they were made.
+    void compressOnly(const PixelBuffer* pb, const Palette& palette,
+                      int streamId, std::vector<uint8_t> &out);
+    void writeOnly(const std::vector<uint8_t> &out) const;
+
   protected:
-    void writeMonoRect(const PixelBuffer* pb, const Palette& palette);
-    void writeIndexedRect(const PixelBuffer* pb, const Palette& palette);
-    void writeFullColourRect(const PixelBuffer* pb, const Palette& palette);
+    void writeMonoRect(const PixelBuffer* pb, const Palette& palette,
+                       rdr::OutStream* os, int streamId);
+    void writeIndexedRect(const PixelBuffer* pb, const Palette& palette,
+                          rdr::OutStream* os, int streamId);
+    void writeFullColourRect(const PixelBuffer* pb, const Palette& palette,
+                             rdr::OutStream* os, int streamId);
 
     void writePixels(const rdr::U8* buffer, const PixelFormat& pf,
                      unsigned int count, rdr::OutStream* os);
 
     void writeCompact(rdr::OutStream* os, rdr::U32 value);
 
-    rdr::OutStream* getZlibOutStream(int streamId, int level, size_t length);
-    void flushZlibOutStream(rdr::OutStream* os);
+    rdr::OutStream* getZlibOutStream(int streamId, int level, size_t length,
+                                     rdr::OutStream* os);
+    void flushZlibOutStream(rdr::OutStream* zos, rdr::OutStream* os,
+                            int streamId);
 
   protected:
     // Preprocessor generated, optimised methods
     void writeMonoRect(int width, int height,
                        const rdr::U8* buffer, int stride,
-                       const PixelFormat& pf, const Palette& palette);
+                       const PixelFormat& pf, const Palette& palette,
+                       rdr::OutStream* os, int streamId);
     void writeMonoRect(int width, int height,
                        const rdr::U16* buffer, int stride,
-                       const PixelFormat& pf, const Palette& palette);
+                       const PixelFormat& pf, const Palette& palette,
+                       rdr::OutStream* os, int streamId);
     void writeMonoRect(int width, int height,
                        const rdr::U32* buffer, int stride,
-                       const PixelFormat& pf, const Palette& palette);
+                       const PixelFormat& pf, const Palette& palette,
+                       rdr::OutStream* os, int streamId);
 
     void writeIndexedRect(int width, int height,
                           const rdr::U16* buffer, int stride,
-                          const PixelFormat& pf, const Palette& palette);
+                          const PixelFormat& pf, const Palette& palette,
+                          rdr::OutStream* os, int streamId);
     void writeIndexedRect(int width, int height,
                           const rdr::U32* buffer, int stride,
-                          const PixelFormat& pf, const Palette& palette);
+                          const PixelFormat& pf, const Palette& palette,
+                          rdr::OutStream* os, int streamId);
 
+    // Everything per stream, so the streams are independent
     rdr::ZlibOutStream zlibStreams[4];
-    rdr::MemOutStream memStream;
+    rdr::MemOutStream memStreams[4];
+    rdr::MemOutStream rectStreams[4];
 
     int idxZlibLevel, monoZlibLevel, rawZlibLevel;
     bool zlibNeedsReset;
@@ -26,11 +26,9 @@
 void TightEncoder::writeMonoRect(int width, int height,
                                  const rdr::UBPP* buffer, int stride,
                                  const PixelFormat& pf,
-                                 const Palette& palette)
+                                 const Palette& palette,
+                                 rdr::OutStream* os, int streamId)
 {
-  rdr::OutStream* os;
-
-  const int streamId = 1;
   rdr::UBPP pal[2];
 
   int length;
@@ -38,8 +36,6 @@ void TightEncoder::writeMonoRect(int width, int height,
 
   assert(palette.size() == 2);
 
-  os = conn->getOutStream(conn->cp.supportsUdp);
-
   if (conn->cp.supportsUdp || zlibNeedsReset)
     os->writeU8(((streamId | tightExplicitFilter) << 4) | (1 << streamId));
   else
@@ -55,7 +51,7 @@ void TightEncoder::writeMonoRect(int width, int height,
 
   // Set up compression
   length = (width + 7)/8 * height;
-  zos = getZlibOutStream(streamId, monoZlibLevel, length);
+  zos = getZlibOutStream(streamId, monoZlibLevel, length, os);
 
   // Encode the data
   rdr::UBPP bg;
@@ -105,18 +101,16 @@ void TightEncoder::writeMonoRect(int width, int height,
   }
 
   // Finish the zlib stream
-  flushZlibOutStream(zos);
+  flushZlibOutStream(zos, os, streamId);
 }
 
 #if (BPP != 8)
 void TightEncoder::writeIndexedRect(int width, int height,
                                     const rdr::UBPP* buffer, int stride,
                                     const PixelFormat& pf,
-                                    const Palette& palette)
+                                    const Palette& palette,
+                                    rdr::OutStream* os, int streamId)
 {
-  rdr::OutStream* os;
-
-  const int streamId = 2;
   rdr::UBPP pal[256];
 
   rdr::OutStream* zos;
@@ -128,8 +122,6 @@ void TightEncoder::writeIndexedRect(int width, int height,
   assert(palette.size() > 0);
   assert(palette.size() <= 256);
 
-  os = conn->getOutStream(conn->cp.supportsUdp);
-
   if (conn->cp.supportsUdp || zlibNeedsReset)
     os->writeU8(((streamId | tightExplicitFilter) << 4) | (1 << streamId));
   else
@@ -144,7 +136,7 @@ void TightEncoder::writeIndexedRect(int width, int height,
   writePixels((rdr::U8*)pal, pf, palette.size(), os);
 
   // Set up compression
-  zos = getZlibOutStream(streamId, idxZlibLevel, width * height);
+  zos = getZlibOutStream(streamId, idxZlibLevel, width * height, os);
 
   // Encode the data
   pad = stride - width;
@@ -166,6 +158,6 @@ void TightEncoder::writeIndexedRect(int width, int height,
   }
 
   // Finish the zlib stream
-  flushZlibOutStream(zos);
+  flushZlibOutStream(zos, os, streamId);
 }
 #endif  // #if (BPP != 8)
@@ -114,7 +114,7 @@ void TightJPEGEncoder::compressOnly(const PixelBuffer* pb, const uint8_t quality
 {
   const rdr::U8* buffer;
   int stride;
-  JpegCompressor jc;
+  JpegCompressor &jc = threadJc.local();
 
   int quality, subsampling;
 
@@ -141,11 +141,12 @@ void TightJPEGEncoder::compressOnly(const PixelBuffer* pb, const uint8_t quality
   jc.compress(buffer, stride, pb->getRect(),
               pb->getPF(), quality, subsampling);
 
-  out.resize(jc.length());
-  memcpy(&out[0], jc.data(), jc.length());
+  out.assign((const uint8_t *) jc.data(),
+             (const uint8_t *) jc.data() + jc.length());
 }
 
-void TightJPEGEncoder::writeOnly(const std::vector<uint8_t> &out) const
+void TightJPEGEncoder::writeOnly(const std::shared_ptr<const rdr::U8> &out,
+                                 size_t length) const
 {
   rdr::OutStream* os;
 
@@ -153,8 +154,8 @@ void TightJPEGEncoder::writeOnly(const std::vector<uint8_t> &out) const
 
   os->writeU8(tightJpeg << 4);
 
-  writeCompact(out.size(), os);
-  os->writeBytes(&out[0], out.size());
+  writeCompact(length, os);
+  os->writeShared(out, length);
 }
 
 void TightJPEGEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
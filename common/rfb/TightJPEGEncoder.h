@@ -23,7 +23,9 @@
 #include <rfb/Encoder.h>
 #include <rfb/JpegCompressor.h>
 #include <stdint.h>
+#include <memory>
 #include <vector>
+#include <tbb/enumerable_thread_specific.h>
 
 namespace rfb {
 
@@ -42,7 +44,8 @@ namespace rfb {
     void writeRect(const PixelBuffer* pb, const Palette& palette) override;
     virtual void compressOnly(const PixelBuffer* pb, const uint8_t quality,
                               std::vector<uint8_t> &out, const bool lowVideoQuality) const;
-    virtual void writeOnly(const std::vector<uint8_t> &out) const;
+    virtual void writeOnly(const std::shared_ptr<const rdr::U8> &out,
+                           size_t length) const;
     void writeSolidRect(int width, int height,
                                 const PixelFormat& pf,
                                 const rdr::U8* colour) override;
@@ -52,6 +55,8 @@ namespace rfb {
 
   protected:
     JpegCompressor jc;
+    // compressOnly() runs on the encoding threads, each keeps its own
+    mutable tbb::enumerable_thread_specific<JpegCompressor> threadJc;
 
     int qualityLevel;
     int fineQuality;
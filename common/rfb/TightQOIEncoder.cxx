@@ -196,7 +196,8 @@ void TightQOIEncoder::compressOnly(const PixelBuffer* pb, const uint8_t qualityI
   free(encoded);
 }
 
-void TightQOIEncoder::writeOnly(const std::vector<uint8_t> &out) const
+void TightQOIEncoder::writeOnly(const std::shared_ptr<const rdr::U8> &out,
+                                size_t length) const
 {
   rdr::OutStream* os;
 
@@ -204,8 +205,8 @@ void TightQOIEncoder::writeOnly(const std::vector<uint8_t> &out) const
 
   os->writeU8(tightQoi << 4);
 
-  writeCompact(out.size(), os);
-  os->writeBytes(&out[0], out.size());
+  writeCompact(length, os);
+  os->writeShared(out, length);
 }
 
 void TightQOIEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
@@ -20,6 +20,7 @@
 
 #include <rfb/Encoder.h>
 #include <stdint.h>
+#include <memory>
 #include <vector>
 
 namespace rfb {
@@ -34,7 +35,8 @@ namespace rfb {
     void writeRect(const PixelBuffer* pb, const Palette& palette) override;
     virtual void compressOnly(const PixelBuffer* pb, const uint8_t quality,
                               std::vector<uint8_t> &out, const bool lowVideoQuality) const;
-    virtual void writeOnly(const std::vector<uint8_t> &out) const;
+    virtual void writeOnly(const std::shared_ptr<const rdr::U8> &out,
+                           size_t length) const;
     void writeSolidRect(int width, int height,
                                 const PixelFormat& pf,
                                 const rdr::U8* colour) override;
@@ -117,6 +117,16 @@ bool TightWEBPEncoder::treatLossless()
   return qualityLevel >= rfb::Server::treatLossless;
 }
 
+static int appendToVector(const uint8_t* data, size_t size,
+                          const WebPPicture* pic)
+{
+  std::vector<uint8_t> *out = (std::vector<uint8_t> *) pic->custom_ptr;
+
+  out->insert(out->end(), data, data + size);
+
+  return 1;
+}
+
 void TightWEBPEncoder::compressOnly(const PixelBuffer* pb, const uint8_t qualityIn,
                                     std::vector<uint8_t> &out, const bool lowVideoQuality) const
 {
@@ -125,7 +135,6 @@ void TightWEBPEncoder::compressOnly(const PixelBuffer* pb, const uint8_t quality
   uint8_t quality, method;
   WebPConfig cfg;
   WebPPicture pic;
-  WebPMemoryWriter wrt;
 
   buffer = pb->getBuffer(pb->getRect(), &stride);
 
@@ -168,23 +177,21 @@ void TightWEBPEncoder::compressOnly(const PixelBuffer* pb, const uint8_t quality
     delete [] tmpbuf;
   }
 
-  WebPMemoryWriterInit(&wrt);
-  pic.writer = WebPMemoryWrite;
-  pic.custom_ptr = &wrt;
+  // Straight into out, which usually has the room from earlier frames
+  out.clear();
+  pic.writer = appendToVector;
+  pic.custom_ptr = &out;
 
   if (!WebPEncode(&cfg, &pic)) {
     // Error
     vlog.error("WEBP error %u", pic.error_code);
   }
 
-  out.resize(wrt.size);
-  memcpy(&out[0], wrt.mem, wrt.size);
-
   WebPPictureFree(&pic);
-  WebPMemoryWriterClear(&wrt);
 }
 
-void TightWEBPEncoder::writeOnly(const std::vector<uint8_t> &out) const
+void TightWEBPEncoder::writeOnly(const std::shared_ptr<const rdr::U8> &out,
+                                 size_t length) const
 {
   rdr::OutStream* os;
 
@@ -192,8 +199,8 @@ void TightWEBPEncoder::writeOnly(const std::vector<uint8_t> &out) const
 
   os->writeU8(tightWebp << 4);
 
-  writeCompact(out.size(), os);
-  os->writeBytes(&out[0], out.size());
+  writeCompact(length, os);
+  os->writeShared(out, length);
 }
 
 void TightWEBPEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
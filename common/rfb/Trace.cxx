@@ -0,0 +1,177 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <mutex>
+#include <vector>
+
+#include <rfb/Trace.h>
+
+using namespace rfb;
+
+unsigned Trace::ringSize = 0;
+std::atomic<uint32_t> Trace::frame(0);
+
+namespace {
+
+  // Each event has its own sequence number, so a reader can tell a
+  // half written or already overwritten one from a good one. For the
+  // n-th event of a thread it is 2n + 1 while it is written, 2n + 2
+  // once done. The fields are atomics only to make reading them while
+  // they change well defined, they are all relaxed.
+  struct Event {
+    std::atomic<uint64_t> seq;
+    std::atomic<const char *> name;
+    std::atomic<uint64_t> start;
+    std::atomic<uint64_t> end;
+    std::atomic<uint32_t> frame;
+  };
+
+  struct Ring {
+    Ring(unsigned size) : events(size), head(0), tid(0) {}
+
+    std::vector<Event> events;
+    std::atomic<uint64_t> head;
+    long tid;
+    char threadName[16];
+  };
+
+  std::mutex ringsMutex;
+  // Threads come and go rarely, their rings are kept for the dumps
+  std::vector<Ring *> rings;
+
+  thread_local Ring *threadRing = NULL;
+
+  Ring *getRing(unsigned size)
+  {
+    Ring *ring = new Ring(size);
+
+    ring->tid = syscall(SYS_gettid);
+    if (pthread_getname_np(pthread_self(), ring->threadName,
+                           sizeof(ring->threadName)))
+      ring->threadName[0] = '\0';
+
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    rings.push_back(ring);
+
+    return ring;
+  }
+
+  void appendEscaped(std::string &out, const char *str)
+  {
+    for (; *str; str++) {
+      if (*str == '"' || *str == '\\')
+        out += '\\';
+      if ((unsigned char) *str >= 0x20)
+        out += *str;
+    }
+  }
+
+}
+
+void Trace::init(unsigned size)
+{
+  ringSize = size;
+}
+
+void Trace::add(const char *name, uint64_t start, uint64_t end)
+{
+  Ring *ring = threadRing;
+
+  if (!ring)
+    ring = threadRing = getRing(ringSize);
+
+  const uint64_t n = ring->head.load(std::memory_order_relaxed);
+  Event &e = ring->events[n % ring->events.size()];
+
+  e.seq.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  e.name.store(name, std::memory_order_relaxed);
+  e.start.store(start, std::memory_order_relaxed);
+  e.end.store(end, std::memory_order_relaxed);
+  e.frame.store(frame.load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+
+  e.seq.store(2 * n + 2, std::memory_order_release);
+  ring->head.store(n + 1, std::memory_order_release);
+}
+
+std::string Trace::dumpJSON()
+{
+  std::string out;
+  char buf[256];
+  const int pid = getpid();
+  bool first = true;
+
+  out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+  std::lock_guard<std::mutex> lock(ringsMutex);
+
+  for (Ring *ring: rings) {
+    const uint64_t head = ring->head.load(std::memory_order_acquire);
+    const uint64_t size = ring->events.size();
+
+    if (ring->threadName[0]) {
+      snprintf(buf, sizeof(buf),
+               "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+               "\"tid\":%ld,\"args\":{\"name\":\"",
+               first ? "" : ",", pid, ring->tid);
+      out += buf;
+      appendEscaped(out, ring->threadName);
+      out += "\"}}";
+      first = false;
+    }
+
+    for (uint64_t n = head > size ? head - size : 0; n < head; n++) {
+      const Event &e = ring->events[n % size];
+
+      if (e.seq.load(std::memory_order_acquire) != 2 * n + 2)
+        continue;
+
+      const char *name = e.name.load(std::memory_order_relaxed);
+      const uint64_t start = e.start.load(std::memory_order_relaxed);
+      const uint64_t end = e.end.load(std::memory_order_relaxed);
+      const uint32_t eventFrame = e.frame.load(std::memory_order_relaxed);
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (e.seq.load(std::memory_order_relaxed) != 2 * n + 2)
+        continue;
+
+      // Timestamps are in microseconds, the fraction keeps the nanoseconds
+      snprintf(buf, sizeof(buf),
+               "%s{\"name\":\"%s\",\"cat\":\"update\",\"ph\":\"X\","
+               "\"pid\":%d,\"tid\":%ld,\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+               "\"args\":{\"frame\":%u}}",
+               first ? "" : ",", name, pid, ring->tid,
+               (unsigned long long) (start / 1000), (unsigned) (start % 1000),
+               (unsigned long long) ((end - start) / 1000),
+               (unsigned) ((end - start) % 1000), eventFrame);
+      out += buf;
+      first = false;
+    }
+  }
+
+  out += "]}\n";
+
+  return out;
+}
@@ -0,0 +1,81 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_TRACE_H__
+#define __RFB_TRACE_H__
+
+#include <atomic>
+#include <string>
+
+#include <stdint.h>
+#include <time.h>
+
+namespace rfb {
+
+  //
+  // Trace records how long each stage of the update path took, with
+  // nanosecond timestamps, into a ring per thread, so the TBB workers
+  // never contend. Only the last TraceBufferSize spans of each thread
+  // are kept. dumpJSON() turns them into the Chrome trace event format,
+  // which chrome://tracing and Perfetto both load, and can run while
+  // the rings are being written to.
+  //
+
+  class Trace {
+  public:
+    // Spans kept per thread, 0 turns tracing off
+    static void init(unsigned size);
+
+    static bool enabled() { return ringSize != 0; }
+
+    static uint64_t now() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    // Called by the server as it starts a frame, spans carry the number
+    static void nextFrame() { frame.fetch_add(1, std::memory_order_relaxed); }
+
+    // name must be a string literal, it is kept as a pointer
+    static void add(const char *name, uint64_t start, uint64_t end);
+
+    static std::string dumpJSON();
+
+  private:
+    static unsigned ringSize;
+    static std::atomic<uint32_t> frame;
+  };
+
+  // Records a span from its construction to the end of the scope
+  class TraceSpan {
+  public:
+    TraceSpan(const char *name_)
+      : name(name_), start(Trace::enabled() ? Trace::now() : 0) {}
+    ~TraceSpan() {
+      if (start)
+        Trace::add(name, start, Trace::now());
+    }
+
+  private:
+    const char *name;
+    uint64_t start;
+  };
+
+}
+
+#endif
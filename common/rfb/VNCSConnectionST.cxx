@@ -27,6 +27,7 @@
 #include <rfb/Security.h>
 #include <rfb/ServerCore.h>
 #include <rfb/SMsgWriter.h>
+#include <rfb/Trace.h>
 #include <rfb/VNCServerST.h>
 #include <rfb/VNCSConnectionST.h>
 #include <rfb/screenTypes.h>
@@ -67,7 +68,7 @@ VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s, con
     losslessTimer(this), kbdLogTimer(this), binclipTimer(this),
     server(server_), updates(false),
     updateRenderedCursor(false), removeRenderedCursor(false),
-    continuousUpdates(false), encodeManager(this, &VNCServerST::encCache, FFmpeg::get(), encoder_probe),
+    continuousUpdates(false), encodeManager(this, &VNCServerST::encCache, &VNCServerST::scaleCache, FFmpeg::get(), encoder_probe),
     needsPermCheck(false), pointerEventTime(0),
     clientHasCursor(false),
     accessRights(AccessDefault), startTime(time(nullptr)), frameTracking(false),
@@ -110,6 +111,11 @@ VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s, con
 
   // Configure the socket
   setSocketTimeouts();
+  if (rfb::Server::sendQueueSize) {
+    if (rfb::Server::zeroCopySend && !sock->outStream().enableZeroCopy())
+      vlog.debug("Zero copy sends not supported on this connection");
+    sock->outStream().startWriter(rfb::Server::sendQueueSize * 1024);
+  }
   lastEventTime = time(nullptr);
   gettimeofday(&lastRealUpdate, nullptr);
   gettimeofday(&lastClipboardOp, nullptr);
@@ -1297,6 +1303,7 @@ void VNCSConnectionST::writeRTTPing()
 
 bool VNCSConnectionST::isCongested()
 {
+  size_t queued;
   int eta;
 
   congestionTimer.stop();
@@ -1307,6 +1314,46 @@ bool VNCSConnectionST::isCongested()
   if (sock->outStream().bufferUsage() > 0)
     return true;
 
+  // Without fences there is no other measure of the link, so let the
+  // writer thread finish the previous update before encoding the next.
+  // Come back about when it should be done.
+  queued = sock->outStream().queuedBytes();
+  if (queued > 0 && (!cp.supportsFence || cp.supportsUdp)) {
+    size_t bandwidth = congestion.getBandwidth();
+
+    eta = 1000 / rfb::Server::frameRate;
+    if (bandwidth > 0 && queued * 1000 / bandwidth < (size_t)eta)
+      eta = queued * 1000 / bandwidth;
+    congestionTimer.start(__rfbmax(eta, 1));
+
+    return true;
+  }
+
+  // UDP data is paced at the rate its congestion control settled on.
+  // Encode the next update once the rest of this one will be out within
+  // a frame, so the link stays busy without the queue growing.
+  if (cp.supportsUdp) {
+    network::UdpStream *udps = (network::UdpStream *) getOutStream(true);
+    const size_t rate = udps->getRate();
+
+    if (rate > 0) {
+      const unsigned frameMs = 1000 / rfb::Server::frameRate;
+
+      eta = udps->queuedBytes() * 1000 / rate;
+      if ((unsigned) eta > frameMs) {
+        congestionTimer.start(eta - frameMs);
+
+        struct timeval now;
+        gettimeofday(&now, NULL);
+
+        bstats[BS_NET_SLOW].push_back(now);
+        bstats_total[BS_NET_SLOW]++;
+
+        return true;
+      }
+    }
+  }
+
   if (!cp.supportsFence || cp.supportsUdp)
     return false;
 
@@ -1394,6 +1441,8 @@ void VNCSConnectionST::writeFramebufferUpdate()
   // mode, we will also have small fence messages around the update. We
   // need to aggregate these in order to not clog up TCP's congestion
   // window.
+  TraceSpan span("client update");
+
   sock->cork(true);
 
   if (frameTracking)
@@ -1406,7 +1455,10 @@ void VNCSConnectionST::writeFramebufferUpdate()
   // Then real data (if possible)
   writeDataUpdate();
 
-  sock->cork(false);
+  {
+    TraceSpan span("flush");
+    sock->cork(false);
+  }
 
   congestion.updatePosition(sock->outStream().length());
 
@@ -1570,6 +1622,13 @@ void VNCSConnectionST::writeDataUpdate()
   maxUpdateSize = congestion.getBandwidth() *
                   server->msToNextUpdate() / 1000;
 
+  // Over UDP the pacing rate is what a frame can use
+  if (cp.supportsUdp) {
+    const size_t rate = ((network::UdpStream *) getOutStream(true))->getRate();
+    if (rate > 0)
+      maxUpdateSize = rate * server->msToNextUpdate() / 1000;
+  }
+
   if (!ui.is_empty()) {
     encodeManager.writeUpdate(ui, server->screenLayout, server->getPixelBuffer(), cursor, maxUpdateSize);
     copypassed.clear();
@@ -1708,8 +1767,12 @@ void VNCSConnectionST::handleFrameStats(rdr::U32 all, rdr::U32 render)
     else
       at++;
 
-    server->apimessager->mainUpdateClientFrameStats(at, render, all,
-                                                    congestion.getPingTime());
+    unsigned ping = congestion.getPingTime();
+    if (cp.supportsUdp &&
+        ((network::UdpStream *) getOutStream(true))->getRate() > 0)
+      ping = ((network::UdpStream *) getOutStream(true))->getCongestion()->getRTT();
+
+    server->apimessager->mainUpdateClientFrameStats(at, render, all, ping);
   }
 
   frameTracking = false;
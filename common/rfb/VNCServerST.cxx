@@ -60,6 +60,8 @@
 #include <rfb/ListConnInfo.h>
 #include <rfb/Security.h>
 #include <rfb/ServerCore.h>
+#include <rfb/ShmExport.h>
+#include <rfb/Trace.h>
 #include <rfb/VNCServerST.h>
 #include <rfb/VNCSConnectionST.h>
 #include <rfb/Watermark.h>
@@ -86,6 +88,7 @@ using namespace rfb;
 static LogWriter slog("VNCServerST");
 LogWriter VNCServerST::connectionsLog("Connections");
 EncCache VNCServerST::encCache;
+ScaleCache VNCServerST::scaleCache;
 
 void SelfBench();
 
@@ -137,14 +140,15 @@ static void parseRegionPart(const bool percents, rdr::U16 &pcdest, int &dest,
 
 VNCServerST::VNCServerST(const char* name_, SDesktop* desktop_, const video_encoders::EncoderProbe &encoder_probe_)
   : blHosts(&blacklist), desktop(desktop_), desktopStarted(false),
-    blockCounter(0), pb(nullptr), blackedpb(nullptr), ledState(ledUnknown),
+    blockCounter(0), pb(nullptr), blackedpb(nullptr),
+    blackedStale(true), ledState(ledUnknown),
     name(strDup(name_)), pointerClient(nullptr), clipboardClient(nullptr),
     comparer(nullptr), cursor(new Cursor(0, 0, Point(), nullptr)),
     renderedCursorInvalid(false),
     queryConnectionHandler(nullptr), keyRemapper(&KeyRemapper::defInstance),
     lastConnectionTime(0), disableclients(false),
-    frameTimer(this), apimessager(nullptr), trackingFrameStats(0),
-    clipboardId(0), sendWatermark(false), encoder_probe(encoder_probe_)
+    frameTimer(this), apimessager(nullptr), shmExport(nullptr),
+    trackingFrameStats(0), clipboardId(0), sendWatermark(false), encoder_probe(encoder_probe_)
 {
     auto to_string = [](const bool value) {
         return value ? "yes" : "no";
@@ -251,6 +255,16 @@ VNCServerST::VNCServerST(const char* name_, SDesktop* desktop_, const video_enco
 
   trackingClient[0] = 0;
 
+  Trace::init(Server::traceBufferSize);
+
+  if (Server::shmExportSocket[0]) {
+    try {
+      shmExport = new ShmExport(Server::shmExportSocket);
+    } catch (rdr::Exception& e) {
+      slog.error("Cannot export the framebuffer: %s", e.str());
+    }
+  }
+
     if (watermarkData)
         sendWatermark = true;
 
@@ -289,6 +303,9 @@ VNCServerST::~VNCServerST()
   delete comparer;
 
   delete cursor;
+
+  delete shmExport;
+  delete blackedpb;
 }
 
 
@@ -336,7 +353,7 @@ void VNCServerST::removeSocket(network::Socket* sock) {
       delete *ci;
 
       // - Check that the desktop object is still required
-      if (authClientCount() == 0)
+      if (authClientCount() == 0 && !(shmExport && shmExport->hasConsumers()))
         stopDesktop();
 
       if (comparer)
@@ -490,6 +507,14 @@ void VNCServerST::setPixelBuffer(PixelBuffer* pb_, const ScreenSet& layout)
   delete comparer;
   comparer = 0;
 
+  scaleCache.clear();
+
+  if (shmExport)
+    shmExport->invalidate();
+
+  // The contents are gone, so the masked copy is built from scratch
+  blackedStale = true;
+
   screenLayout = layout;
 
   if (!pb) {
@@ -746,6 +771,17 @@ SConnection* VNCServerST::getSConnection(network::Socket* sock) {
 bool VNCServerST::handleTimeout(Timer* t)
 {
   if (t == &frameTimer) {
+    if (shmExport) {
+      // Hangups would otherwise wait for a frame with damage
+      shmExport->dropClosed();
+
+      // The desktop was only kept running for a local consumer that left
+      if (!shmExport->hasConsumers() && authClientCount() == 0) {
+        stopDesktop();
+        return false;
+      }
+    }
+
     // We keep running until we go a full interval without any updates
     if (comparer->is_empty())
       return false;
@@ -830,6 +866,29 @@ inline bool VNCServerST::needRenderedCursor()
   return false;
 }
 
+int VNCServerST::getShmExportFd() const
+{
+  return shmExport ? shmExport->getFd() : -1;
+}
+
+void VNCServerST::handleShmExport()
+{
+  shmExport->dropClosed();
+  shmExport->accept();
+  if (!shmExport->hasConsumers())
+    return;
+
+  // Frames are only produced while the desktop runs
+  startDesktop();
+
+  // Fill in the segment now rather than at the next change, if nobody
+  // else had it up to date
+  if (DLPRegion.enabled)
+    blackOut(Region());
+  shmExport->update(DLPRegion.enabled ? blackedpb : pb, screenLayout,
+                    Region());
+}
+
 void VNCServerST::startFrameClock()
 {
   if (frameTimer.isStarted())
@@ -976,38 +1035,49 @@ void VNCServerST::translateDLPRegion(rdr::U16 &x1, rdr::U16 &y1, rdr::U16 &x2, r
   //slog.info("DLP_Region vals %u,%u %u,%u", x1, y1, x2, y2);
 }
 
-void VNCServerST::blackOut()
+// blackOut() brings the masked copy of the framebuffer up to date. Only
+// the changed parts inside the DLP region are copied over, the rest
+// of the copy stays black until the region or the framebuffer changes.
+
+void VNCServerST::blackOut(const Region& changed)
 {
   // Compute the region, since the resolution may have changed
   rdr::U16 x1, y1, x2, y2;
 
   translateDLPRegion(x1, y1, x2, y2);
 
-  if (blackedpb)
-    delete blackedpb;
-  blackedpb = new ManagedPixelBuffer(pb->getPF(), pb->getRect().width(), pb->getRect().height());
+  // Rows up to and including y2, columns up to but not including x2
+  const Rect visible = Rect(x1, y1, x2 ? x2 : pb->width(), y2 + 1)
+                       .intersect(pb->getRect());
 
-  int stride;
-  const rdr::U8 *src = pb->getBuffer(pb->getRect(), &stride);
-  rdr::U8 *data = blackedpb->getBufferRW(pb->getRect(), &stride);
-  stride *= 4;
+  Region toCopy;
 
-  memcpy(data, src, stride * pb->getRect().height());
+  if (!blackedpb || blackedStale || !blackedpb->getPF().equal(pb->getPF()) ||
+      blackedpb->width() != pb->width() ||
+      blackedpb->height() != pb->height() || !visible.equals(blackedVisible)) {
+    const rdr::U32 black = 0;
 
-  rdr::U16 y;
-  const rdr::U16 w = pb->getRect().width();
-  const rdr::U16 h = pb->getRect().height();
-  for (y = 0; y < h; y++) {
-    if (y < y1 || y > y2) {
-      memset(data, 0, stride);
-    } else {
-      if (x1)
-        memset(data, 0, x1 * 4);
-      if (x2)
-        memset(&data[x2 * 4], 0, (w - x2) * 4);
-    }
+    if (!blackedpb)
+      blackedpb = new ManagedPixelBuffer();
+    blackedpb->setPF(pb->getPF());
+    blackedpb->setSize(pb->width(), pb->height());
+    blackedpb->fillRect(blackedpb->getRect(), &black);
+
+    blackedVisible = visible;
+    blackedStale = false;
+    toCopy = visible;
+  } else {
+    toCopy = changed.intersect(visible);
+  }
 
-    data += stride;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator rect;
+
+  toCopy.get_rects(&rects);
+  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+    int stride;
+    const rdr::U8 *buf = pb->getBuffer(*rect, &stride);
+    blackedpb->imageRect(*rect, buf, stride);
   }
 }
 
@@ -1028,18 +1098,19 @@ void VNCServerST::writeUpdate()
   assert(blockCounter == 0);
   assert(desktopStarted);
 
+  Trace::nextFrame();
+  TraceSpan frameSpan("frame");
+
   struct timeval start;
   gettimeofday(&start, NULL);
 
-  if (DLPRegion.enabled) {
+  if (DLPRegion.enabled)
     comparer->enable_copyrect(false);
-    blackOut();
-  }
 
-  if (watermarkData && Server::DLP_WatermarkText[0] && watermarkTextNeedsUpdate(true)) {
-    // The text may have changed
-    sendWatermark = true;
-  }
+  // Fix the time for this frame, updateWatermark() then only sends the
+  // watermark if the text actually looks different
+  if (watermarkData && Server::DLP_WatermarkText[0])
+    watermarkTextNeedsUpdate(true);
 
   comparer->getUpdateInfo(&ui, pb->getRect());
   toCheck = ui.changed.union_(ui.copied);
@@ -1055,7 +1126,15 @@ void VNCServerST::writeUpdate()
     cursorReg = clippedCursorRect;
   }
 
-  pb->grabRegion(toCheck);
+  {
+    TraceSpan span("grab");
+    pb->grabRegion(toCheck);
+  }
+
+  if (DLPRegion.enabled) {
+    TraceSpan span("dlp mask");
+    blackOut(toCheck);
+  }
 
   if (getComparerState())
     comparer->enable();
@@ -1066,16 +1145,26 @@ void VNCServerST::writeUpdate()
   gettimeofday(&beforeAnalysis, NULL);
 
   // Skip scroll detection if the client is slow, and didn't get the previous one yet
-  if (comparer->compare(clients.size() == 1 && (*clients.begin())->has_copypassed(),
-                        cursorReg))
-    comparer->getUpdateInfo(&ui, pb->getRect());
+  {
+    TraceSpan span("compare");
+    if (comparer->compare(clients.size() == 1 && (*clients.begin())->has_copypassed(),
+                          cursorReg))
+      comparer->getUpdateInfo(&ui, pb->getRect());
+  }
 
   comparer->clear();
 
   const unsigned analysisMs = msSince(&beforeAnalysis);
 
-  encCache.clear();
-  encCache.enabled = clients.size() > 1;
+  // Entries are keyed by content, so they stay valid across frames
+  encCache.enabled = clients.size() > 1 && Server::encCacheSize;
+  if (!encCache.enabled)
+    encCache.clear();
+  encCache.frameDone();
+
+  // The scaled copies for video mode follow whatever clients are told
+  scaleCache.add_changed(ui.changed.union_(ui.copied));
+  scaleCache.frameDone();
 
   // Check if the password file was updated
   bool permcheck = false;
@@ -1099,11 +1188,20 @@ void VNCServerST::writeUpdate()
     }
   }
 
+  if (shmExport) {
+    TraceSpan span("shm export");
+    shmExport->update(DLPRegion.enabled ? blackedpb : pb, screenLayout,
+                      ui.changed.union_(ui.copied));
+  }
+
   unsigned shottime = 0;
   if (apimessager) {
     struct timeval shotstart;
     gettimeofday(&shotstart, NULL);
-    apimessager->mainUpdateScreen(pb);
+    {
+      TraceSpan span("screenshot copy");
+      apimessager->mainUpdateScreen(pb, ui.changed.union_(ui.copied));
+    }
     shottime = msSince(&shotstart);
 
     trackingFrameStats = 0;
@@ -1119,6 +1217,9 @@ void VNCServerST::writeUpdate()
   if (watermarkData)
       updateWatermark();
 
+  // Nothing touches the framebuffer until all clients are done
+  encCache.beginShare();
+
   for (ci = clients.begin(); ci != clients.end(); ci = ci_next) {
     ci_next = ci; ci_next++;
 
@@ -1166,6 +1267,8 @@ void VNCServerST::writeUpdate()
     }
   }
 
+  encCache.endShare();
+
   sendWatermark = false; // the client now caches it, only send once
 
   if (trackingFrameStats) {
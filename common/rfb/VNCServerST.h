@@ -31,6 +31,7 @@
 #include <rfb/Cursor.h>
 #include <rfb/EncCache.h>
 #include <rfb/LogWriter.h>
+#include <rfb/ScaleCache.h>
 #include <rfb/SDesktop.h>
 #include <rfb/ScreenSet.h>
 #include <rfb/Timer.h>
@@ -46,6 +47,7 @@ namespace rfb {
   class ListConnInfo;
   class PixelBuffer;
   class KeyRemapper;
+  class ShmExport;
 
   class VNCServerST : public VNCServer,
                       public Timer::Callback,
@@ -196,6 +198,11 @@ namespace rfb {
 
     void setAPIMessager(network::GetAPIMessager *msgr) { apimessager = msgr; }
 
+    // Listening socket of the shared memory export, -1 if it is off
+    int getShmExportFd() const;
+    // Called when it is readable
+    void handleShmExport();
+
     void handleClipboardAnnounce(VNCSConnectionST* client, bool available);
     void handleClipboardAnnounceBinary(VNCSConnectionST* client, const unsigned num,
                                        const char mimes[][32]);
@@ -226,7 +233,11 @@ namespace rfb {
     bool desktopStarted;
     int blockCounter;
     PixelBuffer* pb;
+    // A copy of pb with everything outside the DLP region black, kept
+    // up to date from the damage of each frame
     ManagedPixelBuffer *blackedpb;
+    Rect blackedVisible;
+    bool blackedStale;
     ScreenSet screenLayout;
     unsigned int ledState;
 
@@ -239,6 +250,7 @@ namespace rfb {
     std::list<network::Socket*> closingSockets;
 
     static EncCache encCache;
+    static ScaleCache scaleCache;
 
     ComparingUpdateTracker* comparer;
 
@@ -255,7 +267,7 @@ namespace rfb {
     void stopFrameClock();
     int msToNextUpdate();
     void writeUpdate();
-    void blackOut();
+    void blackOut(const Region& changed);
     Region getPendingRegion();
     const RenderedCursor* getRenderedCursor();
 
@@ -283,6 +295,7 @@ namespace rfb {
     int inotify_fd{-1};
 
     network::GetAPIMessager *apimessager;
+    ShmExport *shmExport;
 
     rdr::U8 trackingFrameStats;
     char trackingClient[128];
@@ -23,6 +23,10 @@
 #include <string.h>
 #include <time.h>
 #include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <vector>
 #include <rfb/LogWriter.h>
 #include <rfb/ServerCore.h>
 #include <rfb/VNCServerST.h>
@@ -50,6 +54,24 @@ static FT_Face face;
 #define MAXW 4096
 #define MAXH 4096
 
+// The packed mask is deflated in bands of this many bytes, each on its
+// own, so a change only needs its bands compressed again
+#define BAND_SIZE 32768
+
+struct band_t {
+	std::vector<uint8_t> data;
+	uLong adler;
+	bool dirty;
+};
+
+static std::vector<band_t> bands;
+static z_stream zs;
+static bool zsInit;
+
+// The text as it was last placed, to find what a new one changed
+static std::vector<uint8_t> lastTile;
+static uint16_t lastTileW, lastTileH;
+
 static bool loadimage(const char path[]) {
 
 	FILE *f = fopen(path, "r");
@@ -393,6 +415,7 @@ bool watermarkInit() {
 	memset(&watermarkInfo, 0, sizeof(watermarkInfo_t));
 	watermarkData = watermarkUnpacked = watermarkTmp = NULL;
 	rw = rh = 0;
+	bands.clear();
 
 	if (!Server::DLP_WatermarkImage[0] && !Server::DLP_WatermarkText[0])
 		return true;
@@ -443,79 +466,134 @@ bool watermarkInit() {
 	return true;
 }
 
-static void packWatermark() {
-	// Take the expanded 4-bit data, filter it by the changed rects, pack
-	// to shared bytes, and compress with zlib
+// Packs the 4-bit pixels from begin to end, two per byte, low nibble
+// first. Rows needn't start on a byte, so the range is widened to whole
+// bytes.
+static void packRange(size_t begin, size_t end, const size_t total) {
+	begin &= ~(size_t) 1;
+	end = (end + 1) & ~(size_t) 1;
+	if (end > total)
+		end = total;
+
+	const uint8_t *src = watermarkUnpacked + begin;
+	uint8_t *dst = watermarkTmp + begin / 2;
+	const size_t pairs = (end - begin) / 2;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	// Each 16-bit lane holds a pair, lo | hi << 8. Shifting it down by
+	// four puts hi << 4 in the low byte, as the pixels are below 16.
+	const __m128i lomask = _mm_set1_epi16(0x000f);
+	for (; i + 16 <= pairs; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *) &src[i * 2]);
+		__m128i b = _mm_loadu_si128((const __m128i *) &src[i * 2 + 16]);
+
+		a = _mm_or_si128(_mm_and_si128(a, lomask), _mm_srli_epi16(a, 4));
+		b = _mm_or_si128(_mm_and_si128(b, lomask), _mm_srli_epi16(b, 4));
+
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_packus_epi16(a, b));
+	}
+#endif
 
-	uint16_t x, y;
-	uint8_t pix[2], cur = 0;
-	uint8_t *dst = watermarkTmp;
+	for (; i < pairs; i++)
+		dst[i] = src[i * 2] | (src[i * 2 + 1] << 4);
 
-	for (y = 0; y < rh; y++) {
-		for (x = 0; x < rw; x++) {
-			pix[cur] = watermarkUnpacked[y * rw + x];
-			if (cur || (y == rh - 1 && x == rw - 1))
-				*dst++ = pix[0] | (pix[1] << 4);
+	// An odd pixel count leaves a last one on its own
+	if (end & 1)
+		dst[pairs] = src[pairs * 2];
+}
+
+// Deflates the dirty bands and puts the zlib stream together. Each band
+// is raw deflate, ending on a byte boundary with a sync flush, and the
+// last one with the final block, so they can simply be concatenated.
+static void compressBands(const size_t len) {
+	size_t i, out;
 
-			cur ^= 1;
+	if (!zsInit) {
+		memset(&zs, 0, sizeof(zs));
+		if (deflateInit2(&zs, 1, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			vlog.error("Zlib init error");
+			return;
 		}
+		zsInit = true;
 	}
 
-	uLong destLen = MAXW * MAXH / 2;
-	if (compress2(watermarkData, &destLen, watermarkTmp, rw * rh / 2 + 1, 1) != Z_OK)
-		vlog.error("Zlib compression error");
+	for (i = 0; i < bands.size(); i++) {
+		band_t &band = bands[i];
+		if (!band.dirty)
+			continue;
 
-	watermarkDataLen = destLen;
-}
+		const size_t start = i * BAND_SIZE;
+		const size_t bandLen = __rfbmin(len - start, (size_t) BAND_SIZE);
+		const bool last = i == bands.size() - 1;
 
-// update the screen-size rendered watermark whenever the screen is resized
-// or if using text, every frame
-void VNCServerST::updateWatermark() {
-	if (rw == pb->width() &&
-		rh == pb->height()) {
+		deflateReset(&zs);
+		band.data.resize(deflateBound(&zs, bandLen) + 16);
 
-		if (Server::DLP_WatermarkImage[0])
-			return;
-		if (!watermarkTextNeedsUpdate(false))
+		zs.next_in = watermarkTmp + start;
+		zs.avail_in = bandLen;
+		zs.next_out = band.data.data();
+		zs.avail_out = band.data.size();
+
+		const int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+		if ((last && ret != Z_STREAM_END) || (!last && ret != Z_OK) ||
+		    zs.avail_in) {
+			vlog.error("Zlib compression error");
 			return;
+		}
+
+		band.data.resize(zs.total_out);
+		band.adler = adler32(adler32(0, NULL, 0), watermarkTmp + start, bandLen);
+		band.dirty = false;
 	}
 
-	if (Server::DLP_WatermarkText[0] && watermarkTextNeedsUpdate(false)) {
-		drawtext(Server::DLP_WatermarkText,
-				Server::DLP_WatermarkTimeOffset * 60 + Server::DLP_WatermarkTimeOffsetMinutes,
-				Server::DLP_WatermarkFont, Server::DLP_WatermarkFontSize);
+	out = 2;
+	for (i = 0; i < bands.size(); i++)
+		out += bands[i].data.size();
+	out += 4;
+
+	if (out > MAXW * MAXH / 2) {
+		vlog.error("Zlib compression error");
+		return;
 	}
 
-	rw = pb->width();
-	rh = pb->height();
+	// Fastest level, no dictionary
+	watermarkData[0] = 0x78;
+	watermarkData[1] = 0x01;
+	out = 2;
+
+	uLong adler = bands[0].adler;
+	for (i = 0; i < bands.size(); i++) {
+		memcpy(&watermarkData[out], bands[i].data.data(), bands[i].data.size());
+		out += bands[i].data.size();
 
-	memset(watermarkUnpacked, 0, rw * rh);
+		if (i) {
+			const size_t bandLen = __rfbmin(len - i * BAND_SIZE, (size_t) BAND_SIZE);
+			adler = adler32_combine(adler, bands[i].adler, bandLen);
+		}
+	}
 
-	uint16_t x, y, srcy;
+	watermarkData[out++] = adler >> 24;
+	watermarkData[out++] = adler >> 16;
+	watermarkData[out++] = adler >> 8;
+	watermarkData[out++] = adler;
 
-	if (watermarkInfo.repeat) {
-		for (y = 0, srcy = 0; y < rh; y++) {
-			for (x = 0; x < rw;) {
-				if (x + watermarkInfo.w < rw)
-					memcpy(&watermarkUnpacked[y * rw + x],
-						&watermarkInfo.src[srcy * watermarkInfo.w],
-						watermarkInfo.w);
-				else
-					memcpy(&watermarkUnpacked[y * rw + x],
-						&watermarkInfo.src[srcy * watermarkInfo.w],
-						rw - x);
-
-				x += watermarkInfo.w + watermarkInfo.repeat;
-			}
+	watermarkDataLen = out;
+}
 
-			srcy++;
-			if (srcy == watermarkInfo.h) {
-				srcy = 0;
-				y += watermarkInfo.repeat;
-			}
+// Where the top left corner of each copy of the watermark goes
+static void getPlacements(std::vector<Point> &places) {
+	uint16_t x, y;
+
+	places.clear();
+
+	if (watermarkInfo.repeat) {
+		for (y = 0; y < rh; y += watermarkInfo.h + watermarkInfo.repeat) {
+			for (x = 0; x < rw; x += watermarkInfo.w + watermarkInfo.repeat)
+				places.push_back(Point(x, y));
 		}
 	} else {
-		int16_t sx, sy;
+		int sx, sy;
 
 		if (!watermarkInfo.x)
 			sx = (rw - watermarkInfo.w) / 2;
@@ -537,19 +615,136 @@ void VNCServerST::updateWatermark() {
 		if (sy < 0)
 			sy = 0;
 
-		for (y = 0; y < watermarkInfo.h; y++) {
-			if (sx + watermarkInfo.w < rw)
-				memcpy(&watermarkUnpacked[(sy + y) * rw + sx],
-					&watermarkInfo.src[y * watermarkInfo.w],
-					watermarkInfo.w);
-			else
-				memcpy(&watermarkUnpacked[(sy + y) * rw + sx],
-					&watermarkInfo.src[y * watermarkInfo.w],
-					rw - sx);
+		places.push_back(Point(sx, sy));
+	}
+}
+
+// The part of the watermark that differs from what was placed before,
+// which had the same size. Returns false if nothing does.
+static bool changedBox(Rect &box) {
+	const uint16_t w = watermarkInfo.w, h = watermarkInfo.h;
+	int x, y;
+
+	box = Rect(w, h, 0, 0);
+	for (y = 0; y < h; y++) {
+		const uint8_t *a = &watermarkInfo.src[y * w];
+		const uint8_t *b = &lastTile[y * w];
+
+		if (!memcmp(a, b, w))
+			continue;
+
+		for (x = 0; a[x] == b[x]; x++)
+			;
+		box.tl.x = __rfbmin(box.tl.x, x);
+		for (x = w - 1; a[x] == b[x]; x--)
+			;
+		box.br.x = __rfbmax(box.br.x, x + 1);
+
+		box.tl.y = __rfbmin(box.tl.y, y);
+		box.br.y = y + 1;
+	}
+
+	return !box.is_empty();
+}
+
+// Keep the screen-size watermark up to date, rebuilding it when the
+// screen is resized. With a text that has the time in it, only the part
+// of the text that changed is redrawn, packed and compressed again.
+void VNCServerST::updateWatermark() {
+	const bool resized = rw != pb->width() || rh != pb->height();
+	Rect box;
+
+	if (!resized) {
+		if (Server::DLP_WatermarkImage[0])
+			return;
+		if (!watermarkTextNeedsUpdate(false))
+			return;
+	}
+
+	if (Server::DLP_WatermarkText[0] && watermarkTextNeedsUpdate(false)) {
+		lastTile.assign(watermarkInfo.src,
+				watermarkInfo.src + watermarkInfo.w * watermarkInfo.h);
+		lastTileW = watermarkInfo.w;
+		lastTileH = watermarkInfo.h;
+
+		drawtext(Server::DLP_WatermarkText,
+				Server::DLP_WatermarkTimeOffset * 60 + Server::DLP_WatermarkTimeOffsetMinutes,
+				Server::DLP_WatermarkFont, Server::DLP_WatermarkFontSize);
+	}
+
+	bool full = resized;
+	if (!full) {
+		// A different size leaves parts of the old text behind.
+		// Otherwise it is usually just the last digits of the time.
+		if (lastTileW != watermarkInfo.w || lastTileH != watermarkInfo.h)
+			full = true;
+		else if (!changedBox(box))
+			return;
+	}
+
+	rw = pb->width();
+	rh = pb->height();
+
+	const size_t total = (size_t) rw * rh;
+	// Historically one byte more than the packed pixels
+	const size_t len = total / 2 + 1;
+
+	std::vector<uint8_t> dirtyRows(rh, full);
+
+	if (full) {
+		memset(watermarkUnpacked, 0, total);
+		watermarkTmp[len - 1] = 0;
+
+		box.setXYWH(0, 0, watermarkInfo.w, watermarkInfo.h);
+
+		bands.assign((len + BAND_SIZE - 1) / BAND_SIZE, band_t());
+		for (size_t i = 0; i < bands.size(); i++)
+			bands[i].dirty = true;
+	}
+
+	std::vector<Point> places;
+	std::vector<Point>::const_iterator place;
+	int y;
+
+	getPlacements(places);
+	for (place = places.begin(); place != places.end(); ++place) {
+		const int x = place->x + box.tl.x;
+		if (x >= rw)
+			continue;
+		const int w = __rfbmin(box.width(), rw - x);
+
+		for (y = box.tl.y; y < box.br.y; y++) {
+			const int dy = place->y + y;
+			if (dy >= rh)
+				break;
+
+			memcpy(&watermarkUnpacked[dy * rw + x],
+				&watermarkInfo.src[y * watermarkInfo.w + box.tl.x], w);
+			dirtyRows[dy] = 1;
 		}
 	}
 
-	packWatermark();
+	for (y = 0; y < rh; y++) {
+		if (!dirtyRows[y])
+			continue;
+
+		// Runs of rows at a time
+		int end = y + 1;
+		while (end < rh && dirtyRows[end])
+			end++;
+
+		const size_t begin = (size_t) y * rw;
+		const size_t stop = (size_t) end * rw;
+		packRange(begin, stop, total);
+
+		for (size_t i = begin / 2 / BAND_SIZE; i <= (stop / 2) / BAND_SIZE &&
+		     i < bands.size(); i++)
+			bands[i].dirty = true;
+
+		y = end;
+	}
+
+	compressBands(len);
 
 	sendWatermark = true;
 }
@@ -29,6 +29,7 @@
 #include <rfb/EncodeManager.h>
 #include <rfb/SConnection.h>
 #include <rfb/SMsgWriter.h>
+#include <rfb/ScaleCache.h>
 #include <rfb/UpdateTracker.h>
 #include <rfb/screenTypes.h>
 #include <string_view>
@@ -142,7 +143,8 @@ namespace benchmarking {
         MockStream udps{};
 
         EncCache cache{};
-        EncodeManager manager{this, &cache, FFmpeg::get(), video_encoders::EncoderProbe::get(FFmpeg::get(), {}, nullptr)};
+        ScaleCache scaleCache{};
+        EncodeManager manager{this, &cache, &scaleCache, FFmpeg::get(), video_encoders::EncoderProbe::get(FFmpeg::get(), {}, nullptr)};
     };
 
     class MockCConnection final : public MockTestConnection {
@@ -61,6 +61,8 @@ namespace cpu_info {
 
         [[nodiscard]] bool has_avx512f() const { return data.flags[CPU_FEATURE_AVX512F]; }
 
+        [[nodiscard]] bool has_avx512bw() const { return data.flags[CPU_FEATURE_AVX512BW]; }
+
         [[nodiscard]] bool has_smt() const { return get_total_cpu_count() > get_cores_count(); }
 
         [[nodiscard]] uint16_t get_total_cpu_count() const { return std::max(1, data.total_logical_cpus); }
@@ -75,6 +77,7 @@ namespace cpu_info {
     inline static const bool has_avx = CpuFeatures::get().has_avx();
     inline static const bool has_avx2 = CpuFeatures::get().has_avx2();
     inline static const bool has_avx512f = CpuFeatures::get().has_avx512f();
+    inline static const bool has_avx512bw = CpuFeatures::get().has_avx512bw();
     inline static const uint16_t cores_count = CpuFeatures::get().get_cores_count();
     inline static const uint16_t total_cpu_count = CpuFeatures::get().get_total_cpu_count();
 }; // namespace cpu_info
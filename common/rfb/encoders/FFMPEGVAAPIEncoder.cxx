@@ -37,7 +37,7 @@ namespace rfb {
     FFMPEGVAAPIEncoder::FFMPEGVAAPIEncoder(Screen layout_, const FFmpeg &ffmpeg_, SConnection *conn, KasmVideoEncoders::Encoder encoder_,
         const char *dri_node_, VideoEncoderParams params) :
         VideoEncoder(layout_.id, conn), layout(layout_),
-        ffmpeg(ffmpeg_), encoder(encoder_), current_params(params), msg_codec_id(KasmVideoEncoders::to_msg_id(encoder)),
+        ffmpeg(ffmpeg_), frame_pool(ffmpeg_), encoder(encoder_), current_params(params), msg_codec_id(KasmVideoEncoders::to_msg_id(encoder)),
         dri_node(dri_node_) {
         AVBufferRef *hw_device_ctx{};
         int err{};
@@ -52,12 +52,6 @@ namespace rfb {
         if (!codec)
             throw std::runtime_error(fmt::format("Could not find {} encoder", enc_name));
 
-        auto *frame = ffmpeg.av_frame_alloc();
-        if (!frame)
-            throw std::runtime_error("Cannot allocate AVFrame");
-
-        sw_frame_guard.reset(frame);
-
         auto *pkt = ffmpeg.av_packet_alloc();
         if (!pkt) {
             throw std::runtime_error("Could not allocate packet");
@@ -130,22 +124,11 @@ namespace rfb {
             return false;
         }
 
-        auto *frame = ffmpeg.av_frame_alloc();
-        if (!frame) {
-            vlog.error("Cannot allocate AVFrame");
+        // The surfaces get the NV12 frames uploaded
+        if (!frame_pool.init(width, height, params.width, params.height, AV_PIX_FMT_NV12))
             return false;
-        }
-        sw_frame_guard.reset(frame);
 
-        frame->format = AV_PIX_FMT_NV12;
-        frame->width = params.width;
-        frame->height = params.height;
-        frame->pict_type = AV_PICTURE_TYPE_I;
-
-        if (ffmpeg.av_frame_get_buffer(frame, 0) < 0) {
-            vlog.error("Could not allocate sw-frame data");
-            return false;
-        }
+        roi_map.init(params.width, params.height);
 
         auto *hw_frame = ffmpeg.av_frame_alloc();
         if (!hw_frame) {
@@ -164,15 +147,6 @@ namespace rfb {
             return false;
         }
 
-        auto *sws_ctx = ffmpeg.sws_getContext(
-            width, height, AV_PIX_FMT_RGB32, params.width, params.height, AV_PIX_FMT_NV12, SWS_BILINEAR, nullptr, nullptr, nullptr);
-        if (!sws_ctx) {
-            vlog.error("Could not initialize the conversion context");
-            return false;
-        }
-
-        sws_guard.reset(sws_ctx);
-
         return true;
     }
 
@@ -188,7 +162,7 @@ namespace rfb {
 
         const int width = rect.width();
         const int height = rect.height();
-        auto *frame = sw_frame_guard.get();
+        bool key_frame = false;
 
         int dst_width = width;
         int dst_height = height;
@@ -206,34 +180,33 @@ namespace rfb {
             static_cast<uint8_t>(Server::videoQualityCRFCQP)};
 
         if (current_params != params) {
-            bpp = pb->getPF().bpp >> 3;
             if (!init(width, height, params)) {
                 vlog.error("Failed to initialize encoder");
                 return false;
             }
 
-            frame = sw_frame_guard.get();
-        } else {
-            frame->pict_type = AV_PICTURE_TYPE_NONE;
+            key_frame = true;
         }
 
-        const uint8_t *src_data[1] = {buffer};
-        const int src_line_size[1] = {stride * bpp}; // RGB has bpp bytes per pixel
-
-        int err{};
-        if (err = ffmpeg.sws_scale(sws_guard.get(), src_data, src_line_size, 0, height, frame->data, frame->linesize); err < 0) {
-            vlog.error("Error (%s) while scaling image. Error code: %d", ffmpeg.get_error_description(err).c_str(), err);
+        auto *frame = frame_pool.get(buffer, stride, pb->getPF());
+        if (!frame) {
+            vlog.error("Error while converting image");
             return false;
         }
 
+        frame->pict_type = key_frame ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
         frame->pts = pts++;
 
+        int err{};
         if (err = ffmpeg.av_hwframe_transfer_data(hw_frame_guard.get(), frame, 0); err < 0) {
             vlog.error(
                 "Error while transferring frame data to surface (%s). Error code: %d", ffmpeg.get_error_description(err).c_str(), err);
             return false;
         }
 
+        // The surface is reused, so its side data gets replaced every time
+        roi_map.apply(ffmpeg, hw_frame_guard.get(), key_frame, current_params.group_of_picture);
+
         if (err = ffmpeg.avcodec_send_frame(ctx_guard.get(), hw_frame_guard.get()); err < 0) {
             vlog.error("Error sending frame to codec (%s). Error code: %d", ffmpeg.get_error_description(err).c_str(), err);
             return false;
@@ -279,4 +252,9 @@ namespace rfb {
         os->writeU8(layout.id);
         os->writeU8(kasmVideoSkip);
     }
+
+    void FFMPEGVAAPIEncoder::add_damage(const Rect &rect) {
+        frame_pool.add_damage(rect);
+        roi_map.add_damage(rect);
+    }
 } // namespace rfb
@@ -21,6 +21,8 @@
 #include "rdr/OutStream.h"
 #include "rfb/Encoder.h"
 #include "rfb/encoders/VideoEncoder.h"
+#include "rfb/encoders/RoiMap.h"
+#include "rfb/encoders/VideoFramePool.h"
 #include "rfb/ffmpeg.h"
 
 namespace rfb {
@@ -28,11 +30,11 @@ class FFMPEGVAAPIEncoder final : public VideoEncoder {
     Screen layout;
     const FFmpeg &ffmpeg;
 
-    FFmpeg::FrameGuard sw_frame_guard;
+    VideoFramePool frame_pool;
+    RoiMap roi_map;
     FFmpeg::FrameGuard hw_frame_guard;
     FFmpeg::PacketGuard pkt_guard;
     FFmpeg::ContextGuard ctx_guard;
-    FFmpeg::SwsContextGuard sws_guard;
     FFmpeg::BufferGuard hw_device_ctx_guard;
     FFmpeg::BufferGuard hw_frames_ref_guard;
 
@@ -43,7 +45,6 @@ class FFMPEGVAAPIEncoder final : public VideoEncoder {
     uint8_t msg_codec_id;
 
     int64_t pts{};
-    int bpp{};
     const char *dri_node{};
 
     [[nodiscard]] bool init(int width, int height, VideoEncoderParams params);
@@ -59,5 +60,6 @@ public:
     void writeSolidRect(int width, int height, const PixelFormat &pf, const rdr::U8 *colour) override;
     bool render(const PixelBuffer *pb) override;
     void writeSkipRect() override;
+    void add_damage(const Rect &rect) override;
 };
 } // namespace rfb
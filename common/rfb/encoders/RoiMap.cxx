@@ -0,0 +1,145 @@
+/* Copyright (C) 2025 Kasm.  All Rights Reserved.
+*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include "RoiMap.h"
+#include <algorithm>
+#include <cstring>
+#include <rfb/LogWriter.h>
+#include <rfb/ServerCore.h>
+
+namespace rfb {
+    static LogWriter vlog("RoiMap");
+
+    // Fractions of the codec's quantizer range, negative is better
+    static constexpr AVRational QOFFSET_CHANGED = {-1, 10};
+    static constexpr AVRational QOFFSET_VIDEO = {0, 1};
+    static constexpr AVRational QOFFSET_UNCHANGED = {1, 5};
+
+    void RoiMap::init(int width_, int height_) {
+        width = width_;
+        height = height_;
+        mb_width = (width + MB_SIZE - 1) / MB_SIZE;
+        mb_height = (height + MB_SIZE - 1) / MB_SIZE;
+        history.assign(mb_width * mb_height, 0);
+        since_key = 0;
+    }
+
+    void RoiMap::add_damage(const Rect &rect) {
+        const int left = std::max(rect.tl.x, 0);
+        const int top = std::max(rect.tl.y, 0);
+        const int right = std::min(rect.br.x, width);
+        const int bottom = std::min(rect.br.y, height);
+
+        if (left >= right || top >= bottom)
+            return;
+
+        for (int mby = top / MB_SIZE; mby <= (bottom - 1) / MB_SIZE; ++mby) {
+            for (int mbx = left / MB_SIZE; mbx <= (right - 1) / MB_SIZE; ++mbx)
+                history[mby * mb_width + mbx] |= 1;
+        }
+    }
+
+    // One region per run of matching macroblocks in a row, grown downwards
+    // while the rows below have a run with the same ends
+    void RoiMap::add_runs(std::vector<AVRegionOfInterest> &rois, bool video, AVRational qoffset) const {
+        std::vector<size_t> above, current;
+
+        for (int mby = 0; mby < mb_height; ++mby) {
+            const uint16_t *row = &history[mby * mb_width];
+            const int top = mby * MB_SIZE;
+            const int bottom = std::min(top + MB_SIZE, height);
+
+            current.clear();
+
+            for (int mbx = 0; mbx < mb_width;) {
+                const auto matches = [&](int x) {
+                    return (row[x] & 1) && (__builtin_popcount(row[x]) >= VIDEO_FRAMES) == video;
+                };
+
+                if (!matches(mbx)) {
+                    ++mbx;
+                    continue;
+                }
+
+                const int start = mbx;
+                while (mbx < mb_width && matches(mbx))
+                    ++mbx;
+
+                const int left = start * MB_SIZE;
+                const int right = std::min(mbx * MB_SIZE, width);
+
+                const auto it = std::find_if(above.begin(), above.end(), [&](size_t i) {
+                    return rois[i].left == left && rois[i].right == right;
+                });
+
+                if (it != above.end()) {
+                    rois[*it].bottom = bottom;
+                    current.push_back(*it);
+                } else {
+                    AVRegionOfInterest roi{};
+                    roi.self_size = sizeof(AVRegionOfInterest);
+                    roi.top = top;
+                    roi.bottom = bottom;
+                    roi.left = left;
+                    roi.right = right;
+                    roi.qoffset = qoffset;
+                    rois.push_back(roi);
+                    current.push_back(rois.size() - 1);
+                }
+            }
+
+            above.swap(current);
+        }
+    }
+
+    void RoiMap::apply(const FFmpeg &ffmpeg, AVFrame *frame, bool key_frame, unsigned gop) {
+        ffmpeg.av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
+        if (key_frame)
+            since_key = 0;
+
+        const bool key = gop <= 1 || since_key % gop == 0;
+        ++since_key;
+
+        const auto changed = std::count_if(history.begin(), history.end(), [](uint16_t h) { return h & 1; });
+
+        // Nothing to tell apart when everything or nothing changed
+        if (!key && Server::videoRegionOfInterest && changed && changed < static_cast<long>(history.size())) {
+            std::vector<AVRegionOfInterest> rois;
+
+            // The first region covering a macroblock decides its offset
+            add_runs(rois, false, QOFFSET_CHANGED);
+            add_runs(rois, true, QOFFSET_VIDEO);
+
+            AVRegionOfInterest rest{};
+            rest.self_size = sizeof(AVRegionOfInterest);
+            rest.bottom = height;
+            rest.right = width;
+            rest.qoffset = QOFFSET_UNCHANGED;
+            rois.push_back(rest);
+
+            const size_t size = rois.size() * sizeof(AVRegionOfInterest);
+            if (auto *side = ffmpeg.av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, size); side)
+                memcpy(side->data, rois.data(), size);
+            else
+                vlog.error("Could not allocate region of interest side data");
+        }
+
+        for (auto &h: history)
+            h <<= 1;
+    }
+} // namespace rfb
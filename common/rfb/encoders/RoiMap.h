@@ -0,0 +1,54 @@
+/* Copyright (C) 2025 Kasm.  All Rights Reserved.
+*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#pragma once
+
+#include <vector>
+#include "rfb/Rect.h"
+#include "rfb/ffmpeg.h"
+
+namespace rfb {
+    // Turns the damage of each frame into region of interest side data,
+    // so the encoder spends its bits where the screen moves. Macroblocks
+    // that changed in most of the recent frames count as video and are
+    // coded at the normal quality, other changes a little better, as
+    // that is usually text, and unchanged ones a lot worse, which makes
+    // the encoder skip them. Key frames get no hints, everything on them
+    // has to look right.
+    class RoiMap {
+        std::vector<uint16_t> history; // Per macroblock, bit 0 is this frame
+        int width{}, height{};
+        int mb_width{}, mb_height{};
+        unsigned since_key{};
+
+        void add_runs(std::vector<AVRegionOfInterest> &rois, bool video, AVRational qoffset) const;
+
+    public:
+        static constexpr int MB_SIZE = 16;
+        // Changed in this many of the last 16 frames
+        static constexpr int VIDEO_FRAMES = 8;
+
+        void init(int width, int height);
+
+        // Area that changed since the last frame, relative to the screen
+        void add_damage(const Rect &rect);
+
+        // Attaches the hints for this frame, replacing any old ones, and
+        // starts the next one. gop is the key frame interval.
+        void apply(const FFmpeg &ffmpeg, AVFrame *frame, bool key_frame, unsigned gop);
+    };
+} // namespace rfb
@@ -140,6 +140,14 @@ namespace rfb {
 
             if (screen.dimensions.overlaps(bounds)) {
                 screens[id].dirty = true;
+
+                // So the encoder only converts what changed
+                if (auto *encoder = screens[id].encoder; encoder) {
+                    std::vector<Rect> rects;
+                    region.intersect(screen.dimensions).get_rects(&rects);
+                    for (const auto &rect: rects)
+                        encoder->add_damage(rect.translate(screen.dimensions.tl.negate()));
+                }
             }
         }
 
@@ -35,18 +35,12 @@ namespace rfb {
     SoftwareEncoder::SoftwareEncoder(Screen layout_, const FFmpeg &ffmpeg_, SConnection *conn, KasmVideoEncoders::Encoder encoder_,
                                              VideoEncoderParams params) :
         VideoEncoder(layout_.id, conn), layout(layout_),
-        ffmpeg(ffmpeg_), encoder(encoder_), current_params(params), msg_codec_id(KasmVideoEncoders::to_msg_id(encoder)) {
+        ffmpeg(ffmpeg_), frame_pool(ffmpeg_), encoder(encoder_), current_params(params), msg_codec_id(KasmVideoEncoders::to_msg_id(encoder)) {
         const auto *enc_name = KasmVideoEncoders::to_string(encoder);
         codec = ffmpeg.avcodec_find_encoder_by_name(enc_name);
         if (!codec)
             throw std::runtime_error(fmt::format("Could not find {} encoder", enc_name));
 
-        auto *frame = ffmpeg.av_frame_alloc();
-        if (!frame) {
-            throw std::runtime_error("Cannot allocate AVFrame");
-        }
-        frame_guard.reset(frame);
-
         auto *pkt = ffmpeg.av_packet_alloc();
         if (!pkt)
             throw std::runtime_error("Could not allocate packet");
@@ -67,7 +61,7 @@ namespace rfb {
 
         const int width = rect.width();
         const int height = rect.height();
-        auto *frame = frame_guard.get();
+        bool key_frame = false;
 
         int dst_width = width;
         int dst_height = height;
@@ -85,27 +79,25 @@ namespace rfb {
                                   static_cast<uint8_t>(Server::videoQualityCRFCQP)};
 
         if (current_params != params) {
-            bpp = pb->getPF().bpp >> 3;
             if (!init(width, height, params)) {
                 vlog.error("Failed to initialize encoder");
                 return false;
             }
 
-            frame = frame_guard.get();
-        } else {
-            frame->pict_type = AV_PICTURE_TYPE_NONE;
+            key_frame = true;
         }
 
-        const uint8_t *src_data[1] = {buffer};
-        const int src_line_size[1] = {stride * bpp}; // RGB has bpp bytes per pixel
-
-        if (ffmpeg.sws_scale(sws_guard.get(), src_data, src_line_size, 0, height, frame->data, frame->linesize) < 0) {
-            vlog.error("Error while scaling image");
+        auto *frame = frame_pool.get(buffer, stride, pb->getPF());
+        if (!frame) {
+            vlog.error("Error while converting image");
             return false;
         }
 
+        frame->pict_type = key_frame ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
         frame->pts = pts++;
 
+        roi_map.apply(ffmpeg, frame, key_frame, current_params.group_of_picture);
+
         int err = ffmpeg.avcodec_send_frame(ctx_guard.get(), frame);
         if (err < 0) {
             vlog.error("Error sending frame to codec (%s). Error code: %d", ffmpeg.get_error_description(err).c_str(), err);
@@ -155,6 +147,11 @@ namespace rfb {
         os->writeU8(kasmVideoSkip);
     }
 
+    void SoftwareEncoder::add_damage(const Rect &rect) {
+        frame_pool.add_damage(rect);
+        roi_map.add_damage(rect);
+    }
+
     bool SoftwareEncoder::init(int width, int height, VideoEncoderParams params) {
         current_params = params;
         vlog.debug("FRAME RESIZE (%d, %d): RATE: %d, GOP: %d, QUALITY: %d", width, height, current_params.frame_rate, current_params.group_of_picture, current_params.quality);
@@ -231,35 +228,24 @@ namespace rfb {
         // if (ffmpeg.av_opt_set(ctx->priv_data, "profile", "high", 0) != 0)
         //     throw std::runtime_error("Could not set codec setting");
 
-        auto *sws_ctx = ffmpeg.sws_getContext(width,
-                                              height,
-                                              AV_PIX_FMT_RGB32,
-                                              current_params.width,
-                                              current_params.height,
-                                              ctx_guard->pix_fmt,
-                                              SWS_BILINEAR,
-                                              nullptr,
-                                              nullptr,
-                                              nullptr);
-        if (!sws_ctx) {
-            vlog.error("Could not initialize the conversion context");
-            return false;
-        }
-
-        sws_guard.reset(sws_ctx);
-
-        auto *frame = frame_guard.get();
+        // Regions of interest only work with adaptive quantization, which
+        // the ultrafast preset turns off
+        if (Server::videoRegionOfInterest) {
+            if (encoder == KasmVideoEncoders::Encoder::h264_software &&
+                ffmpeg.av_opt_set_int(ctx->priv_data, "aq-mode", 1, 0) < 0) {
+                vlog.info("Cannot set aq-mode to 1");
+            }
 
-        ffmpeg.av_frame_unref(frame);
-        frame->format = ctx_guard->pix_fmt;
-        frame->width = current_params.width;
-        frame->height = current_params.height;
-        frame->pict_type = AV_PICTURE_TYPE_I;
+            if (encoder == KasmVideoEncoders::Encoder::h265_software &&
+                ffmpeg.av_opt_set(ctx->priv_data, "x265-params", "aq-mode=1", 0) < 0) {
+                vlog.info("Cannot set x265-params to aq-mode=1");
+            }
+        }
 
-        if (ffmpeg.av_frame_get_buffer(frame, 0) < 0) {
-            vlog.error("Could not allocate frame data");
+        if (!frame_pool.init(width, height, current_params.width, current_params.height, ctx_guard->pix_fmt))
             return false;
-        }
+
+        roi_map.init(current_params.width, current_params.height);
 
         if (ffmpeg.avcodec_open2(ctx_guard.get(), codec, nullptr) < 0) {
             vlog.error("Failed to open codec");
@@ -21,6 +21,8 @@
 #include "rdr/OutStream.h"
 #include "rfb/Encoder.h"
 #include "rfb/encoders/VideoEncoder.h"
+#include "rfb/encoders/RoiMap.h"
+#include "rfb/encoders/VideoFramePool.h"
 #include "rfb/ffmpeg.h"
 
 namespace rfb {
@@ -29,17 +31,16 @@ namespace rfb {
         const FFmpeg &ffmpeg;
         const AVCodec *codec{};
 
-        FFmpeg::FrameGuard frame_guard;
+        VideoFramePool frame_pool;
+        RoiMap roi_map;
         FFmpeg::PacketGuard pkt_guard;
         FFmpeg::ContextGuard ctx_guard;
-        FFmpeg::SwsContextGuard sws_guard;
 
         KasmVideoEncoders::Encoder encoder;
         VideoEncoderParams current_params{};
         uint8_t msg_codec_id;
 
         int64_t pts{};
-        int bpp{};
         [[nodiscard]] bool init(int width, int height, VideoEncoderParams params);
 
         template<typename T>
@@ -52,5 +53,6 @@ namespace rfb {
         void writeSolidRect(int width, int height, const PixelFormat &pf, const rdr::U8 *colour) override;
         bool render(const PixelBuffer *pb) override;
         void writeSkipRect() override;
+        void add_damage(const Rect &rect) override;
     };
 } // namespace rfb
@@ -43,6 +43,9 @@ namespace rfb {
             Encoder(id, conn, encodingKasmVideo, static_cast<EncoderFlags>(EncoderUseNativePF | EncoderLossy), -1) {}
         virtual bool render(const PixelBuffer *pb) = 0;
         virtual void writeSkipRect() = 0;
+        // Area of the screen that changed since the last render, relative
+        // to the screen. Encoders converting everything may ignore it.
+        virtual void add_damage(const Rect &rect) {}
         ~VideoEncoder() override = default;
     };
 } // namespace rfb
@@ -0,0 +1,200 @@
+/* Copyright (C) 2025 Kasm.  All Rights Reserved.
+*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include "VideoFramePool.h"
+#include <algorithm>
+#include <rfb/LogWriter.h>
+#include <tbb/parallel_for.h>
+
+namespace rfb {
+    static LogWriter vlog("VideoFramePool");
+
+    static const PixelFormat pfBGRX(32, 24, false, true, 255, 255, 255, 16, 8, 0);
+
+    static constexpr int align(int value) {
+        return (value + 63) & ~63;
+    }
+
+    VideoFramePool::VideoFramePool(const FFmpeg &ffmpeg_) : ffmpeg(ffmpeg_) {}
+
+    bool VideoFramePool::init(int src_width_, int src_height_, int width_, int height_, AVPixelFormat format_) {
+        src_width = src_width_;
+        src_height = src_height_;
+        width = width_;
+        height = height_;
+        format = format_;
+
+        linesize[0] = align(width);
+        offset[0] = 0;
+        offset[1] = static_cast<size_t>(linesize[0]) * height;
+
+        if (format == AV_PIX_FMT_NV12) {
+            linesize[1] = align(width);
+            linesize[2] = 0;
+            offset[2] = 0;
+            size = offset[1] + static_cast<size_t>(linesize[1]) * height / 2;
+        } else {
+            linesize[1] = linesize[2] = align(width / 2);
+            offset[2] = offset[1] + static_cast<size_t>(linesize[1]) * height / 2;
+            size = offset[2] + static_cast<size_t>(linesize[2]) * height / 2;
+        }
+
+        if (!frame_guard) {
+            auto *frame = ffmpeg.av_frame_alloc();
+            if (!frame) {
+                vlog.error("Cannot allocate AVFrame");
+                return false;
+            }
+            frame_guard.reset(frame);
+        } else {
+            ffmpeg.av_frame_unref(frame_guard.get());
+        }
+
+        entries.clear();
+
+        // For framebuffers in other formats
+        auto *sws_ctx = ffmpeg.sws_getContext(
+            src_width, src_height, AV_PIX_FMT_RGB32, width, height, format, SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (!sws_ctx) {
+            vlog.error("Could not initialize the conversion context");
+            return false;
+        }
+        sws_guard.reset(sws_ctx);
+
+        row_pair = yuv::get_row_pair();
+
+        return true;
+    }
+
+    void VideoFramePool::add_damage(const Rect &rect) {
+        const int top = std::max(rect.tl.y, 0);
+        const int bottom = std::min(rect.br.y, height);
+
+        if (rect.is_empty() || top >= bottom)
+            return;
+
+        for (auto &entry: entries)
+            std::fill(entry.dirty.begin() + top / MB_SIZE, entry.dirty.begin() + (bottom - 1) / MB_SIZE + 1, 1);
+    }
+
+    VideoFramePool::entry_t *VideoFramePool::get_entry() {
+        for (auto &entry: entries) {
+            if (ffmpeg.av_buffer_is_writable(entry.buf.get()))
+                return &entry;
+        }
+
+        if (entries.size() >= MAX_FRAMES) {
+            vlog.error("All %zu frames still held by the encoder", entries.size());
+            return nullptr;
+        }
+
+        auto *buf = ffmpeg.av_buffer_alloc(size);
+        if (!buf) {
+            vlog.error("Could not allocate frame data");
+            return nullptr;
+        }
+
+        auto &entry = entries.emplace_back();
+        entry.buf.reset(buf);
+        entry.dirty.assign((height + MB_SIZE - 1) / MB_SIZE, 1);
+
+        vlog.debug("Frame pool grown to %zu", entries.size());
+
+        return &entry;
+    }
+
+    void VideoFramePool::convert(entry_t &entry, const uint8_t *buffer, int stride) {
+        uint8_t *data = entry.buf->data;
+        const bool nv12 = format == AV_PIX_FMT_NV12;
+        std::vector<int> rows;
+
+        for (size_t i = 0; i < entry.dirty.size(); ++i) {
+            if (entry.dirty[i])
+                rows.push_back(i);
+        }
+
+        const auto convert_row = [&](int mb) {
+            const int end = std::min((mb + 1) * MB_SIZE, height);
+
+            for (int y = mb * MB_SIZE; y < end; y += 2) {
+                row_pair(buffer + static_cast<size_t>(y) * stride * 4,
+                    buffer + static_cast<size_t>(y + 1) * stride * 4,
+                    data + offset[0] + static_cast<size_t>(y) * linesize[0],
+                    data + offset[0] + static_cast<size_t>(y + 1) * linesize[0],
+                    data + offset[1] + static_cast<size_t>(y / 2) * linesize[1],
+                    nv12 ? nullptr : data + offset[2] + static_cast<size_t>(y / 2) * linesize[2],
+                    width,
+                    nv12);
+            }
+        };
+
+        if (rows.size() > 1) {
+            tbb::parallel_for(static_cast<size_t>(0), rows.size(), [&](size_t i) { convert_row(rows[i]); });
+        } else {
+            for (const auto mb: rows)
+                convert_row(mb);
+        }
+
+        std::fill(entry.dirty.begin(), entry.dirty.end(), 0);
+    }
+
+    AVFrame *VideoFramePool::get(const uint8_t *buffer, int stride, const PixelFormat &pf) {
+        auto *frame = frame_guard.get();
+
+        // Our reference from last time would make its buffer look busy
+        ffmpeg.av_frame_unref(frame);
+
+        auto *entry = get_entry();
+        if (!entry)
+            return nullptr;
+
+        uint8_t *data = entry->buf->data;
+        uint8_t *planes[4] = {data + offset[0], data + offset[1], format == AV_PIX_FMT_NV12 ? nullptr : data + offset[2], nullptr};
+        int planes_linesize[4] = {linesize[0], linesize[1], linesize[2], 0};
+
+        if (pf.equal(pfBGRX)) {
+            convert(*entry, buffer, stride);
+        } else {
+            const uint8_t *src_data[1] = {buffer};
+            const int src_line_size[1] = {stride * (pf.bpp >> 3)};
+
+            if (const int err = ffmpeg.sws_scale(sws_guard.get(), src_data, src_line_size, 0, src_height, planes, planes_linesize);
+                err < 0) {
+                vlog.error("Error (%s) while scaling image. Error code: %d", ffmpeg.get_error_description(err).c_str(), err);
+                return nullptr;
+            }
+
+            std::fill(entry->dirty.begin(), entry->dirty.end(), 0);
+        }
+
+        frame->buf[0] = ffmpeg.av_buffer_ref(entry->buf.get());
+        if (!frame->buf[0]) {
+            vlog.error("Failed to create buffer reference");
+            return nullptr;
+        }
+
+        frame->format = format;
+        frame->width = width;
+        frame->height = height;
+        for (int i = 0; i < 4; ++i) {
+            frame->data[i] = planes[i];
+            frame->linesize[i] = planes_linesize[i];
+        }
+
+        return frame;
+    }
+} // namespace rfb
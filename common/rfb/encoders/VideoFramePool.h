@@ -0,0 +1,73 @@
+/* Copyright (C) 2025 Kasm.  All Rights Reserved.
+*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#pragma once
+
+#include <vector>
+#include "rfb/PixelFormat.h"
+#include "rfb/Rect.h"
+#include "rfb/ffmpeg.h"
+#include "yuv.h"
+
+namespace rfb {
+    // The YUV frames a video encoder reads, converted straight from the
+    // framebuffer into refcounted buffers the codec gets references to,
+    // so nothing is copied or allocated per frame. Each buffer remembers
+    // which macroblock rows changed since it was last filled, and only
+    // those get converted again. A buffer the codec still holds is left
+    // alone and another one used.
+    class VideoFramePool {
+        struct entry_t {
+            FFmpeg::BufferGuard buf;
+            std::vector<uint8_t> dirty; // Per macroblock row
+        };
+
+        const FFmpeg &ffmpeg;
+        std::vector<entry_t> entries;
+        FFmpeg::FrameGuard frame_guard;
+        FFmpeg::SwsContextGuard sws_guard;
+
+        AVPixelFormat format{AV_PIX_FMT_NONE};
+        int src_width{}, src_height{};
+        int width{}, height{};
+        int linesize[3]{};
+        size_t offset[3]{};
+        size_t size{};
+        yuv::row_pair_func row_pair{};
+
+        [[nodiscard]] entry_t *get_entry();
+        void convert(entry_t &entry, const uint8_t *buffer, int stride);
+
+    public:
+        static constexpr int MB_SIZE = 16;
+        // More than enough for encoders without lookahead
+        static constexpr size_t MAX_FRAMES = 8;
+
+        explicit VideoFramePool(const FFmpeg &ffmpeg);
+
+        // format is AV_PIX_FMT_YUV420P or AV_PIX_FMT_NV12. The source
+        // is cropped to the even width x height.
+        [[nodiscard]] bool init(int src_width, int src_height, int width, int height, AVPixelFormat format);
+
+        // Source area that changed, relative to the screen
+        void add_damage(const Rect &rect);
+
+        // Brings a free frame up to date with buffer, stride in pixels.
+        // It stays valid until the next call.
+        [[nodiscard]] AVFrame *get(const uint8_t *buffer, int stride, const PixelFormat &pf);
+    };
+} // namespace rfb
@@ -0,0 +1,54 @@
+/* Copyright (C) 2025 Kasm.  All Rights Reserved.
+*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include "yuv.h"
+#include <rfb/cpuid.h>
+
+namespace rfb::yuv {
+    void generic_row_pair(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, int width,
+        bool interleave) {
+        for (int x = 0; x < width; x += 2) {
+            const uint8_t *a = src0 + x * 4;
+            const uint8_t *b = src1 + x * 4;
+
+            y0[x] = luma(a[0], a[1], a[2]);
+            y0[x + 1] = luma(a[4], a[5], a[6]);
+            y1[x] = luma(b[0], b[1], b[2]);
+            y1[x + 1] = luma(b[4], b[5], b[6]);
+
+            const int cb = (a[0] + a[4] + b[0] + b[4] + 2) >> 2;
+            const int cg = (a[1] + a[5] + b[1] + b[5] + 2) >> 2;
+            const int cr = (a[2] + a[6] + b[2] + b[6] + 2) >> 2;
+
+            if (interleave) {
+                u[x] = chroma_u(cb, cg, cr);
+                u[x + 1] = chroma_v(cb, cg, cr);
+            } else {
+                u[x / 2] = chroma_u(cb, cg, cr);
+                v[x / 2] = chroma_v(cb, cg, cr);
+            }
+        }
+    }
+
+    row_pair_func get_row_pair() {
+#ifdef HAVE_YUV_AVX2
+        if (cpu_info::has_avx2)
+            return AVX2_row_pair;
+#endif
+        return generic_row_pair;
+    }
+} // namespace rfb::yuv
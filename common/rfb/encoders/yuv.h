@@ -0,0 +1,55 @@
+/* Copyright (C) 2025 Kasm.  All Rights Reserved.
+*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#pragma once
+
+#include <cstdint>
+
+// BGRX (AV_PIX_FMT_RGB32 on little endian) to 4:2:0 YUV, BT.601 limited
+// range like swscale's default. Chroma is taken from the average of each
+// 2x2 block. All versions give the same output.
+namespace rfb::yuv {
+    // One pair of source rows to two luma rows and one chroma row. With
+    // interleave, u gets NV12's UVUV and v is unused. width is even.
+    using row_pair_func = void (*)(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+        int width, bool interleave);
+
+    void generic_row_pair(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, int width,
+        bool interleave);
+    void AVX2_row_pair(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, int width,
+        bool interleave);
+
+    // The best version for this CPU
+    [[nodiscard]] row_pair_func get_row_pair();
+
+    // Coefficients shared by all versions, in BGRX order
+    inline constexpr int Y_B = 25, Y_G = 129, Y_R = 66;
+    inline constexpr int U_B = 112, U_G = -74, U_R = -38;
+    inline constexpr int V_B = -18, V_G = -94, V_R = 112;
+
+    inline uint8_t luma(int b, int g, int r) {
+        return ((Y_B * b + Y_G * g + Y_R * r + 128) >> 8) + 16;
+    }
+
+    inline uint8_t chroma_u(int b, int g, int r) {
+        return ((U_B * b + U_G * g + U_R * r + 128) >> 8) + 128;
+    }
+
+    inline uint8_t chroma_v(int b, int g, int r) {
+        return ((V_B * b + V_G * g + V_R * r + 128) >> 8) + 128;
+    }
+} // namespace rfb::yuv
@@ -0,0 +1,105 @@
+/* Copyright (C) 2025 Kasm.  All Rights Reserved.
+*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <immintrin.h>
+#include "yuv.h"
+
+namespace rfb::yuv {
+    namespace {
+        // Eight pixels to their eight sums with coef, as 32-bit ints in
+        // pixel order 0-3 | 4-7
+        inline __m256i weigh(__m256i px, __m256i coef) {
+            const __m256i zero = _mm256_setzero_si256();
+            return _mm256_hadd_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coef),
+                _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coef));
+        }
+
+        // The rounded averages of the 2x2 blocks of eight pixels of two
+        // rows, as 16-bit BGRX in block order 0, 1 | 2, 3
+        inline __m256i blocks(__m256i a, __m256i b) {
+            const __m256i zero = _mm256_setzero_si256();
+            __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+            __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+
+            lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+            hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+
+            return _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_set1_epi16(2)), 2);
+        }
+
+        // Sixteen pixels to their luma bytes
+        inline __m128i luma16(__m256i p0, __m256i p1, __m256i coef) {
+            const __m256i round = _mm256_set1_epi32(128);
+            const __m256i lo = _mm256_srli_epi32(_mm256_add_epi32(weigh(p0, coef), round), 8);
+            const __m256i hi = _mm256_srli_epi32(_mm256_add_epi32(weigh(p1, coef), round), 8);
+
+            // packs interleaves the lanes, 0-3 8-11 | 4-7 12-15
+            __m256i y = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8);
+            y = _mm256_add_epi16(y, _mm256_set1_epi16(16));
+            y = _mm256_permute4x64_epi64(_mm256_packus_epi16(y, y), 0x08);
+
+            return _mm256_castsi256_si128(y);
+        }
+
+        // Eight blocks to eight 16-bit chroma values
+        inline __m128i chroma8(__m256i c0, __m256i c1, __m256i coef) {
+            __m256i c = _mm256_hadd_epi32(_mm256_madd_epi16(c0, coef), _mm256_madd_epi16(c1, coef));
+
+            c = _mm256_srai_epi32(_mm256_add_epi32(c, _mm256_set1_epi32(128)), 8);
+            c = _mm256_add_epi32(c, _mm256_set1_epi32(128));
+            // hadd leaves 0 1 4 5 | 2 3 6 7
+            c = _mm256_permutevar8x32_epi32(c, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+
+            return _mm_packs_epi32(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1));
+        }
+    } // namespace
+
+    void AVX2_row_pair(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, int width,
+        bool interleave) {
+        const __m256i cy = _mm256_setr_epi16(Y_B, Y_G, Y_R, 0, Y_B, Y_G, Y_R, 0, Y_B, Y_G, Y_R, 0, Y_B, Y_G, Y_R, 0);
+        const __m256i cu = _mm256_setr_epi16(U_B, U_G, U_R, 0, U_B, U_G, U_R, 0, U_B, U_G, U_R, 0, U_B, U_G, U_R, 0);
+        const __m256i cv = _mm256_setr_epi16(V_B, V_G, V_R, 0, V_B, V_G, V_R, 0, V_B, V_G, V_R, 0, V_B, V_G, V_R, 0);
+        int x;
+
+        for (x = 0; x + 16 <= width; x += 16) {
+            const __m256i a0 = _mm256_loadu_si256((const __m256i *) (src0 + x * 4));
+            const __m256i a1 = _mm256_loadu_si256((const __m256i *) (src0 + x * 4 + 32));
+            const __m256i b0 = _mm256_loadu_si256((const __m256i *) (src1 + x * 4));
+            const __m256i b1 = _mm256_loadu_si256((const __m256i *) (src1 + x * 4 + 32));
+
+            _mm_storeu_si128((__m128i *) (y0 + x), luma16(a0, a1, cy));
+            _mm_storeu_si128((__m128i *) (y1 + x), luma16(b0, b1, cy));
+
+            const __m256i c0 = blocks(a0, b0);
+            const __m256i c1 = blocks(a1, b1);
+            const __m128i uv = _mm_packus_epi16(chroma8(c0, c1, cu), chroma8(c0, c1, cv));
+
+            if (interleave) {
+                _mm_storeu_si128((__m128i *) (u + x), _mm_unpacklo_epi8(uv, _mm_srli_si128(uv, 8)));
+            } else {
+                _mm_storel_epi64((__m128i *) (u + x / 2), uv);
+                _mm_storel_epi64((__m128i *) (v + x / 2), _mm_srli_si128(uv, 8));
+            }
+        }
+
+        if (x < width) {
+            // Remainder in C
+            generic_row_pair(src0 + x * 4, src1 + x * 4, y0 + x, y1 + x, interleave ? u + x : u + x / 2, interleave ? v : v + x / 2,
+                width - x, interleave);
+        }
+    }
+} // namespace rfb::yuv
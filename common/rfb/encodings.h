@@ -88,6 +88,7 @@ namespace rfb {
   constexpr int pseudoEncodingVideoOutTimeLevel100 = -1887;
   constexpr int pseudoEncodingQOI = -1886;
   constexpr int pseudoEncodingKasmDisconnectNotify = -1885;
+  constexpr int pseudoEncodingKasmUdpRecovery = -1884;
 
     constexpr int pseudoEncodingHardwareProfile0 = -1170;
     constexpr int pseudoEncodingHardwareProfile4 = -1166;
@@ -78,6 +78,8 @@ FFmpeg::FFmpeg() {
         av_frame_alloc_f = D_LOOKUP_SYM(handle, av_frame_alloc);
         av_frame_unref_f = D_LOOKUP_SYM(handle, av_frame_unref);
         av_frame_get_buffer_f = D_LOOKUP_SYM(handle, av_frame_get_buffer);
+        av_frame_new_side_data_f = D_LOOKUP_SYM(handle, av_frame_new_side_data);
+        av_frame_remove_side_data_f = D_LOOKUP_SYM(handle, av_frame_remove_side_data);
         av_opt_next_f = D_LOOKUP_SYM(handle, av_opt_next);
         av_opt_set_f = D_LOOKUP_SYM(handle, av_opt_set);
         av_opt_set_int_f = D_LOOKUP_SYM(handle, av_opt_set_int);
@@ -86,6 +88,8 @@ FFmpeg::FFmpeg() {
         av_hwframe_ctx_alloc_f = D_LOOKUP_SYM(handle, av_hwframe_ctx_alloc);
         av_hwframe_ctx_init_f = D_LOOKUP_SYM(handle, av_hwframe_ctx_init);
         av_buffer_ref_f = D_LOOKUP_SYM(handle, av_buffer_ref);
+        av_buffer_alloc_f = D_LOOKUP_SYM(handle, av_buffer_alloc);
+        av_buffer_is_writable_f = D_LOOKUP_SYM(handle, av_buffer_is_writable);
         av_hwframe_get_buffer_f = D_LOOKUP_SYM(handle, av_hwframe_get_buffer);
         av_hwframe_transfer_data_f = D_LOOKUP_SYM(handle, av_hwframe_transfer_data);
         av_strerror_f = D_LOOKUP_SYM(handle, av_strerror);
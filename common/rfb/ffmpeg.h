@@ -95,6 +95,8 @@ class FFmpeg final {
     using av_frame_alloc_func = AVFrame *(*) ();
     using av_frame_get_buffer_func = int (*)(AVFrame *frame, int align);
     using av_frame_unref_func = void (*)(AVFrame *frame);
+    using av_frame_new_side_data_func = AVFrameSideData *(*) (AVFrame *frame, AVFrameSideDataType type, size_t size);
+    using av_frame_remove_side_data_func = void (*)(AVFrame *frame, AVFrameSideDataType type);
     using av_opt_next_func = const AVOption *(*) (const void *obj, const AVOption *prev);
     using av_opt_set_func = int (*)(void *obj, const char *name, const char *val, int search_flags);
     using av_opt_set_int_func = int (*)(void *obj, const char *name, int64_t val, int search_flags);
@@ -104,6 +106,8 @@ class FFmpeg final {
     using av_hwframe_ctx_alloc_func = AVBufferRef *(*) (AVBufferRef *device_ctx);
     using av_hwframe_ctx_init_func = int (*)(AVBufferRef *ref);
     using av_buffer_ref_func = AVBufferRef *(*) (const AVBufferRef *buf);
+    using av_buffer_alloc_func = AVBufferRef *(*) (size_t size);
+    using av_buffer_is_writable_func = int (*)(const AVBufferRef *buf);
     using av_hwframe_get_buffer_func = int (*)(AVBufferRef *hwframe_ctx, AVFrame *frame, int flags);
     using av_hwframe_transfer_data_func = int (*)(AVFrame *dst, const AVFrame *src, int flags);
     using av_strerror_func = int (*)(int errnum, char *errbuf, size_t errbuf_size);
@@ -158,6 +162,8 @@ class FFmpeg final {
     av_frame_alloc_func av_frame_alloc_f{};
     av_frame_get_buffer_func av_frame_get_buffer_f{};
     av_frame_unref_func av_frame_unref_f{};
+    av_frame_new_side_data_func av_frame_new_side_data_f{};
+    av_frame_remove_side_data_func av_frame_remove_side_data_f{};
     av_opt_next_func av_opt_next_f{};
     av_opt_set_func av_opt_set_f{};
     av_opt_set_int_func av_opt_set_int_f{};
@@ -166,6 +172,8 @@ class FFmpeg final {
     av_hwframe_ctx_alloc_func av_hwframe_ctx_alloc_f{};
     av_hwframe_ctx_init_func av_hwframe_ctx_init_f{};
     av_buffer_ref_func av_buffer_ref_f{};
+    av_buffer_alloc_func av_buffer_alloc_f{};
+    av_buffer_is_writable_func av_buffer_is_writable_f{};
     av_hwframe_get_buffer_func av_hwframe_get_buffer_f{};
     av_hwframe_transfer_data_func av_hwframe_transfer_data_f{};
     av_strerror_func av_strerror_f{};
@@ -256,6 +264,14 @@ public:
         av_frame_unref_f(frame);
     }
 
+    [[nodiscard]] AVFrameSideData *av_frame_new_side_data(AVFrame *frame, AVFrameSideDataType type, size_t size) const {
+        return av_frame_new_side_data_f(frame, type, size);
+    }
+
+    void av_frame_remove_side_data(AVFrame *frame, AVFrameSideDataType type) const {
+        av_frame_remove_side_data_f(frame, type);
+    }
+
     [[nodiscard]] const AVOption *av_opt_next(const void *obj, const AVOption *prev) {
         return av_opt_next_f(obj, prev);
     }
@@ -289,6 +305,14 @@ public:
         return av_buffer_ref_f(buf);
     }
 
+    [[nodiscard]] AVBufferRef *av_buffer_alloc(size_t size) const {
+        return av_buffer_alloc_f(size);
+    }
+
+    [[nodiscard]] int av_buffer_is_writable(const AVBufferRef *buf) const {
+        return av_buffer_is_writable_f(buf);
+    }
+
     [[nodiscard]] int av_hwframe_get_buffer(AVBufferRef *hwframe_ctx, AVFrame *frame, int flags) const {
         return av_hwframe_get_buffer_f(hwframe_ctx, frame, flags);
     }
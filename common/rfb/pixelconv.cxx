@@ -0,0 +1,59 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <rfb/cpuid.h>
+#include <rfb/pixelconv.h>
+
+namespace rfb {
+
+bool shuffle888(uint8_t *dst, const uint8_t *src, const int w, const int h,
+		const int dstStride, const int srcStride,
+		const uint8_t order[4]) {
+	if (cpu_info::has_avx2)
+		return AVX2_shuffle888(dst, src, w, h, dstStride, srcStride, order);
+
+	return false;
+}
+
+bool convert888to16(uint16_t *dst, const uint8_t *src, const int w, const int h,
+			const int dstStride, const int srcStride,
+			const int srcShift[3], const int max[3], const int shift[3],
+			const bool swap) {
+	if (cpu_info::has_avx2)
+		return AVX2_convert888to16(dst, src, w, h, dstStride, srcStride,
+					srcShift, max, shift, swap);
+
+	return false;
+}
+
+#ifndef HAVE_PIXELCONV_AVX2
+bool AVX2_shuffle888(uint8_t *dst, const uint8_t *src, const int w, const int h,
+			const int dstStride, const int srcStride,
+			const uint8_t order[4]) {
+	return false;
+}
+
+bool AVX2_convert888to16(uint16_t *dst, const uint8_t *src, const int w, const int h,
+			const int dstStride, const int srcStride,
+			const int srcShift[3], const int max[3], const int shift[3],
+			const bool swap) {
+	return false;
+}
+#endif
+
+}; // namespace rfb
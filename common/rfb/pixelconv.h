@@ -0,0 +1,61 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// Pixel format conversion kernels for PixelFormat::bufferFromBuffer().
+//
+// shuffle888() reorders the bytes of each 888 pixel, byte i of a dst
+// pixel being byte order[i] of the src one. This covers RGB/BGR and
+// endian swaps.
+//
+// convert888to16() turns 888 pixels into a 16bpp format such as 565 or
+// 555. srcShift are the bit positions of red, green and blue in a src
+// pixel read as a little endian 32-bit value, max and shift describe
+// the dst format, and swap byteswaps the result. Channels are rounded
+// the same way as PixelFormat's down conversion tables.
+//
+// Strides are in pixels. Both return false when the CPU has no faster
+// version than the scalar code in PixelFormat, which then does the work.
+//
+
+#ifndef __RFB_PIXELCONV_H__
+#define __RFB_PIXELCONV_H__
+
+#include <stdint.h>
+
+namespace rfb {
+
+	// Picks the best version for the CPU
+	bool shuffle888(uint8_t *dst, const uint8_t *src, const int w, const int h,
+			const int dstStride, const int srcStride,
+			const uint8_t order[4]);
+	bool convert888to16(uint16_t *dst, const uint8_t *src, const int w, const int h,
+			const int dstStride, const int srcStride,
+			const int srcShift[3], const int max[3], const int shift[3],
+			const bool swap);
+
+	bool AVX2_shuffle888(uint8_t *dst, const uint8_t *src, const int w, const int h,
+			const int dstStride, const int srcStride,
+			const uint8_t order[4]);
+	bool AVX2_convert888to16(uint16_t *dst, const uint8_t *src, const int w, const int h,
+			const int dstStride, const int srcStride,
+			const int srcShift[3], const int max[3], const int shift[3],
+			const bool swap);
+};
+
+#endif
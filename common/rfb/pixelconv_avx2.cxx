@@ -0,0 +1,135 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+#include <immintrin.h>
+
+#include <rfb/pixelconv.h>
+
+namespace rfb {
+
+bool AVX2_shuffle888(uint8_t *dst, const uint8_t *src, const int w, const int h,
+			const int dstStride, const int srcStride,
+			const uint8_t order[4]) {
+	uint8_t idx[32];
+
+	for (unsigned i = 0; i < 32; i++)
+		idx[i] = (i & ~3) % 16 + order[i & 3];
+
+	const __m256i mask = _mm256_loadu_si256((const __m256i *) idx);
+
+	for (int y = 0; y < h; y++) {
+		const uint8_t *s = src + (size_t) y * srcStride * 4;
+		uint8_t *d = dst + (size_t) y * dstStride * 4;
+		int x;
+
+		for (x = 0; x + 8 <= w; x += 8) {
+			const __m256i px = _mm256_loadu_si256((const __m256i *) (s + x * 4));
+			_mm256_storeu_si256((__m256i *) (d + x * 4),
+						_mm256_shuffle_epi8(px, mask));
+		}
+
+		for (; x < w; x++) {
+			for (unsigned i = 0; i < 4; i++)
+				d[x * 4 + i] = s[x * 4 + order[i]];
+		}
+	}
+
+	return true;
+}
+
+// (v * max + 128) / 255 without the division, exact for all 8-bit v
+static inline uint32_t down(const uint32_t v, const uint32_t max) {
+	const uint32_t t = v * max + 128;
+	return (t + 1 + (t >> 8)) >> 8;
+}
+
+static inline __m256i down(const __m256i v, const __m256i max) {
+	// The products fit in 16 bits, the upper half of each lane stays 0
+	const __m256i t = _mm256_add_epi32(_mm256_mullo_epi16(v, max),
+						_mm256_set1_epi32(128));
+	return _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(t, _mm256_set1_epi32(1)),
+							_mm256_srli_epi32(t, 8)), 8);
+}
+
+bool AVX2_convert888to16(uint16_t *dst, const uint8_t *src, const int w, const int h,
+			const int dstStride, const int srcStride,
+			const int srcShift[3], const int max[3], const int shift[3],
+			const bool swap) {
+	const __m256i byteMask = _mm256_set1_epi32(0xff);
+	__m128i srcCount[3], dstCount[3];
+	__m256i maxv[3];
+
+	for (unsigned c = 0; c < 3; c++) {
+		srcCount[c] = _mm_cvtsi32_si128(srcShift[c]);
+		dstCount[c] = _mm_cvtsi32_si128(shift[c]);
+		maxv[c] = _mm256_set1_epi32(max[c]);
+	}
+
+	auto convert8 = [&](const uint8_t *s) {
+		const __m256i px = _mm256_loadu_si256((const __m256i *) s);
+		__m256i out = _mm256_setzero_si256();
+
+		for (unsigned c = 0; c < 3; c++) {
+			const __m256i v = _mm256_and_si256(_mm256_srl_epi32(px, srcCount[c]),
+								byteMask);
+			out = _mm256_or_si256(out, _mm256_sll_epi32(down(v, maxv[c]),
+									dstCount[c]));
+		}
+
+		return out;
+	};
+
+	for (int y = 0; y < h; y++) {
+		const uint8_t *s = src + (size_t) y * srcStride * 4;
+		uint16_t *d = dst + (size_t) y * dstStride;
+		int x;
+
+		for (x = 0; x + 16 <= w; x += 16) {
+			// packus works within each 128-bit half, put the quads back in order
+			__m256i out = _mm256_permute4x64_epi64(
+					_mm256_packus_epi32(convert8(s + x * 4),
+								convert8(s + x * 4 + 32)), 0xd8);
+
+			if (swap)
+				out = _mm256_or_si256(_mm256_slli_epi16(out, 8),
+							_mm256_srli_epi16(out, 8));
+
+			_mm256_storeu_si256((__m256i *) (d + x), out);
+		}
+
+		for (; x < w; x++) {
+			uint32_t px;
+			uint16_t out = 0;
+
+			memcpy(&px, s + x * 4, 4);
+
+			for (unsigned c = 0; c < 3; c++)
+				out |= down((px >> srcShift[c]) & 0xff, max[c]) << shift[c];
+
+			if (swap)
+				out = (out << 8) | (out >> 8);
+
+			d[x] = out;
+		}
+	}
+
+	return true;
+}
+
+}; // namespace rfb
@@ -0,0 +1,81 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <rfb/cpuid.h>
+#include <rfb/rectanalysis.h>
+
+namespace rfb {
+
+bool generic_solidRect32(const uint32_t *px, const unsigned stride,
+			const unsigned w, const unsigned h, const uint32_t colour) {
+	for (unsigned y = 0; y < h; y++, px += stride) {
+		uint32_t diff = 0;
+
+		// No early exit inside the row, so the compiler can vectorize it
+		for (unsigned x = 0; x < w; x++)
+			diff |= px[x] ^ colour;
+
+		if (diff)
+			return false;
+	}
+
+	return true;
+}
+
+unsigned generic_colourChanges32(const uint32_t *px, const unsigned len,
+			uint32_t prev, uint16_t *pos) {
+	unsigned n = 0;
+
+	for (unsigned x = 0; x < len; x++) {
+		if (px[x] != prev)
+			pos[n++] = x;
+		prev = px[x];
+	}
+
+	return n;
+}
+
+bool solidRect32(const uint32_t *px, const unsigned stride,
+		const unsigned w, const unsigned h, const uint32_t colour) {
+	if (cpu_info::has_avx2)
+		return AVX2_solidRect32(px, stride, w, h, colour);
+
+	return generic_solidRect32(px, stride, w, h, colour);
+}
+
+unsigned colourChanges32(const uint32_t *px, const unsigned len,
+			const uint32_t prev, uint16_t *pos) {
+	if (cpu_info::has_avx2)
+		return AVX2_colourChanges32(px, len, prev, pos);
+
+	return generic_colourChanges32(px, len, prev, pos);
+}
+
+#ifndef HAVE_RECTANALYSIS_AVX2
+bool AVX2_solidRect32(const uint32_t *px, const unsigned stride,
+			const unsigned w, const unsigned h, const uint32_t colour) {
+	return generic_solidRect32(px, stride, w, h, colour);
+}
+
+unsigned AVX2_colourChanges32(const uint32_t *px, const unsigned len,
+			const uint32_t prev, uint16_t *pos) {
+	return generic_colourChanges32(px, len, prev, pos);
+}
+#endif
+
+}; // namespace rfb
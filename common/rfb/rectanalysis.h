@@ -0,0 +1,59 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// Pixel scanning kernels for the 32bpp encoder selection in EncodeManager.
+//
+// solidRect32() tells if all w x h pixels are colour, stride is in pixels.
+//
+// colourChanges32() stores the positions in px[0..len) where the colour
+// differs from the pixel before it, prev standing in for the one before
+// px[0], and returns how many there are. The runs between them are all
+// analyseRect() needs, so on text and flat content it only has to look
+// at a few pixels itself. len must be at most RECTANALYSIS_CHUNK.
+//
+
+#ifndef __RFB_RECTANALYSIS_H__
+#define __RFB_RECTANALYSIS_H__
+
+#include <stdint.h>
+
+namespace rfb {
+
+	enum {
+		RECTANALYSIS_CHUNK = 256
+	};
+
+	// Picks the best version for the CPU
+	bool solidRect32(const uint32_t *px, const unsigned stride,
+			const unsigned w, const unsigned h, const uint32_t colour);
+	unsigned colourChanges32(const uint32_t *px, const unsigned len,
+			const uint32_t prev, uint16_t *pos);
+
+	bool generic_solidRect32(const uint32_t *px, const unsigned stride,
+			const unsigned w, const unsigned h, const uint32_t colour);
+	unsigned generic_colourChanges32(const uint32_t *px, const unsigned len,
+			const uint32_t prev, uint16_t *pos);
+
+	bool AVX2_solidRect32(const uint32_t *px, const unsigned stride,
+			const unsigned w, const unsigned h, const uint32_t colour);
+	unsigned AVX2_colourChanges32(const uint32_t *px, const unsigned len,
+			const uint32_t prev, uint16_t *pos);
+};
+
+#endif
@@ -0,0 +1,80 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <immintrin.h>
+
+#include <rfb/rectanalysis.h>
+
+namespace rfb {
+
+bool AVX2_solidRect32(const uint32_t *px, const unsigned stride,
+			const unsigned w, const unsigned h, const uint32_t colour) {
+	const __m256i c = _mm256_set1_epi32(colour);
+
+	for (unsigned y = 0; y < h; y++, px += stride) {
+		__m256i diff = _mm256_setzero_si256();
+		unsigned x;
+
+		for (x = 0; x + 8 <= w; x += 8)
+			diff = _mm256_or_si256(diff,
+				_mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (px + x)), c));
+
+		if (!_mm256_testz_si256(diff, diff))
+			return false;
+
+		for (; x < w; x++) {
+			if (px[x] != colour)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+unsigned AVX2_colourChanges32(const uint32_t *px, const unsigned len,
+				const uint32_t prev, uint16_t *pos) {
+	unsigned n = 0, x;
+
+	if (!len)
+		return 0;
+
+	if (px[0] != prev)
+		pos[n++] = 0;
+
+	// Each pixel against its left neighbour, one unaligned load apart
+	for (x = 1; x + 8 <= len; x += 8) {
+		const __m256i cur = _mm256_loadu_si256((const __m256i *) (px + x));
+		const __m256i before = _mm256_loadu_si256((const __m256i *) (px + x - 1));
+		unsigned mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(
+					_mm256_cmpeq_epi32(cur, before))) & 0xff;
+
+		while (mask) {
+			pos[n++] = x + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+
+	for (; x < len; x++) {
+		if (px[x] != px[x - 1])
+			pos[n++] = x;
+	}
+
+	return n;
+}
+
+}; // namespace rfb
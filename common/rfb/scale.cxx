@@ -0,0 +1,430 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+
+#include <rfb/ScaleFilters.h>
+#include <rfb/cpuid.h>
+#include <rfb/scale.h>
+#include <rfb/scale_sse2.h>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+
+namespace rfb {
+
+// Bands get at least this many target pixels, less isn't worth a thread
+static const unsigned BAND_PIXELS = 32 * 1024;
+
+static tbb::task_arena &scaleArena() {
+	static tbb::task_arena arena(cpu_info::cores_count);
+	return arena;
+}
+
+static inline bool haveAVX2() {
+#ifdef HAVE_SCALE_AVX2
+	return cpu_info::has_avx2;
+#else
+	return false;
+#endif
+}
+
+static inline bool haveAVX512() {
+#ifdef HAVE_SCALE_AVX512
+	return cpu_info::has_avx512bw;
+#else
+	return false;
+#endif
+}
+
+template<typename F>
+static void forBands(const uint16_t y0, const uint16_t y1, const unsigned width,
+			const F &fn) {
+	const unsigned rows = y1 - y0;
+
+	if (cpu_info::cores_count < 2 || width * rows < BAND_PIXELS * 2) {
+		fn(y0, y1);
+		return;
+	}
+
+	unsigned grain = BAND_PIXELS / width;
+	if (!grain)
+		grain = 1;
+
+	scaleArena().execute([&] {
+		tbb::parallel_for(tbb::blocked_range<unsigned>(y0, y1, grain),
+				[&](const tbb::blocked_range<unsigned> &r) {
+			fn(r.begin(), r.end());
+		});
+	});
+}
+
+ScaleWeights::ScaleWeights(unsigned filter, unsigned srclen, unsigned dstlen) {
+	ScaleFilters filters;
+	SFilterWeightTab *tabs;
+	unsigned x;
+	int i;
+
+	if (filter == scaleFilterArea)
+		filters.makeAreaWeightTabs(srclen, dstlen, &tabs);
+	else
+		filters.makeWeightTabs(filter, srclen, dstlen, &tabs);
+
+	taps = 1;
+	for (x = 0; x < dstlen; x++) {
+		if ((unsigned) (tabs[x].i1 - tabs[x].i0) > taps)
+			taps = tabs[x].i1 - tabs[x].i0;
+	}
+
+	// The SIMD kernels take taps in pairs
+	if ((taps & 1) && taps < srclen)
+		taps++;
+
+	start.resize(dstlen);
+	weights.assign(dstlen * taps, 0);
+
+	for (x = 0; x < dstlen; x++) {
+		unsigned first = tabs[x].i0;
+		if (first + taps > srclen)
+			first = srclen - taps;
+
+		start[x] = first;
+		for (i = tabs[x].i0; i < tabs[x].i1; i++)
+			weights[x * taps + i - first] = tabs[x].weight[i - tabs[x].i0];
+
+		delete [] tabs[x].weight;
+	}
+
+	delete [] tabs;
+}
+
+//
+// Generic versions
+//
+
+static void generic_halve(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1) {
+	uint16_t x, y;
+	uint8_t i;
+
+	for (y = y0; y < y1; y++) {
+		const uint8_t * const row0 = oldpx + oldstride * y * 2 * 4;
+		const uint8_t * const row1 = row0 + oldstride * 4;
+		uint8_t * const dst = newpx + newstride * y * 4;
+
+		for (x = x0; x < x1; x++) {
+			for (i = 0; i < 4; i++) {
+				dst[x * 4 + i] =
+					(row0[x * 8 + i] +
+					row0[x * 8 + 4 + i] +
+					row1[x * 8 + i] +
+					row1[x * 8 + 4 + i]) / 4;
+			}
+		}
+	}
+}
+
+static void generic_bilinearRows(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const uint16_t srch, const float invdiff,
+			const BilinearColumn *cols, const uint16_t vend,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1) {
+	uint16_t x, y;
+	uint8_t i;
+
+	for (y = y0; y < y1; y++) {
+		const float ny = y * invdiff;
+		const uint16_t lowy = ny;
+		const uint16_t highy = lowy + 1;
+		uint8_t * const dst = newpx + newstride * y * 4;
+
+		if (highy >= srch) {
+			const uint16_t safe_lowy = (lowy < srch) ? lowy : srch - 1;
+			const uint8_t * const row = oldpx + oldstride * safe_lowy * 4;
+
+			for (x = x0; x < x1; x++) {
+				const BilinearColumn &c = cols[x - x0];
+				for (i = 0; i < 4; i++)
+					dst[x * 4 + i] = (row[c.lowx * 4 + i] * c.left +
+							row[c.highx * 4 + i] * c.right) >> 8;
+			}
+			continue;
+		}
+
+		const uint16_t bot = (ny - lowy) * 256;
+		const uint16_t top = 256 - bot;
+		const uint8_t * const row0 = oldpx + oldstride * lowy * 4;
+		const uint8_t * const row1 = oldpx + oldstride * highy * 4;
+
+		for (x = x0; x < x1; x++) {
+			const BilinearColumn &c = cols[x - x0];
+
+			for (i = 0; i < 4; i++) {
+				uint32_t val, val2;
+
+				if (x < vend) {
+					val = (row0[c.lowx * 4 + i] * top +
+						row1[c.lowx * 4 + i] * bot) >> 8;
+					val2 = (row0[c.highx * 4 + i] * top +
+						row1[c.highx * 4 + i] * bot) >> 8;
+
+					dst[x * 4 + i] = (val * c.left + val2 * c.right) >> 8;
+				} else {
+					val = (row0[c.lowx * 4 + i] * c.left +
+						row0[c.highx * 4 + i] * c.right) >> 8;
+					val2 = (row1[c.lowx * 4 + i] * c.left +
+						row1[c.highx * 4 + i] * c.right) >> 8;
+
+					dst[x * 4 + i] = (val * top + val2 * bot) >> 8;
+				}
+			}
+		}
+	}
+}
+
+static void generic_filterVert(const uint8_t *src, const unsigned stride,
+			const int16_t *weights, const unsigned taps,
+			int16_t *out, const unsigned len) {
+	unsigned i, k;
+
+	for (i = 0; i < len; i++) {
+		int32_t acc = 0;
+
+		for (k = 0; k < taps; k++)
+			acc += weights[k] * src[k * stride + i];
+
+		acc >>= SCALE_VERT_SHIFT;
+		if (acc > INT16_MAX)
+			acc = INT16_MAX;
+		else if (acc < INT16_MIN)
+			acc = INT16_MIN;
+
+		out[i] = acc;
+	}
+}
+
+static void generic_filterHorz(const int16_t *tmp, const uint16_t *start,
+			const int16_t *weights, const unsigned taps,
+			uint8_t *dst, const unsigned count) {
+	unsigned x, j;
+	uint8_t i;
+
+	for (x = 0; x < count; x++, weights += taps) {
+		const int16_t * const px = tmp + start[x] * 4;
+
+		for (i = 0; i < 4; i++) {
+			int32_t acc = 1 << (SCALE_HORZ_SHIFT - 1);
+
+			for (j = 0; j < taps; j++)
+				acc += weights[j] * px[j * 4 + i];
+
+			acc >>= SCALE_HORZ_SHIFT;
+			if (acc > 255)
+				acc = 255;
+			else if (acc < 0)
+				acc = 0;
+
+			dst[x * 4 + i] = acc;
+		}
+	}
+}
+
+//
+// Dispatch
+//
+
+void scaleNearest(const uint8_t *oldpx, const unsigned oldstride,
+		uint8_t *newpx, const unsigned newstride,
+		const float tgtdiff,
+		const uint16_t x0, const uint16_t y0,
+		const uint16_t x1, const uint16_t y1) {
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	const float rowstep = 1 / tgtdiff;
+	std::vector<uint16_t> cols(x1 - x0);
+	uint16_t x;
+
+	for (x = x0; x < x1; x++)
+		cols[x - x0] = x / tgtdiff;
+
+	forBands(y0, y1, x1 - x0, [&](const uint16_t by0, const uint16_t by1) {
+		for (uint16_t y = by0; y < by1; y++) {
+			const uint16_t ny = rowstep * y;
+			const uint32_t * const src = (const uint32_t *) (oldpx + oldstride * ny * 4);
+			uint32_t * const dst = (uint32_t *) (newpx + newstride * y * 4);
+
+			for (uint16_t x = x0; x < x1; x++)
+				dst[x] = src[cols[x - x0]];
+		}
+	});
+}
+
+void scaleHalve(const uint8_t *oldpx, const unsigned oldstride,
+		uint8_t *newpx, const unsigned newstride,
+		const uint16_t tgtw, const uint16_t tgth,
+		const uint16_t x0, const uint16_t y0,
+		const uint16_t x1, const uint16_t y1) {
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	forBands(y0, y1, x1 - x0, [&](const uint16_t by0, const uint16_t by1) {
+#ifdef HAVE_SCALE_AVX512
+		if (cpu_info::has_avx512bw) {
+			AVX512_halve(oldpx, oldstride, newpx, newstride, x0, by0, x1, by1);
+			return;
+		}
+#endif
+#ifdef HAVE_SCALE_AVX2
+		if (cpu_info::has_avx2) {
+			AVX2_halve(oldpx, oldstride, newpx, newstride, x0, by0, x1, by1);
+			return;
+		}
+#endif
+		if (cpu_info::has_sse2) {
+			SSE2_halve(oldpx, tgtw, tgth, newpx, oldstride, newstride,
+					x0, by0, x1, by1);
+			return;
+		}
+
+		generic_halve(oldpx, oldstride, newpx, newstride, x0, by0, x1, by1);
+	});
+}
+
+void scaleBilinear(const uint8_t *oldpx, const unsigned oldstride,
+		uint8_t *newpx, const unsigned newstride,
+		const uint16_t tgtw, const uint16_t tgth,
+		const float tgtdiff,
+		const uint16_t x0, const uint16_t y0,
+		const uint16_t x1, const uint16_t y1) {
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	if (cpu_info::has_sse2 && !haveAVX2() && !haveAVX512()) {
+		forBands(y0, y1, x1 - x0, [&](const uint16_t by0, const uint16_t by1) {
+			SSE2_scale(oldpx, tgtw, tgth, newpx, oldstride, newstride,
+					tgtdiff, x0, by0, x1, by1);
+		});
+		return;
+	}
+
+	// Same math as SSE2_scale(), with the columns worked out once
+	const float invdiff = 1 / tgtdiff;
+	const uint16_t srcw = (uint16_t)(tgtw * invdiff);
+	const uint16_t srch = (uint16_t)(tgth * invdiff);
+	std::vector<BilinearColumn> cols(x1 - x0);
+	uint16_t x, vend;
+
+	for (x = x0; x < x1; x++) {
+		const float nx = x * invdiff;
+		BilinearColumn &c = cols[x - x0];
+
+		c.lowx = nx;
+		c.highx = (c.lowx + 1 < srcw) ? c.lowx + 1 : c.lowx;
+		c.right = (nx - c.lowx) * 256;
+		c.left = 256 - c.right;
+	}
+
+	// SSE2_scale() does pairs of columns, from even ones, and falls back
+	// to the other order for a pair reaching the last source column
+	for (vend = x0 & ~1; vend < x1 && vend < tgtw - 1; vend += 2) {
+		const uint16_t lowx = (vend + 1) * invdiff;
+		if (lowx + 1 >= srcw)
+			break;
+	}
+
+	forBands(y0, y1, x1 - x0, [&](const uint16_t by0, const uint16_t by1) {
+#ifdef HAVE_SCALE_AVX512
+		if (cpu_info::has_avx512bw) {
+			AVX512_bilinearRows(oldpx, oldstride, newpx, newstride, srch, invdiff,
+						&cols[0], vend, x0, by0, x1, by1);
+			return;
+		}
+#endif
+#ifdef HAVE_SCALE_AVX2
+		if (cpu_info::has_avx2) {
+			AVX2_bilinearRows(oldpx, oldstride, newpx, newstride, srch, invdiff,
+						&cols[0], vend, x0, by0, x1, by1);
+			return;
+		}
+#endif
+		generic_bilinearRows(oldpx, oldstride, newpx, newstride, srch, invdiff,
+					&cols[0], vend, x0, by0, x1, by1);
+	});
+}
+
+void scaleFilter(const uint8_t *oldpx, const unsigned oldstride,
+		uint8_t *newpx, const unsigned newstride,
+		const ScaleWeights &xw, const ScaleWeights &yw,
+		const uint16_t x0, const uint16_t y0,
+		const uint16_t x1, const uint16_t y1) {
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	typedef void (*vertFn)(const uint8_t *, const unsigned, const int16_t *,
+				const unsigned, int16_t *, const unsigned);
+	typedef void (*horzFn)(const int16_t *, const uint16_t *, const int16_t *,
+				const unsigned, uint8_t *, const unsigned);
+
+	vertFn vert = generic_filterVert;
+	horzFn horz = generic_filterHorz;
+
+	if (cpu_info::has_sse2) {
+		vert = SSE2_filterVert;
+		horz = SSE2_filterHorz;
+	}
+#ifdef HAVE_SCALE_AVX2
+	if (cpu_info::has_avx2) {
+		vert = AVX2_filterVert;
+		horz = AVX2_filterHorz;
+	}
+#endif
+#ifdef HAVE_SCALE_AVX512
+	if (cpu_info::has_avx512bw)
+		vert = AVX512_filterVert;
+#endif
+
+	// The source columns all target pixels of the rect read
+	const unsigned sx0 = xw.start[x0];
+	const unsigned sx1 = xw.start[x1 - 1] + xw.taps;
+	std::vector<uint16_t> start(x1 - x0);
+	uint16_t x;
+
+	for (x = x0; x < x1; x++)
+		start[x - x0] = xw.start[x] - sx0;
+
+	forBands(y0, y1, x1 - x0, [&](const uint16_t by0, const uint16_t by1) {
+		// One row of the vertical pass, and a spare pixel for the
+		// kernels reading taps in pairs
+		std::vector<int16_t> tmp((sx1 - sx0 + 1) * 4, 0);
+
+		for (uint16_t y = by0; y < by1; y++) {
+			vert(oldpx + (yw.start[y] * oldstride + sx0) * 4, oldstride * 4,
+				&yw.weights[y * yw.taps], yw.taps,
+				&tmp[0], (sx1 - sx0) * 4);
+			horz(&tmp[0], &start[0], &xw.weights[x0 * xw.taps], xw.taps,
+				newpx + (y * newstride + x0) * 4, x1 - x0);
+		}
+	});
+}
+
+}; // namespace rfb
@@ -0,0 +1,148 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// Scaling kernels for 32bpp buffers, used by video mode, ScaleCache and
+// the screenshot API.
+//
+// Each entry point computes the target pixels in x0..x1, y0..y1 only,
+// with the same results as when scaling the whole buffer, and splits the
+// rows into bands run in parallel when there is enough work. The best
+// version for the CPU is picked at runtime, all versions produce the
+// same values. Strides are in pixels.
+//
+// scaleHalve() and scaleBilinear() match SSE2_halve() and SSE2_scale().
+// scaleFilter() runs a separable filter from precomputed weights, the
+// ScaleFilters ones or an exact area average, at any ratio.
+//
+
+#ifndef __RFB_SCALE_H__
+#define __RFB_SCALE_H__
+
+#include <stdint.h>
+#include <vector>
+
+namespace rfb {
+
+	// Fixed point of the filter passes: the weights of a target pixel
+	// add up to 1 << 14, the vertical pass keeps 6 fractional bits
+	enum {
+		SCALE_WEIGHT_BITS = 14,
+		SCALE_VERT_SHIFT = 8,
+		SCALE_HORZ_SHIFT = 2 * SCALE_WEIGHT_BITS - SCALE_VERT_SHIFT
+	};
+
+	// Weights along one axis, the same number of taps for every target
+	// pixel so the kernels need no per-pixel bounds
+	class ScaleWeights {
+	public:
+		// filter is one of the ScaleFilters ids, or scaleFilterArea
+		ScaleWeights(unsigned filter, unsigned srclen, unsigned dstlen);
+
+		unsigned taps;
+		std::vector<uint16_t> start;	// First source pixel per target pixel
+		std::vector<int16_t> weights;	// taps per target pixel
+	};
+
+	// Per target column of a bilinear scale
+	struct BilinearColumn {
+		uint16_t lowx, highx;
+		uint16_t left, right;
+	};
+
+	void scaleNearest(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const float tgtdiff,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1);
+
+	void scaleHalve(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const uint16_t tgtw, const uint16_t tgth,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1);
+
+	// Meant for factors between 0.5 and 1.0, below that pixels get skipped
+	void scaleBilinear(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const uint16_t tgtw, const uint16_t tgth,
+			const float tgtdiff,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1);
+
+	void scaleFilter(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const ScaleWeights &xw, const ScaleWeights &yw,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1);
+
+	//
+	// The per-CPU kernels behind the above, working on one band. The
+	// AVX512 ones need AVX-512BW.
+	//
+
+	// Columns before vend get the vertical pass first, the ones after
+	// it and the bottom rows the horizontal one, as in SSE2_scale()
+	void AVX2_bilinearRows(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const uint16_t srch, const float invdiff,
+			const BilinearColumn *cols, const uint16_t vend,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1);
+	void AVX512_bilinearRows(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const uint16_t srch, const float invdiff,
+			const BilinearColumn *cols, const uint16_t vend,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1);
+
+	void AVX2_halve(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1);
+	void AVX512_halve(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1);
+
+	// out[i] = sum(weights[k] * src[k * stride + i]) >> SCALE_VERT_SHIFT,
+	// saturated to 16 bits, for len bytes
+	void SSE2_filterVert(const uint8_t *src, const unsigned stride,
+			const int16_t *weights, const unsigned taps,
+			int16_t *out, const unsigned len);
+	void AVX2_filterVert(const uint8_t *src, const unsigned stride,
+			const int16_t *weights, const unsigned taps,
+			int16_t *out, const unsigned len);
+	void AVX512_filterVert(const uint8_t *src, const unsigned stride,
+			const int16_t *weights, const unsigned taps,
+			int16_t *out, const unsigned len);
+
+	// Each of the count target pixels is the weighted sum of taps pixels
+	// of the vertical pass output from its start on, rounded and clamped.
+	// tmp must have a spare pixel after the last one read. There is no
+	// AVX512 version, gathering four pixels into lanes costs more than
+	// the wider math gains.
+	void SSE2_filterHorz(const int16_t *tmp, const uint16_t *start,
+			const int16_t *weights, const unsigned taps,
+			uint8_t *dst, const unsigned count);
+	void AVX2_filterHorz(const int16_t *tmp, const uint16_t *start,
+			const int16_t *weights, const unsigned taps,
+			uint8_t *dst, const unsigned count);
+};
+
+#endif
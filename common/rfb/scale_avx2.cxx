@@ -0,0 +1,291 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <immintrin.h>
+
+#include <rfb/scale.h>
+
+namespace rfb {
+
+void AVX2_bilinearRows(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const uint16_t srch, const float invdiff,
+			const BilinearColumn *cols, const uint16_t vend,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1) {
+	// Spread each column's left and right weight over its four channels
+	const __m256i leftmask = _mm256_setr_epi8(4, 5, 4, 5, 4, 5, 4, 5,
+						12, 13, 12, 13, 12, 13, 12, 13,
+						4, 5, 4, 5, 4, 5, 4, 5,
+						12, 13, 12, 13, 12, 13, 12, 13);
+	const __m256i rightmask = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7,
+						14, 15, 14, 15, 14, 15, 14, 15,
+						6, 7, 6, 7, 6, 7, 6, 7,
+						14, 15, 14, 15, 14, 15, 14, 15);
+	const uint16_t vmax = vend < x1 ? vend : x1;
+	uint16_t x, y;
+	uint8_t i;
+
+	for (y = y0; y < y1; y++) {
+		const float ny = y * invdiff;
+		const uint16_t lowy = ny;
+		const uint16_t highy = lowy + 1;
+		uint8_t * const dst = newpx + newstride * y * 4;
+
+		if (highy >= srch) {
+			const uint16_t safe_lowy = (lowy < srch) ? lowy : srch - 1;
+			const uint8_t * const row = oldpx + oldstride * safe_lowy * 4;
+
+			for (x = x0; x < x1; x++) {
+				const BilinearColumn &c = cols[x - x0];
+				for (i = 0; i < 4; i++)
+					dst[x * 4 + i] = (row[c.lowx * 4 + i] * c.left +
+							row[c.highx * 4 + i] * c.right) >> 8;
+			}
+			continue;
+		}
+
+		const uint16_t bot = (ny - lowy) * 256;
+		const uint16_t top = 256 - bot;
+		const uint32_t * const row0 = (const uint32_t *) (oldpx + oldstride * lowy * 4);
+		const uint32_t * const row1 = (const uint32_t *) (oldpx + oldstride * highy * 4);
+		const uint8_t * const brow0 = (const uint8_t *) row0;
+		const uint8_t * const brow1 = (const uint8_t *) row1;
+
+		const __m256i vertmul = _mm256_set1_epi16(top);
+		const __m256i vertmul2 = _mm256_set1_epi16(bot);
+
+		for (x = x0; x + 4 <= vmax; x += 4) {
+			const BilinearColumn * const c = &cols[x - x0];
+			__m256i lo, hi, out;
+
+			lo = _mm256_add_epi16(
+				_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_setr_epi32(
+					row0[c[0].lowx], row0[c[1].lowx],
+					row0[c[2].lowx], row0[c[3].lowx])), vertmul),
+				_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_setr_epi32(
+					row1[c[0].lowx], row1[c[1].lowx],
+					row1[c[2].lowx], row1[c[3].lowx])), vertmul2));
+			hi = _mm256_add_epi16(
+				_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_setr_epi32(
+					row0[c[0].highx], row0[c[1].highx],
+					row0[c[2].highx], row0[c[3].highx])), vertmul),
+				_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_setr_epi32(
+					row1[c[0].highx], row1[c[1].highx],
+					row1[c[2].highx], row1[c[3].highx])), vertmul2));
+
+			lo = _mm256_srli_epi16(lo, 8);
+			hi = _mm256_srli_epi16(hi, 8);
+
+			const __m256i cv = _mm256_loadu_si256((const __m256i *) c);
+
+			out = _mm256_add_epi16(
+				_mm256_mullo_epi16(lo, _mm256_shuffle_epi8(cv, leftmask)),
+				_mm256_mullo_epi16(hi, _mm256_shuffle_epi8(cv, rightmask)));
+			out = _mm256_srli_epi16(out, 8);
+
+			_mm_storeu_si128((__m128i *) &dst[x * 4],
+					_mm_packus_epi16(_mm256_castsi256_si128(out),
+							_mm256_extracti128_si256(out, 1)));
+		}
+
+		for (; x < x1; x++) {
+			// Remainder in C
+			const BilinearColumn &c = cols[x - x0];
+
+			for (i = 0; i < 4; i++) {
+				uint32_t val, val2;
+
+				if (x < vend) {
+					val = (brow0[c.lowx * 4 + i] * top +
+						brow1[c.lowx * 4 + i] * bot) >> 8;
+					val2 = (brow0[c.highx * 4 + i] * top +
+						brow1[c.highx * 4 + i] * bot) >> 8;
+
+					dst[x * 4 + i] = (val * c.left + val2 * c.right) >> 8;
+				} else {
+					val = (brow0[c.lowx * 4 + i] * c.left +
+						brow0[c.highx * 4 + i] * c.right) >> 8;
+					val2 = (brow1[c.lowx * 4 + i] * c.left +
+						brow1[c.highx * 4 + i] * c.right) >> 8;
+
+					dst[x * 4 + i] = (val * top + val2 * bot) >> 8;
+				}
+			}
+		}
+	}
+}
+
+void AVX2_halve(const uint8_t *oldpx, const unsigned oldstride,
+		uint8_t *newpx, const unsigned newstride,
+		const uint16_t x0, const uint16_t y0,
+		const uint16_t x1, const uint16_t y1) {
+	uint16_t x, y;
+	uint8_t i;
+
+	for (y = y0; y < y1; y++) {
+		const uint8_t * const row0 = oldpx + oldstride * y * 2 * 4;
+		const uint8_t * const row1 = row0 + oldstride * 4;
+		uint8_t * const dst = newpx + newstride * y * 4;
+
+		// Eight source pixels of both rows to four target pixels
+		for (x = x0; x + 4 <= x1; x += 4) {
+			const __m256i a = _mm256_loadu_si256((const __m256i *) &row0[x * 8]);
+			const __m256i b = _mm256_loadu_si256((const __m256i *) &row1[x * 8]);
+			__m256i lo, hi, sum;
+
+			lo = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(a)),
+						_mm256_cvtepu8_epi16(_mm256_castsi256_si128(b)));
+			hi = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1)),
+						_mm256_cvtepu8_epi16(_mm256_extracti128_si256(b, 1)));
+
+			// Even and odd source columns, the sums come out as 0, 2 | 1, 3
+			sum = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi),
+						_mm256_unpackhi_epi64(lo, hi));
+			sum = _mm256_srli_epi16(sum, 2);
+			sum = _mm256_permute4x64_epi64(sum, _MM_SHUFFLE(3, 1, 2, 0));
+
+			_mm_storeu_si128((__m128i *) &dst[x * 4],
+					_mm_packus_epi16(_mm256_castsi256_si128(sum),
+							_mm256_extracti128_si256(sum, 1)));
+		}
+
+		for (; x < x1; x++) {
+			// Remainder in C
+			for (i = 0; i < 4; i++) {
+				dst[x * 4 + i] =
+					(row0[x * 8 + i] +
+					row0[x * 8 + 4 + i] +
+					row1[x * 8 + i] +
+					row1[x * 8 + 4 + i]) / 4;
+			}
+		}
+	}
+}
+
+void AVX2_filterVert(const uint8_t *src, const unsigned stride,
+			const int16_t *weights, const unsigned taps,
+			int16_t *out, const unsigned len) {
+	const __m256i zero = _mm256_setzero_si256();
+	unsigned i, k;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m256i acclo = zero, acchi = zero;
+
+		// Two rows at a time, interleaved for madd. Widening first
+		// keeps the results in order within the lanes.
+		for (k = 0; k < taps; k += 2) {
+			const __m256i a = _mm256_cvtepu8_epi16(
+					_mm_loadu_si128((const __m128i *) &src[k * stride + i]));
+			__m256i b = zero;
+			uint32_t w = (uint16_t) weights[k];
+
+			if (k + 1 < taps) {
+				b = _mm256_cvtepu8_epi16(
+					_mm_loadu_si128((const __m128i *) &src[(k + 1) * stride + i]));
+				w |= (uint32_t) weights[k + 1] << 16;
+			}
+
+			const __m256i wv = _mm256_set1_epi32(w);
+
+			acclo = _mm256_add_epi32(acclo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), wv));
+			acchi = _mm256_add_epi32(acchi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), wv));
+		}
+
+		acclo = _mm256_srai_epi32(acclo, SCALE_VERT_SHIFT);
+		acchi = _mm256_srai_epi32(acchi, SCALE_VERT_SHIFT);
+
+		_mm256_storeu_si256((__m256i *) &out[i], _mm256_packs_epi32(acclo, acchi));
+	}
+
+	for (; i < len; i++) {
+		// Remainder in C
+		int32_t acc = 0;
+
+		for (k = 0; k < taps; k++)
+			acc += weights[k] * src[k * stride + i];
+
+		acc >>= SCALE_VERT_SHIFT;
+		out[i] = acc > INT16_MAX ? INT16_MAX : (acc < INT16_MIN ? INT16_MIN : acc);
+	}
+}
+
+void AVX2_filterHorz(const int16_t *tmp, const uint16_t *start,
+			const int16_t *weights, const unsigned taps,
+			uint8_t *dst, const unsigned count) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi32(1 << (SCALE_HORZ_SHIFT - 1));
+	unsigned x, j;
+
+	// Two target pixels at a time, one per lane
+	for (x = 0; x + 2 <= count; x += 2, weights += taps * 2) {
+		const int16_t * const px0 = tmp + start[x] * 4;
+		const int16_t * const px1 = tmp + start[x + 1] * 4;
+		__m256i acc = round;
+
+		for (j = 0; j < taps; j += 2) {
+			const __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+					_mm_loadu_si128((const __m128i *) &px0[j * 4])),
+					_mm_loadu_si128((const __m128i *) &px1[j * 4]), 1);
+			uint32_t w0 = (uint16_t) weights[j];
+			uint32_t w1 = (uint16_t) weights[taps + j];
+
+			if (j + 1 < taps) {
+				w0 |= (uint32_t) weights[j + 1] << 16;
+				w1 |= (uint32_t) weights[taps + j + 1] << 16;
+			}
+
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(
+					_mm256_unpacklo_epi16(v, _mm256_srli_si256(v, 8)),
+					_mm256_setr_epi32(w0, w0, w0, w0, w1, w1, w1, w1)));
+		}
+
+		acc = _mm256_srai_epi32(acc, SCALE_HORZ_SHIFT);
+		acc = _mm256_packs_epi32(acc, zero);
+		acc = _mm256_packus_epi16(acc, zero);
+
+		*(uint32_t *) &dst[x * 4] = _mm_cvtsi128_si32(_mm256_castsi256_si128(acc));
+		*(uint32_t *) &dst[(x + 1) * 4] = _mm_cvtsi128_si32(_mm256_extracti128_si256(acc, 1));
+	}
+
+	if (x < count) {
+		// The odd one out, in 128 bits
+		const int16_t * const px = tmp + start[x] * 4;
+		__m128i acc = _mm256_castsi256_si128(round);
+
+		for (j = 0; j < taps; j += 2) {
+			const __m128i v = _mm_loadu_si128((const __m128i *) &px[j * 4]);
+			uint32_t w = (uint16_t) weights[j];
+
+			if (j + 1 < taps)
+				w |= (uint32_t) weights[j + 1] << 16;
+
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(
+					_mm_unpacklo_epi16(v, _mm_srli_si128(v, 8)),
+					_mm_set1_epi32(w)));
+		}
+
+		acc = _mm_srai_epi32(acc, SCALE_HORZ_SHIFT);
+		acc = _mm_packs_epi32(acc, _mm_setzero_si128());
+		acc = _mm_packus_epi16(acc, _mm_setzero_si128());
+
+		*(uint32_t *) &dst[x * 4] = _mm_cvtsi128_si32(acc);
+	}
+}
+
+}; // namespace rfb
@@ -0,0 +1,234 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <immintrin.h>
+
+#include <rfb/scale.h>
+
+namespace rfb {
+
+// These need AVX-512BW for the 16-bit math, with only AVX-512F the
+// 32-bit lanes would make them slower than the AVX2 versions
+
+void AVX512_bilinearRows(const uint8_t *oldpx, const unsigned oldstride,
+			uint8_t *newpx, const unsigned newstride,
+			const uint16_t srch, const float invdiff,
+			const BilinearColumn *cols, const uint16_t vend,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1) {
+	// Spread each column's left and right weight over its four channels
+	const __m512i leftmask = _mm512_broadcast_i32x4(_mm_setr_epi8(
+						4, 5, 4, 5, 4, 5, 4, 5,
+						12, 13, 12, 13, 12, 13, 12, 13));
+	const __m512i rightmask = _mm512_broadcast_i32x4(_mm_setr_epi8(
+						6, 7, 6, 7, 6, 7, 6, 7,
+						14, 15, 14, 15, 14, 15, 14, 15));
+	const uint16_t vmax = vend < x1 ? vend : x1;
+	uint16_t x, y;
+	uint8_t i;
+
+	for (y = y0; y < y1; y++) {
+		const float ny = y * invdiff;
+		const uint16_t lowy = ny;
+		const uint16_t highy = lowy + 1;
+		uint8_t * const dst = newpx + newstride * y * 4;
+
+		if (highy >= srch) {
+			const uint16_t safe_lowy = (lowy < srch) ? lowy : srch - 1;
+			const uint8_t * const row = oldpx + oldstride * safe_lowy * 4;
+
+			for (x = x0; x < x1; x++) {
+				const BilinearColumn &c = cols[x - x0];
+				for (i = 0; i < 4; i++)
+					dst[x * 4 + i] = (row[c.lowx * 4 + i] * c.left +
+							row[c.highx * 4 + i] * c.right) >> 8;
+			}
+			continue;
+		}
+
+		const uint16_t bot = (ny - lowy) * 256;
+		const uint16_t top = 256 - bot;
+		const uint32_t * const row0 = (const uint32_t *) (oldpx + oldstride * lowy * 4);
+		const uint32_t * const row1 = (const uint32_t *) (oldpx + oldstride * highy * 4);
+		const uint8_t * const brow0 = (const uint8_t *) row0;
+		const uint8_t * const brow1 = (const uint8_t *) row1;
+
+		const __m512i vertmul = _mm512_set1_epi16(top);
+		const __m512i vertmul2 = _mm512_set1_epi16(bot);
+
+		for (x = x0; x + 8 <= vmax; x += 8) {
+			const BilinearColumn * const c = &cols[x - x0];
+			__m512i lo, hi, out;
+
+			lo = _mm512_add_epi16(
+				_mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_setr_epi32(
+					row0[c[0].lowx], row0[c[1].lowx],
+					row0[c[2].lowx], row0[c[3].lowx],
+					row0[c[4].lowx], row0[c[5].lowx],
+					row0[c[6].lowx], row0[c[7].lowx])), vertmul),
+				_mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_setr_epi32(
+					row1[c[0].lowx], row1[c[1].lowx],
+					row1[c[2].lowx], row1[c[3].lowx],
+					row1[c[4].lowx], row1[c[5].lowx],
+					row1[c[6].lowx], row1[c[7].lowx])), vertmul2));
+			hi = _mm512_add_epi16(
+				_mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_setr_epi32(
+					row0[c[0].highx], row0[c[1].highx],
+					row0[c[2].highx], row0[c[3].highx],
+					row0[c[4].highx], row0[c[5].highx],
+					row0[c[6].highx], row0[c[7].highx])), vertmul),
+				_mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_setr_epi32(
+					row1[c[0].highx], row1[c[1].highx],
+					row1[c[2].highx], row1[c[3].highx],
+					row1[c[4].highx], row1[c[5].highx],
+					row1[c[6].highx], row1[c[7].highx])), vertmul2));
+
+			lo = _mm512_srli_epi16(lo, 8);
+			hi = _mm512_srli_epi16(hi, 8);
+
+			const __m512i cv = _mm512_loadu_si512(c);
+
+			out = _mm512_add_epi16(
+				_mm512_mullo_epi16(lo, _mm512_shuffle_epi8(cv, leftmask)),
+				_mm512_mullo_epi16(hi, _mm512_shuffle_epi8(cv, rightmask)));
+			out = _mm512_srli_epi16(out, 8);
+
+			_mm256_storeu_si256((__m256i *) &dst[x * 4], _mm512_cvtepi16_epi8(out));
+		}
+
+		for (; x < x1; x++) {
+			// Remainder in C
+			const BilinearColumn &c = cols[x - x0];
+
+			for (i = 0; i < 4; i++) {
+				uint32_t val, val2;
+
+				if (x < vend) {
+					val = (brow0[c.lowx * 4 + i] * top +
+						brow1[c.lowx * 4 + i] * bot) >> 8;
+					val2 = (brow0[c.highx * 4 + i] * top +
+						brow1[c.highx * 4 + i] * bot) >> 8;
+
+					dst[x * 4 + i] = (val * c.left + val2 * c.right) >> 8;
+				} else {
+					val = (brow0[c.lowx * 4 + i] * c.left +
+						brow0[c.highx * 4 + i] * c.right) >> 8;
+					val2 = (brow1[c.lowx * 4 + i] * c.left +
+						brow1[c.highx * 4 + i] * c.right) >> 8;
+
+					dst[x * 4 + i] = (val * top + val2 * bot) >> 8;
+				}
+			}
+		}
+	}
+}
+
+void AVX512_halve(const uint8_t *oldpx, const unsigned oldstride,
+		uint8_t *newpx, const unsigned newstride,
+		const uint16_t x0, const uint16_t y0,
+		const uint16_t x1, const uint16_t y1) {
+	// The pair sums come out as 0, 4 | 1, 5 | 2, 6 | 3, 7
+	const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+	uint16_t x, y;
+	uint8_t i;
+
+	for (y = y0; y < y1; y++) {
+		const uint8_t * const row0 = oldpx + oldstride * y * 2 * 4;
+		const uint8_t * const row1 = row0 + oldstride * 4;
+		uint8_t * const dst = newpx + newstride * y * 4;
+
+		// Sixteen source pixels of both rows to eight target pixels
+		for (x = x0; x + 8 <= x1; x += 8) {
+			const __m512i a = _mm512_loadu_si512(&row0[x * 8]);
+			const __m512i b = _mm512_loadu_si512(&row1[x * 8]);
+			__m512i lo, hi, sum;
+
+			lo = _mm512_add_epi16(_mm512_cvtepu8_epi16(_mm512_castsi512_si256(a)),
+						_mm512_cvtepu8_epi16(_mm512_castsi512_si256(b)));
+			hi = _mm512_add_epi16(_mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(a, 1)),
+						_mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(b, 1)));
+
+			sum = _mm512_add_epi16(_mm512_unpacklo_epi64(lo, hi),
+						_mm512_unpackhi_epi64(lo, hi));
+			sum = _mm512_srli_epi16(sum, 2);
+			sum = _mm512_permutexvar_epi64(order, sum);
+
+			_mm256_storeu_si256((__m256i *) &dst[x * 4], _mm512_cvtepi16_epi8(sum));
+		}
+
+		for (; x < x1; x++) {
+			// Remainder in C
+			for (i = 0; i < 4; i++) {
+				dst[x * 4 + i] =
+					(row0[x * 8 + i] +
+					row0[x * 8 + 4 + i] +
+					row1[x * 8 + i] +
+					row1[x * 8 + 4 + i]) / 4;
+			}
+		}
+	}
+}
+
+void AVX512_filterVert(const uint8_t *src, const unsigned stride,
+			const int16_t *weights, const unsigned taps,
+			int16_t *out, const unsigned len) {
+	const __m512i zero = _mm512_setzero_si512();
+	unsigned i, k;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m512i acclo = zero, acchi = zero;
+
+		// Two rows at a time, interleaved for madd. Widening first
+		// keeps the results in order within the lanes.
+		for (k = 0; k < taps; k += 2) {
+			const __m512i a = _mm512_cvtepu8_epi16(
+					_mm256_loadu_si256((const __m256i *) &src[k * stride + i]));
+			__m512i b = zero;
+			uint32_t w = (uint16_t) weights[k];
+
+			if (k + 1 < taps) {
+				b = _mm512_cvtepu8_epi16(
+					_mm256_loadu_si256((const __m256i *) &src[(k + 1) * stride + i]));
+				w |= (uint32_t) weights[k + 1] << 16;
+			}
+
+			const __m512i wv = _mm512_set1_epi32(w);
+
+			acclo = _mm512_add_epi32(acclo, _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), wv));
+			acchi = _mm512_add_epi32(acchi, _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), wv));
+		}
+
+		acclo = _mm512_srai_epi32(acclo, SCALE_VERT_SHIFT);
+		acchi = _mm512_srai_epi32(acchi, SCALE_VERT_SHIFT);
+
+		_mm512_storeu_si512(&out[i], _mm512_packs_epi32(acclo, acchi));
+	}
+
+	for (; i < len; i++) {
+		// Remainder in C
+		int32_t acc = 0;
+
+		for (k = 0; k < taps; k++)
+			acc += weights[k] * src[k * stride + i];
+
+		acc >>= SCALE_VERT_SHIFT;
+		out[i] = acc > INT16_MAX ? INT16_MAX : (acc < INT16_MIN ? INT16_MIN : acc);
+	}
+}
+
+}; // namespace rfb
@@ -16,6 +16,7 @@
  * USA.
  */
 
+#include <rfb/scale.h>
 #include <rfb/scale_sse2.h>
 
 namespace rfb {
@@ -23,7 +24,9 @@ namespace rfb {
 void SSE2_halve(const uint8_t *oldpx,
 			const uint16_t tgtw, const uint16_t tgth,
 			uint8_t *newpx,
-			const unsigned oldstride, const unsigned newstride) {
+			const unsigned oldstride, const unsigned newstride,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1) {
 }
 
 // Handles factors between 0.5 and 1.0
@@ -31,7 +34,19 @@ void SSE2_scale(const uint8_t *oldpx,
 		const uint16_t tgtw, const uint16_t tgth,
 		uint8_t *newpx,
 		const unsigned oldstride, const unsigned newstride,
-		const float tgtdiff) {
+		const float tgtdiff,
+		const uint16_t x0, const uint16_t y0,
+		const uint16_t x1, const uint16_t y1) {
+}
+
+void SSE2_filterVert(const uint8_t *src, const unsigned stride,
+			const int16_t *weights, const unsigned taps,
+			int16_t *out, const unsigned len) {
+}
+
+void SSE2_filterHorz(const int16_t *tmp, const uint16_t *start,
+			const int16_t *weights, const unsigned taps,
+			uint8_t *dst, const unsigned count) {
 }
 
 }; // namespace rfb
@@ -18,6 +18,7 @@
 
 #include <emmintrin.h>
 
+#include <rfb/scale.h>
 #include <rfb/scale_sse2.h>
 
 namespace rfb {
@@ -55,21 +56,23 @@ static void print128(const char msg[], const __m128i v) {
 void SSE2_halve(const uint8_t *oldpx,
 			const uint16_t tgtw, const uint16_t tgth,
 			uint8_t *newpx,
-			const unsigned oldstride, const unsigned newstride) {
+			const unsigned oldstride, const unsigned newstride,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1) {
 	uint16_t x, y;
-	const uint16_t srcw = tgtw * 2, srch = tgth * 2;
+	const uint16_t srcx0 = x0 * 2, srcx1 = x1 * 2;
 	const __m128i zero = _mm_setzero_si128();
 	const __m128i shift = _mm_set_epi32(0, 0, 0, 2);
 	const __m128i low = _mm_set_epi32(0, 0, 0xffffffff, 0xffffffff);
 	const __m128i high = _mm_set_epi32(0xffffffff, 0xffffffff, 0, 0);
 
-	for (y = 0; y < srch; y += 2) {
+	for (y = y0 * 2; y < y1 * 2; y += 2) {
 		const uint8_t * const row0 = oldpx + oldstride * y * 4;
 		const uint8_t * const row1 = oldpx + oldstride * (y + 1) * 4;
 
 		uint8_t * const dst = newpx + newstride * (y / 2) * 4;
 
-		for (x = 0; x < srcw - 3; x += 4) {
+		for (x = srcx0; x < srcx1 - 3; x += 4) {
 			__m128i lo, hi, a, b, c, d;
 			lo = _mm_loadu_si128((__m128i *) &row0[x * 4]);
 			hi = _mm_loadu_si128((__m128i *) &row1[x * 4]);
@@ -98,7 +101,7 @@ void SSE2_halve(const uint8_t *oldpx,
 			_mm_storel_epi64((__m128i *) &dst[(x / 2) * 4], a);
 		}
 
-		for (; x < srcw; x += 2) {
+		for (; x < srcx1; x += 2) {
 			// Remainder in C
 			uint8_t i;
 			for (i = 0; i < 4; i++) {
@@ -117,7 +120,9 @@ void SSE2_scale(const uint8_t *oldpx,
 		const uint16_t tgtw, const uint16_t tgth,
 		uint8_t *newpx,
 		const unsigned oldstride, const unsigned newstride,
-		const float tgtdiff) {
+		const float tgtdiff,
+		const uint16_t x0, const uint16_t y0,
+		const uint16_t x1, const uint16_t y1) {
 
 	uint16_t x, y;
 	const __m128i zero = _mm_setzero_si128();
@@ -129,7 +134,7 @@ void SSE2_scale(const uint8_t *oldpx,
 	const uint16_t srcw = (uint16_t)(tgtw * invdiff);
 	const uint16_t srch = (uint16_t)(tgth * invdiff);
 
-	for (y = 0; y < tgth; y++) {
+	for (y = y0; y < y1; y++) {
 		const float ny = y * invdiff;
 		const uint16_t lowy = ny;
 		const uint16_t highy = lowy + 1;
@@ -144,7 +149,7 @@ void SSE2_scale(const uint8_t *oldpx,
 			uint8_t * const dst = newpx + newstride * y * 4;
 
 			// Process entire row with C fallback (no vertical interpolation needed)
-			for (x = 0; x < tgtw; x++) {
+			for (x = x0; x < x1; x++) {
 				const float nx = x * invdiff;
 				const uint16_t lowx = nx;
 				const uint16_t highx = (lowx + 1 < srcw) ? lowx + 1 : lowx;
@@ -175,7 +180,8 @@ void SSE2_scale(const uint8_t *oldpx,
 		const __m128i vertmul = _mm_set1_epi16(top);
 		const __m128i vertmul2 = _mm_set1_epi16(bot);
 
-		for (x = 0; x < tgtw - 1; x += 2) {
+		// Pairs start on even columns, same as for the full width
+		for (x = x0 & ~1; x < x1 && x < tgtw - 1; x += 2) {
 			const float nx[2] = {
 				x * invdiff,
 				(x + 1) * invdiff,
@@ -213,7 +219,6 @@ void SSE2_scale(const uint8_t *oldpx,
 						dst[(x + i) * 4 + j] = (val * top + val2 * bot) >> 8;
 					}
 				}
-				x++; // Skip the second pixel since we processed both
 				continue;
 			}
 
@@ -293,7 +298,7 @@ void SSE2_scale(const uint8_t *oldpx,
 			_mm_storel_epi64((__m128i *) &dst[x * 4], a);
 		}
 
-		for (; x < tgtw; x++) {
+		for (; x < x1; x++) {
 			// Remainder in C with bounds checking
 			const float nx = x * invdiff;
 			const uint16_t lowx = nx;
@@ -319,4 +324,89 @@ void SSE2_scale(const uint8_t *oldpx,
 	}
 }
 
+void SSE2_filterVert(const uint8_t *src, const unsigned stride,
+			const int16_t *weights, const unsigned taps,
+			int16_t *out, const unsigned len) {
+	const __m128i zero = _mm_setzero_si128();
+	unsigned i, k;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+
+		// Two rows at a time, interleaved for madd
+		for (k = 0; k < taps; k += 2) {
+			const __m128i a = _mm_loadu_si128((__m128i *) &src[k * stride + i]);
+			__m128i b = zero;
+			uint32_t w = (uint16_t) weights[k];
+
+			if (k + 1 < taps) {
+				b = _mm_loadu_si128((__m128i *) &src[(k + 1) * stride + i]);
+				w |= (uint32_t) weights[k + 1] << 16;
+			}
+
+			const __m128i wv = _mm_set1_epi32(w);
+			const __m128i alo = _mm_unpacklo_epi8(a, zero);
+			const __m128i ahi = _mm_unpackhi_epi8(a, zero);
+			const __m128i blo = _mm_unpacklo_epi8(b, zero);
+			const __m128i bhi = _mm_unpackhi_epi8(b, zero);
+
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(alo, blo), wv));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(alo, blo), wv));
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi16(ahi, bhi), wv));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi16(ahi, bhi), wv));
+		}
+
+		acc0 = _mm_srai_epi32(acc0, SCALE_VERT_SHIFT);
+		acc1 = _mm_srai_epi32(acc1, SCALE_VERT_SHIFT);
+		acc2 = _mm_srai_epi32(acc2, SCALE_VERT_SHIFT);
+		acc3 = _mm_srai_epi32(acc3, SCALE_VERT_SHIFT);
+
+		_mm_storeu_si128((__m128i *) &out[i], _mm_packs_epi32(acc0, acc1));
+		_mm_storeu_si128((__m128i *) &out[i + 8], _mm_packs_epi32(acc2, acc3));
+	}
+
+	for (; i < len; i++) {
+		// Remainder in C
+		int32_t acc = 0;
+
+		for (k = 0; k < taps; k++)
+			acc += weights[k] * src[k * stride + i];
+
+		acc >>= SCALE_VERT_SHIFT;
+		out[i] = acc > INT16_MAX ? INT16_MAX : (acc < INT16_MIN ? INT16_MIN : acc);
+	}
+}
+
+void SSE2_filterHorz(const int16_t *tmp, const uint16_t *start,
+			const int16_t *weights, const unsigned taps,
+			uint8_t *dst, const unsigned count) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (SCALE_HORZ_SHIFT - 1));
+	unsigned x, j;
+
+	for (x = 0; x < count; x++, weights += taps) {
+		const int16_t * const px = tmp + start[x] * 4;
+		__m128i acc = round;
+
+		// A load holds two source pixels, interleaved for madd
+		for (j = 0; j < taps; j += 2) {
+			const __m128i v = _mm_loadu_si128((__m128i *) &px[j * 4]);
+			uint32_t w = (uint16_t) weights[j];
+
+			if (j + 1 < taps)
+				w |= (uint32_t) weights[j + 1] << 16;
+
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(
+					_mm_unpacklo_epi16(v, _mm_srli_si128(v, 8)),
+					_mm_set1_epi32(w)));
+		}
+
+		acc = _mm_srai_epi32(acc, SCALE_HORZ_SHIFT);
+		acc = _mm_packs_epi32(acc, zero);
+		acc = _mm_packus_epi16(acc, zero);
+
+		*(uint32_t *) &dst[x * 4] = _mm_cvtsi128_si32(acc);
+	}
+}
+
 }; // namespace rfb
@@ -23,16 +23,40 @@
 
 namespace rfb {
 
+	// Only the target pixels in x0..x1, y0..y1 are computed, with the
+	// same results as when scaling the whole buffer
 	void SSE2_halve(const uint8_t *oldpx,
 			const uint16_t tgtw, const uint16_t tgth,
 			uint8_t *newpx,
-			const unsigned oldstride, const unsigned newstride);
+			const unsigned oldstride, const unsigned newstride,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1);
 
 	void SSE2_scale(const uint8_t *oldpx,
 			const uint16_t tgtw, const uint16_t tgth,
 			uint8_t *newpx,
 			const unsigned oldstride, const unsigned newstride,
-			const float tgtdiff);
+			const float tgtdiff,
+			const uint16_t x0, const uint16_t y0,
+			const uint16_t x1, const uint16_t y1);
+
+	static inline void SSE2_halve(const uint8_t *oldpx,
+			const uint16_t tgtw, const uint16_t tgth,
+			uint8_t *newpx,
+			const unsigned oldstride, const unsigned newstride) {
+		SSE2_halve(oldpx, tgtw, tgth, newpx, oldstride, newstride,
+				0, 0, tgtw, tgth);
+	}
+
+	// Handles factors between 0.5 and 1.0
+	static inline void SSE2_scale(const uint8_t *oldpx,
+			const uint16_t tgtw, const uint16_t tgth,
+			uint8_t *newpx,
+			const unsigned oldstride, const unsigned newstride,
+			const float tgtdiff) {
+		SSE2_scale(oldpx, tgtw, tgth, newpx, oldstride, newstride,
+				tgtdiff, 0, 0, tgtw, tgth);
+	}
 };
 
 #endif
@@ -0,0 +1,95 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_SHMEXPORTTYPES_H__
+#define __RFB_SHMEXPORTTYPES_H__
+
+//
+// Layout of the shared memory framebuffer export (-ShmExportSocket). This
+// header is plain C and has no other dependencies, so local consumers can
+// include it on its own.
+//
+// A consumer connects to the unix socket and gets one byte, the protocol
+// version, with two file descriptors attached (SCM_RIGHTS): a read-only
+// memfd holding a kasmvnc_shm_header followed by the pixels, and an
+// eventfd the server adds 1 to after every frame. The connection carries
+// nothing else, closing it unregisters the consumer.
+//
+// The header is guarded by a sequence lock. seq is odd while the server
+// writes, a consistent copy of the header and pixels is one taken
+// between two equal, even reads of it:
+//
+//   do {
+//     while ((s = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE)) & 1)
+//       ;
+//     ... copy the header fields and the pixels needed ...
+//     __atomic_thread_fence(__ATOMIC_ACQUIRE);
+//   } while (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) != s);
+//
+// The segment only ever grows. If size is larger than the mapping, map
+// it again before reading the pixels. The damage only covers the last
+// frame; a consumer that sees frame jump by more than one, or the full
+// flag set, must take the whole screen.
+//
+
+#include <stdint.h>
+
+#define KASMVNC_SHM_MAGIC       0x464d534b /* "KSMF" */
+#define KASMVNC_SHM_VERSION     1
+
+#define KASMVNC_SHM_MAX_SCREENS 16
+#define KASMVNC_SHM_MAX_RECTS   64
+
+/* Everything changed, ignore rects: first frame, resize, or too much damage */
+#define KASMVNC_SHM_FLAG_FULL   (1 << 0)
+
+struct kasmvnc_shm_rect {
+  int32_t x, y, w, h;
+};
+
+struct kasmvnc_shm_screen {
+  uint32_t id;
+  uint32_t flags;
+  int32_t x, y, w, h;
+};
+
+struct kasmvnc_shm_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq;
+  uint32_t data_offset;      /* Of the first pixel, from the segment start */
+  uint64_t frame;            /* Counts up by one per published frame */
+  uint64_t timestamp_us;     /* CLOCK_MONOTONIC when it was published */
+  uint64_t size;             /* Bytes of the segment in use */
+
+  int32_t width, height;
+  int32_t stride;            /* In bytes */
+
+  /* Pixel format, as in the RFB protocol */
+  uint8_t bpp, depth, big_endian, true_colour;
+  uint16_t red_max, green_max, blue_max;
+  uint8_t red_shift, green_shift, blue_shift;
+  uint8_t pad[3];
+
+  uint32_t flags;
+  uint32_t num_screens;
+  uint32_t num_rects;
+  struct kasmvnc_shm_screen screens[KASMVNC_SHM_MAX_SCREENS];
+  struct kasmvnc_shm_rect rects[KASMVNC_SHM_MAX_RECTS];
+};
+
+#endif
@@ -0,0 +1,139 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+
+#include <rfb/cpuid.h>
+#include <rfb/tilecmp.h>
+#include <rfb/xxhash.h>
+
+namespace rfb {
+
+static inline uint32_t rotl32(const uint32_t x, const unsigned r) {
+	return (x << r) | (x >> (32 - r));
+}
+
+static inline void hashChunk(uint32_t a[TILEHASH_LANES], uint32_t b[TILEHASH_LANES],
+				const uint8_t *px) {
+	for (unsigned i = 0; i < TILEHASH_LANES; i++) {
+		uint32_t w;
+		memcpy(&w, px + i * 4, 4);
+
+		a[i] = rotl32(a[i] + w * TILEHASH_PRIME2, 13) * TILEHASH_PRIME1;
+		b[i] = rotl32(b[i] + w * TILEHASH_PRIME4, 17) * TILEHASH_PRIME3;
+	}
+}
+
+void tileHashInit(uint32_t a[TILEHASH_LANES], uint32_t b[TILEHASH_LANES]) {
+	for (unsigned i = 0; i < TILEHASH_LANES; i++) {
+		a[i] = TILEHASH_PRIME1 + i;
+		b[i] = TILEHASH_PRIME2 ^ i;
+	}
+}
+
+uint64_t tileHashFinish(const uint32_t a[TILEHASH_LANES],
+			const uint32_t b[TILEHASH_LANES],
+			const unsigned len, const unsigned h) {
+	uint32_t state[TILEHASH_LANES * 2];
+
+	memcpy(state, a, TILEHASH_LANES * 4);
+	memcpy(state + TILEHASH_LANES, b, TILEHASH_LANES * 4);
+
+	return XXH64(state, sizeof(state), ((uint64_t) len << 32) | h);
+}
+
+uint64_t generic_tileHash(const uint8_t *px, const unsigned stride,
+			const unsigned len, const unsigned h) {
+	uint32_t a[TILEHASH_LANES], b[TILEHASH_LANES];
+
+	tileHashInit(a, b);
+
+	for (unsigned y = 0; y < h; y++, px += stride) {
+		for (unsigned x = 0; x < len; x += TILEHASH_CHUNK)
+			hashChunk(a, b, px + x);
+	}
+
+	return tileHashFinish(a, b, len, h);
+}
+
+int generic_tileCompare(uint8_t *oldpx, const unsigned oldstride,
+			const uint8_t *newpx, const unsigned newstride,
+			const unsigned len, const unsigned h) {
+	int first = -1;
+
+	for (unsigned y = 0; y < h; y++) {
+		if (first < 0 && memcmp(oldpx, newpx, len))
+			first = y;
+		if (first >= 0)
+			memcpy(oldpx, newpx, len);
+
+		oldpx += oldstride;
+		newpx += newstride;
+	}
+
+	return first;
+}
+
+uint64_t tileHash(const uint8_t *px, const unsigned stride,
+			const unsigned len, const unsigned h) {
+	if (cpu_info::has_avx512f)
+		return AVX512_tileHash(px, stride, len, h);
+	if (cpu_info::has_avx2)
+		return AVX2_tileHash(px, stride, len, h);
+
+	return generic_tileHash(px, stride, len, h);
+}
+
+int tileCompare(uint8_t *oldpx, const unsigned oldstride,
+		const uint8_t *newpx, const unsigned newstride,
+		const unsigned len, const unsigned h) {
+	if (cpu_info::has_avx512f)
+		return AVX512_tileCompare(oldpx, oldstride, newpx, newstride, len, h);
+	if (cpu_info::has_avx2)
+		return AVX2_tileCompare(oldpx, oldstride, newpx, newstride, len, h);
+
+	return generic_tileCompare(oldpx, oldstride, newpx, newstride, len, h);
+}
+
+#ifndef HAVE_TILECMP_AVX2
+uint64_t AVX2_tileHash(const uint8_t *px, const unsigned stride,
+			const unsigned len, const unsigned h) {
+	return generic_tileHash(px, stride, len, h);
+}
+
+int AVX2_tileCompare(uint8_t *oldpx, const unsigned oldstride,
+			const uint8_t *newpx, const unsigned newstride,
+			const unsigned len, const unsigned h) {
+	return generic_tileCompare(oldpx, oldstride, newpx, newstride, len, h);
+}
+#endif
+
+#ifndef HAVE_TILECMP_AVX512
+uint64_t AVX512_tileHash(const uint8_t *px, const unsigned stride,
+			const unsigned len, const unsigned h) {
+	return AVX2_tileHash(px, stride, len, h);
+}
+
+int AVX512_tileCompare(uint8_t *oldpx, const unsigned oldstride,
+			const uint8_t *newpx, const unsigned newstride,
+			const unsigned len, const unsigned h) {
+	return AVX2_tileCompare(oldpx, oldstride, newpx, newstride, len, h);
+}
+#endif
+
+}; // namespace rfb
@@ -0,0 +1,82 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// Tile comparison kernels for ComparingUpdateTracker, and the tile hash
+// the screenshot API uses to tell unchanged screens apart.
+//
+// tileHash() hashes h rows of len bytes. tileCompare() compares the same
+// area against an old copy and copies everything from the first differing
+// row on into the old copy. It returns the first differing row, or -1 if
+// the tile is unchanged.
+//
+// len must be a multiple of 64. The hash runs 16 32-bit lanes, each with
+// two independent xxh32-style chains, over consecutive 64-byte chunks and
+// folds them with XXH64 at the end. The SIMD versions produce the same
+// values as the generic ones.
+//
+
+#ifndef __RFB_TILECMP_H__
+#define __RFB_TILECMP_H__
+
+#include <stdint.h>
+
+namespace rfb {
+
+	enum {
+		TILEHASH_LANES = 16,
+		TILEHASH_CHUNK = TILEHASH_LANES * 4
+	};
+
+	static const uint32_t TILEHASH_PRIME1 = 2654435761U;
+	static const uint32_t TILEHASH_PRIME2 = 2246822519U;
+	static const uint32_t TILEHASH_PRIME3 = 3266489917U;
+	static const uint32_t TILEHASH_PRIME4 = 668265263U;
+
+	void tileHashInit(uint32_t a[TILEHASH_LANES], uint32_t b[TILEHASH_LANES]);
+	uint64_t tileHashFinish(const uint32_t a[TILEHASH_LANES],
+				const uint32_t b[TILEHASH_LANES],
+				const unsigned len, const unsigned h);
+
+	// Picks the best version for the CPU
+	uint64_t tileHash(const uint8_t *px, const unsigned stride,
+			const unsigned len, const unsigned h);
+	int tileCompare(uint8_t *oldpx, const unsigned oldstride,
+			const uint8_t *newpx, const unsigned newstride,
+			const unsigned len, const unsigned h);
+
+	uint64_t generic_tileHash(const uint8_t *px, const unsigned stride,
+			const unsigned len, const unsigned h);
+	int generic_tileCompare(uint8_t *oldpx, const unsigned oldstride,
+			const uint8_t *newpx, const unsigned newstride,
+			const unsigned len, const unsigned h);
+
+	uint64_t AVX2_tileHash(const uint8_t *px, const unsigned stride,
+			const unsigned len, const unsigned h);
+	int AVX2_tileCompare(uint8_t *oldpx, const unsigned oldstride,
+			const uint8_t *newpx, const unsigned newstride,
+			const unsigned len, const unsigned h);
+
+	uint64_t AVX512_tileHash(const uint8_t *px, const unsigned stride,
+			const unsigned len, const unsigned h);
+	int AVX512_tileCompare(uint8_t *oldpx, const unsigned oldstride,
+			const uint8_t *newpx, const unsigned newstride,
+			const unsigned len, const unsigned h);
+};
+
+#endif
@@ -0,0 +1,130 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <immintrin.h>
+
+#include <rfb/tilecmp.h>
+
+namespace rfb {
+
+// Lanes 0-7 live in the first register, 8-15 in the second
+struct avx2HashState {
+	__m256i a0, a1, b0, b1;
+};
+
+static inline __m256i rotl32(const __m256i v, const int r) {
+	return _mm256_or_si256(_mm256_slli_epi32(v, r), _mm256_srli_epi32(v, 32 - r));
+}
+
+static inline __m256i hashRound(const __m256i acc, const __m256i w,
+				const __m256i pin, const __m256i pout, const int r) {
+	return _mm256_mullo_epi32(rotl32(_mm256_add_epi32(acc, _mm256_mullo_epi32(w, pin)), r),
+					pout);
+}
+
+static inline void hashInit(avx2HashState &s) {
+	uint32_t a[TILEHASH_LANES], b[TILEHASH_LANES];
+
+	tileHashInit(a, b);
+
+	s.a0 = _mm256_loadu_si256((const __m256i *) a);
+	s.a1 = _mm256_loadu_si256((const __m256i *) (a + 8));
+	s.b0 = _mm256_loadu_si256((const __m256i *) b);
+	s.b1 = _mm256_loadu_si256((const __m256i *) (b + 8));
+}
+
+static inline void hashChunk(avx2HashState &s, const __m256i w0, const __m256i w1) {
+	const __m256i p1 = _mm256_set1_epi32(TILEHASH_PRIME1);
+	const __m256i p2 = _mm256_set1_epi32(TILEHASH_PRIME2);
+	const __m256i p3 = _mm256_set1_epi32(TILEHASH_PRIME3);
+	const __m256i p4 = _mm256_set1_epi32(TILEHASH_PRIME4);
+
+	s.a0 = hashRound(s.a0, w0, p2, p1, 13);
+	s.a1 = hashRound(s.a1, w1, p2, p1, 13);
+	s.b0 = hashRound(s.b0, w0, p4, p3, 17);
+	s.b1 = hashRound(s.b1, w1, p4, p3, 17);
+}
+
+static inline uint64_t hashFinish(const avx2HashState &s,
+					const unsigned len, const unsigned h) {
+	uint32_t a[TILEHASH_LANES], b[TILEHASH_LANES];
+
+	_mm256_storeu_si256((__m256i *) a, s.a0);
+	_mm256_storeu_si256((__m256i *) (a + 8), s.a1);
+	_mm256_storeu_si256((__m256i *) b, s.b0);
+	_mm256_storeu_si256((__m256i *) (b + 8), s.b1);
+
+	return tileHashFinish(a, b, len, h);
+}
+
+uint64_t AVX2_tileHash(const uint8_t *px, const unsigned stride,
+			const unsigned len, const unsigned h) {
+	avx2HashState s;
+
+	hashInit(s);
+
+	for (unsigned y = 0; y < h; y++, px += stride) {
+		for (unsigned x = 0; x < len; x += TILEHASH_CHUNK) {
+			const __m256i w0 = _mm256_loadu_si256((const __m256i *) (px + x));
+			const __m256i w1 = _mm256_loadu_si256((const __m256i *) (px + x + 32));
+			hashChunk(s, w0, w1);
+		}
+	}
+
+	return hashFinish(s, len, h);
+}
+
+int AVX2_tileCompare(uint8_t *oldpx, const unsigned oldstride,
+			const uint8_t *newpx, const unsigned newstride,
+			const unsigned len, const unsigned h) {
+	int first = -1;
+
+	for (unsigned y = 0; y < h; y++) {
+		__m256i diff = _mm256_setzero_si256();
+
+		for (unsigned x = 0; x < len; x += TILEHASH_CHUNK) {
+			const __m256i w0 = _mm256_loadu_si256((const __m256i *) (newpx + x));
+			const __m256i w1 = _mm256_loadu_si256((const __m256i *) (newpx + x + 32));
+
+			if (first < 0) {
+				const __m256i o0 = _mm256_loadu_si256((const __m256i *) (oldpx + x));
+				const __m256i o1 = _mm256_loadu_si256((const __m256i *) (oldpx + x + 32));
+				diff = _mm256_or_si256(diff, _mm256_xor_si256(w0, o0));
+				diff = _mm256_or_si256(diff, _mm256_xor_si256(w1, o1));
+			} else {
+				_mm256_storeu_si256((__m256i *) (oldpx + x), w0);
+				_mm256_storeu_si256((__m256i *) (oldpx + x + 32), w1);
+			}
+		}
+
+		// The row that differed was only compared, copy it now
+		if (first < 0 && !_mm256_testz_si256(diff, diff)) {
+			first = y;
+			for (unsigned x = 0; x < len; x += 32)
+				_mm256_storeu_si256((__m256i *) (oldpx + x),
+						_mm256_loadu_si256((const __m256i *) (newpx + x)));
+		}
+
+		oldpx += oldstride;
+		newpx += newstride;
+	}
+
+	return first;
+}
+
+}; // namespace rfb
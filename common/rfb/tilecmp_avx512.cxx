@@ -0,0 +1,113 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <immintrin.h>
+
+#include <rfb/tilecmp.h>
+
+namespace rfb {
+
+// One 64-byte chunk is exactly one register, a lane per 32-bit word
+struct avx512HashState {
+	__m512i a, b;
+};
+
+// The zero-masked form, GCC's headers give the plain one an undefined
+// passthrough operand that trips -Wmaybe-uninitialized
+static inline __m512i rotl32(const __m512i v, const int r) {
+	return _mm512_maskz_rol_epi32((__mmask16) 0xffff, v, r);
+}
+
+static inline __m512i hashRound(const __m512i acc, const __m512i w,
+				const __m512i pin, const __m512i pout, const int r) {
+	return _mm512_mullo_epi32(rotl32(_mm512_add_epi32(acc,
+						_mm512_mullo_epi32(w, pin)), r), pout);
+}
+
+static inline void hashInit(avx512HashState &s) {
+	uint32_t a[TILEHASH_LANES], b[TILEHASH_LANES];
+
+	tileHashInit(a, b);
+
+	s.a = _mm512_loadu_si512(a);
+	s.b = _mm512_loadu_si512(b);
+}
+
+static inline void hashChunk(avx512HashState &s, const __m512i w) {
+	s.a = hashRound(s.a, w, _mm512_set1_epi32(TILEHASH_PRIME2),
+			_mm512_set1_epi32(TILEHASH_PRIME1), 13);
+	s.b = hashRound(s.b, w, _mm512_set1_epi32(TILEHASH_PRIME4),
+			_mm512_set1_epi32(TILEHASH_PRIME3), 17);
+}
+
+static inline uint64_t hashFinish(const avx512HashState &s,
+					const unsigned len, const unsigned h) {
+	uint32_t a[TILEHASH_LANES], b[TILEHASH_LANES];
+
+	_mm512_storeu_si512(a, s.a);
+	_mm512_storeu_si512(b, s.b);
+
+	return tileHashFinish(a, b, len, h);
+}
+
+uint64_t AVX512_tileHash(const uint8_t *px, const unsigned stride,
+			const unsigned len, const unsigned h) {
+	avx512HashState s;
+
+	hashInit(s);
+
+	for (unsigned y = 0; y < h; y++, px += stride) {
+		for (unsigned x = 0; x < len; x += TILEHASH_CHUNK)
+			hashChunk(s, _mm512_loadu_si512(px + x));
+	}
+
+	return hashFinish(s, len, h);
+}
+
+int AVX512_tileCompare(uint8_t *oldpx, const unsigned oldstride,
+			const uint8_t *newpx, const unsigned newstride,
+			const unsigned len, const unsigned h) {
+	int first = -1;
+
+	for (unsigned y = 0; y < h; y++) {
+		__mmask16 diff = 0;
+
+		for (unsigned x = 0; x < len; x += TILEHASH_CHUNK) {
+			const __m512i w = _mm512_loadu_si512(newpx + x);
+
+			if (first < 0)
+				diff |= _mm512_cmpneq_epi32_mask(w, _mm512_loadu_si512(oldpx + x));
+			else
+				_mm512_storeu_si512(oldpx + x, w);
+		}
+
+		// The row that differed was only compared, copy it now
+		if (first < 0 && diff) {
+			first = y;
+			for (unsigned x = 0; x < len; x += TILEHASH_CHUNK)
+				_mm512_storeu_si512(oldpx + x, _mm512_loadu_si512(newpx + x));
+		}
+
+		oldpx += oldstride;
+		newpx += newstride;
+	}
+
+	return first;
+}
+
+}; // namespace rfb
@@ -0,0 +1,418 @@
+/* Copyright (C) 2025 Kasm Technologies Corp
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// Checks that the SIMD kernels give the same results as the generic
+// ones, on odd sizes, strides and offsets so that the remainder paths
+// run too. Kernels the CPU can't run are skipped.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rfb/cpuid.h>
+#include <rfb/pixelconv.h>
+#include <rfb/rectanalysis.h>
+#include <rfb/tilecmp.h>
+#include <rfb/encoders/yuv.h>
+
+typedef bool (*testfn) ();
+
+struct TestEntry {
+  const char *label;
+  testfn fn;
+  const bool *supported;
+};
+
+static const unsigned lens[] = { 64, 128, 192, 448 };
+static const unsigned heights[] = { 1, 2, 3, 7, 16, 17, 31 };
+// Extra bytes per row, odd ones leave the rows unaligned
+static const unsigned pads[] = { 0, 1, 13, 64, 67 };
+
+#define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
+
+static void fillRandom(uint8_t *buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    buf[i] = rand();
+}
+
+static bool testTileHash()
+{
+  for (size_t l = 0; l < ARRAY_SIZE(lens); l++) {
+    for (size_t h = 0; h < ARRAY_SIZE(heights); h++) {
+      for (size_t p = 0; p < ARRAY_SIZE(pads); p++) {
+        const unsigned len = lens[l], height = heights[h];
+        const unsigned stride = len + pads[p];
+        uint8_t *buf = new uint8_t[stride * height + 1];
+        // Start one byte in so that even stride 64 is unaligned
+        const uint8_t *px = buf + 1;
+        uint64_t ref;
+        bool ok = true;
+
+        fillRandom(buf, stride * height + 1);
+
+        ref = rfb::generic_tileHash(px, stride, len, height);
+
+        if (cpu_info::has_avx2 &&
+            rfb::AVX2_tileHash(px, stride, len, height) != ref)
+          ok = false;
+        if (cpu_info::has_avx512f &&
+            rfb::AVX512_tileHash(px, stride, len, height) != ref)
+          ok = false;
+
+        delete [] buf;
+
+        if (!ok) {
+          printf("len %u, height %u, stride %u: ", len, height, stride);
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+typedef int (*comparefn) (uint8_t *, const unsigned, const uint8_t *,
+                          const unsigned, const unsigned, const unsigned);
+
+static bool checkTileCompare(comparefn fn, const uint8_t *src,
+                             const uint8_t *cur, unsigned oldstride,
+                             unsigned newstride, unsigned len,
+                             unsigned height)
+{
+  const size_t size = oldstride * height;
+  uint8_t *ref, *test;
+  int refRow, testRow;
+  bool ok;
+
+  ref = new uint8_t[size];
+  test = new uint8_t[size];
+
+  memcpy(ref, src, size);
+  memcpy(test, src, size);
+
+  refRow = rfb::generic_tileCompare(ref, oldstride, cur, newstride,
+                                    len, height);
+  testRow = fn(test, oldstride, cur, newstride, len, height);
+
+  // The padding between the rows must be left alone as well
+  ok = (refRow == testRow) && (memcmp(ref, test, size) == 0);
+
+  delete [] ref;
+  delete [] test;
+
+  return ok;
+}
+
+static bool testTileCompare()
+{
+  for (size_t l = 0; l < ARRAY_SIZE(lens); l++) {
+    for (size_t h = 0; h < ARRAY_SIZE(heights); h++) {
+      for (size_t p = 0; p < ARRAY_SIZE(pads); p++) {
+        const unsigned len = lens[l], height = heights[h];
+        const unsigned oldstride = len + pads[p];
+        const unsigned newstride = len + pads[(p + 1) % ARRAY_SIZE(pads)];
+        uint8_t *old, *cur;
+        bool ok = true;
+
+        old = new uint8_t[oldstride * height];
+        cur = new uint8_t[newstride * height];
+
+        fillRandom(old, oldstride * height);
+        fillRandom(cur, newstride * height);
+        for (unsigned y = 0; y < height; y++)
+          memcpy(cur + y * newstride, old + y * oldstride, len);
+
+        // Unchanged, then a single byte changed in the first, some and
+        // the last row, at the start, middle and end of the row
+        for (int change = -1; change < (int)height && ok; change++) {
+          const unsigned positions[] = { 0, len / 2 + 1, len - 1 };
+
+          for (size_t i = 0; i < ARRAY_SIZE(positions) && ok; i++) {
+            uint8_t *b = NULL;
+
+            if (change >= 0) {
+              b = &cur[change * newstride + positions[i]];
+              *b ^= 0x10;
+            }
+
+            if (cpu_info::has_avx2 &&
+                !checkTileCompare(rfb::AVX2_tileCompare, old, cur,
+                                  oldstride, newstride, len, height))
+              ok = false;
+            if (cpu_info::has_avx512f &&
+                !checkTileCompare(rfb::AVX512_tileCompare, old, cur,
+                                  oldstride, newstride, len, height))
+              ok = false;
+
+            if (b)
+              *b ^= 0x10;
+            else
+              break;
+          }
+        }
+
+        delete [] old;
+        delete [] cur;
+
+        if (!ok) {
+          printf("len %u, height %u, strides %u/%u: ",
+                 len, height, oldstride, newstride);
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool testSolidRect()
+{
+  const uint32_t colour = 0x00c397f1;
+
+  for (unsigned w = 1; w <= 40; w++) {
+    for (size_t h = 0; h < ARRAY_SIZE(heights); h++) {
+      const unsigned height = heights[h];
+      const unsigned stride = w + 3;
+      uint32_t *buf = new uint32_t[stride * height];
+      bool ok = true;
+
+      for (unsigned i = 0; i < stride * height; i++)
+        buf[i] = colour;
+
+      if (rfb::AVX2_solidRect32(buf, stride, w, height, colour) !=
+          rfb::generic_solidRect32(buf, stride, w, height, colour))
+        ok = false;
+
+      // Any pixel inside the rect, but nothing in the padding, counts
+      for (unsigned y = 0; y < height && ok; y++) {
+        for (unsigned x = 0; x < stride && ok; x++) {
+          buf[y * stride + x] ^= 1;
+          if (rfb::AVX2_solidRect32(buf, stride, w, height, colour) !=
+              rfb::generic_solidRect32(buf, stride, w, height, colour))
+            ok = false;
+          buf[y * stride + x] ^= 1;
+        }
+      }
+
+      delete [] buf;
+
+      if (!ok) {
+        printf("width %u, height %u: ", w, height);
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool testColourChanges()
+{
+  uint32_t px[rfb::RECTANALYSIS_CHUNK];
+  uint16_t ref[rfb::RECTANALYSIS_CHUNK], test[rfb::RECTANALYSIS_CHUNK];
+
+  for (unsigned len = 0; len <= rfb::RECTANALYSIS_CHUNK; len++) {
+    // Runs of random length, a few colours so that some repeat
+    for (unsigned x = 0; x < len; x++) {
+      if (x == 0 || rand() % 4 == 0)
+        px[x] = rand() % 3;
+      else
+        px[x] = px[x - 1];
+    }
+
+    for (uint32_t prev = 0; prev < 3; prev++) {
+      unsigned n;
+
+      n = rfb::generic_colourChanges32(px, len, prev, ref);
+      if (rfb::AVX2_colourChanges32(px, len, prev, test) != n ||
+          memcmp(ref, test, n * sizeof(uint16_t)) != 0) {
+        printf("len %u: ", len);
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool testYUV()
+{
+  const rfb::yuv::row_pair_func fn = rfb::yuv::get_row_pair();
+
+  for (int w = 2; w <= 70; w += 2) {
+    for (int interleave = 0; interleave < 2; interleave++) {
+      uint8_t src[2][70 * 4 + 1];
+      uint8_t y[2][2][70], u[2][70], v[2][35];
+
+      fillRandom(&src[0][0], sizeof(src));
+      memset(y, 0, sizeof(y));
+      memset(u, 0, sizeof(u));
+      memset(v, 0, sizeof(v));
+
+      // Unaligned rows
+      rfb::yuv::generic_row_pair(src[0] + 1, src[1] + 1, y[0][0], y[0][1],
+                                 u[0], v[0], w, interleave);
+      fn(src[0] + 1, src[1] + 1, y[1][0], y[1][1], u[1], v[1], w,
+         interleave);
+
+      if (memcmp(y[0], y[1], sizeof(y[0])) != 0 ||
+          memcmp(u[0], u[1], sizeof(u[0])) != 0 ||
+          memcmp(v[0], v[1], sizeof(v[0])) != 0) {
+        printf("width %d%s: ", w, interleave ? ", interleaved" : "");
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool testShuffle()
+{
+  static const uint8_t orders[][4] = {
+    { 0, 1, 2, 3 }, { 2, 1, 0, 3 }, { 3, 2, 1, 0 }, { 1, 2, 3, 0 },
+  };
+
+  for (size_t o = 0; o < ARRAY_SIZE(orders); o++) {
+    for (int w = 1; w <= 40; w++) {
+      const int h = 3, srcStride = w + 5, dstStride = w + 2;
+      uint8_t src[45 * 3 * 4], ref[42 * 3 * 4], test[42 * 3 * 4];
+
+      fillRandom(src, sizeof(src));
+      fillRandom(ref, sizeof(ref));
+      memcpy(test, ref, sizeof(test));
+
+      for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+          for (int i = 0; i < 4; i++)
+            ref[(y * dstStride + x) * 4 + i] =
+              src[(y * srcStride + x) * 4 + orders[o][i]];
+        }
+      }
+
+      if (!rfb::AVX2_shuffle888(test, src, w, h, dstStride, srcStride,
+                                orders[o]) ||
+          memcmp(ref, test, sizeof(ref)) != 0) {
+        printf("width %d, order %zu: ", w, o);
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool testConvert16()
+{
+  // rgb565 and bgr555 from a little endian 888 source
+  static const int srcShifts[][3] = { { 16, 8, 0 }, { 0, 8, 16 } };
+  static const int maxes[][3] = { { 31, 63, 31 }, { 31, 31, 31 } };
+  static const int shifts[][3] = { { 11, 5, 0 }, { 0, 5, 10 } };
+
+  for (size_t f = 0; f < ARRAY_SIZE(srcShifts); f++) {
+    for (int swap = 0; swap < 2; swap++) {
+      for (int w = 1; w <= 40; w++) {
+        const int h = 3, srcStride = w + 5, dstStride = w + 3;
+        uint8_t src[45 * 3 * 4];
+        uint16_t ref[43 * 3], test[43 * 3];
+
+        fillRandom(src, sizeof(src));
+        fillRandom((uint8_t*)ref, sizeof(ref));
+        memcpy(test, ref, sizeof(test));
+
+        for (int y = 0; y < h; y++) {
+          for (int x = 0; x < w; x++) {
+            const uint8_t *s = &src[(y * srcStride + x) * 4];
+            uint32_t p;
+            uint16_t out = 0;
+
+            memcpy(&p, s, 4);
+
+            // Same rounding as PixelFormat's downconvTable
+            for (int c = 0; c < 3; c++)
+              out |= ((((p >> srcShifts[f][c]) & 0xff) * maxes[f][c] + 128) /
+                      255) << shifts[f][c];
+
+            if (swap)
+              out = (out << 8) | (out >> 8);
+
+            ref[y * dstStride + x] = out;
+          }
+        }
+
+        if (!rfb::AVX2_convert888to16(test, src, w, h, dstStride, srcStride,
+                                      srcShifts[f], maxes[f], shifts[f],
+                                      swap) ||
+            memcmp(ref, test, sizeof(ref)) != 0) {
+          printf("width %d, format %zu%s: ", w, f, swap ? ", swapped" : "");
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static const bool always = true;
+
+struct TestEntry tests[] = {
+  {"Tile hash", testTileHash, &always},
+  {"Tile compare", testTileCompare, &always},
+  {"Solid rect", testSolidRect, &cpu_info::has_avx2},
+  {"Colour changes", testColourChanges, &cpu_info::has_avx2},
+  {"BGRX to YUV", testYUV, &cpu_info::has_avx2},
+  {"888 shuffle", testShuffle, &cpu_info::has_avx2},
+  {"888 to 16 bpp", testConvert16, &cpu_info::has_avx2},
+};
+
+int main(int argc, char **argv)
+{
+  size_t i;
+  int failures;
+
+  printf("SIMD Kernel Correctness Test\n");
+  printf("\n");
+  printf("AVX2: %s, AVX-512F: %s\n", cpu_info::has_avx2 ? "yes" : "no",
+         cpu_info::has_avx512f ? "yes" : "no");
+  printf("\n");
+
+  srand(0);
+
+  failures = 0;
+  for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++) {
+    printf("    %s: ", tests[i].label);
+    fflush(stdout);
+    if (!*tests[i].supported)
+      printf("skipped");
+    else if (tests[i].fn())
+      printf("OK");
+    else {
+      printf("FAILED");
+      failures++;
+    }
+    printf("\n");
+  }
+
+  return failures ? 1 : 0;
+}
@@ -28,6 +28,7 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xcursor/Xcursor.h>
+#include <X11/extensions/Xdamage.h>
 #include <X11/extensions/Xfixes.h>
 #include <X11/extensions/Xrandr.h>
 #include <X11/extensions/XShm.h>
@@ -36,6 +37,12 @@
 #include "xxhash.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+// Tile size for change detection when the app display lacks XDAMAGE
+#define TILE 64
+// Damaged rows this close together are fetched as one band
+#define BAND_SLACK 32
 
 static void help(const char name[]) {
 	printf("Usage: %s [opts]\n\n"
@@ -103,6 +110,110 @@ static void supplyselection(Display *disp, const XEvent * const ev, const Atom x
 			(XEvent *) &sev);
 }
 
+// XShmGetImage always fills the whole image, at the image's own stride.
+// A full-width view of some rows of it thus fetches just those rows.
+static void fetchband(Display *disp, Window root, const XImage *img,
+			const unsigned y, const unsigned h) {
+	XImage band = *img;
+
+	band.height = h;
+	band.data = img->data + y * img->bytes_per_line;
+
+	XShmGetImage(disp, root, &band, 0, y, AllPlanes);
+}
+
+// Fetches the damaged rects from the app display and pushes them to the
+// VNC display. Rects come y-x banded, so nearby rows are merged as we go.
+static void copyrects(Display *appdisp, Window approot, XImage *img,
+			Display *vncdisp, Window vncroot, GC gc, XImage *vncimg,
+			const XRectangle *rects, const int nrects,
+			const unsigned w, const unsigned h) {
+	int i, y0 = -1, y1 = -1;
+
+	for (i = 0; i < nrects; i++) {
+		const int ry0 = max(rects[i].y, 0);
+		const int ry1 = min(rects[i].y + rects[i].height, (int) h);
+		if (ry0 >= ry1 || rects[i].x >= (int) w)
+			continue;
+
+		if (y0 >= 0 && ry0 <= y1 + BAND_SLACK) {
+			y1 = max(y1, ry1);
+			continue;
+		}
+
+		if (y0 >= 0)
+			fetchband(appdisp, approot, img, y0, y1 - y0);
+		y0 = ry0;
+		y1 = ry1;
+	}
+
+	if (y0 < 0)
+		return;
+	fetchband(appdisp, approot, img, y0, y1 - y0);
+
+	for (i = 0; i < nrects; i++) {
+		const int x0 = max(rects[i].x, 0);
+		const int ry0 = max(rects[i].y, 0);
+		const int x1 = min(rects[i].x + rects[i].width, (int) w);
+		const int ry1 = min(rects[i].y + rects[i].height, (int) h);
+		if (x0 >= x1 || ry0 >= ry1)
+			continue;
+
+		XShmPutImage(vncdisp, vncroot, gc, vncimg, x0, ry0, x0, ry0,
+				x1 - x0, ry1 - ry0, False);
+	}
+}
+
+// Fallback without XDAMAGE: hash each tile of a full grab and push only
+// the runs of tiles that changed. Returns the number of tiles pushed.
+static unsigned copytiles(Display *vncdisp, Window vncroot, GC gc,
+			XImage *vncimg, uint64_t *hashes, XXH64_state_t *state,
+			const unsigned w, const unsigned h) {
+	const unsigned bpp = vncimg->bits_per_pixel / 8;
+	unsigned tx, ty, y, changed = 0;
+
+	for (ty = 0; ty * TILE < h; ty++) {
+		const unsigned th = min(TILE, h - ty * TILE);
+		unsigned runstart = 0, runlen = 0;
+
+		for (tx = 0; tx * TILE < w; tx++) {
+			const unsigned tw = min(TILE, w - tx * TILE);
+			const uint8_t *src = (uint8_t *) vncimg->data +
+						ty * TILE * vncimg->bytes_per_line +
+						tx * TILE * bpp;
+			uint64_t *hash = &hashes[ty * ((w + TILE - 1) / TILE) + tx];
+
+			XXH64_reset(state, 0);
+			for (y = 0; y < th; y++)
+				XXH64_update(state, src + y * vncimg->bytes_per_line,
+						tw * bpp);
+			const uint64_t newhash = XXH64_digest(state);
+
+			if (newhash != *hash) {
+				*hash = newhash;
+				if (!runlen)
+					runstart = tx * TILE;
+				runlen += tw;
+				changed++;
+				continue;
+			}
+
+			if (runlen)
+				XShmPutImage(vncdisp, vncroot, gc, vncimg,
+						runstart, ty * TILE, runstart, ty * TILE,
+						runlen, th, False);
+			runlen = 0;
+		}
+
+		if (runlen)
+			XShmPutImage(vncdisp, vncroot, gc, vncimg,
+					runstart, ty * TILE, runstart, ty * TILE,
+					runlen, th, False);
+	}
+
+	return changed;
+}
+
 int main(int argc, char **argv) {
 
 	const char *appstr = ":0";
@@ -169,7 +280,7 @@ int main(int argc, char **argv) {
 	const int appscreen = DefaultScreen(appdisp);
 	const int vncscreen = DefaultScreen(vncdisp);
 	Visual *appvis = DefaultVisual(appdisp, appscreen);
-	//Visual *vncvis = DefaultVisual(vncdisp, vncscreen);
+	Visual *vncvis = DefaultVisual(vncdisp, vncscreen);
 	const int appdepth = DefaultDepth(appdisp, appscreen);
 	const int vncdepth = DefaultDepth(vncdisp, vncscreen);
 	if (appdepth != vncdepth) {
@@ -186,8 +297,10 @@ int main(int argc, char **argv) {
 	gcval.function = GXcopy;
 	GC gc = XCreateGC(vncdisp, vncroot, GCFunction | GCPlaneMask, &gcval);
 
-	XImage *img = NULL;
-	XShmSegmentInfo shminfo;
+	// Both displays attach the same segment: grabs land in img and are
+	// pushed straight from it through vncimg
+	XImage *img = NULL, *vncimg = NULL;
+	XShmSegmentInfo shminfo, vncshminfo;
 	unsigned imgw = 0, imgh = 0;
 
 	if (XGrabPointer(vncdisp, vncroot, False,
@@ -199,10 +312,32 @@ int main(int argc, char **argv) {
 				CurrentTime) != Success)
 		return 1;
 
-	int xfixesbase, xfixeserrbase;
+	int xfixesbase, xfixeserrbase, xfixesmajor = 0, xfixesminor = 0;
 	XFixesQueryExtension(appdisp, &xfixesbase, &xfixeserrbase);
+	XFixesQueryVersion(appdisp, &xfixesmajor, &xfixesminor);
 	XFixesSelectSelectionInput(appdisp, approot, XA_PRIMARY,
 					XFixesSetSelectionOwnerNotifyMask);
+	if (xfixesmajor >= 2)
+		XFixesSelectCursorInput(appdisp, approot,
+					XFixesDisplayCursorNotifyMask);
+
+	// Only fetch what changed. Without XDAMAGE, every frame is grabbed
+	// but only changed tiles are pushed.
+	int damagebase, damageerrbase, damagemajor, damageminor;
+	Damage damage = None;
+	XserverRegion damageregion = None;
+	if (xfixesmajor >= 2 &&
+		XDamageQueryExtension(appdisp, &damagebase, &damageerrbase) &&
+		XDamageQueryVersion(appdisp, &damagemajor, &damageminor)) {
+		damage = XDamageCreate(appdisp, approot, XDamageReportNonEmpty);
+		damageregion = XFixesCreateRegion(appdisp, NULL, 0);
+	} else {
+		printf("Display %s lacks DAMAGE extension, comparing tiles\n", appstr);
+	}
+
+	XXH64_state_t *tilestate = XXH64_createState();
+	uint64_t *tilehashes = NULL;
+	uint8_t damaged = 1, fullframe = 1;
 
 	int xfixesbasevnc, xfixeserrbasevnc;
 	XFixesQueryExtension(vncdisp, &xfixesbasevnc, &xfixeserrbasevnc);
@@ -217,6 +352,7 @@ int main(int argc, char **argv) {
 	XFixesCursorImage *cursor = NULL;
 	uint64_t cursorhash = 0;
 	Cursor xcursor = None;
+	uint8_t cursorchanged = 1;
 
 	const unsigned sleeptime = 1000 * 1000 / fps;
 
@@ -320,7 +456,9 @@ int main(int argc, char **argv) {
 		if (w != imgw || h != imgh) {
 			if (img) {
 				XShmDetach(appdisp, &shminfo);
+				XShmDetach(vncdisp, &vncshminfo);
 				XDestroyImage(img);
+				XDestroyImage(vncimg);
 				shmdt(shminfo.shmaddr);
 				shmctl(shminfo.shmid, IPC_RMID, NULL);
 			}
@@ -328,6 +466,10 @@ int main(int argc, char **argv) {
 						NULL, &shminfo, w, h);
 			if (!img)
 				break;
+			vncimg = XShmCreateImage(vncdisp, vncvis, vncdepth, ZPixmap,
+						NULL, &vncshminfo, w, h);
+			if (!vncimg || vncimg->bytes_per_line != img->bytes_per_line)
+				break;
 
 			shminfo.shmid = shmget(IPC_PRIVATE,
 						img->bytes_per_line * img->height,
@@ -339,12 +481,54 @@ int main(int argc, char **argv) {
 			if (!XShmAttach(appdisp, &shminfo))
 				break;
 
+			vncshminfo.shmid = shminfo.shmid;
+			vncshminfo.shmaddr = vncimg->data = shminfo.shmaddr;
+			vncshminfo.readOnly = True;
+			if (!XShmAttach(vncdisp, &vncshminfo))
+				break;
+
+			free(tilehashes);
+			tilehashes = calloc(((w + TILE - 1) / TILE) * ((h + TILE - 1) / TILE),
+						sizeof(uint64_t));
+			if (!tilehashes)
+				break;
+
 			imgw = w;
 			imgh = h;
+			fullframe = 1;
 		}
 
-		XShmGetImage(appdisp, approot, img, 0, 0, 0xffffffff);
-		XPutImage(vncdisp, vncroot, gc, img, 0, 0, 0, 0, w, h);
+		uint8_t pushed = 0;
+		if (damage == None) {
+			XShmGetImage(appdisp, approot, img, 0, 0, AllPlanes);
+			pushed = copytiles(vncdisp, vncroot, gc, vncimg, tilehashes,
+						tilestate, w, h) > 0;
+		} else if (fullframe) {
+			// Anything damaged so far is covered by this grab
+			XDamageSubtract(appdisp, damage, None, None);
+			XShmGetImage(appdisp, approot, img, 0, 0, AllPlanes);
+			XShmPutImage(vncdisp, vncroot, gc, vncimg, 0, 0, 0, 0, w, h,
+					False);
+			pushed = 1;
+		} else if (damaged) {
+			int nrects;
+			XDamageSubtract(appdisp, damage, None, damageregion);
+			XRectangle *rects = XFixesFetchRegion(appdisp, damageregion,
+								&nrects);
+			if (rects) {
+				copyrects(appdisp, approot, img,
+						vncdisp, vncroot, gc, vncimg,
+						rects, nrects, w, h);
+				pushed = nrects > 0;
+				XFree(rects);
+			}
+		}
+		damaged = fullframe = 0;
+
+		// The VNC server must be done reading the segment before the
+		// next grab overwrites it
+		if (pushed)
+			XSync(vncdisp, False);
 
 		// Handle events
 		while (XPending(vncdisp)) {
@@ -446,6 +630,11 @@ int main(int argc, char **argv) {
 
 				XConvertSelection(appdisp, XA_PRIMARY, XA_STRING, XA_STRING,
 							selwin, CurrentTime);
+			} else if (ev.type == xfixesbase + XFixesCursorNotify) {
+				cursorchanged = 1;
+			} else if (damage != None &&
+					ev.type == damagebase + XDamageNotify) {
+				damaged = 1;
 			} else switch (ev.type) {
 				case SelectionNotify:
 				{
@@ -494,37 +683,44 @@ int main(int argc, char **argv) {
 			}
 		}
 
-		// Cursors
-		cursor = XFixesGetCursorImage(appdisp);
-		uint64_t newhash = XXH64(cursor->pixels,
-						cursor->width * cursor->height * sizeof(unsigned long),
-						0);
-		if (cursorhash != newhash) {
-			if (cursorhash)
-				XFreeCursor(vncdisp, xcursor);
-
-			XcursorImage *converted = XcursorImageCreate(cursor->width, cursor->height);
-
-			converted->xhot = cursor->xhot;
-			converted->yhot = cursor->yhot;
-			unsigned i;
-			for (i = 0; i < cursor->width * cursor->height; i++) {
-				converted->pixels[i] = cursor->pixels[i];
-			}
+		// Cursors, fetched only when the app display reports a change
+		if (cursorchanged) {
+			cursorchanged = xfixesmajor < 2;
+
+			cursor = XFixesGetCursorImage(appdisp);
+			uint64_t newhash = XXH64(cursor->pixels,
+							cursor->width * cursor->height * sizeof(unsigned long),
+							0);
+			if (cursorhash != newhash) {
+				if (cursorhash)
+					XFreeCursor(vncdisp, xcursor);
+
+				XcursorImage *converted = XcursorImageCreate(cursor->width, cursor->height);
+
+				converted->xhot = cursor->xhot;
+				converted->yhot = cursor->yhot;
+				unsigned i;
+				for (i = 0; i < cursor->width * cursor->height; i++) {
+					converted->pixels[i] = cursor->pixels[i];
+				}
 
-			xcursor = XcursorImageLoadCursor(vncdisp, converted);
-			XDefineCursor(vncdisp, vncroot, xcursor);
+				xcursor = XcursorImageLoadCursor(vncdisp, converted);
+				XDefineCursor(vncdisp, vncroot, xcursor);
 
-			XcursorImageDestroy(converted);
+				XcursorImageDestroy(converted);
 
-			cursorhash = newhash;
-		}
+				cursorhash = newhash;
+			}
 
-		XFree(cursor);
+			XFree(cursor);
+		}
 
 		usleep(sleeptime);
 	}
 
+	XXH64_freeState(tilestate);
+	free(tilehashes);
+
 	XCloseDisplay(appdisp);
 	XCloseDisplay(vncdisp);
 
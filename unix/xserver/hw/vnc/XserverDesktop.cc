@@ -33,6 +33,7 @@
 #include <sys/un.h>
 #include <fcntl.h>
 #include <sys/utsname.h>
+#include <algorithm>
 
 #include <network/Socket.h>
 #include <rfb/Exception.h>
@@ -98,6 +99,9 @@ XserverDesktop::XserverDesktop(int screenIndex_,
     if ((*i)->getMessager())
       server->setAPIMessager((*i)->getMessager());
   }
+
+  if (server->getShmExportFd() >= 0)
+    vncSetNotifyFd(server->getShmExportFd(), screenIndex, true, false);
 }
 
 XserverDesktop::~XserverDesktop()
@@ -107,6 +111,8 @@ XserverDesktop::~XserverDesktop()
     delete listeners.back();
     listeners.pop_back();
   }
+  if (server->getShmExportFd() >= 0)
+    vncRemoveNotifyFd(server->getShmExportFd());
   if (!directFbptr)
     delete [] data;
   delete server;
@@ -326,6 +332,11 @@ void XserverDesktop::handleSocketEvent(int fd, bool read, bool write)
         return;
       }
 
+      if (fd == server->getShmExportFd()) {
+        server->handleShmExport();
+        return;
+      }
+
       unsigned i;
       for (i = 0; i < MAX_UNIX_RELAYS; i++) {
         if (unixrelays[i] == -1)
@@ -348,6 +359,8 @@ void XserverDesktop::handleSocketEvent(int fd, bool read, bool write)
 
       if (handleListenerEvent(fd, &listeners, server))
         return;
+      if (handlePendingEvent(fd, &listeners, server))
+        return;
     }
 
     if (handleSocketEvent(fd, server, read, write))
@@ -374,6 +387,50 @@ bool XserverDesktop::handleListenerEvent(int fd,
     return false;
 
   Socket* sock = (*i)->accept();
+  if (!sock) {
+    // Refused, or pending until the connection has more to say
+    std::list<int> fds;
+    std::list<int>::iterator fd;
+
+    (*i)->getPendingFds(&fds);
+    for (fd = fds.begin(); fd != fds.end(); ++fd)
+      vncSetNotifyFd(*fd, screenIndex, true, false);
+
+    return true;
+  }
+
+  sock->outStream().setBlocking(false);
+  vlog.debug("new client, sock %d", sock->getFd());
+  sockserv->addSocket(sock);
+  vncSetNotifyFd(sock->getFd(), screenIndex, true, false);
+
+  return true;
+}
+
+bool XserverDesktop::handlePendingEvent(int fd,
+                                        std::list<SocketListener*>* sockets,
+                                        SocketServer* sockserv)
+{
+  std::list<SocketListener*>::iterator i;
+  std::list<int> fds;
+
+  for (i = sockets->begin(); i != sockets->end(); i++) {
+    fds.clear();
+    (*i)->getPendingFds(&fds);
+    if (std::find(fds.begin(), fds.end(), fd) != fds.end())
+      break;
+  }
+
+  if (i == sockets->end())
+    return false;
+
+  // The listener either owns the fd from here or has closed it
+  vncRemoveNotifyFd(fd);
+
+  Socket* sock = (*i)->finishAccept(fd);
+  if (!sock)
+    return true;
+
   sock->outStream().setBlocking(false);
   vlog.debug("new client, sock %d", sock->getFd());
   sockserv->addSocket(sock);
@@ -433,6 +490,17 @@ void XserverDesktop::blockHandler(int* timeout)
       }
     }
 
+    // Drop connections that never finished their handshake
+    std::list<SocketListener*>::iterator l;
+    for (l = listeners.begin(); l != listeners.end(); l++) {
+      std::list<int> expired;
+      std::list<int>::iterator fd;
+
+      (*l)->expirePending(&expired);
+      for (fd = expired.begin(); fd != expired.end(); ++fd)
+        vncRemoveNotifyFd(*fd);
+    }
+
     // We are responsible for propagating mouse movement between clients
     int cursorX, cursorY;
     vncGetPointerPos(&cursorX, &cursorY);
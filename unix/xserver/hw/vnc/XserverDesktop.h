@@ -118,6 +118,9 @@ protected:
   bool handleListenerEvent(int fd,
                            std::list<network::SocketListener*>* sockets,
                            network::SocketServer* sockserv);
+  bool handlePendingEvent(int fd,
+                          std::list<network::SocketListener*>* sockets,
+                          network::SocketServer* sockserv);
   bool handleSocketEvent(int fd,
                          network::SocketServer* sockserv,
                          bool read, bool write);